@@ -1,20 +1,31 @@
-#include "SerialPort.h"
+#include "SerialPort.hpp"
+#include "SerialPortFramer.hpp"
 #include <stdio.h>
-#include "StateMachine.h"
 
-StateMachine stateMachine;
+#define MAGICBYTE 0x38
 
-void CommandReceived(unsigned char command, unsigned char param1, unsigned char param2)
-{
-    printf("Info: Command received (Cmd: %i, Param1: %i, Param2: %i)\r\n", command, param1, param2);
-}
+//magic byte, command, param1, param2
+typedef TSerialPortFixedFraming<MAGICBYTE, 4> TCommandFraming;
 
-void DataReceived (const unsigned char* pData, int dataLength)
+class TCommandHandler
 {
-    for(int i = 0; i<dataLength; i++)
+public:
+    void OnFramesReceived(const TSerialPortFrame* pFrames, int frameCount)
     {
-        stateMachine.OnByteReceived(pData[i]);
+        for(int i = 0; i<frameCount; i++)
+        {
+            const unsigned char* pCommand = pFrames[i].pData;
+            printf("Info: Command received (Cmd: %i, Param1: %i, Param2: %i)\r\n", pCommand[0], pCommand[1], pCommand[2]);
+        }
     }
+};
+
+TCommandHandler commandHandler;
+TSerialPortFramer<TCommandFraming, TCommandHandler> framer(&commandHandler);
+
+void DataReceived (const unsigned char* pData, int dataLength)
+{
+    framer.OnDataReceived(pData, dataLength);
 }
 
 void DataSent()
@@ -25,15 +36,13 @@ void DataSent()
 
 int main(int argc, char* argv[])
 {
-    stateMachine.SetEventHandler(CommandReceived);
-    
     TSerialPort com1;
     com1.OpenAsync(3, 9600, DataReceived, DataSent);
     while(1)
     {        
         com1.WriteLine("050010");
-        Sleep(1000);
+        SerialPortIO_Sleep(1000);
     }
     com1.Close();
     return 0;
-}
\ No newline at end of file
+}
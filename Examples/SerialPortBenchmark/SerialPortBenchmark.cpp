@@ -0,0 +1,429 @@
+/*
+* Throughput and latency benchmark over pseudo-terminal pairs (Linux and
+* other POSIX systems with openpty).
+*
+*   cmake -S ../.. -B build -DCMAKE_BUILD_TYPE=Release
+*   cmake --build build --target SerialPortBenchmark
+*
+*   SerialPortBenchmark [quick] > results.json
+*
+* Every result is one JSON object per line:
+*
+*   throughput - bytes/s received by TSerialPort ("cpp") or the C API ("c")
+*                in sync (ReadBuffer), async (OnDataReceivedHandler, ports
+*                share one reactor thread) and line (ReadLine) mode, for
+*                several chunk sizes and port counts
+*   latency    - round trip of one chunk (write, echoed by the pty master,
+*                read back), p50/p99/p99.9 in microseconds
+*
+* cpu_us_per_mb is user+system time of the whole process per MB received,
+* wakeups_per_s counts context switches of the process.
+*/
+
+#include "SerialPort.hpp"
+#include "SerialPort.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#if defined(__APPLE__) || defined(__FreeBSD__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+#define BENCHMARK_BAUDRATE  115200
+#define BENCHMARK_TIMEOUT   100
+#define BENCHMARK_MAX_PORTS 16
+#define BENCHMARK_MAX_CHUNK 4096
+
+static volatile unsigned int m_receivedBytes;
+
+static void OnCppDataReceived(const unsigned char* pData, int dataLength)
+{
+    (void)pData;
+    SERIALPORT_ATOMIC_ADD(&m_receivedBytes, (unsigned int)dataLength);
+}
+
+static void OnCDataReceived(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength)
+{
+    (void)pPort;
+    (void)pData;
+    SERIALPORT_ATOMIC_ADD(&m_receivedBytes, (unsigned int)dataLength);
+}
+
+//same benchmark code drives both APIs
+class TBenchmarkPort
+{
+public:
+    virtual ~TBenchmarkPort() {}
+    virtual bool Open(const char* deviceName, bool async, TSerialPortReactor* pReactor) = 0;
+    virtual void Close() = 0;
+    virtual int  Read(unsigned char* pData, int dataLength) = 0;
+    virtual int  ReadLine(char* pLine, int maxBufferSize) = 0;
+    virtual int  Write(const unsigned char* pData, int dataLength) = 0;
+    virtual int  WriteLine(const char* pLine) = 0;
+};
+
+class TCppBenchmarkPort : public TBenchmarkPort
+{
+private:
+    TSerialPort m_port;
+
+public:
+    bool Open(const char* deviceName, bool async, TSerialPortReactor* pReactor)
+    {
+        m_port.SetReactor(pReactor);
+        if (async)
+        {
+            return m_port.OpenAsync(deviceName, BENCHMARK_BAUDRATE, OnCppDataReceived, NULL, BENCHMARK_TIMEOUT);
+        }
+        return m_port.Open(deviceName, BENCHMARK_BAUDRATE, BENCHMARK_TIMEOUT);
+    }
+    void Close()                                          { m_port.Close(); }
+    int  Read(unsigned char* pData, int dataLength)       { return m_port.ReadBuffer(pData, dataLength); }
+    int  ReadLine(char* pLine, int maxBufferSize)         { return m_port.ReadLine(pLine, maxBufferSize); }
+    int  Write(const unsigned char* pData, int dataLength){ return m_port.WriteBuffer(pData, dataLength); }
+    int  WriteLine(const char* pLine)                     { return m_port.WriteLine(pLine, false); }
+};
+
+class TCBenchmarkPort : public TBenchmarkPort
+{
+private:
+    TSerialPortInstance* m_pPort;
+
+public:
+    TCBenchmarkPort()  { m_pPort = SerialPortInstance_Create(); }
+    ~TCBenchmarkPort() { SerialPortInstance_Delete(m_pPort); }
+
+    bool Open(const char* deviceName, bool async, TSerialPortReactor* pReactor)
+    {
+        SerialPortInstance_SetReactor(m_pPort, pReactor);
+        if (async)
+        {
+            return SerialPortInstance_OpenDeviceAsync(m_pPort, deviceName, BENCHMARK_BAUDRATE, OnCDataReceived, NULL, BENCHMARK_TIMEOUT)!=FALSE;
+        }
+        return SerialPortInstance_OpenDevice(m_pPort, deviceName, BENCHMARK_BAUDRATE, BENCHMARK_TIMEOUT)!=FALSE;
+    }
+    void Close()                                          { SerialPortInstance_Close(m_pPort); }
+    int  Read(unsigned char* pData, int dataLength)       { return SerialPortInstance_ReadBuffer(m_pPort, pData, dataLength, -1); }
+    int  ReadLine(char* pLine, int maxBufferSize)         { return SerialPortInstance_ReadLine(m_pPort, pLine, maxBufferSize, -1); }
+    int  Write(const unsigned char* pData, int dataLength){ return SerialPortInstance_WriteBuffer(m_pPort, pData, dataLength); }
+    int  WriteLine(const char* pLine)                     { return SerialPortInstance_WriteLine(m_pPort, pLine, FALSE); }
+};
+
+typedef struct
+{
+    int             masterHandle;
+    char            deviceName[SERIALPORT_MAX_DEVICE_NAME];
+    TBenchmarkPort* pPort;
+    pthread_t       thread;
+    int             chunkSize;
+    long long       totalBytes;
+    bool            lineMode;
+    volatile bool   stop;
+    long long       receivedBytes;
+} TBenchmarkLink;
+
+typedef struct
+{
+    struct timeval       cpuTime;
+    long                 contextSwitches;
+    SERIALPORT_TIMESTAMP time;
+} TBenchmarkSample;
+
+static bool OpenLink(TBenchmarkLink* pLink, bool useCApi)
+{
+    int slaveHandle;
+
+    memset(pLink, 0, sizeof(TBenchmarkLink));
+    if (openpty(&pLink->masterHandle, &slaveHandle, pLink->deviceName, NULL, NULL)!=0)
+    {
+        return false;
+    }
+    //the port opens the slave by name, this handle only keeps the pty alive until then
+    close(slaveHandle);
+    fcntl(pLink->masterHandle, F_SETFL, O_NONBLOCK);
+    if (useCApi)
+    {
+        pLink->pPort = new TCBenchmarkPort();
+    } else {
+        pLink->pPort = new TCppBenchmarkPort();
+    }
+    return true;
+}
+
+static void CloseLink(TBenchmarkLink* pLink)
+{
+    pLink->pPort->Close();
+    delete pLink->pPort;
+    close(pLink->masterHandle);
+}
+
+static void WriteAll(TBenchmarkLink* pLink, const unsigned char* pData, int dataLength)
+{
+    struct pollfd pollHandle;
+    ssize_t       bytesWritten;
+
+    pollHandle.fd     = pLink->masterHandle;
+    pollHandle.events = POLLOUT;
+    while((dataLength>0) && (!pLink->stop))
+    {
+        bytesWritten = write(pLink->masterHandle, pData, dataLength);
+        if (bytesWritten<0)
+        {
+            if (errno==EINTR) continue;
+            if (errno!=EAGAIN) return;
+            poll(&pollHandle, 1, 50);
+            continue;
+        }
+        pData += bytesWritten;
+        dataLength -= (int)bytesWritten;
+    }
+}
+
+static void* FeedThread(void* lpParam)
+{
+    TBenchmarkLink* pLink = (TBenchmarkLink*)lpParam;
+    unsigned char   chunk[BENCHMARK_MAX_CHUNK];
+    long long       sentBytes = 0;
+
+    memset(chunk, 'a', sizeof(chunk));
+    if (pLink->lineMode)
+    {
+        chunk[pLink->chunkSize-1] = '\n';
+    }
+    while((sentBytes<pLink->totalBytes) && (!pLink->stop))
+    {
+        WriteAll(pLink, chunk, pLink->chunkSize);
+        sentBytes += pLink->chunkSize;
+    }
+    return NULL;
+}
+
+static void* ReadThread(void* lpParam)
+{
+    TBenchmarkLink* pLink = (TBenchmarkLink*)lpParam;
+    char            chunk[BENCHMARK_MAX_CHUNK+1];
+    int             bytesRead;
+
+    while((pLink->receivedBytes<pLink->totalBytes) && (!pLink->stop))
+    {
+        if (pLink->lineMode)
+        {
+            bytesRead = pLink->pPort->ReadLine(chunk, sizeof(chunk));
+            if (bytesRead>0) bytesRead++;   //line end is stripped
+        } else {
+            bytesRead = pLink->pPort->Read((unsigned char*)chunk, pLink->chunkSize);
+        }
+        if (bytesRead<=0) break;
+        pLink->receivedBytes += bytesRead;
+    }
+    return NULL;
+}
+
+static void* EchoThread(void* lpParam)
+{
+    TBenchmarkLink* pLink = (TBenchmarkLink*)lpParam;
+    unsigned char   chunk[BENCHMARK_MAX_CHUNK];
+    struct pollfd   pollHandle;
+    ssize_t         bytesRead;
+
+    pollHandle.fd     = pLink->masterHandle;
+    pollHandle.events = POLLIN;
+    while(!pLink->stop)
+    {
+        if (poll(&pollHandle, 1, 50)<=0) continue;
+        bytesRead = read(pLink->masterHandle, chunk, sizeof(chunk));
+        if (bytesRead<=0) continue;
+        WriteAll(pLink, chunk, (int)bytesRead);
+    }
+    return NULL;
+}
+
+static void TakeSample(TBenchmarkSample* pSample)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    timeradd(&usage.ru_utime, &usage.ru_stime, &pSample->cpuTime);
+    pSample->contextSwitches = usage.ru_nvcsw + usage.ru_nivcsw;
+    pSample->time = SerialPortIO_GetTime();
+}
+
+static void PrintThroughput(const char* api, const char* mode, int chunkSize, int portCount, long long receivedBytes,
+                            const TBenchmarkSample* pStart, const TBenchmarkSample* pEnd)
+{
+    double elapsedS = (pEnd->time - pStart->time) / 1000000.0;
+    double cpuUs = (pEnd->cpuTime.tv_sec - pStart->cpuTime.tv_sec) * 1000000.0 + (pEnd->cpuTime.tv_usec - pStart->cpuTime.tv_usec);
+    double receivedMB = receivedBytes / 1048576.0;
+
+    if (elapsedS<=0) elapsedS = 0.000001;
+    printf("{\"benchmark\":\"throughput\",\"api\":\"%s\",\"mode\":\"%s\",\"chunk\":%i,\"ports\":%i,"
+           "\"bytes\":%lld,\"seconds\":%.6f,\"bytes_per_s\":%.0f,\"cpu_us_per_mb\":%.1f,\"wakeups_per_s\":%.0f}\n",
+           api, mode, chunkSize, portCount, receivedBytes, elapsedS, receivedBytes/elapsedS,
+           (receivedMB>0) ? cpuUs/receivedMB : 0.0, (pEnd->contextSwitches - pStart->contextSwitches)/elapsedS);
+    fflush(stdout);
+}
+
+static void RunThroughput(bool useCApi, const char* mode, int chunkSize, int portCount, long long totalBytes)
+{
+    TBenchmarkLink      links[BENCHMARK_MAX_PORTS];
+    TSerialPortReactor* pReactor = NULL;
+    TBenchmarkSample    start, end;
+    SERIALPORT_TIMESTAMP deadline;
+    bool                async = (strcmp(mode, "async")==0);
+    long long           receivedBytes = 0;
+    int                 openCount, i;
+
+    if (async && (portCount>1))
+    {
+        pReactor = SerialPortReactor_Create(1);
+    }
+    for(openCount = 0; openCount<portCount; openCount++)
+    {
+        if (!OpenLink(&links[openCount], useCApi)) break;
+        links[openCount].chunkSize  = chunkSize;
+        links[openCount].totalBytes = totalBytes/portCount;
+        links[openCount].lineMode   = (strcmp(mode, "line")==0);
+        if (!links[openCount].pPort->Open(links[openCount].deviceName, async, pReactor))
+        {
+            CloseLink(&links[openCount]);
+            break;
+        }
+    }
+    if (openCount==portCount)
+    {
+        SERIALPORT_ATOMIC_STORE(&m_receivedBytes, 0);
+        TakeSample(&start);
+        for(i = 0; i<portCount; i++)
+        {
+            if (!async) pthread_create(&links[i].thread, NULL, ReadThread, &links[i]);
+        }
+        std::vector<pthread_t> feeders(portCount);
+        for(i = 0; i<portCount; i++)
+        {
+            pthread_create(&feeders[i], NULL, FeedThread, &links[i]);
+        }
+        if (async)
+        {
+            deadline = SerialPortIO_GetTime() + 30000000;
+            while((SERIALPORT_ATOMIC_LOAD(&m_receivedBytes)<(unsigned int)((totalBytes/portCount)*portCount)) && (SerialPortIO_GetTime()<deadline))
+            {
+                SerialPortIO_Sleep(1);
+            }
+            receivedBytes = SERIALPORT_ATOMIC_LOAD(&m_receivedBytes);
+        } else {
+            for(i = 0; i<portCount; i++)
+            {
+                pthread_join(links[i].thread, NULL);
+                receivedBytes += links[i].receivedBytes;
+            }
+        }
+        TakeSample(&end);
+        for(i = 0; i<portCount; i++)
+        {
+            links[i].stop = true;
+        }
+        for(i = 0; i<portCount; i++)
+        {
+            pthread_join(feeders[i], NULL);
+            CloseLink(&links[i]);
+        }
+        PrintThroughput(useCApi ? "c" : "cpp", mode, chunkSize, portCount, receivedBytes, &start, &end);
+    } else {
+        fprintf(stderr, "Error: cannot open %i pty pairs\n", portCount);
+        for(i = 0; i<openCount; i++)
+        {
+            CloseLink(&links[i]);
+        }
+    }
+    if (pReactor)
+    {
+        SerialPortReactor_Delete(pReactor);
+    }
+}
+
+static void RunLatency(bool useCApi, const char* mode, int chunkSize, int roundTrips)
+{
+    TBenchmarkLink link;
+    unsigned char  chunk[BENCHMARK_MAX_CHUNK+1];
+    char           response[BENCHMARK_MAX_CHUNK+1];
+    bool           lineMode = (strcmp(mode, "line")==0);
+    std::vector<SERIALPORT_TIMESTAMP> latencies;
+    SERIALPORT_TIMESTAMP startTime;
+    int            bytesRead, i;
+
+    if (!OpenLink(&link, useCApi)) return;
+    if (!link.pPort->Open(link.deviceName, strcmp(mode, "async")==0, NULL))
+    {
+        CloseLink(&link);
+        return;
+    }
+    pthread_create(&link.thread, NULL, EchoThread, &link);
+
+    memset(chunk, 'a', sizeof(chunk));
+    chunk[chunkSize-1] = lineMode ? '\r' : 'a';
+    chunk[chunkSize] = 0;
+    for(i = 0; i<roundTrips; i++)
+    {
+        startTime = SerialPortIO_GetTime();
+        if (lineMode)
+        {
+            link.pPort->WriteLine((const char*)chunk);
+            bytesRead = link.pPort->ReadLine(response, sizeof(response));
+            if (bytesRead>0) bytesRead++;
+        } else {
+            link.pPort->Write(chunk, chunkSize);
+            bytesRead = link.pPort->Read((unsigned char*)response, chunkSize);
+        }
+        if (bytesRead!=chunkSize) break;
+        latencies.push_back(SerialPortIO_GetTime() - startTime);
+    }
+    link.stop = true;
+    pthread_join(link.thread, NULL);
+    CloseLink(&link);
+    if (latencies.empty()) return;
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("{\"benchmark\":\"latency\",\"api\":\"%s\",\"mode\":\"%s\",\"chunk\":%i,\"round_trips\":%i,"
+           "\"p50_us\":%llu,\"p99_us\":%llu,\"p999_us\":%llu,\"max_us\":%llu}\n",
+           useCApi ? "c" : "cpp", mode, chunkSize, (int)latencies.size(),
+           latencies[latencies.size()*50/100], latencies[latencies.size()*99/100],
+           latencies[latencies.size()*999/1000], latencies.back());
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    static const char* modes[3]  = { "sync", "async", "line" };
+    static const int   chunks[4] = { 16, 256, 1024, 4096 };
+    static const int   ports[3]  = { 1, 4, 16 };
+    bool      quick = (argc>1) && (strcmp(argv[1], "quick")==0);
+    long long totalBytes = quick ? (1<<20) : (16<<20);
+    int       roundTrips = quick ? 200 : 5000;
+    int       api, mode, chunk, port;
+
+    for(api = 0; api<2; api++)
+    {
+        for(mode = 0; mode<3; mode++)
+        {
+            for(chunk = 0; chunk<4; chunk++)
+            {
+                for(port = 0; port<3; port++)
+                {
+                    RunThroughput(api==1, modes[mode], chunks[chunk], ports[port], totalBytes);
+                }
+                RunLatency(api==1, modes[mode], chunks[chunk], roundTrips);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+* Simulates any number of devices on pseudo-terminals (Linux and other
+* POSIX systems), all answering by the rules of one profile script
+* (SerialPortSimulator.h), for soak and load tests of the client side.
+*
+*   cmake -S ../.. -B build -DCMAKE_BUILD_TYPE=Release
+*   cmake --build build --target SerialPortSimulatorCli
+*
+*   SerialPortSimulator MagicByte.sim [devices [threads]]
+*
+* The names the clients open (pty slaves) are printed first, one per
+* line, then a blank line. Afterwards one JSON object per second with the
+* totals of all devices, until SIGINT or SIGTERM:
+*
+*   {"seconds":10,"devices":500,"requests":..,"responses":..,"unmatched":..,"dropped":..,
+*    "corrupted":..,"truncated":..,"overflows":..,"rx_bytes":..,"tx_bytes":..,
+*    "late_p50_us":..,"late_p99_us":..}
+*
+* late_* tell how late responses were sent after they were due, the
+* simulator keeps up with the load while they stay small.
+*/
+
+#include "SerialPortSimulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <signal.h>
+#include <sys/resource.h>
+
+#define SIMULATOR_BAUDRATE 115200
+
+static volatile sig_atomic_t m_stop;
+
+static void OnSignal(int signalNumber)
+{
+    (void)signalNumber;
+    m_stop = 1;
+}
+
+static void PrintTotals(const std::vector<TSerialPortSimulatorDevice*>& devices, int seconds)
+{
+    TSerialPortSimulatorStatistics total, statistics;
+    size_t                         i;
+    int                            j;
+
+    memset(&total, 0, sizeof(total));
+    for(i = 0; i<devices.size(); i++)
+    {
+        SerialPortSimulator_GetStatistics(devices[i], &statistics);
+        total.requests      += statistics.requests;
+        total.responses     += statistics.responses;
+        total.unmatched     += statistics.unmatched;
+        total.dropped       += statistics.dropped;
+        total.corrupted     += statistics.corrupted;
+        total.truncated     += statistics.truncated;
+        total.overflows     += statistics.overflows;
+        total.bytesReceived += statistics.bytesReceived;
+        total.bytesSent     += statistics.bytesSent;
+        for(j = 0; j<SERIALPORT_HISTOGRAM_BUCKETS; j++)
+        {
+            total.lateness[j] += statistics.lateness[j];
+        }
+    }
+    printf("{\"seconds\":%i,\"devices\":%i,\"requests\":%llu,\"responses\":%llu,\"unmatched\":%llu,\"dropped\":%llu,"
+           "\"corrupted\":%llu,\"truncated\":%llu,\"overflows\":%llu,\"rx_bytes\":%llu,\"tx_bytes\":%llu,"
+           "\"late_p50_us\":%llu,\"late_p99_us\":%llu}\n",
+           seconds, (int)devices.size(), total.requests, total.responses, total.unmatched, total.dropped,
+           total.corrupted, total.truncated, total.overflows, total.bytesReceived, total.bytesSent,
+           SerialPortStatistics_GetPercentile(total.lateness, 50), SerialPortStatistics_GetPercentile(total.lateness, 99));
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    static TSerialPortSimulatorProfile        profile;
+    std::vector<TSerialPortSimulatorDevice*> devices;
+    TSerialPortSimulator*                    pSimulator;
+    TSerialPortSimulatorDevice*              pDevice;
+    struct rlimit                            limit;
+    char                                     peerName[256];
+    int                                      deviceCount, threadCount, errorLine, seconds, i;
+
+    if (argc<2)
+    {
+        fprintf(stderr, "Usage: SerialPortSimulator script [devices [threads]]\n");
+        return 1;
+    }
+    deviceCount = (argc>2) ? atoi(argv[2]) : 1;
+    threadCount = (argc>3) ? atoi(argv[3]) : 1;
+
+    SerialPortSimulator_InitProfile(&profile);
+    if (!SerialPortSimulator_LoadProfile(&profile, argv[1], &errorLine))
+    {
+        fprintf(stderr, "Error: %s, line %i\n", argv[1], errorLine);
+        return 1;
+    }
+
+    //every device takes a pty and the events of its port
+    if (getrlimit(RLIMIT_NOFILE, &limit)==0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    pSimulator = SerialPortSimulator_Create(threadCount);
+    if (pSimulator==NULL)
+    {
+        fprintf(stderr, "Error: simulator not created\n");
+        return 1;
+    }
+    for(i = 0; i<deviceCount; i++)
+    {
+        pDevice = SerialPortSimulator_AddDevice(pSimulator, "pty:", SIMULATOR_BAUDRATE, &profile);
+        if (pDevice==NULL)
+        {
+            fprintf(stderr, "Error: %i devices opened\n", i);
+            break;
+        }
+        devices.push_back(pDevice);
+        if (SerialPortSimulator_GetPeerName(pDevice, peerName, sizeof(peerName)))
+        {
+            printf("%s\n", peerName);
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+    for(seconds = 1; !m_stop; seconds++)
+    {
+        for(i = 0; (i<10) && !m_stop; i++)
+        {
+            SerialPortIO_Sleep(100);
+        }
+        PrintTotals(devices, seconds);
+    }
+    SerialPortSimulator_Delete(pSimulator);
+    return 0;
+}
@@ -15,294 +15,2174 @@
 */
 
 #include "SerialPort.h"
+#include "SerialPortRing.h"
+#include "SerialPortWriteQueue.h"
+#include "SerialPortPacer.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-static HANDLE m_portHandle = 0;
-static HANDLE m_workingThread = 0;
-static DWORD  m_workingThreadId = 0;
-static int    m_timeoutMilliSeconds = 0;
+#define SERIALPORT_POSTED_SENT          1
+#define SERIALPORT_POSTED_BUFFER        2
+#define SERIALPORT_POSTED_LINE_EVENT    3
+#define SERIALPORT_POSTED_WRITE_TIME    4
+#define SERIALPORT_POSTED_MODEM         5
+
+//handler call queued on the dispatcher, records of one port are coalesced back to back
+typedef struct
+{
+    int                  kind;
+    SERIALPORT_TIMESTAMP time;
+    union
+    {
+        int                  bytesWritten;
+        TSerialPortBuffer*   pBuffer;
+        TSerialPortLineEvent lineEvent;
+        struct
+        {
+            unsigned int status;
+            unsigned int changedLines;
+        } modem;
+    } u;
+} TSerialPortPostedEvent;
+
+struct TSerialPortInstance
+{
+    SERIALPORT_HANDLE portHandle;
+    SERIALPORT_THREAD workingThread;
+    BOOL   workingThreadStarted;
+    volatile unsigned int closing;
+    BOOL   receiveAsync;
+    TSerialPortReactor* pReactor;
+    TSerialPortReactorEntry* pReactorEntry;
+    char   deviceName[SERIALPORT_MAX_DEVICE_NAME];
+    TSerialPortSettings settings;
+    BOOL   autoReconnect;
+    int    reconnectMinDelayMS;
+    int    reconnectMaxDelayMS;
+    volatile unsigned int reconnectCount;
+    SERIALPORT_THREAD reconnectThread;
+    BOOL   reconnectThreadStarted;
+    TSerialPortWriteQueue writeQueue;
+    volatile unsigned int writeRequested;
+    int    writeCrcType;
+    TSerialPortPacer* pPacer;
+    int    timeoutMilliSeconds;
+    SERIALPORT_TIMESTAMP lastReadDuration;
+    SERIALPORT_TIMESTAMP receiveTime;       //when the chunk being handed over was read
+    TSerialPortStatistics statistics;
+    SERIALPORT_EVENT wakeEvent;
+    TSerialPortRing  receiveRing;
+    SERIALPORT_EVENT receiveEvent;
+    volatile unsigned int receiveWaiting;
+    volatile unsigned int receiveOverflow;
+    BOOL   skipLineFeed;
+    void*  pUserData;
+    void (*OnDataReceivedHandler)(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength);
+    void (*OnDataSentHandler)(TSerialPortInstance* pPort);
+    void (*OnBufferReceivedHandler)(TSerialPortInstance* pPort, TSerialPortBuffer* pBuffer);
+    TSerialPortBufferPool* pBufferPool;
+    TSerialPortTransactions* volatile pTransactions;
+    TSerialPortModbusBus* volatile pModbusBus;
+    TSerialPortCapture* pCapture;
+    TSerialPortTrace* pTrace;
+    int    tracePortId;
+    TSerialPortDispatcher* pDispatcher;
+    TSerialPortBroadcast* pBroadcast;
+    void (*OnModemHandler)(TSerialPortInstance* pPort, unsigned int modemStatus, unsigned int changedLines);
+    void (*OnLineErrorHandler)(TSerialPortInstance* pPort, const TSerialPortLineEvent* pEvent);
+    void (*OnReceiveTimeHandler)(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP receiveTime);
+    void (*OnWriteTimeHandler)(TSerialPortInstance* pPort, int bytesWritten, SERIALPORT_TIMESTAMP writeTime);
+    SERIALPORT_LOCK criticalSectionRead;
+    SERIALPORT_LOCK criticalSectionWrite;
+    SERIALPORT_LOCK criticalSectionDevice;
+    SERIALPORT_LOCK criticalSectionQueue;
+};
+
+//SerialPort_XXX functions work with this one
+static TSerialPortInstance m_defaultPort;
 static void (*m_OnDataReceivedHandler)(const unsigned char* pData, int dataLength) = NULL;
 static void (*m_OnDataSentHandler)(void) = NULL;
-static CRITICAL_SECTION m_criticalSectionRead;
-static CRITICAL_SECTION m_criticalSectionWrite;
+static void (*m_OnBufferReceivedHandler)(TSerialPortBuffer* pBuffer) = NULL;
+static void (*m_OnModemHandler)(unsigned int modemStatus, unsigned int changedLines) = NULL;
+static void (*m_OnLineErrorHandler)(const TSerialPortLineEvent* pEvent) = NULL;
+
+static void SerialPortInstance__WaitForData( void* lpParam );
+static BOOL SerialPortInstance__ReceiveReady( void* lpParam, BOOL deviceError );
+static BOOL SerialPortInstance__SendReady( void* lpParam );
+static void SerialPortInstance__ReconnectThread( void* lpParam );
+static BOOL SerialPortInstance__Reconnect(TSerialPortInstance* pPort);
+static void SerialPortInstance__StartReconnect(TSerialPortInstance* pPort);
+static BOOL SerialPortInstance__SendWriteQueue(TSerialPortInstance* pPort, BOOL blocking);
+static int  SerialPortInstance__WriteBuffer(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength);
+static int  SerialPortInstance__ReadBuffer(TSerialPortInstance* pPort, unsigned char* pData, int dataLength, int timeOutMS);
+static int  SerialPortInstance__ReadReceiveRing(TSerialPortInstance* pPort, unsigned char* pData, int dataLength, int timeOutMS);
+static BOOL SerialPortInstance__ReceiveData(TSerialPortInstance* pPort);
+static int  SerialPortInstance__ReadUntil(TSerialPortInstance* pPort, unsigned char* pData, int dataLength, const unsigned char* delimiters, int delimiterCount, int timeOutMS);
+static int  SerialPortInstance__WaitForReceivedData(TSerialPortInstance* pPort, int timeOutMS);
+static int  SerialPortInstance__ReadVector(TSerialPortInstance* pPort, const SERIALPORT_READ_BUFFER* pBuffers, int bufferCount, int minLength, int timeOutMS);
+static BOOL SerialPortInstance__OnDataRead(TSerialPortInstance* pPort, const unsigned char* pData, int bytesRead);
+static BOOL SerialPortInstance__CallDataReceivedHandler(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength);
+static void SerialPortInstance__HandleTimed(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP receiveTime);
+static void SerialPortInstance__HandleReceived(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength);
+static void SerialPortInstance__DispatchReceived(void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded);
+static void SerialPortInstance__DispatchTimed(void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded);
+static void SerialPortInstance__DispatchEvents(void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded);
+static void SerialPortInstance__PostEvent(TSerialPortInstance* pPort, const TSerialPortPostedEvent* pEvent);
+static void SerialPortInstance__ModemChanged(void* pContext, unsigned int modemStatus, unsigned int changedLines);
+static void SerialPortInstance__Written(void* pContext, int bytesWritten, SERIALPORT_TIMESTAMP writeTime);
+static void SerialPortInstance__CallLineErrorHandler(TSerialPortInstance* pPort, const TSerialPortLineEvent* pEvents, int eventCount);
+static void SerialPortInstance__CallBufferReceivedHandler(TSerialPortInstance* pPort, TSerialPortBuffer* pBuffer);
+static void SerialPortInstance__CallDataSentHandler(TSerialPortInstance* pPort);
+static int  SerialPortInstance__QueueWrite(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength, BOOL waitForTransmit, int crcType);
+static void SerialPortInstance__NotifyWriter(TSerialPortInstance* pPort);
+static SERIALPORT_TIMESTAMP SerialPortInstance__SendPaced( void* lpParam );
+
+static void SerialPortInstance__Initialize(TSerialPortInstance* pPort)
+{
+    memset(pPort, 0, sizeof(TSerialPortInstance));
+    pPort->portHandle = SERIALPORT_INVALID_HANDLE;
+    pPort->tracePortId = -1;
+    pPort->reconnectMinDelayMS = SERIALPORT_RECONNECT_MIN_DELAY;
+    pPort->reconnectMaxDelayMS = SERIALPORT_RECONNECT_MAX_DELAY;
+    SerialPortIO_InitSettings(&pPort->settings, 0);
+    SerialPortIO_CreateEvent(&pPort->wakeEvent);
+    SerialPortIO_CreateEvent(&pPort->receiveEvent);
+    SerialPortIO_InitLock(&pPort->criticalSectionRead);
+    SerialPortIO_InitLock(&pPort->criticalSectionWrite);
+    SerialPortIO_InitLock(&pPort->criticalSectionDevice);
+    SerialPortIO_InitLock(&pPort->criticalSectionQueue);
+    SerialPortWriteQueue_Init(&pPort->writeQueue);
+    pPort->writeQueue.pStatistics = &pPort->statistics;
+}
+
+static void SerialPortInstance__Uninitialize(TSerialPortInstance* pPort)
+{
+    if (pPort->portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        SerialPortInstance_Close(pPort);  
+    }
+    SerialPortPacer_Delete(pPort->pPacer);
+    pPort->pPacer = NULL;
+    if (pPort->workingThreadStarted)
+    {
+        //left running by SerialPortInstance_Close() called from a handler
+        SerialPortIO_JoinThread(&pPort->workingThread);
+    }
+    if (pPort->reconnectThreadStarted)
+    {
+        SerialPortIO_JoinThread(&pPort->reconnectThread);
+    }
+    SerialPortIO_DeleteLock(&pPort->criticalSectionRead);
+    SerialPortIO_DeleteLock(&pPort->criticalSectionWrite);
+    SerialPortIO_DeleteLock(&pPort->criticalSectionDevice);
+    SerialPortIO_DeleteLock(&pPort->criticalSectionQueue);
+    SerialPortIO_DeleteEvent(&pPort->wakeEvent);
+    SerialPortIO_DeleteEvent(&pPort->receiveEvent);
+    SerialPortRing_Delete(&pPort->receiveRing);
+    SerialPortWriteQueue_Clear(&pPort->writeQueue);
+    if (pPort->pBufferPool)
+    {
+        SerialPortBufferPool_Delete(pPort->pBufferPool);
+    }
+}
+
+static void SerialPort__OnDataReceived(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength)
+{
+    (void)pPort;
+    if (m_OnDataReceivedHandler)
+    {
+        m_OnDataReceivedHandler(pData, dataLength);
+    }
+}
+
+static void SerialPort__OnDataSent(TSerialPortInstance* pPort)
+{
+    (void)pPort;
+    if (m_OnDataSentHandler)
+    {
+        m_OnDataSentHandler();
+    }
+}
+
+static void SerialPort__OnBufferReceived(TSerialPortInstance* pPort, TSerialPortBuffer* pBuffer)
+{
+    (void)pPort;
+    if (m_OnBufferReceivedHandler)
+    {
+        m_OnBufferReceivedHandler(pBuffer);
+    }
+}
+
+static void SerialPort__OnModemChanged(TSerialPortInstance* pPort, unsigned int modemStatus, unsigned int changedLines)
+{
+    (void)pPort;
+    if (m_OnModemHandler)
+    {
+        m_OnModemHandler(modemStatus, changedLines);
+    }
+}
+
+static void SerialPort__OnLineError(TSerialPortInstance* pPort, const TSerialPortLineEvent* pEvent)
+{
+    (void)pPort;
+    if (m_OnLineErrorHandler)
+    {
+        m_OnLineErrorHandler(pEvent);
+    }
+}
+
+void SerialPort_Initialize(void)
+{
+    m_OnDataReceivedHandler = NULL;	
+    m_OnDataSentHandler = NULL;	
+    SerialPortInstance__Initialize(&m_defaultPort);
+}
+
+void SerialPort_Uninitialize(void)
+{
+    SerialPortInstance__Uninitialize(&m_defaultPort);
+}
+
+int SerialPort_GetMaxTimeout()
+{
+    return SerialPortInstance_GetMaxTimeout(&m_defaultPort);
+}
+
+SERIALPORT_TIMESTAMP SerialPort_GetLastReadDuration()
+{
+    return SerialPortInstance_GetLastReadDuration(&m_defaultPort);
+}
+
+BOOL SerialPort_OpenAsync(int comPortNumber, int baudRate,                             
+                     void (*OnDataReceivedHandler)(const unsigned char* pData, int dataLength),
+                     void (*OnDataSentHandler)(void),                         
+                     int timeoutMS
+                    )
+
+{
+    char deviceName[SERIALPORT_MAX_DEVICE_NAME];
+    if (!SerialPortIO_GetDeviceName(comPortNumber, deviceName, sizeof(deviceName))) return FALSE;
+
+    return SerialPort_OpenDeviceAsync(deviceName, baudRate, OnDataReceivedHandler, OnDataSentHandler, timeoutMS);
+}
+
+BOOL SerialPort_OpenDeviceAsync(const char* deviceName, int baudRate,                             
+                     void (*OnDataReceivedHandler)(const unsigned char* pData, int dataLength),
+                     void (*OnDataSentHandler)(void),                         
+                     int timeoutMS
+                    )
+
+{
+    m_OnDataReceivedHandler = OnDataReceivedHandler;
+    m_OnDataSentHandler     = OnDataSentHandler;
+    return SerialPortInstance_OpenDeviceAsync(&m_defaultPort, deviceName, baudRate, 
+                                              OnDataReceivedHandler ? SerialPort__OnDataReceived : NULL,
+                                              OnDataSentHandler ? SerialPort__OnDataSent : NULL,
+                                              timeoutMS);
+}
+
+BOOL SerialPort_Open(int comPortNumber, int baudRate, int timeoutMS)
+{
+    return SerialPortInstance_Open(&m_defaultPort, comPortNumber, baudRate, timeoutMS);
+}
+
+BOOL SerialPort_OpenDevice(const char* deviceName, int baudRate, int timeoutMS)
+{
+    return SerialPortInstance_OpenDevice(&m_defaultPort, deviceName, baudRate, timeoutMS);
+}
+
+void SerialPort_Close()
+{    
+    SerialPortInstance_Close(&m_defaultPort);
+}
+
+BOOL SerialPort_IsOpen()
+{
+    return SerialPortInstance_IsOpen(&m_defaultPort);
+}
+
+BOOL SerialPort_GetPeerName(char* deviceName, int maxLength)
+{
+    return SerialPortInstance_GetPeerName(&m_defaultPort, deviceName, maxLength);
+}
+
+int SerialPort_ReadBuffer(unsigned char* pData, int dataLength, int timeOutMS)
+{
+    return SerialPortInstance_ReadBuffer(&m_defaultPort, pData, dataLength, timeOutMS);
+}
+
+int SerialPort_WriteBuffer(const unsigned char* pData, int dataLength)
+{
+    return SerialPortInstance_WriteBuffer(&m_defaultPort, pData, dataLength);
+}
+
+int SerialPort_WriteLine(const char* pLine, BOOL addCRatEnd)
+{
+    return SerialPortInstance_WriteLine(&m_defaultPort, pLine, addCRatEnd);
+}
+
+int SerialPort_QueueWrite(const unsigned char* pData, int dataLength, BOOL waitForTransmit)
+{
+    return SerialPortInstance_QueueWrite(&m_defaultPort, pData, dataLength, waitForTransmit);
+}
+
+int SerialPort_GetWriteQueueCount()
+{
+    return SerialPortInstance_GetWriteQueueCount(&m_defaultPort);
+}
+
+void SerialPort_SetWriteCrc(int crcType)
+{
+    SerialPortInstance_SetWriteCrc(&m_defaultPort, crcType);
+}
+
+BOOL SerialPort_SetPacing(const TSerialPortPacing* pPacing)
+{
+    return SerialPortInstance_SetPacing(&m_defaultPort, pPacing);
+}
+
+void SerialPort_GetPacing(TSerialPortPacing* pPacing)
+{
+    SerialPortInstance_GetPacing(&m_defaultPort, pPacing);
+}
+
+void SerialPort_SetTransactions(TSerialPortTransactions* pTransactions)
+{
+    SerialPortInstance_SetTransactions(&m_defaultPort, pTransactions);
+}
+
+void SerialPort_SetModbusBus(TSerialPortModbusBus* pBus)
+{
+    SerialPortInstance_SetModbusBus(&m_defaultPort, pBus);
+}
+
+void SerialPort_SetCapture(TSerialPortCapture* pCapture)
+{
+    SerialPortInstance_SetCapture(&m_defaultPort, pCapture);
+}
+
+void SerialPort_SetTrace(TSerialPortTrace* pTrace, const char* name)
+{
+    SerialPortInstance_SetTrace(&m_defaultPort, pTrace, name);
+}
+
+void SerialPort_SetDispatcher(TSerialPortDispatcher* pDispatcher)
+{
+    SerialPortInstance_SetDispatcher(&m_defaultPort, pDispatcher);
+}
+
+void SerialPort_SetBroadcast(TSerialPortBroadcast* pBroadcast)
+{
+    SerialPortInstance_SetBroadcast(&m_defaultPort, pBroadcast);
+}
+
+void SerialPort_SetModemHandler(void (*OnModemHandler)(unsigned int modemStatus, unsigned int changedLines))
+{
+    m_OnModemHandler = OnModemHandler;
+    SerialPortInstance_SetModemHandler(&m_defaultPort, OnModemHandler ? SerialPort__OnModemChanged : NULL);
+}
+
+void SerialPort_SetLineErrorHandler(void (*OnLineErrorHandler)(const TSerialPortLineEvent* pEvent))
+{
+    m_OnLineErrorHandler = OnLineErrorHandler;
+    SerialPortInstance_SetLineErrorHandler(&m_defaultPort, OnLineErrorHandler ? SerialPort__OnLineError : NULL);
+}
+
+BOOL SerialPort_GetModemStatus(unsigned int* pModemStatus)
+{
+    return SerialPortInstance_GetModemStatus(&m_defaultPort, pModemStatus);
+}
+
+BOOL SerialPort_SetRTS(BOOL enable)
+{
+    return SerialPortInstance_SetRTS(&m_defaultPort, enable);
+}
+
+BOOL SerialPort_SetDTR(BOOL enable)
+{
+    return SerialPortInstance_SetDTR(&m_defaultPort, enable);
+}
+
+BOOL SerialPort_SetBreak(BOOL enable)
+{
+    return SerialPortInstance_SetBreak(&m_defaultPort, enable);
+}
+
+BOOL SerialPort_SetSettings(const TSerialPortSettings* pSettings)
+{
+    return SerialPortInstance_SetSettings(&m_defaultPort, pSettings);
+}
+
+void SerialPort_GetSettings(TSerialPortSettings* pSettings)
+{
+    SerialPortInstance_GetSettings(&m_defaultPort, pSettings);
+}
+
+void SerialPort_SetAutoReconnect(BOOL enable, int minDelayMS, int maxDelayMS)
+{
+    SerialPortInstance_SetAutoReconnect(&m_defaultPort, enable, minDelayMS, maxDelayMS);
+}
+
+unsigned int SerialPort_GetReconnectCount()
+{
+    return SerialPortInstance_GetReconnectCount(&m_defaultPort);
+}
+
+void SerialPort_GetStatistics(TSerialPortStatistics* pStatistics)
+{
+    SerialPortInstance_GetStatistics(&m_defaultPort, pStatistics);
+}
+
+void SerialPort_ResetStatistics()
+{
+    SerialPortInstance_ResetStatistics(&m_defaultPort);
+}
+
+int SerialPort_ReadUntil(unsigned char* pData, int dataLength, const char* delimiters, int timeOutMS)
+{
+    return SerialPortInstance_ReadUntil(&m_defaultPort, pData, dataLength, delimiters, timeOutMS);
+}
+
+int SerialPort_ReadLine(char* pLine, int maxBufferSize, int timeOutMS)
+{
+    return SerialPortInstance_ReadLine(&m_defaultPort, pLine, maxBufferSize, timeOutMS);
+}
+
+int SerialPort_ReadExact(unsigned char* pData, int dataLength, int timeOutMS)
+{
+    return SerialPortInstance_ReadExact(&m_defaultPort, pData, dataLength, timeOutMS);
+}
+
+int SerialPort_ReadAtLeast(unsigned char* pData, int minLength, int maxLength, int timeOutMS)
+{
+    return SerialPortInstance_ReadAtLeast(&m_defaultPort, pData, minLength, maxLength, timeOutMS);
+}
+
+int SerialPort_ReadAvailable(unsigned char* pData, int maxLength)
+{
+    return SerialPortInstance_ReadAvailable(&m_defaultPort, pData, maxLength);
+}
+
+int SerialPort_ReadVector(const SERIALPORT_READ_BUFFER* pBuffers, int bufferCount, int minLength, int timeOutMS)
+{
+    return SerialPortInstance_ReadVector(&m_defaultPort, pBuffers, bufferCount, minLength, timeOutMS);
+}
+
+int SerialPort_GetReceivedCount()
+{
+    return SerialPortInstance_GetReceivedCount(&m_defaultPort);
+}
+
+unsigned int SerialPort_GetReceiveOverflow()
+{
+    return SerialPortInstance_GetReceiveOverflow(&m_defaultPort);
+}
+
+void SerialPort_ClearReceiveBuffer()
+{
+    SerialPortInstance_ClearReceiveBuffer(&m_defaultPort);
+}
+
+BOOL SerialPort_SetReceiveBufferPool(int bufferCount, int bufferSize)
+{
+    return SerialPortInstance_SetReceiveBufferPool(&m_defaultPort, bufferCount, bufferSize);
+}
+
+void SerialPort_SetBufferReceivedHandler(void (*OnBufferReceivedHandler)(TSerialPortBuffer* pBuffer))
+{
+    if (m_defaultPort.receiveAsync) return;
+    m_OnBufferReceivedHandler = OnBufferReceivedHandler;
+    SerialPortInstance_SetBufferReceivedHandler(&m_defaultPort, OnBufferReceivedHandler ? SerialPort__OnBufferReceived : NULL);
+}
+
+int SerialPort_GetFreeBufferCount()
+{
+    return SerialPortInstance_GetFreeBufferCount(&m_defaultPort);
+}
+
+TSerialPortInstance* SerialPortInstance_Create(void)
+{
+    TSerialPortInstance* pPort = (TSerialPortInstance*)malloc(sizeof(TSerialPortInstance));
+    if (pPort)
+    {
+        SerialPortInstance__Initialize(pPort);
+    }
+    return pPort;
+}
+
+void SerialPortInstance_Delete(TSerialPortInstance* pPort)
+{
+    if (pPort)
+    {
+        SerialPortInstance__Uninitialize(pPort);
+        free(pPort);
+    }
+}
+
+void SerialPortInstance_SetReactor(TSerialPortInstance* pPort, TSerialPortReactor* pReactor)
+{
+    pPort->pReactor = pReactor;
+}
+
+static int SerialPortInstance__SendRequest(void* pContext, const unsigned char* pData, int dataLength)
+{
+    //engine frames carry their own checksum
+    return SerialPortInstance__QueueWrite((TSerialPortInstance*)pContext, pData, dataLength, FALSE, SERIALPORT_CRC_NONE);
+}
+
+void SerialPortInstance_SetTransactions(TSerialPortInstance* pPort, TSerialPortTransactions* pTransactions)
+{
+    if (pPort->pTransactions)
+    {
+        SerialPortTransactions_SetSendHandler(pPort->pTransactions, NULL, NULL);
+    }
+    if (pTransactions)
+    {
+        SerialPortTransactions_SetSendHandler(pTransactions, SerialPortInstance__SendRequest, pPort);
+    }
+    pPort->pTransactions = pTransactions;
+}
+
+TSerialPortTransactions* SerialPortInstance_GetTransactions(TSerialPortInstance* pPort)
+{
+    return pPort->pTransactions;
+}
+
+void SerialPortInstance_SetModbusBus(TSerialPortInstance* pPort, TSerialPortModbusBus* pBus)
+{
+    if (pPort->pModbusBus)
+    {
+        SerialPortModbus_SetSendHandler(pPort->pModbusBus, NULL, NULL);
+    }
+    if (pBus)
+    {
+        SerialPortModbus_SetSendHandler(pBus, SerialPortInstance__SendRequest, pPort);
+    }
+    pPort->pModbusBus = pBus;
+}
+
+TSerialPortModbusBus* SerialPortInstance_GetModbusBus(TSerialPortInstance* pPort)
+{
+    return pPort->pModbusBus;
+}
+
+void SerialPortInstance_SetCapture(TSerialPortInstance* pPort, TSerialPortCapture* pCapture)
+{
+    SerialPortIO_Lock(&pPort->criticalSectionDevice);
+    pPort->pCapture = pCapture;
+    SerialPortIO_SetCapture(pPort->portHandle, pCapture);
+    SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+}
+
+TSerialPortCapture* SerialPortInstance_GetCapture(TSerialPortInstance* pPort)
+{
+    return pPort->pCapture;
+}
+
+void SerialPortInstance_SetTrace(TSerialPortInstance* pPort, TSerialPortTrace* pTrace, const char* name)
+{
+    SerialPortIO_Lock(&pPort->criticalSectionDevice);
+    if (name==NULL)
+    {
+        name = pPort->deviceName[0] ? pPort->deviceName : NULL;
+    }
+    pPort->pTrace      = pTrace;
+    pPort->tracePortId = pTrace ? SerialPortTrace_AddPort(pTrace, name) : -1;
+    SerialPortIO_SetTrace(pPort->portHandle, pTrace, pPort->tracePortId);
+    SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+}
+
+TSerialPortTrace* SerialPortInstance_GetTrace(TSerialPortInstance* pPort)
+{
+    return pPort->pTrace;
+}
+
+void SerialPortInstance_SetReceiveTimeHandler(TSerialPortInstance* pPort, void (*OnReceiveTimeHandler)(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP receiveTime))
+{
+    pPort->OnReceiveTimeHandler = OnReceiveTimeHandler;
+}
+
+void SerialPortInstance_SetWriteTimeHandler(TSerialPortInstance* pPort, void (*OnWriteTimeHandler)(TSerialPortInstance* pPort, int bytesWritten, SERIALPORT_TIMESTAMP writeTime))
+{
+    SerialPortIO_Lock(&pPort->criticalSectionDevice);
+    pPort->OnWriteTimeHandler = OnWriteTimeHandler;
+    SerialPortIO_SetWriteHandler(pPort->portHandle, OnWriteTimeHandler ? SerialPortInstance__Written : NULL, pPort);
+    SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+}
+
+SERIALPORT_TIMESTAMP SerialPortInstance_GetLastReceiveTime(TSerialPortInstance* pPort)
+{
+    return pPort->receiveTime;
+}
+
+SERIALPORT_TIMESTAMP SerialPortInstance_GetLastWriteTime(TSerialPortInstance* pPort)
+{
+    SERIALPORT_TIMESTAMP writeTime;
+
+    SerialPortIO_Lock(&pPort->criticalSectionDevice);
+    writeTime = SerialPortIO_GetLastWriteTime(pPort->portHandle);
+    SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+    return writeTime;
+}
+
+void SerialPortInstance_SetDispatcher(TSerialPortInstance* pPort, TSerialPortDispatcher* pDispatcher)
+{
+    pPort->pDispatcher = pDispatcher;
+}
+
+TSerialPortDispatcher* SerialPortInstance_GetDispatcher(TSerialPortInstance* pPort)
+{
+    return pPort->pDispatcher;
+}
+
+void SerialPortInstance_SetBroadcast(TSerialPortInstance* pPort, TSerialPortBroadcast* pBroadcast)
+{
+    if (pPort->receiveAsync) return;
+    pPort->pBroadcast = pBroadcast;
+}
+
+TSerialPortBroadcast* SerialPortInstance_GetBroadcast(TSerialPortInstance* pPort)
+{
+    return pPort->pBroadcast;
+}
+
+void SerialPortInstance_SetModemHandler(TSerialPortInstance* pPort, void (*OnModemHandler)(TSerialPortInstance* pPort, unsigned int modemStatus, unsigned int changedLines))
+{
+    SerialPortIO_Lock(&pPort->criticalSectionDevice);
+    pPort->OnModemHandler = OnModemHandler;
+    if (pPort->portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        SerialPortIO_SetModemHandler(pPort->portHandle, OnModemHandler ? SerialPortInstance__ModemChanged : NULL, pPort);
+    }
+    SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+}
+
+void SerialPortInstance_SetLineErrorHandler(TSerialPortInstance* pPort, void (*OnLineErrorHandler)(TSerialPortInstance* pPort, const TSerialPortLineEvent* pEvent))
+{
+    pPort->OnLineErrorHandler = OnLineErrorHandler;
+}
+
+BOOL SerialPortInstance_GetModemStatus(TSerialPortInstance* pPort, unsigned int* pModemStatus)
+{
+    BOOL result;
+
+    SerialPortIO_Lock(&pPort->criticalSectionDevice);
+    result = SerialPortIO_GetModemStatus(pPort->portHandle, pModemStatus);
+    SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+    return result;
+}
+
+BOOL SerialPortInstance_SetRTS(TSerialPortInstance* pPort, BOOL enable)
+{
+    BOOL result;
+
+    SerialPortIO_Lock(&pPort->criticalSectionDevice);
+    result = SerialPortIO_SetModemLines(pPort->portHandle, enable ? SERIALPORT_MODEM_RTS : 0, SERIALPORT_MODEM_RTS);
+    SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+    return result;
+}
+
+BOOL SerialPortInstance_SetDTR(TSerialPortInstance* pPort, BOOL enable)
+{
+    BOOL result;
+
+    SerialPortIO_Lock(&pPort->criticalSectionDevice);
+    result = SerialPortIO_SetModemLines(pPort->portHandle, enable ? SERIALPORT_MODEM_DTR : 0, SERIALPORT_MODEM_DTR);
+    SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+    return result;
+}
+
+BOOL SerialPortInstance_SetBreak(TSerialPortInstance* pPort, BOOL enable)
+{
+    BOOL result;
+
+    SerialPortIO_Lock(&pPort->criticalSectionDevice);
+    result = SerialPortIO_SetBreak(pPort->portHandle, enable);
+    SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+    return result;
+}
+
+BOOL SerialPortInstance_SetSettings(TSerialPortInstance* pPort, const TSerialPortSettings* pSettings)
+{
+    BOOL result = TRUE;
+
+    if (pSettings==NULL) return FALSE;
+    SerialPortIO_Lock(&pPort->criticalSectionWrite);
+    SerialPortIO_Lock(&pPort->criticalSectionDevice);
+    if (pPort->portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        //the open device is reconfigured in place, a write in progress is finished first
+        result = SerialPortIO_Configure(pPort->portHandle, pSettings);
+    }
+    if (result)
+    {
+        pPort->settings = *pSettings;
+        if (pPort->writeQueue.paced)
+        {
+            //character time of the new line rate
+            SerialPortWriteQueue_SetPacing(&pPort->writeQueue, &pPort->writeQueue.pacing, &pPort->settings);
+        }
+    }
+    SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+    SerialPortIO_Unlock(&pPort->criticalSectionWrite);
+    return result;
+}
+
+void SerialPortInstance_GetSettings(TSerialPortInstance* pPort, TSerialPortSettings* pSettings)
+{
+    SerialPortIO_Lock(&pPort->criticalSectionDevice);
+    *pSettings = pPort->settings;
+    SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+}
+
+void SerialPortInstance_SetAutoReconnect(TSerialPortInstance* pPort, BOOL enable, int minDelayMS, int maxDelayMS)
+{
+    if (minDelayMS<1) minDelayMS = 1;
+    if (maxDelayMS<minDelayMS) maxDelayMS = minDelayMS;
+    pPort->reconnectMinDelayMS = minDelayMS;
+    pPort->reconnectMaxDelayMS = maxDelayMS;
+    pPort->autoReconnect = enable;
+    //queued frames wait for the reopened device instead of being dropped
+    pPort->writeQueue.keepOnError = enable;
+}
+
+unsigned int SerialPortInstance_GetReconnectCount(TSerialPortInstance* pPort)
+{
+    return SERIALPORT_ATOMIC_LOAD(&pPort->reconnectCount);
+}
+
+BOOL SerialPortInstance_SetReceiveBufferPool(TSerialPortInstance* pPort, int bufferCount, int bufferSize)
+{
+    TSerialPortBufferPool* pBufferPool;
+
+    if (pPort->receiveAsync) return FALSE;
+    pBufferPool = SerialPortBufferPool_Create(bufferCount, bufferSize);
+    if (pBufferPool==NULL) return FALSE;
+    if (pPort->pBufferPool)
+    {
+        //buffers still leased keep the old pool alive
+        SerialPortBufferPool_Delete(pPort->pBufferPool);
+    }
+    pPort->pBufferPool = pBufferPool;
+    return TRUE;
+}
+
+void SerialPortInstance_SetBufferReceivedHandler(TSerialPortInstance* pPort, void (*OnBufferReceivedHandler)(TSerialPortInstance* pPort, TSerialPortBuffer* pBuffer))
+{
+    if (pPort->receiveAsync) return;
+    pPort->OnBufferReceivedHandler = OnBufferReceivedHandler;
+}
+
+int SerialPortInstance_GetFreeBufferCount(TSerialPortInstance* pPort)
+{
+    if (pPort->pBufferPool==NULL) return 0;
+    return SerialPortBufferPool_GetFreeCount(pPort->pBufferPool);
+}
+
+void SerialPortInstance_SetUserData(TSerialPortInstance* pPort, void* pUserData)
+{
+    pPort->pUserData = pUserData;
+}
+
+void* SerialPortInstance_GetUserData(TSerialPortInstance* pPort)
+{
+    return pPort->pUserData;
+}
+
+int SerialPortInstance_GetMaxTimeout(TSerialPortInstance* pPort)
+{
+    return pPort->timeoutMilliSeconds;
+}
+
+SERIALPORT_TIMESTAMP SerialPortInstance_GetLastReadDuration(TSerialPortInstance* pPort)
+{
+    return pPort->lastReadDuration;
+}
+
+BOOL SerialPortInstance_OpenAsync(TSerialPortInstance* pPort, int comPortNumber, int baudRate,                             
+                     void (*OnDataReceivedHandler)(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength),
+                     void (*OnDataSentHandler)(TSerialPortInstance* pPort),                         
+                     int timeoutMS
+                    )
+
+{
+    char deviceName[SERIALPORT_MAX_DEVICE_NAME];
+    if (!SerialPortIO_GetDeviceName(comPortNumber, deviceName, sizeof(deviceName))) return FALSE;
+
+    return SerialPortInstance_OpenDeviceAsync(pPort, deviceName, baudRate, OnDataReceivedHandler, OnDataSentHandler, timeoutMS);
+}
+
+BOOL SerialPortInstance_OpenDeviceAsync(TSerialPortInstance* pPort, const char* deviceName, int baudRate,                             
+                     void (*OnDataReceivedHandler)(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength),
+                     void (*OnDataSentHandler)(TSerialPortInstance* pPort),                         
+                     int timeoutMS
+                    )
+
+{
+    BOOL result = SerialPortInstance_OpenDevice(pPort, deviceName, baudRate, timeoutMS);
+    if (result)
+    {
+        pPort->OnDataReceivedHandler = OnDataReceivedHandler;
+        pPort->OnDataSentHandler     = OnDataSentHandler;
+        if (pPort->OnBufferReceivedHandler && (pPort->pBufferPool==NULL))
+        {
+            pPort->pBufferPool = SerialPortBufferPool_Create(SERIALPORT_DEFAULT_BUFFER_COUNT, SERIALPORT_DEFAULT_BUFFER_SIZE);
+        }
+        if (pPort->OnBufferReceivedHandler && (pPort->pBufferPool==NULL))
+        {
+            pPort->receiveAsync = FALSE;
+        } else if (pPort->pReactor)
+        {
+            SerialPortIO_Lock(&pPort->criticalSectionQueue);
+            pPort->pReactorEntry = SerialPortReactor_Add(pPort->pReactor, pPort->portHandle, 
+                                                         SerialPortInstance__ReceiveReady, SerialPortInstance__SendReady, pPort);
+            SerialPortIO_Unlock(&pPort->criticalSectionQueue);
+            pPort->receiveAsync = (pPort->pReactorEntry!=NULL);
+        } else {
+            pPort->workingThreadStarted = SerialPortIO_StartThread(&pPort->workingThread, SerialPortInstance__WaitForData, pPort);
+            pPort->receiveAsync = pPort->workingThreadStarted;
+        }
+        if (!pPort->receiveAsync)
+        {
+            SerialPortInstance_Close(pPort);
+            result = FALSE;
+        }
+    }
+    return result;
+}
+
+BOOL SerialPortInstance_Open(TSerialPortInstance* pPort, int comPortNumber, int baudRate, int timeoutMS)
+{
+    char deviceName[SERIALPORT_MAX_DEVICE_NAME];
+    if (!SerialPortIO_GetDeviceName(comPortNumber, deviceName, sizeof(deviceName))) return FALSE;
+
+    return SerialPortInstance_OpenDevice(pPort, deviceName, baudRate, timeoutMS);
+}
+
+BOOL SerialPortInstance_OpenDevice(TSerialPortInstance* pPort, const char* deviceName, int baudRate, int timeoutMS)
+{
+    if (deviceName==NULL) return FALSE;
+    if (timeoutMS>15000) return FALSE;
+    if (pPort->portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        //the working thread of the open port would never be joined, SerialPortInstance_Close() first
+        return FALSE;
+    }
+    if (pPort->workingThreadStarted)
+    {
+        //left running by SerialPortInstance_Close() called from a handler, it cannot join itself
+        if (SerialPortIO_IsCurrentThread(&pPort->workingThread)) return FALSE;
+        SerialPortIO_JoinThread(&pPort->workingThread);
+        pPort->workingThreadStarted = FALSE;
+    }
+    if (pPort->reconnectThreadStarted)
+    {
+        if (SerialPortIO_IsCurrentThread(&pPort->reconnectThread)) return FALSE;
+        SerialPortIO_JoinThread(&pPort->reconnectThread);
+        pPort->reconnectThreadStarted = FALSE;
+    }
+    if ((pPort->receiveRing.pBuffer==NULL) && (!SerialPortRing_Create(&pPort->receiveRing, SERIALPORT_RECEIVE_BUFFER_SIZE)))
+    {
+        return FALSE;
+    }
+
+    SerialPortIO_Lock(&pPort->criticalSectionWrite);
+    pPort->settings.baudRate = baudRate;
+    if (pPort->writeQueue.paced)
+    {
+        SerialPortWriteQueue_SetPacing(&pPort->writeQueue, &pPort->writeQueue.pacing, &pPort->settings);
+    }
+    SerialPortIO_Unlock(&pPort->criticalSectionWrite);
+    pPort->portHandle = SerialPortIO_OpenWithSettings(deviceName, &pPort->settings);
+    if (pPort->portHandle==SERIALPORT_INVALID_HANDLE)
+    {
+        return FALSE;
+    }
+    SerialPortIO_SetCapture(pPort->portHandle, pPort->pCapture);
+    SerialPortIO_SetTrace(pPort->portHandle, pPort->pTrace, pPort->tracePortId);
+    SerialPortIO_SetWriteHandler(pPort->portHandle, pPort->OnWriteTimeHandler ? SerialPortInstance__Written : NULL, pPort);
+    if (pPort->OnModemHandler)
+    {
+        SerialPortIO_SetModemHandler(pPort->portHandle, SerialPortInstance__ModemChanged, pPort);
+    }
+
+    //kept for reconnecting
+    strncpy(pPort->deviceName, deviceName, sizeof(pPort->deviceName)-1);
+    pPort->deviceName[sizeof(pPort->deviceName)-1] = 0;
+    SERIALPORT_ATOMIC_STORE(&pPort->closing, 0);
+
+    pPort->timeoutMilliSeconds = timeoutMS;
+    pPort->receiveOverflow = 0;
+    pPort->skipLineFeed = FALSE;
+    SerialPortRing_Clear(&pPort->receiveRing);
+    SerialPortIO_ResetEvent(&pPort->receiveEvent);
+    SerialPortIO_ResetEvent(&pPort->wakeEvent);
+    return TRUE;
+}
+
+void SerialPortInstance_Close(TSerialPortInstance* pPort)
+{    
+    TSerialPortReactorEntry* pReactorEntry;
+
+    //no reconnect is started from now on, the one in progress gives up
+    SerialPortIO_Lock(&pPort->criticalSectionQueue);
+    SERIALPORT_ATOMIC_STORE(&pPort->closing, 1);
+    SerialPortIO_Unlock(&pPort->criticalSectionQueue);
+    SerialPortIO_SetEvent(&pPort->wakeEvent);        //wakes up the working thread waiting for data
+    if (pPort->reconnectThreadStarted && !SerialPortIO_IsCurrentThread(&pPort->reconnectThread))
+    {
+        SerialPortIO_JoinThread(&pPort->reconnectThread);
+        pPort->reconnectThreadStarted = FALSE;
+    }
+
+    SerialPortIO_Lock(&pPort->criticalSectionQueue);
+    pReactorEntry = pPort->pReactorEntry;
+    pPort->pReactorEntry = NULL;
+    SerialPortIO_Unlock(&pPort->criticalSectionQueue);
+    if (pReactorEntry)
+    {
+        //handlers are not running when Remove returns, it must not wait for our locks
+        SerialPortReactor_Remove(pPort->pReactor, pReactorEntry);
+        SerialPortIO_SetEvent(&pPort->receiveEvent);
+    }
+    //frees room for the working thread in case it is blocked in Post
+    SerialPortDispatcher_Cancel(pPort->pDispatcher, pPort);
+    if (pPort->workingThreadStarted && !SerialPortIO_IsCurrentThread(&pPort->workingThread))
+    {
+        //the working thread must not use the handle after it is closed
+        SerialPortIO_JoinThread(&pPort->workingThread);
+        pPort->workingThreadStarted = FALSE;
+    }
+    //the modem handler may wait for our locks, its thread is joined before taking them
+    SerialPortIO_SetModemHandler(pPort->portHandle, NULL, NULL);
+    SerialPortIO_Lock(&pPort->criticalSectionRead);  //prevents port closing if ReadBuffer  is not complete
+    SerialPortIO_Lock(&pPort->criticalSectionWrite); //prevents port closing if WriteBuffer is not complete
+    SerialPortIO_Lock(&pPort->criticalSectionDevice);//prevents port closing if working thread is reading
+    if (pPort->portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        SerialPortIO_Close(pPort->portHandle);			
+        pPort->portHandle = SERIALPORT_INVALID_HANDLE;
+        pPort->receiveAsync = FALSE;
+        SerialPortWriteQueue_Clear(&pPort->writeQueue);
+    }
+    SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+    SerialPortIO_Unlock(&pPort->criticalSectionRead);
+    SerialPortIO_Unlock(&pPort->criticalSectionWrite);
+    SerialPortDispatcher_Cancel(pPort->pDispatcher, pPort);
+}
+
+BOOL SerialPortInstance_IsOpen(TSerialPortInstance* pPort)
+{
+    return (pPort->portHandle!=SERIALPORT_INVALID_HANDLE);
+}
+
+BOOL SerialPortInstance_GetPeerName(TSerialPortInstance* pPort, char* deviceName, int maxLength)
+{
+    BOOL result;
+
+    SerialPortIO_Lock(&pPort->criticalSectionDevice);
+    result = SerialPortIO_GetPeerName(pPort->portHandle, deviceName, maxLength);
+    SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+    return result;
+}
+
+static int SerialPortInstance__WriteBuffer(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength)
+{
+    SERIALPORT_BUFFER    buffers[2];
+    unsigned char        crcBytes[SERIALPORT_CRC_MAX_SIZE];
+    SERIALPORT_TIMESTAMP startTime;
+    int                  result;
+
+    if (pPort->portHandle==SERIALPORT_INVALID_HANDLE)
+    {
+        return 0;
+    }    
+    startTime = SerialPortIO_GetTime();
+    if (pPort->writeCrcType==SERIALPORT_CRC_NONE)
+    {
+        result = SerialPortIO_Write(pPort->portHandle, pData, dataLength);   
+        SerialPortStatistics_AddWrite(&pPort->statistics, result, SerialPortIO_GetTime()-startTime);
+        SerialPortWriteQueue_NoteWrite(&pPort->writeQueue, result);
+        return result;
+    }
+
+    //frame and its checksum go out in one gathered write
+    buffers[0].pData      = pData;
+    buffers[0].dataLength = dataLength;
+    buffers[1].pData      = crcBytes;
+    buffers[1].dataLength = SerialPortCrc_Append(pPort->writeCrcType, SerialPortCrc_Compute(pPort->writeCrcType, pData, dataLength), crcBytes);
+    result = SerialPortIO_WriteVector(pPort->portHandle, buffers, 2, TRUE);
+    SerialPortStatistics_AddWrite(&pPort->statistics, result, SerialPortIO_GetTime()-startTime);
+    SerialPortWriteQueue_NoteWrite(&pPort->writeQueue, result);
+    if (result<0)
+    {
+        return 0;
+    }
+    return (result<dataLength) ? result : dataLength;
+}
+	
+static int SerialPortInstance__ReadBuffer(TSerialPortInstance* pPort, unsigned char* pData, int dataLength, int timeOutMS)
+{
+    SERIALPORT_TIMESTAMP startTime, currentTime, deadline;
+    int   bytesRead, bytesReadTotal, waitMS;
+
+    if (pPort->portHandle==SERIALPORT_INVALID_HANDLE)
+    {
+        return 0;
+    }
+    if (timeOutMS<0)
+    {
+        timeOutMS = pPort->timeoutMilliSeconds;
+    }
+    if (pPort->receiveAsync)
+    {
+        return SerialPortInstance__ReadReceiveRing(pPort, pData, dataLength, timeOutMS);
+    }
+    
+    //bytes left in the ring by ReadLine/ReadUntil go first
+    bytesReadTotal = SerialPortRing_Read(&pPort->receiveRing, pData, dataLength);
+    dataLength -= bytesReadTotal;
+    startTime   = SerialPortIO_GetTime();
+    currentTime = startTime;
+    deadline    = startTime + (SERIALPORT_TIMESTAMP)timeOutMS*1000;
+
+    //timeout is measured from the last received byte, the thread sleeps in poll/WaitForMultipleObjects
+    while(dataLength>0)
+    {
+        waitMS = (deadline>currentTime) ? (int)((deadline-currentTime+999)/1000) : 0;
+        bytesRead = SerialPortIO_Read(pPort->portHandle, pData+bytesReadTotal, dataLength, waitMS, NULL);
+        SerialPortStatistics_AddRead(&pPort->statistics, bytesRead);
+        SerialPortInstance__OnDataRead(pPort, pData+bytesReadTotal, bytesRead);
+        currentTime = SerialPortIO_GetTime();
+        if (bytesRead<0)
+        {
+            break;
+        }
+        if (bytesRead)
+        {
+            dataLength     -= bytesRead;
+            bytesReadTotal += bytesRead;
+            deadline = currentTime + (SERIALPORT_TIMESTAMP)timeOutMS*1000;
+        } else if (currentTime>=deadline) {
+            break;
+        }
+    }
+    pPort->lastReadDuration = currentTime - startTime;
+    return bytesReadTotal;
+}
+
+static int SerialPortInstance__ReadReceiveRing(TSerialPortInstance* pPort, unsigned char* pData, int dataLength, int timeOutMS)
+{
+    SERIALPORT_TIMESTAMP startTime, currentTime, deadline;
+    int   bytesRead, bytesReadTotal;
+
+    bytesReadTotal = 0;
+    startTime   = SerialPortIO_GetTime();
+    currentTime = startTime;
+    deadline    = startTime + (SERIALPORT_TIMESTAMP)timeOutMS*1000;
+
+    //working thread fills the ring, no syscall is needed as long as data are there
+    while(dataLength>0)
+    {
+        bytesRead = SerialPortRing_Read(&pPort->receiveRing, pData+bytesReadTotal, dataLength);
+        if (bytesRead)
+        {
+            dataLength     -= bytesRead;
+            bytesReadTotal += bytesRead;
+            currentTime = SerialPortIO_GetTime();
+            deadline = currentTime + (SERIALPORT_TIMESTAMP)timeOutMS*1000;
+            continue;
+        }
+        if ((currentTime>=deadline) || (!SerialPortInstance_IsOpen(pPort)))
+        {
+            break;
+        }
+        SerialPortInstance__WaitForReceivedData(pPort, (int)((deadline-currentTime+999)/1000));
+        currentTime = SerialPortIO_GetTime();
+    }
+    pPort->lastReadDuration = currentTime - startTime;
+    return bytesReadTotal;
+}
+
+static int SerialPortInstance__WaitForReceivedData(TSerialPortInstance* pPort, int timeOutMS)
+{
+    unsigned char* pWrite;
+    int            writeLength, bytesRead, receivedCount;
+
+    if (!pPort->receiveAsync)
+    {
+        //nobody else reads the device, caller fills the ring by itself
+        writeLength = SerialPortRing_GetWriteBuffer(&pPort->receiveRing, &pWrite);
+        if (writeLength==0)
+        {
+            return 0;
+        }
+        bytesRead = SerialPortIO_Read(pPort->portHandle, pWrite, writeLength, timeOutMS, NULL);
+        SerialPortStatistics_AddRead(&pPort->statistics, bytesRead);
+        if (bytesRead>0)
+        {
+            SerialPortRing_CommitWrite(&pPort->receiveRing, bytesRead);
+            SerialPortStatistics_UpdateMax(&pPort->statistics.receiveHighWater, SerialPortRing_GetCount(&pPort->receiveRing));
+        }
+        SerialPortInstance__OnDataRead(pPort, pWrite, bytesRead);
+        return bytesRead;
+    }
+
+    receivedCount = SerialPortRing_GetCount(&pPort->receiveRing);
+    SERIALPORT_ATOMIC_STORE(&pPort->receiveWaiting, 1);
+    if (SerialPortRing_GetCount(&pPort->receiveRing)==receivedCount)
+    {
+        SerialPortIO_WaitEvent(&pPort->receiveEvent, timeOutMS);
+    }
+    SERIALPORT_ATOMIC_STORE(&pPort->receiveWaiting, 0);
+    return SerialPortRing_GetCount(&pPort->receiveRing) - receivedCount;
+}
+
+static int SerialPortInstance__ReadUntil(TSerialPortInstance* pPort, unsigned char* pData, int dataLength, const unsigned char* delimiters, int delimiterCount, int timeOutMS)
+{
+    SERIALPORT_TIMESTAMP startTime, currentTime, deadline;
+    int   receivedCount, scanLength, scannedLength, position, bytesRead;
+
+    if (pPort->portHandle==SERIALPORT_INVALID_HANDLE)
+    {
+        return 0;
+    }
+    if (timeOutMS<0)
+    {
+        timeOutMS = pPort->timeoutMilliSeconds;
+    }
+    if (dataLength>(int)pPort->receiveRing.capacity)
+    {
+        dataLength = (int)pPort->receiveRing.capacity;
+    }
+    if ((timeOutMS==0) && (!pPort->receiveAsync))
+    {
+        SerialPortInstance__WaitForReceivedData(pPort, 0);
+    }
+
+    scannedLength = 0;
+    startTime   = SerialPortIO_GetTime();
+    currentTime = startTime;
+    deadline    = startTime + (SERIALPORT_TIMESTAMP)timeOutMS*1000;
+
+    //data stay in the ring until a delimiter is found, bytes behind it are kept for the next call
+    for(;;)
+    {
+        receivedCount = SerialPortRing_GetCount(&pPort->receiveRing);
+        scanLength = (receivedCount<dataLength) ? receivedCount : dataLength;
+        position = SerialPortRing_Find(&pPort->receiveRing, scannedLength, scanLength, delimiters, delimiterCount);
+        if (position>=0)
+        {
+            scanLength = position+1;
+            break;
+        }
+        if (scanLength==dataLength)
+        {
+            break;
+        }
+        scannedLength = scanLength;
+
+        if ((currentTime>=deadline) || (!SerialPortInstance_IsOpen(pPort)))
+        {
+            break;
+        }
+        bytesRead = SerialPortInstance__WaitForReceivedData(pPort, (int)((deadline-currentTime+999)/1000));
+        currentTime = SerialPortIO_GetTime();
+        if (bytesRead<0)
+        {
+            break;
+        }
+        if (bytesRead>0)
+        {
+            deadline = currentTime + (SERIALPORT_TIMESTAMP)timeOutMS*1000;
+        }
+    }
+    pPort->lastReadDuration = currentTime - startTime;
+    return SerialPortRing_Read(&pPort->receiveRing, pData, scanLength);
+}
+
+static int SerialPortInstance__ReadVector(TSerialPortInstance* pPort, const SERIALPORT_READ_BUFFER* pBuffers, int bufferCount, int minLength, int timeOutMS)
+{
+    SERIALPORT_TIMESTAMP startTime, currentTime, deadline;
+    int   bufferIndex, offset, bytesRead, bytesReadTotal, maxLength, i;
+    BOOL  waited;
+
+    if (pPort->portHandle==SERIALPORT_INVALID_HANDLE)
+    {
+        return 0;
+    }
+    if (timeOutMS<0)
+    {
+        timeOutMS = pPort->timeoutMilliSeconds;
+    }
+    maxLength = 0;
+    for(i = 0; i<bufferCount; i++)
+    {
+        maxLength += pBuffers[i].dataLength;
+    }
+    if (minLength>maxLength)
+    {
+        minLength = maxLength;
+    }
+
+    bufferIndex    = 0;
+    offset         = 0;
+    bytesReadTotal = 0;
+    waited         = FALSE;
+    startTime   = SerialPortIO_GetTime();
+    currentTime = startTime;
+    deadline    = startTime + (SERIALPORT_TIMESTAMP)timeOutMS*1000;
+
+    //the deadline stays where it is, nothing waits once minLength bytes are there
+    for(;;)
+    {
+        while(bufferIndex<bufferCount)
+        {
+            bytesRead = SerialPortRing_Read(&pPort->receiveRing, pBuffers[bufferIndex].pData+offset, pBuffers[bufferIndex].dataLength-offset);
+            offset         += bytesRead;
+            bytesReadTotal += bytesRead;
+            if (offset<pBuffers[bufferIndex].dataLength)
+            {
+                break;
+            }
+            bufferIndex++;
+            offset = 0;
+        }
+        if ((bytesReadTotal==maxLength) || ((bytesReadTotal>=minLength) && ((bytesReadTotal>0) || waited)))
+        {
+            break;
+        }
+        if ((waited && (currentTime>=deadline)) || (!SerialPortInstance_IsOpen(pPort)))
+        {
+            break;
+        }
+        //with an empty ring and no minimum the device is polled once, without waiting
+        bytesRead = SerialPortInstance__WaitForReceivedData(pPort, (deadline>currentTime) ? (int)((deadline-currentTime+999)/1000) : 0);
+        currentTime = SerialPortIO_GetTime();
+        waited = TRUE;
+        if (bytesRead<0)
+        {
+            break;
+        }
+    }
+    pPort->lastReadDuration = currentTime - startTime;
+    return bytesReadTotal;
+}
+
+static BOOL SerialPortInstance__ReceiveData(TSerialPortInstance* pPort)
+{
+    TSerialPortLineEvent lineEvents[SERIALPORT_MAX_LINE_EVENTS];
+    unsigned char        discard[256];
+    unsigned char*       pWrite;
+    TSerialPortBuffer*   pBuffer;
+    int                  writeLength, bytesRead, eventCount;
+    BOOL                 result = TRUE;
+
+    for(;;)
+    {
+        //the device lock is held for the read only, handlers run without it
+        SerialPortIO_Lock(&pPort->criticalSectionDevice);
+        if (pPort->portHandle==SERIALPORT_INVALID_HANDLE)
+        {
+            SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+            break;
+        }
+        pBuffer = NULL;
+        writeLength = 0;
+        if (pPort->OnBufferReceivedHandler)
+        {
+            //device reads straight into a leased pool buffer
+            pBuffer = SerialPortBufferPool_Get(pPort->pBufferPool);
+            if (pBuffer)
+            {
+                pWrite = pBuffer->pData;
+                writeLength = pBuffer->capacity;
+            }
+        } else if (pPort->pBroadcast) {
+            //one read serves all subscribers, the broadcast ring is never full
+            writeLength = SerialPortBroadcast_GetWriteBuffer(pPort->pBroadcast, &pWrite);
+        } else {
+            //device reads straight into the ring
+            writeLength = SerialPortRing_GetWriteBuffer(&pPort->receiveRing, &pWrite);
+        }
+        if (writeLength==0)
+        {
+            //no room left, data are read out and dropped
+            pWrite = discard;
+            writeLength = sizeof(discard);
+        }
+        bytesRead = SerialPortIO_Read(pPort->portHandle, pWrite, writeLength, 0, NULL);
+        SerialPortStatistics_AddRead(&pPort->statistics, bytesRead);
+        //events are collected anyway, so they do not pile up
+        eventCount = SerialPortIO_GetLineEvents(pPort->portHandle, lineEvents, SERIALPORT_MAX_LINE_EVENTS);
+        if (bytesRead<=0)
+        {
+            if (pPort->pBroadcast) SerialPortBroadcast_CommitWrite(pPort->pBroadcast, 0);
+        } else if (pWrite==discard) {
+            SERIALPORT_ATOMIC_ADD(&pPort->receiveOverflow, (unsigned int)bytesRead);
+        } else if ((pBuffer==NULL) && pPort->pBroadcast) {
+            SerialPortBroadcast_CommitWrite(pPort->pBroadcast, bytesRead);
+        } else if (pBuffer==NULL) {
+            SerialPortRing_CommitWrite(&pPort->receiveRing, bytesRead);
+            SerialPortStatistics_UpdateMax(&pPort->statistics.receiveHighWater, SerialPortRing_GetCount(&pPort->receiveRing));
+            if (SERIALPORT_ATOMIC_LOAD(&pPort->receiveWaiting))
+            {
+                SerialPortIO_SetEvent(&pPort->receiveEvent);
+            }
+        }
+        if (bytesRead>0)
+        {
+            pPort->receiveTime = SerialPortIO_GetLastReadTime(pPort->portHandle);
+        }
+        SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+
+        SerialPortInstance__CallLineErrorHandler(pPort, lineEvents, eventCount);
+        if (bytesRead<=0) 
+        {
+            if (pBuffer) SerialPortBuffer_Release(pBuffer);
+            result = (bytesRead==0);
+            break;
+        }
+        if (!SerialPortInstance__CallDataReceivedHandler(pPort, pWrite, bytesRead) && (pWrite==discard))
+        {
+            //no handler took what did not fit into the ring
+            SERIALPORT_ATOMIC_ADD64(&pPort->statistics.droppedBytes, (unsigned long long)bytesRead);
+        }
+        if (pBuffer)
+        {
+            pBuffer->dataLength  = bytesRead;
+            pBuffer->receiveTime = pPort->receiveTime;
+            SerialPortInstance__CallBufferReceivedHandler(pPort, pBuffer);
+        }
+        if (bytesRead<writeLength)
+        {
+            //driver buffer is empty
+            break;
+        }
+    }
+    return result;
+}
+
+int SerialPortInstance_GetReceivedCount(TSerialPortInstance* pPort)
+{
+    if (pPort->receiveRing.pBuffer==NULL)
+    {
+        return 0;
+    }
+    return SerialPortRing_GetCount(&pPort->receiveRing);
+}
+
+unsigned int SerialPortInstance_GetReceiveOverflow(TSerialPortInstance* pPort)
+{
+    return SERIALPORT_ATOMIC_LOAD(&pPort->receiveOverflow);
+}
+
+void SerialPortInstance_ClearReceiveBuffer(TSerialPortInstance* pPort)
+{
+    SerialPortIO_Lock(&pPort->criticalSectionRead);
+    if (pPort->receiveRing.pBuffer)
+    {
+        SerialPortRing_Clear(&pPort->receiveRing);
+    }
+    SerialPortIO_Unlock(&pPort->criticalSectionRead);
+}
+
+int SerialPortInstance_ReadBuffer(TSerialPortInstance* pPort, unsigned char* pData, int dataLength, int timeOutMS)
+{
+    int result;
+    SerialPortIO_Lock(&pPort->criticalSectionRead);
+    result = SerialPortInstance__ReadBuffer(pPort, pData, dataLength, timeOutMS);
+    SerialPortStatistics_AddLatency(pPort->statistics.readLatency, pPort->lastReadDuration);
+    SerialPortIO_Unlock(&pPort->criticalSectionRead);
+    return result;
+}
+
+
+int SerialPortInstance_WriteBuffer(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength)
+{
+    int result;
+    SerialPortIO_Lock(&pPort->criticalSectionWrite);
+    result = SerialPortInstance__WriteBuffer(pPort, pData, dataLength);
+    SerialPortIO_Unlock(&pPort->criticalSectionWrite);
+    SerialPortInstance__CallDataSentHandler(pPort);
+    return result;
+}
+
+
+int SerialPortInstance_WriteLine(TSerialPortInstance* pPort, const char* pLine, BOOL addCRatEnd)
+{
+    SERIALPORT_BUFFER    buffers[2];
+    SERIALPORT_TIMESTAMP startTime;
+    int                  lineLength, result;
+
+    if (pPort->portHandle==SERIALPORT_INVALID_HANDLE)
+    {
+        return 0;
+    }
+    if (pLine==NULL)
+    {
+        return 0;
+    }
+    lineLength = strlen(pLine);
+    if (lineLength==0)
+    {
+        return 0;
+    }
+
+    //line and CR go out in one gathered write
+    buffers[0].pData      = (const unsigned char*)pLine;
+    buffers[0].dataLength = lineLength;
+    buffers[1].pData      = (const unsigned char*)"\r";
+    buffers[1].dataLength = 1;
+
+    SerialPortIO_Lock(&pPort->criticalSectionWrite);
+    result = 0;
+    if (pPort->portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        startTime = SerialPortIO_GetTime();
+        result = SerialPortIO_WriteVector(pPort->portHandle, buffers, (addCRatEnd && (pLine[lineLength-1]!=0x0D)) ? 2 : 1, TRUE);
+        SerialPortStatistics_AddWrite(&pPort->statistics, result, SerialPortIO_GetTime()-startTime);
+        SerialPortWriteQueue_NoteWrite(&pPort->writeQueue, result);
+    }
+    SerialPortIO_Unlock(&pPort->criticalSectionWrite);
+    if (result<0)
+    {
+        result = 0;
+    }
+    SerialPortInstance__CallDataSentHandler(pPort);
+    return result;
+}
+
+int SerialPortInstance_QueueWrite(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength, BOOL waitForTransmit)
+{
+    return SerialPortInstance__QueueWrite(pPort, pData, dataLength, waitForTransmit, pPort->writeCrcType);
+}
+
+static int SerialPortInstance__QueueWrite(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength, BOOL waitForTransmit, int crcType)
+{
+    SERIALPORT_BUFFER buffers[2];
+    unsigned char     crcBytes[SERIALPORT_CRC_MAX_SIZE];
+    int               bufferCount = 1;
+    BOOL              wasEmpty;
+
+    if ((pPort->portHandle==SERIALPORT_INVALID_HANDLE) || (pData==NULL) || (dataLength<=0))
+    {
+        return 0;
+    }
+    buffers[0].pData      = pData;
+    buffers[0].dataLength = dataLength;
+    if (crcType!=SERIALPORT_CRC_NONE)
+    {
+        //checksum is queued in the same node as the frame
+        buffers[1].pData      = crcBytes;
+        buffers[1].dataLength = SerialPortCrc_Append(crcType, SerialPortCrc_Compute(crcType, pData, dataLength), crcBytes);
+        bufferCount = 2;
+    }
+    if (!SerialPortWriteQueue_Push(&pPort->writeQueue, buffers, bufferCount, waitForTransmit, &wasEmpty))
+    {
+        return 0;
+    }
+    if (!wasEmpty)
+    {
+        //writer takes it together with the frames queued before
+        return dataLength;
+    }
+
+    SerialPortInstance__NotifyWriter(pPort);
+    return dataLength;
+}
 
-DWORD WINAPI    SerialPort_WaitForData( LPVOID lpParam );
-int             SerialPort__WriteBuffer(const unsigned char* pData, int dataLength);
-int             SerialPort__ReadBuffer(unsigned char* pData, int dataLength, int timeOutMS);
+int SerialPortInstance_GetWriteQueueCount(TSerialPortInstance* pPort)
+{
+    return SerialPortWriteQueue_GetCount(&pPort->writeQueue);
+}
 
-#define SERIALPORT_INTERNAL_TIMEOUT 1
+void SerialPortInstance_SetWriteCrc(TSerialPortInstance* pPort, int crcType)
+{
+    pPort->writeCrcType = (SerialPortCrc_GetSize(crcType)>0) ? crcType : SERIALPORT_CRC_NONE;
+}
 
-void SerialPort_Initialize(void)
+int SerialPortInstance_GetWriteCrc(TSerialPortInstance* pPort)
 {
-	m_portHandle = NULL;
-	m_OnDataReceivedHandler = NULL;	
-    m_OnDataSentHandler = NULL;	
-    m_timeoutMilliSeconds = 0;
-    m_workingThread = NULL;
-    m_workingThreadId = 0;
-    InitializeCriticalSection(&m_criticalSectionRead);
-    InitializeCriticalSection(&m_criticalSectionWrite);
+    return pPort->writeCrcType;
 }
 
-void SerialPort_Uninitialize(void)
+BOOL SerialPortInstance_SetPacing(TSerialPortInstance* pPort, const TSerialPortPacing* pPacing)
 {
-    if (m_portHandle)
+    TSerialPortPacer* pPacer = NULL;
+    BOOL              paced;
+
+    SerialPortIO_Lock(&pPort->criticalSectionWrite);
+    SerialPortWriteQueue_SetPacing(&pPort->writeQueue, pPacing, &pPort->settings);
+    paced = pPort->writeQueue.paced;
+    SerialPortIO_Unlock(&pPort->criticalSectionWrite);
+
+    if (paced && (pPort->pPacer==NULL))
+    {
+        pPacer = SerialPortPacer_Create(SerialPortInstance__SendPaced, pPort);
+        if (pPacer==NULL)
+        {
+            SerialPortIO_Lock(&pPort->criticalSectionWrite);
+            SerialPortWriteQueue_SetPacing(&pPort->writeQueue, NULL, &pPort->settings);
+            SerialPortIO_Unlock(&pPort->criticalSectionWrite);
+            return FALSE;
+        }
+        SerialPortIO_Lock(&pPort->criticalSectionQueue);
+        pPort->pPacer = pPacer;
+        SerialPortIO_Unlock(&pPort->criticalSectionQueue);
+    } else if ((!paced) && pPort->pPacer)
+    {
+        SerialPortIO_Lock(&pPort->criticalSectionQueue);
+        pPacer = pPort->pPacer;
+        pPort->pPacer = NULL;
+        SerialPortIO_Unlock(&pPort->criticalSectionQueue);
+        //waits for the pacer thread, it takes the write lock
+        SerialPortPacer_Delete(pPacer);
+    }
+    if (paced)
+    {
+        //the writer of QueueWrite may have started the pacer before
+        SerialPortIO_Lock(&pPort->criticalSectionQueue);
+        SerialPortPacer_SetTimeCritical(pPort->pPacer, TRUE);
+        SerialPortIO_Unlock(&pPort->criticalSectionQueue);
+    }
+    if ((pPort->portHandle!=SERIALPORT_INVALID_HANDLE) && (SerialPortWriteQueue_GetCount(&pPort->writeQueue)>0))
     {
-        SerialPort_Close();  
+        //frames queued before are sent the new way
+        SerialPortInstance__NotifyWriter(pPort);
     }
-    DeleteCriticalSection(&m_criticalSectionRead);
-    DeleteCriticalSection(&m_criticalSectionWrite);
+    return TRUE;
 }
 
-int SerialPort_GetMaxTimeout()
+void SerialPortInstance_GetPacing(TSerialPortInstance* pPort, TSerialPortPacing* pPacing)
 {
-    return m_timeoutMilliSeconds;
+    SerialPortIO_Lock(&pPort->criticalSectionWrite);
+    *pPacing = pPort->writeQueue.pacing;
+    SerialPortIO_Unlock(&pPort->criticalSectionWrite);
 }
 
-BOOL SerialPort_OpenAsync(int comPortNumber, int baudRate,                             
-                     void (*OnDataReceivedHandler)(const unsigned char* pData, int dataLength),
-                     void (*OnDataSentHandler)(void),                         
-                     int timeoutMS
-                    )
+void SerialPortInstance_GetStatistics(TSerialPortInstance* pPort, TSerialPortStatistics* pStatistics)
+{
+    SerialPortStatistics_GetSnapshot(&pPort->statistics, pStatistics);
+    pStatistics->writeQueueDepth = SerialPortWriteQueue_GetCount(&pPort->writeQueue);
+}
 
+void SerialPortInstance_ResetStatistics(TSerialPortInstance* pPort)
 {
-    BOOL result = SerialPort_Open(comPortNumber, baudRate, timeoutMS);
-    if (result)
+    SerialPortStatistics_Reset(&pPort->statistics);
+}
+
+static void SerialPortInstance__NotifyWriter(TSerialPortInstance* pPort)
+{
+    BOOL writeNow = FALSE;
+
+    SerialPortIO_Lock(&pPort->criticalSectionQueue);
+    if (pPort->pPacer)
     {
-        m_OnDataReceivedHandler = OnDataReceivedHandler;
-        m_OnDataSentHandler     = OnDataSentHandler;
-        if (m_OnDataSentHandler || m_OnDataReceivedHandler)
+        SerialPortPacer_Wake(pPort->pPacer);
+    } else if (pPort->pReactorEntry)
+    {
+        SerialPortReactor_RequestWrite(pPort->pReactorEntry);
+    } else if (pPort->workingThreadStarted) {
+        SERIALPORT_ATOMIC_STORE(&pPort->writeRequested, 1);
+        SerialPortIO_SetEvent(&pPort->wakeEvent);
+    } else {
+        //opened by Open(), a pacer thread becomes the writer so QueueWrite does not wait
+        pPort->pPacer = SerialPortPacer_Create(SerialPortInstance__SendPaced, pPort);
+        if (pPort->pPacer)
         {
-            m_workingThread = CreateThread(NULL, 0, SerialPort_WaitForData, NULL, 0, &m_workingThreadId);
+            SerialPortPacer_Wake(pPort->pPacer);
+        } else {
+            writeNow = TRUE;
         }
     }
-    return result;
+    SerialPortIO_Unlock(&pPort->criticalSectionQueue);
+
+    if (writeNow)
+    {
+        SerialPortInstance__SendWriteQueue(pPort, TRUE);
+    }
 }
 
-BOOL SerialPort_Open(int comPortNumber, int baudRate, int timeoutMS)
+static BOOL SerialPortInstance__SendWriteQueue(TSerialPortInstance* pPort, BOOL blocking)
 {
-	char portName[12];
-	int  portNameLength;
-    DCB  portSettings;
-    COMMTIMEOUTS portTimeOuts;
+    int  result = 0;
+    BOOL writeComplete = TRUE;
 
-	if (comPortNumber<0) return FALSE;
-	if (comPortNumber>255) return FALSE;
-    if (timeoutMS>15000) return FALSE;
+    if (pPort->pPacer)
+    {
+        //paced frames are written by the pacer only (after a reconnect, say)
+        SerialPortPacer_Wake(pPort->pPacer);
+        return TRUE;
+    }
+    SerialPortIO_Lock(&pPort->criticalSectionWrite);
+    if (pPort->portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        result = SerialPortWriteQueue_Send(&pPort->writeQueue, pPort->portHandle, blocking);
+        writeComplete = (pPort->writeQueue.pPending==NULL);
+    }
+    SerialPortIO_Unlock(&pPort->criticalSectionWrite);
+
+    if (result>0)
+    {
+        SerialPortInstance__CallDataSentHandler(pPort);
+    }
+    return writeComplete;
+}
 
-	portNameLength = sprintf(portName, "\\\\.\\COM%i", comPortNumber );
+static SERIALPORT_TIMESTAMP SerialPortInstance__SendPaced( void* lpParam )
+{
+    TSerialPortInstance* pPort = (TSerialPortInstance*)lpParam;
+    SERIALPORT_TIMESTAMP releaseTime = 0;
+    int                  result = 0;
 
-	m_portHandle = CreateFileA(portName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
-    if ((m_portHandle==0) || ((unsigned long)m_portHandle==0xffffffff))
+    //called by the pacer thread when paced bytes are due or QueueWrite woke it up
+    SerialPortIO_Lock(&pPort->criticalSectionWrite);
+    if (pPort->portHandle!=SERIALPORT_INVALID_HANDLE)
     {
-        m_portHandle = 0;
-        return FALSE;
+        result = SerialPortWriteQueue_Send(&pPort->writeQueue, pPort->portHandle, TRUE);
+        releaseTime = pPort->writeQueue.releaseTime;
     }
+    SerialPortIO_Unlock(&pPort->criticalSectionWrite);
 
-    m_timeoutMilliSeconds = timeoutMS;
-	
-	memset(&portSettings, 0, sizeof(portSettings));
+    if (result>0)
+    {
+        SerialPortInstance__CallDataSentHandler(pPort);
+    }
+    return releaseTime;
+}
+
+int SerialPortInstance_ReadUntil(TSerialPortInstance* pPort, unsigned char* pData, int dataLength, const char* delimiters, int timeOutMS)
+{
+    int result;
+    if ((pData==NULL) || (delimiters==NULL))
+    {
+        return 0;
+    }
 
-	portSettings.BaudRate = baudRate;
-    portSettings.ByteSize = 8;
-    portSettings.Parity   = NOPARITY;
-    portSettings.StopBits = ONESTOPBIT;
+    SerialPortIO_Lock(&pPort->criticalSectionRead);
+    result = SerialPortInstance__ReadUntil(pPort, pData, dataLength, (const unsigned char*)delimiters, (int)strlen(delimiters), timeOutMS);
+    SerialPortStatistics_AddLatency(pPort->statistics.readLatency, pPort->lastReadDuration);
+    SerialPortIO_Unlock(&pPort->criticalSectionRead);
+    return result;
+}
 
-	if (!SetCommState(m_portHandle, &portSettings))
-	{
-		return FALSE;
-	}
-                      
-    memset(&portTimeOuts, 0, sizeof(portTimeOuts));
-    portTimeOuts.ReadIntervalTimeout = SERIALPORT_INTERNAL_TIMEOUT;
-    portTimeOuts.ReadTotalTimeoutMultiplier = 0;    
-    portTimeOuts.ReadTotalTimeoutConstant = SERIALPORT_INTERNAL_TIMEOUT;    
+int SerialPortInstance_ReadLine(TSerialPortInstance* pPort, char* pLine, int maxBufferSize, int timeOutMS)
+{
+    static const unsigned char lineDelimiters[2] = { 0x0D, 0x0A };
+    int result;
 
-    if (!SetCommTimeouts(m_portHandle, &portTimeOuts))
+    if (pPort->portHandle==SERIALPORT_INVALID_HANDLE)
     {
-        return FALSE;
+        return 0;
+    }
+    if ((pLine==NULL) || (maxBufferSize<=0))
+    {
+        return 0;
+    }
+
+    SerialPortIO_Lock(&pPort->criticalSectionRead);
+    result = SerialPortInstance__ReadUntil(pPort, (unsigned char*)pLine, maxBufferSize-1, lineDelimiters, 2, timeOutMS);	
+    if (pPort->skipLineFeed && (result==1) && (pLine[0]==0x0A))
+    {
+        //LF of the CR LF pair which ended the previous line
+        pPort->skipLineFeed = FALSE;
+        result = SerialPortInstance__ReadUntil(pPort, (unsigned char*)pLine, maxBufferSize-1, lineDelimiters, 2, timeOutMS);	
+    }
+    if (result>0)
+    {
+        //a timeout keeps waiting for the LF
+        pPort->skipLineFeed = (pLine[result-1]==0x0D);
     }
-	return (m_portHandle!=0);
+    if ((result>0) && ((pLine[result-1]==0x0D) || (pLine[result-1]==0x0A)))
+    {
+        result--;
+    }
+    pLine[result] = 0;
+    SerialPortStatistics_AddLatency(pPort->statistics.readLatency, pPort->lastReadDuration);
+    SerialPortIO_Unlock(&pPort->criticalSectionRead);
+    return result;
 }
 
-void SerialPort_Close()
-{    
-    EnterCriticalSection(&m_criticalSectionRead);  //prevents port closing if ReadBuffer  is not complete
-    EnterCriticalSection(&m_criticalSectionWrite); //prevents port closing if WriteBuffer is not complete
-	if (m_portHandle)
-	{
-		CloseHandle(m_portHandle);			
-        m_portHandle = NULL;
-        Sleep(SERIALPORT_INTERNAL_TIMEOUT*4);
-        m_workingThread = NULL;
-        m_workingThreadId = 0;
-	}
-    LeaveCriticalSection(&m_criticalSectionRead);
-    LeaveCriticalSection(&m_criticalSectionWrite);
+int SerialPortInstance_ReadVector(TSerialPortInstance* pPort, const SERIALPORT_READ_BUFFER* pBuffers, int bufferCount, int minLength, int timeOutMS)
+{
+    int result;
+    if ((pBuffers==NULL) || (bufferCount<=0))
+    {
+        return 0;
+    }
+
+    SerialPortIO_Lock(&pPort->criticalSectionRead);
+    result = SerialPortInstance__ReadVector(pPort, pBuffers, bufferCount, minLength, timeOutMS);
+    SerialPortStatistics_AddLatency(pPort->statistics.readLatency, pPort->lastReadDuration);
+    SerialPortIO_Unlock(&pPort->criticalSectionRead);
+    return result;
 }
 
-BOOL SerialPort_IsOpen()
+int SerialPortInstance_ReadAtLeast(TSerialPortInstance* pPort, unsigned char* pData, int minLength, int maxLength, int timeOutMS)
+{
+    SERIALPORT_READ_BUFFER buffer;
+
+    buffer.pData      = pData;
+    buffer.dataLength = maxLength;
+    return SerialPortInstance_ReadVector(pPort, &buffer, 1, minLength, timeOutMS);
+}
+
+int SerialPortInstance_ReadExact(TSerialPortInstance* pPort, unsigned char* pData, int dataLength, int timeOutMS)
 {
-    return (m_portHandle!=NULL);
+    return SerialPortInstance_ReadAtLeast(pPort, pData, dataLength, dataLength, timeOutMS);
 }
 
-int SerialPort__WriteBuffer(const unsigned char* pData, int dataLength)
+int SerialPortInstance_ReadAvailable(TSerialPortInstance* pPort, unsigned char* pData, int maxLength)
 {
-    DWORD bytesWritten = 0;
+    return SerialPortInstance_ReadAtLeast(pPort, pData, 0, maxLength, 0);
+}
 
-	if (m_portHandle==NULL)
-	{
-		return 0;
-	}    
+static void SerialPortInstance__WaitForData( void* lpParam )
+{
+    TSerialPortInstance* pPort = (TSerialPortInstance*)lpParam;
+    int  waitResult;
+    BOOL deviceFailed;
 
-    if (!WriteFile(m_portHandle, pData, dataLength, &bytesWritten, NULL))
+    while(SerialPortInstance_IsOpen(pPort) && !SERIALPORT_ATOMIC_LOAD(&pPort->closing))
     {
-        return 0;
+         //no timeout, the thread sleeps until data arrive or SerialPortInstance_Close() sets wakeEvent
+         waitResult = SerialPortIO_WaitForData(pPort->portHandle, SERIALPORT_INFINITE, &pPort->wakeEvent);
+         deviceFailed = (waitResult<0);
+         if (!deviceFailed)
+         {
+             SERIALPORT_ATOMIC_ADD64(&pPort->statistics.wakeups, 1);
+             if (waitResult>0)
+             {
+                 deviceFailed = !SerialPortInstance__ReceiveData(pPort);
+             }
+         }
+         if (deviceFailed)
+         {
+             //device is gone (unplugged), without auto-reconnect the thread ends
+             if ((!pPort->autoReconnect) || (!SerialPortInstance__Reconnect(pPort)))
+             {
+                 break;
+             }
+         }
+         if (SERIALPORT_ATOMIC_EXCHANGE(&pPort->writeRequested, 0))
+         {
+             SerialPortInstance__SendWriteQueue(pPort, TRUE);
+         }
     }    
-	return (int)bytesWritten;   
+    //wakes up SerialPortInstance_ReadBuffer waiting for data which will never come
+    SerialPortIO_SetEvent(&pPort->receiveEvent);
 }
-	
-int SerialPort__ReadBuffer(unsigned char* pData, int dataLength, int timeOutMS)
+
+static BOOL SerialPortInstance__ReceiveReady( void* lpParam, BOOL deviceError )
 {
-    DWORD bytesRead,bytesReadTotal;
-    int   timeOutCounter, bytesLeft;
+    TSerialPortInstance* pPort = (TSerialPortInstance*)lpParam;
 
-	if (m_portHandle==NULL)
-	{
-		return 0;
-	}
-    if (timeOutMS<0)
+    //called by the reactor whenever the port is readable
+    SERIALPORT_ATOMIC_ADD64(&pPort->statistics.wakeups, 1);
+    if ((!SerialPortInstance__ReceiveData(pPort)) || deviceError)
     {
-        timeOutMS = m_timeoutMilliSeconds;
+        if (pPort->autoReconnect)
+        {
+            //the entry stops here, the reconnecting thread adds a new one
+            SerialPortInstance__StartReconnect(pPort);
+            return FALSE;
+        }
+        //wakes up SerialPortInstance_ReadBuffer waiting for data which will never come
+        SerialPortIO_SetEvent(&pPort->receiveEvent);
+        return FALSE;
     }
-    
-    bytesRead = 0;
-    bytesReadTotal = 0;
-    timeOutCounter = timeOutMS;
-    bytesLeft = dataLength;
+    return TRUE;
+}
+
+static BOOL SerialPortInstance__SendReady( void* lpParam )
+{
+    TSerialPortInstance* pPort = (TSerialPortInstance*)lpParam;
+
+    //called by the reactor after QueueWrite, FALSE waits until the port is writable
+    SERIALPORT_ATOMIC_ADD64(&pPort->statistics.wakeups, 1);
+    return SerialPortInstance__SendWriteQueue(pPort, FALSE);
+}
+
+static BOOL SerialPortInstance__Reconnect(TSerialPortInstance* pPort)
+{
+    SERIALPORT_HANDLE        portHandle = SERIALPORT_INVALID_HANDLE;
+    SERIALPORT_HANDLE        oldHandle;
+    TSerialPortReactorEntry* pReactorEntry;
+    TSerialPortSettings      settings;
+    SERIALPORT_TIMESTAMP     currentTime, deadline;
+    int                      delayMS = pPort->reconnectMinDelayMS;
+    BOOL                     reconnected = FALSE;
 
-    if (timeOutMS<SERIALPORT_INTERNAL_TIMEOUT*2)
+    //the device comes back under the same name once it is plugged in again
+    while(!SERIALPORT_ATOMIC_LOAD(&pPort->closing))
     {
-        Sleep(timeOutMS);
-        ReadFile(m_portHandle, pData, dataLength, &bytesRead, NULL);
-        bytesReadTotal += bytesRead;
-    } else {
-        while(timeOutCounter>0)
-        {            
-            bytesRead = 0;
-            ReadFile(m_portHandle, pData+bytesReadTotal, dataLength, &bytesRead, NULL);
-            if (bytesRead)
-            {
-                dataLength     -= bytesRead;
-                bytesReadTotal += bytesRead;
-                if (dataLength==0) break;
-                timeOutCounter = timeOutMS;
-            } else {
-                timeOutCounter -= SERIALPORT_INTERNAL_TIMEOUT;
-            }            
+        currentTime = SerialPortIO_GetTime();
+        deadline    = currentTime + (SERIALPORT_TIMESTAMP)delayMS*1000;
+        while((currentTime<deadline) && !SERIALPORT_ATOMIC_LOAD(&pPort->closing))
+        {
+            //SerialPortInstance_Close() sets wakeEvent, QueueWrite may set it too
+            SerialPortIO_WaitEvent(&pPort->wakeEvent, (int)((deadline-currentTime+999)/1000));
+            currentTime = SerialPortIO_GetTime();
+        }
+        if (SERIALPORT_ATOMIC_LOAD(&pPort->closing))
+        {
+            break;
+        }
+        //SerialPortInstance_SetSettings() may change them meanwhile
+        SerialPortIO_Lock(&pPort->criticalSectionDevice);
+        settings = pPort->settings;
+        SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+        portHandle = SerialPortIO_OpenWithSettings(pPort->deviceName, &settings);
+        if (portHandle!=SERIALPORT_INVALID_HANDLE)
+        {
+            break;
+        }
+        delayMS = (delayMS<pPort->reconnectMaxDelayMS/2) ? delayMS*2 : pPort->reconnectMaxDelayMS;
+    }
+    if (portHandle==SERIALPORT_INVALID_HANDLE)
+    {
+        return FALSE;
+    }
+    SerialPortIO_SetCapture(portHandle, pPort->pCapture);
+    SerialPortIO_SetTrace(portHandle, pPort->pTrace, pPort->tracePortId);
+    SerialPortIO_SetWriteHandler(portHandle, pPort->OnWriteTimeHandler ? SerialPortInstance__Written : NULL, pPort);
+    if (pPort->OnModemHandler)
+    {
+        SerialPortIO_SetModemHandler(portHandle, SerialPortInstance__ModemChanged, pPort);
+    }
+
+    //the reactor must not wait on the old handle any more
+    SerialPortIO_Lock(&pPort->criticalSectionQueue);
+    pReactorEntry = pPort->pReactorEntry;
+    pPort->pReactorEntry = NULL;
+    SerialPortIO_Unlock(&pPort->criticalSectionQueue);
+    if (pReactorEntry)
+    {
+        SerialPortReactor_Remove(pPort->pReactor, pReactorEntry);
+    }
+
+    //ring, write queue and handlers stay, only the device is swapped
+    SerialPortIO_Lock(&pPort->criticalSectionWrite);
+    SerialPortIO_Lock(&pPort->criticalSectionDevice);
+    if ((pPort->portHandle!=SERIALPORT_INVALID_HANDLE) && !SERIALPORT_ATOMIC_LOAD(&pPort->closing))
+    {
+        oldHandle         = pPort->portHandle;
+        pPort->portHandle = portHandle;
+        portHandle        = oldHandle;
+        reconnected       = TRUE;
+    }
+    SerialPortIO_Unlock(&pPort->criticalSectionDevice);
+    SerialPortIO_Unlock(&pPort->criticalSectionWrite);
+    SerialPortIO_Close(portHandle);
+    if (!reconnected)
+    {
+        return FALSE;
+    }
+    SERIALPORT_ATOMIC_INCREMENT(&pPort->reconnectCount);
 
+    if (pPort->workingThreadStarted)
+    {
+        //called by the working thread, it sends the queue right after
+        SERIALPORT_ATOMIC_STORE(&pPort->writeRequested, 1);
+        return TRUE;
+    }
+    //nothing may follow the unlock, StartReconnect joins this thread holding the lock
+    SerialPortIO_Lock(&pPort->criticalSectionQueue);
+    if (!SERIALPORT_ATOMIC_LOAD(&pPort->closing))
+    {
+        pPort->pReactorEntry = SerialPortReactor_Add(pPort->pReactor, pPort->portHandle, 
+                                                     SerialPortInstance__ReceiveReady, SerialPortInstance__SendReady, pPort);
+        if (pPort->pReactorEntry && (SerialPortWriteQueue_GetCount(&pPort->writeQueue)>0))
+        {
+            SerialPortReactor_RequestWrite(pPort->pReactorEntry);
         }
     }
-	return bytesReadTotal;
+    reconnected = (pPort->pReactorEntry!=NULL);
+    SerialPortIO_Unlock(&pPort->criticalSectionQueue);
+    return reconnected;
 }
 
-int SerialPort_ReadBuffer(unsigned char* pData, int dataLength, int timeOutMS)
+static void SerialPortInstance__ReconnectThread( void* lpParam )
 {
-    int result;
-    EnterCriticalSection(&m_criticalSectionRead);
-    result = SerialPort__ReadBuffer(pData, dataLength, timeOutMS);
-    LeaveCriticalSection(&m_criticalSectionRead);
-    return result;
+    TSerialPortInstance* pPort = (TSerialPortInstance*)lpParam;
+
+    if (!SerialPortInstance__Reconnect(pPort))
+    {
+        //wakes up SerialPortInstance_ReadBuffer waiting for data which will never come
+        SerialPortIO_SetEvent(&pPort->receiveEvent);
+    }
 }
 
+static void SerialPortInstance__StartReconnect(TSerialPortInstance* pPort)
+{
+    //called by the reactor thread, the reconnect must not block it
+    SerialPortIO_Lock(&pPort->criticalSectionQueue);
+    if (!SERIALPORT_ATOMIC_LOAD(&pPort->closing))
+    {
+        if (pPort->reconnectThreadStarted)
+        {
+            //previous reconnect has finished, it added the entry failing now
+            SerialPortIO_JoinThread(&pPort->reconnectThread);
+        }
+        pPort->reconnectThreadStarted = SerialPortIO_StartThread(&pPort->reconnectThread, SerialPortInstance__ReconnectThread, pPort);
+    }
+    SerialPortIO_Unlock(&pPort->criticalSectionQueue);
+    if (!pPort->reconnectThreadStarted)
+    {
+        SerialPortIO_SetEvent(&pPort->receiveEvent);
+    }
+}
 
-int SerialPort_WriteBuffer(const unsigned char* pData, int dataLength)
+//reads on the calling thread (no working thread) end here
+static BOOL SerialPortInstance__OnDataRead(TSerialPortInstance* pPort, const unsigned char* pData, int bytesRead)
 {
-    int result;
-    EnterCriticalSection(&m_criticalSectionWrite);
-    result = SerialPort__WriteBuffer(pData, dataLength);
-    LeaveCriticalSection(&m_criticalSectionWrite);
-    if (m_OnDataSentHandler)
+    TSerialPortLineEvent lineEvents[SERIALPORT_MAX_LINE_EVENTS];
+    int                  eventCount;
+
+    //events are collected anyway, so they do not pile up
+    eventCount = SerialPortIO_GetLineEvents(pPort->portHandle, lineEvents, SERIALPORT_MAX_LINE_EVENTS);
+    SerialPortInstance__CallLineErrorHandler(pPort, lineEvents, eventCount);
+    if (bytesRead<=0)
     {
-        m_OnDataSentHandler();
+        return FALSE;
     }
-    return result;
+    pPort->receiveTime = SerialPortIO_GetLastReadTime(pPort->portHandle);
+    return SerialPortInstance__CallDataReceivedHandler(pPort, pData, bytesRead);
 }
 
+//returns whether any handler got the data
+static BOOL SerialPortInstance__CallDataReceivedHandler(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength)
+{
+    TSerialPortDispatcher* pDispatcher = pPort->pDispatcher;
+    BOOL timed = (pPort->pTransactions || pPort->pModbusBus || pPort->OnReceiveTimeHandler);
+
+    if (pDispatcher)
+    {
+        //the receive time travels with the chunk, such chunks are never coalesced
+        if (timed)
+        {
+            SerialPortDispatcher_Post(pDispatcher, SerialPortInstance__DispatchTimed, pPort, pData, dataLength, pPort->receiveTime);
+        }
+        if (pPort->OnDataReceivedHandler)
+        {
+            SerialPortDispatcher_Post(pDispatcher, SerialPortInstance__DispatchReceived, pPort, pData, dataLength, 0);
+        }
+    } else {
+        SerialPortInstance__HandleTimed(pPort, pData, dataLength, pPort->receiveTime);
+        SerialPortInstance__HandleReceived(pPort, pData, dataLength);
+    }
+    return (timed || pPort->OnDataReceivedHandler);
+}
 
-int SerialPort_WriteLine(char* pLine, BOOL addCRatEnd)
+static void SerialPortInstance__HandleTimed(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP receiveTime)
 {
-    int lineLength, result;
+    SERIALPORT_TIMESTAMP startTime;
+    TSerialPortTransactions* pTransactions = pPort->pTransactions;
+    TSerialPortModbusBus* pModbusBus = pPort->pModbusBus;
 
-	if (m_portHandle==NULL)
-	{
-		return 0;
-	}
-    if (pLine==NULL)
+    if (pTransactions)
     {
-        return 0;
+        SerialPortTransactions_OnDataReceived(pTransactions, pData, dataLength);
     }
-    lineLength = strlen(pLine);
-    if (lineLength==0)
+    if (pModbusBus)
     {
-        return 0;
+        SerialPortModbus_OnDataReceived(pModbusBus, pData, dataLength, receiveTime);
+    }
+    if (pPort->OnReceiveTimeHandler)
+    {
+        startTime = SerialPortIO_GetTime();
+        pPort->OnReceiveTimeHandler(pPort, pData, dataLength, receiveTime);
+        SerialPortStatistics_AddCallback(&pPort->statistics, SerialPortIO_GetTime()-startTime);
+    }
+}
+
+static void SerialPortInstance__HandleReceived(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength)
+{
+    SERIALPORT_TIMESTAMP startTime;
+
+    if (pPort->OnDataReceivedHandler)
+    {
+        startTime = SerialPortIO_GetTime();
+        pPort->OnDataReceivedHandler(pPort, pData, dataLength);
+        SerialPortStatistics_AddCallback(&pPort->statistics, SerialPortIO_GetTime()-startTime);
     }
+}
 
-    EnterCriticalSection(&m_criticalSectionWrite);
-    result = SerialPort__WriteBuffer((unsigned char*)pLine, lineLength);
-    if (pLine[lineLength-1]!=0x0D)
+//called on the dispatcher thread (or executor)
+static void SerialPortInstance__DispatchReceived(void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded)
+{
+    (void)time;
+    if (!discarded)
     {
-        char cr = 13;
-        result+=SerialPort__WriteBuffer((unsigned char*)&cr, 1);
+        SerialPortInstance__HandleReceived((TSerialPortInstance*)pContext, pData, dataLength);
     }
-    LeaveCriticalSection(&m_criticalSectionWrite);
-    if (m_OnDataSentHandler)
+}
+
+//engines and the receive time handler get the chunk with its receive time
+static void SerialPortInstance__DispatchTimed(void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded)
+{
+    if (!discarded)
     {
-        m_OnDataSentHandler();
+        SerialPortInstance__HandleTimed((TSerialPortInstance*)pContext, pData, dataLength, time);
     }
-    return result;
 }
 
-int SerialPort_ReadLine(char* pLine, int maxBufferSize, int timeOutMS)
+//takes over the reference of the caller
+static void SerialPortInstance__CallBufferReceivedHandler(TSerialPortInstance* pPort, TSerialPortBuffer* pBuffer)
 {
-    int result;
-	if (m_portHandle==NULL)
-	{
-		return 0;
-	}
-    if (pLine==NULL)
+    TSerialPortPostedEvent event;
+    SERIALPORT_TIMESTAMP   startTime;
+
+    if (pPort->pDispatcher)
     {
-        return 0;
+        event.kind = SERIALPORT_POSTED_BUFFER;
+        event.u.pBuffer = pBuffer;
+        SerialPortInstance__PostEvent(pPort, &event);
+        return;
     }
+    startTime = SerialPortIO_GetTime();
+    pPort->OnBufferReceivedHandler(pPort, pBuffer);
+    SerialPortStatistics_AddCallback(&pPort->statistics, SerialPortIO_GetTime()-startTime);
+    SerialPortBuffer_Release(pBuffer);
+}
+
+static void SerialPortInstance__CallDataSentHandler(TSerialPortInstance* pPort)
+{
+    TSerialPortPostedEvent event;
+    SERIALPORT_TIMESTAMP   startTime;
 
-    EnterCriticalSection(&m_criticalSectionRead);
-    result = SerialPort__ReadBuffer((unsigned char*)pLine, maxBufferSize-1, timeOutMS);	
-    if (result<maxBufferSize)
+    if (pPort->OnDataSentHandler==NULL)
     {
-        pLine[result] = 0;
+        return;
     }
-    LeaveCriticalSection(&m_criticalSectionRead);
-    return result;
+    if (pPort->pDispatcher)
+    {
+        event.kind = SERIALPORT_POSTED_SENT;
+        SerialPortInstance__PostEvent(pPort, &event);
+        return;
+    }
+    startTime = SerialPortIO_GetTime();
+    pPort->OnDataSentHandler(pPort);
+    SerialPortStatistics_AddCallback(&pPort->statistics, SerialPortIO_GetTime()-startTime);
 }
 
-DWORD WINAPI SerialPort_WaitForData( LPVOID lpParam )
+//called on the modem watching thread
+static void SerialPortInstance__ModemChanged(void* pContext, unsigned int modemStatus, unsigned int changedLines)
 {
-    static unsigned char packet[64];
-    int packetSize = sizeof(packet);
-    int bytesRead = 0;
+    TSerialPortInstance*   pPort = (TSerialPortInstance*)pContext;
+    TSerialPortPostedEvent event;
 
-    while(SerialPort_IsOpen())
+    if (pPort->pDispatcher)
     {
-         bytesRead = SerialPort_ReadBuffer(packet, packetSize, SERIALPORT_INTERNAL_TIMEOUT);
-         if (bytesRead)
-         {
-             if (m_OnDataReceivedHandler)
-             {
-                 m_OnDataReceivedHandler(packet, bytesRead);
-             }
-         }
-    }    
-    return 0;
+        event.kind = SERIALPORT_POSTED_MODEM;
+        event.u.modem.status = modemStatus;
+        event.u.modem.changedLines = changedLines;
+        SerialPortInstance__PostEvent(pPort, &event);
+    } else if (pPort->OnModemHandler) {
+        pPort->OnModemHandler(pPort, modemStatus, changedLines);
+    }
+}
+
+//called on the thread that wrote the data
+static void SerialPortInstance__Written(void* pContext, int bytesWritten, SERIALPORT_TIMESTAMP writeTime)
+{
+    TSerialPortInstance*   pPort = (TSerialPortInstance*)pContext;
+    TSerialPortPostedEvent event;
+
+    if (pPort->pDispatcher)
+    {
+        event.kind = SERIALPORT_POSTED_WRITE_TIME;
+        event.time = writeTime;
+        event.u.bytesWritten = bytesWritten;
+        SerialPortInstance__PostEvent(pPort, &event);
+    } else if (pPort->OnWriteTimeHandler) {
+        pPort->OnWriteTimeHandler(pPort, bytesWritten, writeTime);
+    }
+}
+
+static void SerialPortInstance__CallLineErrorHandler(TSerialPortInstance* pPort, const TSerialPortLineEvent* pEvents, int eventCount)
+{
+    TSerialPortPostedEvent event;
+    int                    i;
+
+    if (pPort->OnLineErrorHandler)
+    {
+        for(i = 0; i<eventCount; i++)
+        {
+            if (pPort->pDispatcher)
+            {
+                event.kind = SERIALPORT_POSTED_LINE_EVENT;
+                event.u.lineEvent = pEvents[i];
+                SerialPortInstance__PostEvent(pPort, &event);
+            } else {
+                pPort->OnLineErrorHandler(pPort, &pEvents[i]);
+            }
+        }
+    }
+}
+
+static void SerialPortInstance__PostEvent(TSerialPortInstance* pPort, const TSerialPortPostedEvent* pEvent)
+{
+    SerialPortDispatcher_Post(pPort->pDispatcher, SerialPortInstance__DispatchEvents, pPort, (const unsigned char*)pEvent, sizeof(TSerialPortPostedEvent), 0);
 }
 
+//runs on the dispatcher (or the thread discarding them), coalesced events follow each other
+static void SerialPortInstance__DispatchEvents(void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded)
+{
+    TSerialPortInstance*   pPort = (TSerialPortInstance*)pContext;
+    TSerialPortPostedEvent event;
+    SERIALPORT_TIMESTAMP   startTime;
+
+    (void)time;
+    for(; dataLength>=(int)sizeof(event); pData += sizeof(event), dataLength -= sizeof(event))
+    {
+        memcpy(&event, pData, sizeof(event));
+        if (discarded)
+        {
+            //leased buffers go back to the pool
+            if (event.kind==SERIALPORT_POSTED_BUFFER)
+            {
+                SerialPortBuffer_Release(event.u.pBuffer);
+            }
+            continue;
+        }
+        startTime = SerialPortIO_GetTime();
+        switch(event.kind)
+        {
+        case SERIALPORT_POSTED_SENT:
+            if (pPort->OnDataSentHandler)
+            {
+                pPort->OnDataSentHandler(pPort);
+            }
+            break;
+        case SERIALPORT_POSTED_BUFFER:
+            if (pPort->OnBufferReceivedHandler)
+            {
+                pPort->OnBufferReceivedHandler(pPort, event.u.pBuffer);
+            }
+            SerialPortBuffer_Release(event.u.pBuffer);
+            break;
+        case SERIALPORT_POSTED_LINE_EVENT:
+            if (pPort->OnLineErrorHandler)
+            {
+                pPort->OnLineErrorHandler(pPort, &event.u.lineEvent);
+            }
+            break;
+        case SERIALPORT_POSTED_WRITE_TIME:
+            if (pPort->OnWriteTimeHandler)
+            {
+                pPort->OnWriteTimeHandler(pPort, event.u.bytesWritten, event.time);
+            }
+            break;
+        case SERIALPORT_POSTED_MODEM:
+            if (pPort->OnModemHandler)
+            {
+                pPort->OnModemHandler(pPort, event.u.modem.status, event.u.modem.changedLines);
+            }
+            break;
+        }
+        SerialPortStatistics_AddCallback(&pPort->statistics, SerialPortIO_GetTime()-startTime);
+    }
+}
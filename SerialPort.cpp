@@ -17,282 +17,1854 @@
 #include "SerialPort.hpp"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define SERIALPORT_INTERNAL__TIMEOUT 1
+#define SERIALPORT_POSTED_NOTIFY        1
+#define SERIALPORT_POSTED_BUFFER        2
+#define SERIALPORT_POSTED_LINE_EVENT    3
+#define SERIALPORT_POSTED_WRITE_TIME    4
+#define SERIALPORT_POSTED_MODEM         5
+
+//handler call queued on the dispatcher, records of one port are coalesced back to back
+struct TSerialPortPostedEvent
+{
+    int                  kind;
+    SERIALPORT_TIMESTAMP time;
+    union
+    {
+        int                  notification;
+        int                  bytesWritten;
+        TSerialPortBuffer*   pBuffer;
+        TSerialPortLineEvent lineEvent;
+        struct
+        {
+            unsigned int status;
+            unsigned int changedLines;
+        } modem;
+    } u;
+};
 
 TSerialPort::TSerialPort()
 {
-    m_portHandle = NULL;
-    m_OnDataReceivedHandler = NULL;	
-    m_OnDataSentHandler = NULL;	
-    m_timeoutMilliSeconds = 0;
-    m_workingThread = NULL;
-    m_workingThreadId = 0;
-    InitializeCriticalSection(&m_criticalSectionRead);
-    InitializeCriticalSection(&m_criticalSectionWrite);
+    m_portHandle = SERIALPORT_INVALID_HANDLE;
+    m_OnDataReceivedHandler = NULL;	
+    m_OnDataSentHandler = NULL;	
+    m_OnNotifyHandler = NULL;
+    m_pNotifyContext = NULL;
+    m_OnBufferReceivedHandler = NULL;
+    m_pBufferReceivedContext = NULL;
+    m_pBufferPool = NULL;
+    m_pTransactions = NULL;
+    m_pModbusBus = NULL;
+    m_receiveTime = 0;
+    m_pCapture = NULL;
+    m_pTrace = NULL;
+    m_tracePortId = -1;
+    m_OnReceiveTimeHandler = NULL;
+    m_pReceiveTimeContext = NULL;
+    m_OnWriteTimeHandler = NULL;
+    m_pWriteTimeContext = NULL;
+    m_pDispatcher = NULL;
+    m_pBroadcast = NULL;
+    m_OnModemHandler = NULL;
+    m_pModemContext = NULL;
+    m_OnLineErrorHandler = NULL;
+    m_pLineErrorContext = NULL;
+    m_timeoutMilliSeconds = 0;
+    m_workingThreadStarted = false;
+    m_closing = 0;
+    m_receiveAsync = false;
+    m_pReactor = NULL;
+    m_pReactorEntry = NULL;
+    m_deviceName[0] = 0;
+    SerialPortIO_InitSettings(&m_settings, 0);
+    m_autoReconnect = false;
+    m_reconnectMinDelayMS = SERIALPORT_RECONNECT_MIN_DELAY;
+    m_reconnectMaxDelayMS = SERIALPORT_RECONNECT_MAX_DELAY;
+    m_reconnectCount = 0;
+    m_reconnectThreadStarted = false;
+    m_writeRequested = 0;
+    m_writeCrcType = SERIALPORT_CRC_NONE;
+    m_pPacer = NULL;
+    SerialPortWriteQueue_Init(&m_writeQueue);
+    SerialPortStatistics_Reset(&m_statistics);
+    m_writeQueue.pStatistics = &m_statistics;
+    m_lastReadDuration = 0;
+    m_receiveWaiting = 0;
+    m_receiveOverflow = 0;
+    m_skipLineFeed = false;
+    memset(&m_receiveRing, 0, sizeof(m_receiveRing));
+    SerialPortIO_CreateEvent(&m_wakeEvent);
+    SerialPortIO_CreateEvent(&m_receiveEvent);
+    SerialPortIO_InitLock(&m_criticalSectionRead);
+    SerialPortIO_InitLock(&m_criticalSectionWrite);
+    SerialPortIO_InitLock(&m_criticalSectionDevice);
+    SerialPortIO_InitLock(&m_criticalSectionQueue);
+}
+
+TSerialPort::~TSerialPort()
+{
+    if (m_portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        Close();        
+    }
+    SerialPortPacer_Delete(m_pPacer);
+    if (m_workingThreadStarted)
+    {
+        //left running by Close() called from a handler
+        SerialPortIO_JoinThread(&m_workingThread);
+    }
+    if (m_reconnectThreadStarted)
+    {
+        SerialPortIO_JoinThread(&m_reconnectThread);
+    }
+    SerialPortIO_DeleteLock(&m_criticalSectionRead);
+    SerialPortIO_DeleteLock(&m_criticalSectionWrite);
+    SerialPortIO_DeleteLock(&m_criticalSectionDevice);
+    SerialPortIO_DeleteLock(&m_criticalSectionQueue);
+    SerialPortIO_DeleteEvent(&m_wakeEvent);
+    SerialPortIO_DeleteEvent(&m_receiveEvent);
+    SerialPortRing_Delete(&m_receiveRing);
+    SerialPortWriteQueue_Clear(&m_writeQueue);
+    if (m_pBufferPool)
+    {
+        SerialPortBufferPool_Delete(m_pBufferPool);
+    }
+}
+
+int TSerialPort::GetMaxTimeout()
+{
+    return m_timeoutMilliSeconds;
+}
+
+SERIALPORT_TIMESTAMP TSerialPort::GetLastReadDuration()
+{
+    return m_lastReadDuration;
+}
+
+void* TSerialPort::GetDataReceivedHandler()
+{
+    return (void*)m_OnDataReceivedHandler;
+}
+
+void* TSerialPort::GetDataSentHandler()
+{
+    return (void*)m_OnDataSentHandler;
+}
+
+void TSerialPort::SetReactor(TSerialPortReactor* pReactor)
+{
+    m_pReactor = pReactor;
+}
+
+TSerialPortReactor* TSerialPort::GetReactor()
+{
+    return m_pReactor;
+}
+
+int SerialPort_SendRequest( void* pContext, const unsigned char* pData, int dataLength )
+{
+    //engine frames carry their own checksum
+    return ((TSerialPort*)pContext)->__QueueWrite(pData, dataLength, false, SERIALPORT_CRC_NONE);
+}
+
+void TSerialPort::SetTransactions(TSerialPortTransactions* pTransactions)
+{
+    if (m_pTransactions)
+    {
+        SerialPortTransactions_SetSendHandler(m_pTransactions, NULL, NULL);
+    }
+    if (pTransactions)
+    {
+        SerialPortTransactions_SetSendHandler(pTransactions, SerialPort_SendRequest, this);
+    }
+    m_pTransactions = pTransactions;
+}
+
+TSerialPortTransactions* TSerialPort::GetTransactions()
+{
+    return m_pTransactions;
+}
+
+void TSerialPort::SetModbusBus(TSerialPortModbusBus* pBus)
+{
+    if (m_pModbusBus)
+    {
+        SerialPortModbus_SetSendHandler(m_pModbusBus, NULL, NULL);
+    }
+    if (pBus)
+    {
+        SerialPortModbus_SetSendHandler(pBus, SerialPort_SendRequest, this);
+    }
+    m_pModbusBus = pBus;
+}
+
+TSerialPortModbusBus* TSerialPort::GetModbusBus()
+{
+    return m_pModbusBus;
+}
+
+void TSerialPort::SetDispatcher(TSerialPortDispatcher* pDispatcher)
+{
+    m_pDispatcher = pDispatcher;
+}
+
+TSerialPortDispatcher* TSerialPort::GetDispatcher()
+{
+    return m_pDispatcher;
+}
+
+void TSerialPort::SetBroadcast(TSerialPortBroadcast* pBroadcast)
+{
+    if (m_receiveAsync) return;
+    m_pBroadcast = pBroadcast;
+}
+
+TSerialPortBroadcast* TSerialPort::GetBroadcast()
+{
+    return m_pBroadcast;
+}
+
+void TSerialPort::SetModemHandler(void (*OnModemHandler)(void* pContext, unsigned int modemStatus, unsigned int changedLines), void* pContext)
+{
+    SerialPortIO_Lock(&m_criticalSectionDevice);
+    m_OnModemHandler = OnModemHandler;
+    m_pModemContext  = pContext;
+    if (m_portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        SerialPortIO_SetModemHandler(m_portHandle, OnModemHandler ? SerialPort_ModemChanged : NULL, this);
+    }
+    SerialPortIO_Unlock(&m_criticalSectionDevice);
+}
+
+void TSerialPort::SetLineErrorHandler(void (*OnLineErrorHandler)(void* pContext, const TSerialPortLineEvent* pEvent), void* pContext)
+{
+    m_OnLineErrorHandler = OnLineErrorHandler;
+    m_pLineErrorContext  = pContext;
+}
+
+bool TSerialPort::GetModemStatus(unsigned int* pModemStatus)
+{
+    bool result;
+    
+    SerialPortIO_Lock(&m_criticalSectionDevice);
+    result = SerialPortIO_GetModemStatus(m_portHandle, pModemStatus)!=FALSE;
+    SerialPortIO_Unlock(&m_criticalSectionDevice);
+    return result;
+}
+
+bool TSerialPort::SetRTS(bool enable)
+{
+    bool result;
+    
+    SerialPortIO_Lock(&m_criticalSectionDevice);
+    result = SerialPortIO_SetModemLines(m_portHandle, enable ? SERIALPORT_MODEM_RTS : 0, SERIALPORT_MODEM_RTS)!=FALSE;
+    SerialPortIO_Unlock(&m_criticalSectionDevice);
+    return result;
+}
+
+bool TSerialPort::SetDTR(bool enable)
+{
+    bool result;
+    
+    SerialPortIO_Lock(&m_criticalSectionDevice);
+    result = SerialPortIO_SetModemLines(m_portHandle, enable ? SERIALPORT_MODEM_DTR : 0, SERIALPORT_MODEM_DTR)!=FALSE;
+    SerialPortIO_Unlock(&m_criticalSectionDevice);
+    return result;
+}
+
+bool TSerialPort::SetBreak(bool enable)
+{
+    bool result;
+    
+    SerialPortIO_Lock(&m_criticalSectionDevice);
+    result = SerialPortIO_SetBreak(m_portHandle, enable ? TRUE : FALSE)!=FALSE;
+    SerialPortIO_Unlock(&m_criticalSectionDevice);
+    return result;
+}
+
+void TSerialPort::SetCapture(TSerialPortCapture* pCapture)
+{
+    SerialPortIO_Lock(&m_criticalSectionDevice);
+    m_pCapture = pCapture;
+    SerialPortIO_SetCapture(m_portHandle, pCapture);
+    SerialPortIO_Unlock(&m_criticalSectionDevice);
+}
+
+TSerialPortCapture* TSerialPort::GetCapture()
+{
+    return m_pCapture;
+}
+
+void TSerialPort::SetTrace(TSerialPortTrace* pTrace, const char* name)
+{
+    SerialPortIO_Lock(&m_criticalSectionDevice);
+    if (name==NULL)
+    {
+        name = m_deviceName[0] ? m_deviceName : NULL;
+    }
+    m_pTrace      = pTrace;
+    m_tracePortId = pTrace ? SerialPortTrace_AddPort(pTrace, name) : -1;
+    SerialPortIO_SetTrace(m_portHandle, pTrace, m_tracePortId);
+    SerialPortIO_Unlock(&m_criticalSectionDevice);
+}
+
+TSerialPortTrace* TSerialPort::GetTrace()
+{
+    return m_pTrace;
+}
+
+void TSerialPort::SetReceiveTimeHandler(void (*OnReceiveTimeHandler)(void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP receiveTime), void* pContext)
+{
+    m_pReceiveTimeContext  = pContext;
+    m_OnReceiveTimeHandler = OnReceiveTimeHandler;
+}
+
+void TSerialPort::SetWriteTimeHandler(void (*OnWriteTimeHandler)(void* pContext, int bytesWritten, SERIALPORT_TIMESTAMP writeTime), void* pContext)
+{
+    SerialPortIO_Lock(&m_criticalSectionDevice);
+    m_OnWriteTimeHandler = OnWriteTimeHandler;
+    m_pWriteTimeContext  = pContext;
+    SerialPortIO_SetWriteHandler(m_portHandle, OnWriteTimeHandler ? SerialPort_Written : NULL, this);
+    SerialPortIO_Unlock(&m_criticalSectionDevice);
+}
+
+SERIALPORT_TIMESTAMP TSerialPort::GetLastReceiveTime()
+{
+    return m_receiveTime;
+}
+
+SERIALPORT_TIMESTAMP TSerialPort::GetLastWriteTime()
+{
+    SERIALPORT_TIMESTAMP writeTime;
+
+    SerialPortIO_Lock(&m_criticalSectionDevice);
+    writeTime = SerialPortIO_GetLastWriteTime(m_portHandle);
+    SerialPortIO_Unlock(&m_criticalSectionDevice);
+    return writeTime;
+}
+
+bool TSerialPort::SetReceiveBufferPool(int bufferCount, int bufferSize)
+{
+    TSerialPortBufferPool* pBufferPool;
+
+    if (m_receiveAsync) return false;
+    pBufferPool = SerialPortBufferPool_Create(bufferCount, bufferSize);
+    if (pBufferPool==NULL) return false;
+    if (m_pBufferPool)
+    {
+        //buffers still leased keep the old pool alive
+        SerialPortBufferPool_Delete(m_pBufferPool);
+    }
+    m_pBufferPool = pBufferPool;
+    return true;
+}
+
+void TSerialPort::SetBufferReceivedHandler(void (*OnBufferReceivedHandler)(TSerialPortBuffer* pBuffer, void* pContext), void* pContext)
+{
+    if (m_receiveAsync) return;
+    m_OnBufferReceivedHandler = OnBufferReceivedHandler;
+    m_pBufferReceivedContext = pContext;
+}
+
+int TSerialPort::GetFreeBufferCount()
+{
+    if (m_pBufferPool==NULL) return 0;
+    return SerialPortBufferPool_GetFreeCount(m_pBufferPool);
+}
+
+void TSerialPort::SetNotifyHandler(void (*OnNotifyHandler)(void* pContext, int notification), void* pContext)
+{
+    if (m_receiveAsync) return;
+    m_OnNotifyHandler = OnNotifyHandler;
+    m_pNotifyContext = pContext;
+}
+
+bool TSerialPort::SetSettings(const TSerialPortSettings* pSettings)
+{
+    bool result = true;
+    
+    if (pSettings==NULL) return false;
+    SerialPortIO_Lock(&m_criticalSectionWrite);
+    SerialPortIO_Lock(&m_criticalSectionDevice);
+    if (m_portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        //the open device is reconfigured in place, a write in progress is finished first
+        result = SerialPortIO_Configure(m_portHandle, pSettings)!=FALSE;
+    }
+    if (result)
+    {
+        m_settings = *pSettings;
+        if (m_writeQueue.paced)
+        {
+            //character time of the new line rate
+            SerialPortWriteQueue_SetPacing(&m_writeQueue, &m_writeQueue.pacing, &m_settings);
+        }
+    }
+    SerialPortIO_Unlock(&m_criticalSectionDevice);
+    SerialPortIO_Unlock(&m_criticalSectionWrite);
+    return result;
+}
+
+void TSerialPort::GetSettings(TSerialPortSettings* pSettings)
+{
+    SerialPortIO_Lock(&m_criticalSectionDevice);
+    *pSettings = m_settings;
+    SerialPortIO_Unlock(&m_criticalSectionDevice);
+}
+
+void TSerialPort::SetAutoReconnect(bool enable, int minDelayMS, int maxDelayMS)
+{
+    if (minDelayMS<1) minDelayMS = 1;
+    if (maxDelayMS<minDelayMS) maxDelayMS = minDelayMS;
+    m_reconnectMinDelayMS = minDelayMS;
+    m_reconnectMaxDelayMS = maxDelayMS;
+    m_autoReconnect = enable;
+    //queued frames wait for the reopened device instead of being dropped
+    m_writeQueue.keepOnError = enable ? TRUE : FALSE;
+}
+
+bool TSerialPort::GetAutoReconnect()
+{
+    return m_autoReconnect;
+}
+
+unsigned int TSerialPort::GetReconnectCount()
+{
+    return SERIALPORT_ATOMIC_LOAD(&m_reconnectCount);
+}
+
+bool TSerialPort::OpenAsync(int comPortNumber, 
+                            int baudRate,                             
+                            void (*OnDataReceivedHandler)(const unsigned char* pData, int dataLength),
+                            void (*OnDataSentHandler)(void),                         
+                            int timeoutMS 
+                            )                            
+{
+    char deviceName[SERIALPORT_MAX_DEVICE_NAME];
+    if (!SerialPortIO_GetDeviceName(comPortNumber, deviceName, sizeof(deviceName))) return false;
+
+    return OpenAsync(deviceName, baudRate, OnDataReceivedHandler, OnDataSentHandler, timeoutMS);
+}
+
+bool TSerialPort::OpenAsync(const char* deviceName, 
+                            int baudRate,                             
+                            void (*OnDataReceivedHandler)(const unsigned char* pData, int dataLength),
+                            void (*OnDataSentHandler)(void),                         
+                            int timeoutMS 
+                            )                            
+{
+    bool result = Open(deviceName, baudRate, timeoutMS);
+    if (result)
+    {
+        m_OnDataReceivedHandler = OnDataReceivedHandler;
+        m_OnDataSentHandler     = OnDataSentHandler;
+        if (m_OnBufferReceivedHandler && (m_pBufferPool==NULL))
+        {
+            m_pBufferPool = SerialPortBufferPool_Create(SERIALPORT_DEFAULT_BUFFER_COUNT, SERIALPORT_DEFAULT_BUFFER_SIZE);
+        }
+        if (m_OnBufferReceivedHandler && (m_pBufferPool==NULL))
+        {
+            m_receiveAsync = false;
+        } else if (m_pReactor)
+        {
+            SerialPortIO_Lock(&m_criticalSectionQueue);
+            m_pReactorEntry = SerialPortReactor_Add(m_pReactor, m_portHandle, SerialPort_ReceiveData, SerialPort_SendData, this);
+            SerialPortIO_Unlock(&m_criticalSectionQueue);
+            m_receiveAsync = (m_pReactorEntry!=NULL);
+        } else {
+            m_workingThreadStarted = SerialPortIO_StartThread(&m_workingThread, SerialPort_WaitForData, this)!=FALSE;
+            m_receiveAsync = m_workingThreadStarted;
+        }
+        if (!m_receiveAsync)
+        {
+            Close();
+            result = false;
+        }
+    }
+    return result;
+}
+
+bool TSerialPort::Open(int comPortNumber, int baudRate, int timeoutMS)
+{
+    char deviceName[SERIALPORT_MAX_DEVICE_NAME];
+    if (!SerialPortIO_GetDeviceName(comPortNumber, deviceName, sizeof(deviceName))) return false;
+
+    return Open(deviceName, baudRate, timeoutMS);
+}
+
+bool TSerialPort::Open(const char* deviceName, int baudRate, int timeoutMS)
+{
+    if (deviceName==NULL) return false;
+    if (timeoutMS>15000) return false;
+    if (m_portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        //the working thread of the open port would never be joined, Close() first
+        return false;
+    }
+    if (m_workingThreadStarted)
+    {
+        //left running by Close() called from a handler, it cannot join itself
+        if (SerialPortIO_IsCurrentThread(&m_workingThread)) return false;
+        SerialPortIO_JoinThread(&m_workingThread);
+        m_workingThreadStarted = false;
+    }
+    if (m_reconnectThreadStarted)
+    {
+        if (SerialPortIO_IsCurrentThread(&m_reconnectThread)) return false;
+        SerialPortIO_JoinThread(&m_reconnectThread);
+        m_reconnectThreadStarted = false;
+    }
+    if ((m_receiveRing.pBuffer==NULL) && (!SerialPortRing_Create(&m_receiveRing, SERIALPORT_RECEIVE_BUFFER_SIZE)))
+    {
+        return false;
+    }
+    
+    SerialPortIO_Lock(&m_criticalSectionWrite);
+    m_settings.baudRate = baudRate;
+    if (m_writeQueue.paced)
+    {
+        SerialPortWriteQueue_SetPacing(&m_writeQueue, &m_writeQueue.pacing, &m_settings);
+    }
+    SerialPortIO_Unlock(&m_criticalSectionWrite);
+    m_portHandle = SerialPortIO_OpenWithSettings(deviceName, &m_settings);
+    if (m_portHandle==SERIALPORT_INVALID_HANDLE)
+    {
+        return false;
+    }
+    SerialPortIO_SetCapture(m_portHandle, m_pCapture);
+    SerialPortIO_SetTrace(m_portHandle, m_pTrace, m_tracePortId);
+    SerialPortIO_SetWriteHandler(m_portHandle, m_OnWriteTimeHandler ? SerialPort_Written : NULL, this);
+    if (m_OnModemHandler)
+    {
+        SerialPortIO_SetModemHandler(m_portHandle, SerialPort_ModemChanged, this);
+    }
+
+    //kept for reconnecting
+    strncpy(m_deviceName, deviceName, sizeof(m_deviceName)-1);
+    m_deviceName[sizeof(m_deviceName)-1] = 0;
+    SERIALPORT_ATOMIC_STORE(&m_closing, 0);
+
+    m_timeoutMilliSeconds = timeoutMS;
+    m_receiveOverflow = 0;
+    m_skipLineFeed = false;
+    SerialPortRing_Clear(&m_receiveRing);
+    SerialPortIO_ResetEvent(&m_receiveEvent);
+    SerialPortIO_ResetEvent(&m_wakeEvent);
+    return true;
+}
+
+void TSerialPort::Close()
+{    
+    //no reconnect is started from now on, the one in progress gives up
+    SerialPortIO_Lock(&m_criticalSectionQueue);
+    SERIALPORT_ATOMIC_STORE(&m_closing, 1);
+    SerialPortIO_Unlock(&m_criticalSectionQueue);
+    SerialPortIO_SetEvent(&m_wakeEvent);        //wakes up the working thread waiting for data
+    if (m_reconnectThreadStarted && !SerialPortIO_IsCurrentThread(&m_reconnectThread))
+    {
+        SerialPortIO_JoinThread(&m_reconnectThread);
+        m_reconnectThreadStarted = false;
+    }
+    
+    SerialPortIO_Lock(&m_criticalSectionQueue);
+    TSerialPortReactorEntry* pReactorEntry = m_pReactorEntry;
+    m_pReactorEntry = NULL;
+    SerialPortIO_Unlock(&m_criticalSectionQueue);
+    if (pReactorEntry)
+    {
+        //handlers are not running when Remove returns, it must not wait for our locks
+        SerialPortReactor_Remove(m_pReactor, pReactorEntry);
+        SerialPortIO_SetEvent(&m_receiveEvent);
+    }
+    //frees room for the working thread in case it is blocked in Post
+    SerialPortDispatcher_Cancel(m_pDispatcher, this);
+    if (m_workingThreadStarted && !SerialPortIO_IsCurrentThread(&m_workingThread))
+    {
+        //the working thread must not use the handle after it is closed
+        SerialPortIO_JoinThread(&m_workingThread);
+        m_workingThreadStarted = false;
+    }
+    //the modem handler may wait for our locks, its thread is joined before taking them
+    SerialPortIO_SetModemHandler(m_portHandle, NULL, NULL);
+    SerialPortIO_Lock(&m_criticalSectionRead);  //prevents port closing if ReadBuffer  is not complete
+    SerialPortIO_Lock(&m_criticalSectionWrite); //prevents port closing if WriteBuffer is not complete
+    SerialPortIO_Lock(&m_criticalSectionDevice);//prevents port closing if working thread is reading
+    bool wasOpen = (m_portHandle!=SERIALPORT_INVALID_HANDLE);
+    if (wasOpen)
+    {
+        SerialPortIO_Close(m_portHandle);			
+        m_portHandle = SERIALPORT_INVALID_HANDLE;
+        m_receiveAsync = false;
+        SerialPortWriteQueue_Clear(&m_writeQueue);
+    }
+    SerialPortIO_Unlock(&m_criticalSectionDevice);
+    SerialPortIO_Unlock(&m_criticalSectionRead);
+    SerialPortIO_Unlock(&m_criticalSectionWrite);
+    SerialPortDispatcher_Cancel(m_pDispatcher, this);
+    if (wasOpen)
+    {
+        __CallNotifyHandler(SERIALPORT_NOTIFY_CLOSED);
+    }
+}
+
+bool TSerialPort::IsOpen()
+{
+    return (m_portHandle!=SERIALPORT_INVALID_HANDLE);
+}
+
+bool TSerialPort::GetPeerName(char* deviceName, int maxLength)
+{
+    bool result;
+    
+    SerialPortIO_Lock(&m_criticalSectionDevice);
+    result = SerialPortIO_GetPeerName(m_portHandle, deviceName, maxLength)!=FALSE;
+    SerialPortIO_Unlock(&m_criticalSectionDevice);
+    return result;
+}
+
+int TSerialPort::__WriteBuffer(const unsigned char* pData, int dataLength)
+{
+    SERIALPORT_BUFFER    buffers[2];
+    unsigned char        crcBytes[SERIALPORT_CRC_MAX_SIZE];
+    SERIALPORT_TIMESTAMP startTime;
+    int                  result;
+    
+    if (m_portHandle==SERIALPORT_INVALID_HANDLE)
+    {
+        return 0;
+    }
+    startTime = SerialPortIO_GetTime();
+    if (m_writeCrcType==SERIALPORT_CRC_NONE)
+    {
+        result = SerialPortIO_Write(m_portHandle, pData, dataLength);   
+        SerialPortStatistics_AddWrite(&m_statistics, result, SerialPortIO_GetTime()-startTime);
+        SerialPortWriteQueue_NoteWrite(&m_writeQueue, result);
+        return result;
+    }
+    
+    //frame and its checksum go out in one gathered write
+    buffers[0].pData      = pData;
+    buffers[0].dataLength = dataLength;
+    buffers[1].pData      = crcBytes;
+    buffers[1].dataLength = SerialPortCrc_Append(m_writeCrcType, SerialPortCrc_Compute(m_writeCrcType, pData, dataLength), crcBytes);
+    result = SerialPortIO_WriteVector(m_portHandle, buffers, 2, TRUE);
+    SerialPortStatistics_AddWrite(&m_statistics, result, SerialPortIO_GetTime()-startTime);
+    SerialPortWriteQueue_NoteWrite(&m_writeQueue, result);
+    if (result<0)
+    {
+        return 0;
+    }
+    return (result<dataLength) ? result : dataLength;
+}
+
+int TSerialPort::__ReadBuffer(unsigned char* pData, int dataLength, int timeOutMS)
+{
+    SERIALPORT_TIMESTAMP startTime, currentTime, deadline;
+    int   bytesRead, bytesReadTotal, waitMS;
+
+	if (m_portHandle==SERIALPORT_INVALID_HANDLE)
+	{
+		return 0;
+	}
+    if (timeOutMS<0)
+    {
+        timeOutMS = m_timeoutMilliSeconds;
+    }
+    if (m_receiveAsync)
+    {
+        return __ReadReceiveRing(pData, dataLength, timeOutMS);
+    }
+    
+    //bytes left in the ring by ReadLine/ReadUntil go first
+    bytesReadTotal = SerialPortRing_Read(&m_receiveRing, pData, dataLength);
+    dataLength -= bytesReadTotal;
+    startTime   = SerialPortIO_GetTime();
+    currentTime = startTime;
+    deadline    = startTime + (SERIALPORT_TIMESTAMP)timeOutMS*1000;
+
+    //timeout is measured from the last received byte, the thread sleeps in poll/WaitForMultipleObjects
+    while(dataLength>0)
+    {
+        waitMS = (deadline>currentTime) ? (int)((deadline-currentTime+999)/1000) : 0;
+        bytesRead = SerialPortIO_Read(m_portHandle, pData+bytesReadTotal, dataLength, waitMS, NULL);
+        SerialPortStatistics_AddRead(&m_statistics, bytesRead);
+        __OnDataRead(pData+bytesReadTotal, bytesRead);
+        currentTime = SerialPortIO_GetTime();
+        if (bytesRead<0)
+        {
+            break;
+        }
+        if (bytesRead)
+        {
+            dataLength     -= bytesRead;
+            bytesReadTotal += bytesRead;
+            deadline = currentTime + (SERIALPORT_TIMESTAMP)timeOutMS*1000;
+        } else if (currentTime>=deadline) {
+            break;
+        }
+    }
+    m_lastReadDuration = currentTime - startTime;
+	return bytesReadTotal;
+}
+
+int TSerialPort::__WaitForReceivedData(int timeOutMS)
+{
+    unsigned char* pWrite;
+    int            writeLength, bytesRead, receivedCount;
+
+    if (!m_receiveAsync)
+    {
+        //nobody else reads the device, caller fills the ring by itself
+        writeLength = SerialPortRing_GetWriteBuffer(&m_receiveRing, &pWrite);
+        if (writeLength==0)
+        {
+            return 0;
+        }
+        bytesRead = SerialPortIO_Read(m_portHandle, pWrite, writeLength, timeOutMS, NULL);
+        SerialPortStatistics_AddRead(&m_statistics, bytesRead);
+        if (bytesRead>0)
+        {
+            SerialPortRing_CommitWrite(&m_receiveRing, bytesRead);
+            SerialPortStatistics_UpdateMax(&m_statistics.receiveHighWater, SerialPortRing_GetCount(&m_receiveRing));
+        }
+        __OnDataRead(pWrite, bytesRead);
+        return bytesRead;
+    }
+
+    receivedCount = SerialPortRing_GetCount(&m_receiveRing);
+    SERIALPORT_ATOMIC_STORE(&m_receiveWaiting, 1);
+    if (SerialPortRing_GetCount(&m_receiveRing)==receivedCount)
+    {
+        SerialPortIO_WaitEvent(&m_receiveEvent, timeOutMS);
+    }
+    SERIALPORT_ATOMIC_STORE(&m_receiveWaiting, 0);
+    return SerialPortRing_GetCount(&m_receiveRing) - receivedCount;
+}
+
+int TSerialPort::__ReadReceiveRing(unsigned char* pData, int dataLength, int timeOutMS)
+{
+    SERIALPORT_TIMESTAMP startTime, currentTime, deadline;
+    int   bytesRead, bytesReadTotal;
+
+    bytesReadTotal = 0;
+    startTime   = SerialPortIO_GetTime();
+    currentTime = startTime;
+    deadline    = startTime + (SERIALPORT_TIMESTAMP)timeOutMS*1000;
+
+    //working thread fills the ring, no syscall is needed as long as data are there
+    while(dataLength>0)
+    {
+        bytesRead = SerialPortRing_Read(&m_receiveRing, pData+bytesReadTotal, dataLength);
+        if (bytesRead)
+        {
+            dataLength     -= bytesRead;
+            bytesReadTotal += bytesRead;
+            currentTime = SerialPortIO_GetTime();
+            deadline = currentTime + (SERIALPORT_TIMESTAMP)timeOutMS*1000;
+            continue;
+        }
+        if ((currentTime>=deadline) || (!IsOpen()))
+        {
+            break;
+        }
+        __WaitForReceivedData((int)((deadline-currentTime+999)/1000));
+        currentTime = SerialPortIO_GetTime();
+    }
+    m_lastReadDuration = currentTime - startTime;
+    return bytesReadTotal;
+}
+
+int TSerialPort::__ReadUntil(unsigned char* pData, int dataLength, const unsigned char* delimiters, int delimiterCount, int timeOutMS)
+{
+    SERIALPORT_TIMESTAMP startTime, currentTime, deadline;
+    int   receivedCount, scanLength, scannedLength, position, bytesRead;
+
+	if (m_portHandle==SERIALPORT_INVALID_HANDLE)
+	{
+		return 0;
+	}
+    if (timeOutMS<0)
+    {
+        timeOutMS = m_timeoutMilliSeconds;
+    }
+    if (dataLength>(int)m_receiveRing.capacity)
+    {
+        dataLength = (int)m_receiveRing.capacity;
+    }
+
+    if ((timeOutMS==0) && (!m_receiveAsync))
+    {
+        __WaitForReceivedData(0);
+    }
+
+    scannedLength = 0;
+    startTime   = SerialPortIO_GetTime();
+    currentTime = startTime;
+    deadline    = startTime + (SERIALPORT_TIMESTAMP)timeOutMS*1000;
+
+    //data stay in the ring until a delimiter is found, bytes behind it are kept for the next call
+    for(;;)
+    {
+        receivedCount = SerialPortRing_GetCount(&m_receiveRing);
+        scanLength = (receivedCount<dataLength) ? receivedCount : dataLength;
+        position = SerialPortRing_Find(&m_receiveRing, scannedLength, scanLength, delimiters, delimiterCount);
+        if (position>=0)
+        {
+            scanLength = position+1;
+            break;
+        }
+        if (scanLength==dataLength)
+        {
+            break;
+        }
+        scannedLength = scanLength;
+
+        if ((currentTime>=deadline) || (!IsOpen()))
+        {
+            break;
+        }
+        bytesRead = __WaitForReceivedData((int)((deadline-currentTime+999)/1000));
+        currentTime = SerialPortIO_GetTime();
+        if (bytesRead<0)
+        {
+            break;
+        }
+        if (bytesRead>0)
+        {
+            deadline = currentTime + (SERIALPORT_TIMESTAMP)timeOutMS*1000;
+        }
+    }
+    m_lastReadDuration = currentTime - startTime;
+    return SerialPortRing_Read(&m_receiveRing, pData, scanLength);
+}
+
+int TSerialPort::__ReadVector(const SERIALPORT_READ_BUFFER* pBuffers, int bufferCount, int minLength, int timeOutMS)
+{
+    SERIALPORT_TIMESTAMP startTime, currentTime, deadline;
+    int   bufferIndex, offset, bytesRead, bytesReadTotal, maxLength, i;
+    bool  waited;
+
+	if (m_portHandle==SERIALPORT_INVALID_HANDLE)
+	{
+		return 0;
+	}
+    if (timeOutMS<0)
+    {
+        timeOutMS = m_timeoutMilliSeconds;
+    }
+    maxLength = 0;
+    for(i = 0; i<bufferCount; i++)
+    {
+        maxLength += pBuffers[i].dataLength;
+    }
+    if (minLength>maxLength)
+    {
+        minLength = maxLength;
+    }
+
+    bufferIndex    = 0;
+    offset         = 0;
+    bytesReadTotal = 0;
+    waited         = false;
+    startTime   = SerialPortIO_GetTime();
+    currentTime = startTime;
+    deadline    = startTime + (SERIALPORT_TIMESTAMP)timeOutMS*1000;
+
+    //the deadline stays where it is, nothing waits once minLength bytes are there
+    for(;;)
+    {
+        while(bufferIndex<bufferCount)
+        {
+            bytesRead = SerialPortRing_Read(&m_receiveRing, pBuffers[bufferIndex].pData+offset, pBuffers[bufferIndex].dataLength-offset);
+            offset         += bytesRead;
+            bytesReadTotal += bytesRead;
+            if (offset<pBuffers[bufferIndex].dataLength)
+            {
+                break;
+            }
+            bufferIndex++;
+            offset = 0;
+        }
+        if ((bytesReadTotal==maxLength) || ((bytesReadTotal>=minLength) && ((bytesReadTotal>0) || waited)))
+        {
+            break;
+        }
+        if ((waited && (currentTime>=deadline)) || (!IsOpen()))
+        {
+            break;
+        }
+        //with an empty ring and no minimum the device is polled once, without waiting
+        bytesRead = __WaitForReceivedData((deadline>currentTime) ? (int)((deadline-currentTime+999)/1000) : 0);
+        currentTime = SerialPortIO_GetTime();
+        waited = true;
+        if (bytesRead<0)
+        {
+            break;
+        }
+    }
+    m_lastReadDuration = currentTime - startTime;
+    return bytesReadTotal;
+}
+
+bool TSerialPort::__ReceiveData()
+{
+    TSerialPortLineEvent lineEvents[SERIALPORT_MAX_LINE_EVENTS];
+    unsigned char        discard[256];
+    unsigned char*       pWrite;
+    TSerialPortBuffer*   pBuffer;
+    int                  writeLength, bytesRead, eventCount;
+    bool                 result = true;
+
+    for(;;)
+    {
+        //the device lock is held for the read only, handlers run without it
+        SerialPortIO_Lock(&m_criticalSectionDevice);
+        if (m_portHandle==SERIALPORT_INVALID_HANDLE)
+        {
+            SerialPortIO_Unlock(&m_criticalSectionDevice);
+            break;
+        }
+        pBuffer = NULL;
+        writeLength = 0;
+        if (m_OnBufferReceivedHandler)
+        {
+            //device reads straight into a leased pool buffer
+            pBuffer = SerialPortBufferPool_Get(m_pBufferPool);
+            if (pBuffer)
+            {
+                pWrite = pBuffer->pData;
+                writeLength = pBuffer->capacity;
+            }
+        } else if (m_pBroadcast) {
+            //one read serves all subscribers, the broadcast ring is never full
+            writeLength = SerialPortBroadcast_GetWriteBuffer(m_pBroadcast, &pWrite);
+        } else {
+            //device reads straight into the ring
+            writeLength = SerialPortRing_GetWriteBuffer(&m_receiveRing, &pWrite);
+        }
+        if (writeLength==0)
+        {
+            //no room left, data are read out and dropped
+            pWrite = discard;
+            writeLength = sizeof(discard);
+        }
+        bytesRead = SerialPortIO_Read(m_portHandle, pWrite, writeLength, 0, NULL);
+        SerialPortStatistics_AddRead(&m_statistics, bytesRead);
+        //events are collected anyway, so they do not pile up
+        eventCount = SerialPortIO_GetLineEvents(m_portHandle, lineEvents, SERIALPORT_MAX_LINE_EVENTS);
+        if (bytesRead<=0)
+        {
+            if (m_pBroadcast) SerialPortBroadcast_CommitWrite(m_pBroadcast, 0);
+        } else if (pWrite==discard) {
+            SERIALPORT_ATOMIC_ADD(&m_receiveOverflow, (unsigned int)bytesRead);
+        } else if ((pBuffer==NULL) && m_pBroadcast) {
+            SerialPortBroadcast_CommitWrite(m_pBroadcast, bytesRead);
+        } else if (pBuffer==NULL) {
+            SerialPortRing_CommitWrite(&m_receiveRing, bytesRead);
+            SerialPortStatistics_UpdateMax(&m_statistics.receiveHighWater, SerialPortRing_GetCount(&m_receiveRing));
+            if (SERIALPORT_ATOMIC_LOAD(&m_receiveWaiting))
+            {
+                SerialPortIO_SetEvent(&m_receiveEvent);
+            }
+        }
+        if (bytesRead>0)
+        {
+            m_receiveTime = SerialPortIO_GetLastReadTime(m_portHandle);
+        }
+        SerialPortIO_Unlock(&m_criticalSectionDevice);
+        
+        __CallLineErrorHandler(lineEvents, eventCount);
+        if (bytesRead<=0) 
+        {
+            if (pBuffer) SerialPortBuffer_Release(pBuffer);
+            result = (bytesRead==0);
+            break;
+        }
+        if (!__CallDataReceivedHandler(pWrite, bytesRead) && (pWrite==discard))
+        {
+            //no handler took what did not fit into the ring
+            SERIALPORT_ATOMIC_ADD64(&m_statistics.droppedBytes, (unsigned long long)bytesRead);
+        }
+        if (pBuffer)
+        {
+            pBuffer->dataLength  = bytesRead;
+            pBuffer->receiveTime = m_receiveTime;
+            __CallBufferReceivedHandler(pBuffer);
+        }
+        if (bytesRead<writeLength)
+        {
+            //driver buffer is empty
+            break;
+        }
+    }
+    return result;
+}
+
+bool TSerialPort::__Reconnect()
+{
+    SERIALPORT_HANDLE        portHandle = SERIALPORT_INVALID_HANDLE;
+    TSerialPortReactorEntry* pReactorEntry;
+    TSerialPortSettings      settings;
+    SERIALPORT_TIMESTAMP     currentTime, deadline;
+    int                      delayMS = m_reconnectMinDelayMS;
+    bool                     reconnected = false;
+
+    __CallNotifyHandler(SERIALPORT_NOTIFY_DISCONNECTED);
+    
+    //the device comes back under the same name once it is plugged in again
+    while(!SERIALPORT_ATOMIC_LOAD(&m_closing))
+    {
+        currentTime = SerialPortIO_GetTime();
+        deadline    = currentTime + (SERIALPORT_TIMESTAMP)delayMS*1000;
+        while((currentTime<deadline) && !SERIALPORT_ATOMIC_LOAD(&m_closing))
+        {
+            //Close() sets m_wakeEvent, QueueWrite may set it too
+            SerialPortIO_WaitEvent(&m_wakeEvent, (int)((deadline-currentTime+999)/1000));
+            currentTime = SerialPortIO_GetTime();
+        }
+        if (SERIALPORT_ATOMIC_LOAD(&m_closing))
+        {
+            break;
+        }
+        //SetSettings() may change them meanwhile
+        SerialPortIO_Lock(&m_criticalSectionDevice);
+        settings = m_settings;
+        SerialPortIO_Unlock(&m_criticalSectionDevice);
+        portHandle = SerialPortIO_OpenWithSettings(m_deviceName, &settings);
+        if (portHandle!=SERIALPORT_INVALID_HANDLE)
+        {
+            break;
+        }
+        delayMS = (delayMS<m_reconnectMaxDelayMS/2) ? delayMS*2 : m_reconnectMaxDelayMS;
+    }
+    if (portHandle==SERIALPORT_INVALID_HANDLE)
+    {
+        return false;
+    }
+    SerialPortIO_SetCapture(portHandle, m_pCapture);
+    SerialPortIO_SetTrace(portHandle, m_pTrace, m_tracePortId);
+    SerialPortIO_SetWriteHandler(portHandle, m_OnWriteTimeHandler ? SerialPort_Written : NULL, this);
+    if (m_OnModemHandler)
+    {
+        SerialPortIO_SetModemHandler(portHandle, SerialPort_ModemChanged, this);
+    }
+    
+    //the reactor must not wait on the old handle any more
+    SerialPortIO_Lock(&m_criticalSectionQueue);
+    pReactorEntry = m_pReactorEntry;
+    m_pReactorEntry = NULL;
+    SerialPortIO_Unlock(&m_criticalSectionQueue);
+    if (pReactorEntry)
+    {
+        SerialPortReactor_Remove(m_pReactor, pReactorEntry);
+    }
+    
+    //ring, write queue and handlers stay, only the device is swapped
+    SerialPortIO_Lock(&m_criticalSectionWrite);
+    SerialPortIO_Lock(&m_criticalSectionDevice);
+    if ((m_portHandle!=SERIALPORT_INVALID_HANDLE) && !SERIALPORT_ATOMIC_LOAD(&m_closing))
+    {
+        SERIALPORT_HANDLE oldHandle = m_portHandle;
+        m_portHandle = portHandle;
+        portHandle   = oldHandle;
+        reconnected  = true;
+    }
+    SerialPortIO_Unlock(&m_criticalSectionDevice);
+    SerialPortIO_Unlock(&m_criticalSectionWrite);
+    SerialPortIO_Close(portHandle);
+    if (!reconnected)
+    {
+        return false;
+    }
+    SERIALPORT_ATOMIC_INCREMENT(&m_reconnectCount);
+    __CallNotifyHandler(SERIALPORT_NOTIFY_RECONNECTED);
+    
+    if (m_workingThreadStarted)
+    {
+        //called by the working thread, it sends the queue right after
+        SERIALPORT_ATOMIC_STORE(&m_writeRequested, 1);
+        return true;
+    }
+    //nothing may follow the unlock, __StartReconnect joins this thread holding the lock
+    SerialPortIO_Lock(&m_criticalSectionQueue);
+    if (!SERIALPORT_ATOMIC_LOAD(&m_closing))
+    {
+        m_pReactorEntry = SerialPortReactor_Add(m_pReactor, m_portHandle, SerialPort_ReceiveData, SerialPort_SendData, this);
+        if (m_pReactorEntry && (SerialPortWriteQueue_GetCount(&m_writeQueue)>0))
+        {
+            SerialPortReactor_RequestWrite(m_pReactorEntry);
+        }
+    }
+    reconnected = (m_pReactorEntry!=NULL);
+    SerialPortIO_Unlock(&m_criticalSectionQueue);
+    return reconnected;
+}
+
+void TSerialPort::__StartReconnect()
+{
+    //called by the reactor thread, the reconnect must not block it
+    SerialPortIO_Lock(&m_criticalSectionQueue);
+    if (!SERIALPORT_ATOMIC_LOAD(&m_closing))
+    {
+        if (m_reconnectThreadStarted)
+        {
+            //previous reconnect has finished, it added the entry failing now
+            SerialPortIO_JoinThread(&m_reconnectThread);
+        }
+        m_reconnectThreadStarted = SerialPortIO_StartThread(&m_reconnectThread, SerialPort_Reconnect, this)!=FALSE;
+    }
+    SerialPortIO_Unlock(&m_criticalSectionQueue);
+    if (!m_reconnectThreadStarted)
+    {
+        SerialPortIO_SetEvent(&m_receiveEvent);
+    }
+}
+
+int TSerialPort::ReadBuffer(unsigned char* pData, int dataLength, int timeOutMS)
+{
+    SerialPortIO_Lock(&m_criticalSectionRead);
+    int result = __ReadBuffer(pData, dataLength, timeOutMS);
+    SerialPortStatistics_AddLatency(m_statistics.readLatency, m_lastReadDuration);
+    SerialPortIO_Unlock(&m_criticalSectionRead);
+    return result;
+}
+
+
+int TSerialPort::WriteBuffer(const unsigned char* pData, int dataLength)
+{
+    SerialPortIO_Lock(&m_criticalSectionWrite);
+    int result = __WriteBuffer(pData, dataLength);
+    SerialPortIO_Unlock(&m_criticalSectionWrite);
+    __CallDataSentHandler();
+    return result;
+}
+
+
+int TSerialPort::WriteLine(const char* pLine, bool addCRatEnd)
+{
+    SERIALPORT_BUFFER buffers[2];
+    
+    if (m_portHandle==SERIALPORT_INVALID_HANDLE)
+    {
+        return 0;
+    }
+    if (pLine==NULL)
+    {
+        return 0;
+    }
+    int lineLength = strlen(pLine);
+    if (lineLength==0)
+    {
+        return 0;
+    }
+    
+    //line and CR go out in one gathered write
+    buffers[0].pData      = (const unsigned char*)pLine;
+    buffers[0].dataLength = lineLength;
+    buffers[1].pData      = (const unsigned char*)"\r";
+    buffers[1].dataLength = 1;
+    
+    SerialPortIO_Lock(&m_criticalSectionWrite);
+    int result = 0;
+    if (m_portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        SERIALPORT_TIMESTAMP startTime = SerialPortIO_GetTime();
+        result = SerialPortIO_WriteVector(m_portHandle, buffers, (addCRatEnd && (pLine[lineLength-1]!=0x0D)) ? 2 : 1, TRUE);
+        SerialPortStatistics_AddWrite(&m_statistics, result, SerialPortIO_GetTime()-startTime);
+        SerialPortWriteQueue_NoteWrite(&m_writeQueue, result);
+    }
+    SerialPortIO_Unlock(&m_criticalSectionWrite);
+    if (result<0)
+    {
+        result = 0;
+    }
+    __CallDataSentHandler();
+    return result;
+}
+
+int TSerialPort::QueueWrite(const unsigned char* pData, int dataLength, bool waitForTransmit)
+{
+    return __QueueWrite(pData, dataLength, waitForTransmit, m_writeCrcType);
 }
 
-TSerialPort::~TSerialPort()
+int TSerialPort::__QueueWrite(const unsigned char* pData, int dataLength, bool waitForTransmit, int crcType)
 {
-    if (m_portHandle)
+    SERIALPORT_BUFFER buffers[2];
+    unsigned char     crcBytes[SERIALPORT_CRC_MAX_SIZE];
+    int               bufferCount = 1;
+    BOOL              wasEmpty;
+    
+    if ((m_portHandle==SERIALPORT_INVALID_HANDLE) || (pData==NULL) || (dataLength<=0))
     {
-        Close();        
+        return 0;
+    }
+    buffers[0].pData      = pData;
+    buffers[0].dataLength = dataLength;
+    if (crcType!=SERIALPORT_CRC_NONE)
+    {
+        //checksum is queued in the same node as the frame
+        buffers[1].pData      = crcBytes;
+        buffers[1].dataLength = SerialPortCrc_Append(crcType, SerialPortCrc_Compute(crcType, pData, dataLength), crcBytes);
+        bufferCount = 2;
+    }
+    if (!SerialPortWriteQueue_Push(&m_writeQueue, buffers, bufferCount, waitForTransmit, &wasEmpty))
+    {
+        return 0;
     }
-    DeleteCriticalSection(&m_criticalSectionRead);
-    DeleteCriticalSection(&m_criticalSectionWrite);
+    if (wasEmpty)
+    {
+        //writer takes everything queued in the meantime as well
+        __NotifyWriter();
+    }
+    return dataLength;
 }
 
-int TSerialPort::GetMaxTimeout()
+int TSerialPort::GetWriteQueueCount()
 {
-    return m_timeoutMilliSeconds;
+    return SerialPortWriteQueue_GetCount(&m_writeQueue);
 }
 
-void* TSerialPort::GetDataReceivedHandler()
+void TSerialPort::SetWriteCrc(int crcType)
 {
-    return m_OnDataReceivedHandler;
+    m_writeCrcType = (SerialPortCrc_GetSize(crcType)>0) ? crcType : SERIALPORT_CRC_NONE;
 }
 
-void* TSerialPort::GetDataSentHandler()
+int TSerialPort::GetWriteCrc()
 {
-    return m_OnDataSentHandler;
+    return m_writeCrcType;
 }
 
-bool TSerialPort::OpenAsync(int comPortNumber, 
-                            int baudRate,                             
-                            void (*OnDataReceivedHandler)(const unsigned char* pData, int dataLength),
-                            void (*OnDataSentHandler)(void),                         
-                            int timeoutMS 
-                            )                            
+bool TSerialPort::SetPacing(const TSerialPortPacing* pPacing)
 {
-    bool result = Open(comPortNumber, baudRate, timeoutMS);
-    if (result)
+    TSerialPortPacer* pPacer = NULL;
+    bool              paced;
+    
+    SerialPortIO_Lock(&m_criticalSectionWrite);
+    SerialPortWriteQueue_SetPacing(&m_writeQueue, pPacing, &m_settings);
+    paced = (m_writeQueue.paced!=FALSE);
+    SerialPortIO_Unlock(&m_criticalSectionWrite);
+    
+    if (paced && (m_pPacer==NULL))
     {
-        m_OnDataReceivedHandler = OnDataReceivedHandler;
-        m_OnDataSentHandler     = OnDataSentHandler;
-        if (m_OnDataSentHandler || m_OnDataReceivedHandler)
+        pPacer = SerialPortPacer_Create(SerialPort_SendPaced, this);
+        if (pPacer==NULL)
         {
-            m_workingThread = CreateThread(NULL, 0, SerialPort_WaitForData, this, 0, &m_workingThreadId);
+            SerialPortIO_Lock(&m_criticalSectionWrite);
+            SerialPortWriteQueue_SetPacing(&m_writeQueue, NULL, &m_settings);
+            SerialPortIO_Unlock(&m_criticalSectionWrite);
+            return false;
         }
+        SerialPortIO_Lock(&m_criticalSectionQueue);
+        m_pPacer = pPacer;
+        SerialPortIO_Unlock(&m_criticalSectionQueue);
+    } else if ((!paced) && m_pPacer)
+    {
+        SerialPortIO_Lock(&m_criticalSectionQueue);
+        pPacer = m_pPacer;
+        m_pPacer = NULL;
+        SerialPortIO_Unlock(&m_criticalSectionQueue);
+        //waits for the pacer thread, it takes the write lock
+        SerialPortPacer_Delete(pPacer);
     }
-    return result;
+    if (paced)
+    {
+        //the writer of QueueWrite may have started the pacer before
+        SerialPortIO_Lock(&m_criticalSectionQueue);
+        SerialPortPacer_SetTimeCritical(m_pPacer, TRUE);
+        SerialPortIO_Unlock(&m_criticalSectionQueue);
+    }
+    if ((m_portHandle!=SERIALPORT_INVALID_HANDLE) && (SerialPortWriteQueue_GetCount(&m_writeQueue)>0))
+    {
+        //frames queued before are sent the new way
+        __NotifyWriter();
+    }
+    return true;
 }
 
-bool TSerialPort::Open(int comPortNumber, int baudRate, int timeoutMS)
+void TSerialPort::GetPacing(TSerialPortPacing* pPacing)
 {
-    char portName[12];
-    int  portNameLength;
-    if (comPortNumber<0) return false;
-    if (comPortNumber>255) return false;
-    if (timeoutMS>15000) return false;
+    SerialPortIO_Lock(&m_criticalSectionWrite);
+    *pPacing = m_writeQueue.pacing;
+    SerialPortIO_Unlock(&m_criticalSectionWrite);
+}
+
+void TSerialPort::__NotifyWriter()
+{
+    bool writeNow = false;
     
-    portNameLength = sprintf(portName, "\\\\.\\COM%i", comPortNumber );
+    SerialPortIO_Lock(&m_criticalSectionQueue);
+    if (m_pPacer)
+    {
+        SerialPortPacer_Wake(m_pPacer);
+    } else if (m_pReactorEntry)
+    {
+        SerialPortReactor_RequestWrite(m_pReactorEntry);
+    } else if (m_workingThreadStarted) {
+        SERIALPORT_ATOMIC_STORE(&m_writeRequested, 1);
+        SerialPortIO_SetEvent(&m_wakeEvent);
+    } else {
+        //opened by Open(), a pacer thread becomes the writer so QueueWrite does not wait
+        m_pPacer = SerialPortPacer_Create(SerialPort_SendPaced, this);
+        if (m_pPacer)
+        {
+            SerialPortPacer_Wake(m_pPacer);
+        } else {
+            writeNow = true;
+        }
+    }
+    SerialPortIO_Unlock(&m_criticalSectionQueue);
     
-    m_portHandle = CreateFileA(portName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
-    if ((m_portHandle==0) || ((unsigned long)m_portHandle==0xffffffff))
+    if (writeNow)
     {
-        m_portHandle = 0;
-        return false;
+        __SendWriteQueue(true);
     }
+}
 
-    m_timeoutMilliSeconds = timeoutMS;
+bool TSerialPort::__SendWriteQueue(bool blocking)
+{
+    int  result = 0;
+    bool writeComplete = true;
     
-    DCB portSettings;
-    memset(&portSettings, 0, sizeof(portSettings));
+    if (m_pPacer)
+    {
+        //paced frames are written by the pacer only (after a reconnect, say)
+        SerialPortPacer_Wake(m_pPacer);
+        return true;
+    }
+    SerialPortIO_Lock(&m_criticalSectionWrite);
+    if (m_portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        result = SerialPortWriteQueue_Send(&m_writeQueue, m_portHandle, blocking ? TRUE : FALSE);
+        writeComplete = (m_writeQueue.pPending==NULL);
+    }
+    SerialPortIO_Unlock(&m_criticalSectionWrite);
     
-    portSettings.BaudRate = baudRate;
-    portSettings.ByteSize = 8;
-    portSettings.Parity   = NOPARITY;
-    portSettings.StopBits = ONESTOPBIT;
+    if (result>0)
+    {
+        __CallDataSentHandler();
+    }
+    return writeComplete;
+}
+
+SERIALPORT_TIMESTAMP TSerialPort::__SendPaced()
+{
+    SERIALPORT_TIMESTAMP releaseTime = 0;
+    int                  result = 0;
     
-    if (!SetCommState(m_portHandle, &portSettings))
+    SerialPortIO_Lock(&m_criticalSectionWrite);
+    if (m_portHandle!=SERIALPORT_INVALID_HANDLE)
     {
-        return false;
+        result = SerialPortWriteQueue_Send(&m_writeQueue, m_portHandle, TRUE);
+        releaseTime = m_writeQueue.releaseTime;
     }
+    SerialPortIO_Unlock(&m_criticalSectionWrite);
     
-    COMMTIMEOUTS portTimeOuts;                   
-    memset(&portTimeOuts, 0, sizeof(portTimeOuts));
-    portTimeOuts.ReadIntervalTimeout = SERIALPORT_INTERNAL_TIMEOUT;
-    portTimeOuts.ReadTotalTimeoutMultiplier = 0;    
-    portTimeOuts.ReadTotalTimeoutConstant = SERIALPORT_INTERNAL_TIMEOUT;    
+    if (result>0)
+    {
+        __CallDataSentHandler();
+    }
+    return releaseTime;
+}
 
-    if (!SetCommTimeouts(m_portHandle, &portTimeOuts))
+//reads on the calling thread (no working thread) end here
+bool TSerialPort::__OnDataRead(const unsigned char* pData, int bytesRead)
+{
+    TSerialPortLineEvent lineEvents[SERIALPORT_MAX_LINE_EVENTS];
+    int                  eventCount;
+    
+    //events are collected anyway, so they do not pile up
+    eventCount = SerialPortIO_GetLineEvents(m_portHandle, lineEvents, SERIALPORT_MAX_LINE_EVENTS);
+    __CallLineErrorHandler(lineEvents, eventCount);
+    if (bytesRead<=0)
     {
         return false;
     }
-    return (m_portHandle!=0);
+    m_receiveTime = SerialPortIO_GetLastReadTime(m_portHandle);
+    return __CallDataReceivedHandler(pData, bytesRead);
 }
 
-void TSerialPort::Close()
-{    
-    EnterCriticalSection(&m_criticalSectionRead);  //prevents port closing if ReadBuffer  is not complete
-    EnterCriticalSection(&m_criticalSectionWrite); //prevents port closing if WriteBuffer is not complete
-    if (m_portHandle)
+//returns whether any handler got the data
+bool TSerialPort::__CallDataReceivedHandler(const unsigned char* pData, int dataLength)
+{
+    TSerialPortDispatcher* pDispatcher = m_pDispatcher;
+    bool timed = (m_pTransactions || m_pModbusBus || m_OnReceiveTimeHandler);
+    
+    if (pDispatcher)
     {
-        CloseHandle(m_portHandle);			
-        m_portHandle = NULL;
-        Sleep(SERIALPORT_INTERNAL_TIMEOUT*4);
-        m_workingThread = NULL;
-        m_workingThreadId = 0;      
+        //the receive time travels with the chunk, such chunks are never coalesced
+        if (timed)
+        {
+            SerialPortDispatcher_Post(pDispatcher, SerialPort_DispatchTimed, this, pData, dataLength, m_receiveTime);
+        }
+        if (m_OnDataReceivedHandler)
+        {
+            SerialPortDispatcher_Post(pDispatcher, SerialPort_DispatchReceived, this, pData, dataLength, 0);
+        }
+    } else {
+        __HandleTimed(pData, dataLength, m_receiveTime);
+        __HandleReceived(pData, dataLength);
     }
-    LeaveCriticalSection(&m_criticalSectionRead);
-    LeaveCriticalSection(&m_criticalSectionWrite);
+    __CallNotifyHandler(SERIALPORT_NOTIFY_RECEIVED);
+    return (timed || m_OnDataReceivedHandler);
 }
 
-bool TSerialPort::IsOpen()
+void TSerialPort::__HandleTimed(const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP receiveTime)
 {
-    return (m_portHandle!=0);
+    SERIALPORT_TIMESTAMP startTime;
+    TSerialPortTransactions* pTransactions = m_pTransactions;
+    TSerialPortModbusBus* pModbusBus = m_pModbusBus;
+    
+    if (pTransactions)
+    {
+        SerialPortTransactions_OnDataReceived(pTransactions, pData, dataLength);
+    }
+    if (pModbusBus)
+    {
+        SerialPortModbus_OnDataReceived(pModbusBus, pData, dataLength, receiveTime);
+    }
+    if (m_OnReceiveTimeHandler)
+    {
+        startTime = SerialPortIO_GetTime();
+        m_OnReceiveTimeHandler(m_pReceiveTimeContext, pData, dataLength, receiveTime);
+        SerialPortStatistics_AddCallback(&m_statistics, SerialPortIO_GetTime()-startTime);
+    }
 }
 
-int TSerialPort::__WriteBuffer(const unsigned char* pData, int dataLength)
+void TSerialPort::__HandleReceived(const unsigned char* pData, int dataLength)
 {
-    if (m_portHandle==NULL)
+    SERIALPORT_TIMESTAMP startTime;
+    
+    if (m_OnDataReceivedHandler)
     {
-        return 0;
+        startTime = SerialPortIO_GetTime();
+        m_OnDataReceivedHandler(pData, dataLength);
+        SerialPortStatistics_AddCallback(&m_statistics, SerialPortIO_GetTime()-startTime);
     }
-    DWORD bytesWritten = 0;
+}
+
+//takes over the reference of the caller
+void TSerialPort::__CallBufferReceivedHandler(TSerialPortBuffer* pBuffer)
+{
+    TSerialPortPostedEvent event;
+    SERIALPORT_TIMESTAMP   startTime;
     
-    if (!WriteFile(m_portHandle, pData, dataLength, &bytesWritten, NULL))
+    if (m_pDispatcher)
     {
-        return 0;
-    }    
-    return (int)bytesWritten;   
+        event.kind = SERIALPORT_POSTED_BUFFER;
+        event.u.pBuffer = pBuffer;
+        __PostEvent(&event);
+        return;
+    }
+    startTime = SerialPortIO_GetTime();
+    m_OnBufferReceivedHandler(pBuffer, m_pBufferReceivedContext);
+    SerialPortStatistics_AddCallback(&m_statistics, SerialPortIO_GetTime()-startTime);
+    SerialPortBuffer_Release(pBuffer);
 }
 
-int TSerialPort::__ReadBuffer(unsigned char* pData, int dataLength, int timeOutMS)
+void TSerialPort::__CallDataSentHandler()
 {
-    DWORD bytesRead,bytesReadTotal;
-    int   timeOutCounter, bytesLeft;
+    TSerialPortPostedEvent event;
+    SERIALPORT_TIMESTAMP   startTime;
+    
+    if (m_pDispatcher)
+    {
+        if (m_OnDataSentHandler || m_OnNotifyHandler)
+        {
+            event.kind = SERIALPORT_POSTED_NOTIFY;
+            event.u.notification = SERIALPORT_NOTIFY_SENT;
+            __PostEvent(&event);
+        }
+        return;
+    }
+    if (m_OnDataSentHandler)
+    {
+        startTime = SerialPortIO_GetTime();
+        m_OnDataSentHandler();
+        SerialPortStatistics_AddCallback(&m_statistics, SerialPortIO_GetTime()-startTime);
+    }
+    __Notify(SERIALPORT_NOTIFY_SENT);
+}
 
-	if (m_portHandle==NULL)
-	{
-		return 0;
-	}
-    if (timeOutMS<0)
+void TSerialPort::__CallNotifyHandler(int notification)
+{
+    TSerialPortPostedEvent event;
+    
+    //Close cancels the queued handlers before it notifies
+    if (m_pDispatcher && (notification!=SERIALPORT_NOTIFY_CLOSED))
     {
-        timeOutMS = m_timeoutMilliSeconds;
+        if (m_OnNotifyHandler)
+        {
+            event.kind = SERIALPORT_POSTED_NOTIFY;
+            event.u.notification = notification;
+            __PostEvent(&event);
+        }
+        return;
     }
+    __Notify(notification);
+}
+
+void TSerialPort::__Notify(int notification)
+{
+    SERIALPORT_TIMESTAMP startTime;
     
-    bytesRead = 0;
-    bytesReadTotal = 0;
-    timeOutCounter = timeOutMS;
-    bytesLeft = dataLength;
+    if (m_OnNotifyHandler)
+    {
+        startTime = SerialPortIO_GetTime();
+        m_OnNotifyHandler(m_pNotifyContext, notification);
+        SerialPortStatistics_AddCallback(&m_statistics, SerialPortIO_GetTime()-startTime);
+    }
+}
 
-    if (timeOutMS<SERIALPORT_INTERNAL_TIMEOUT*2)
+void TSerialPort::__CallLineErrorHandler(const TSerialPortLineEvent* pEvents, int eventCount)
+{
+    TSerialPortPostedEvent event;
+    int                    i;
+    
+    if (m_OnLineErrorHandler)
     {
-        Sleep(timeOutMS);
-        ReadFile(m_portHandle, pData, dataLength, &bytesRead, NULL);
-        bytesReadTotal += bytesRead;
-    } else {
-        while(timeOutCounter>0)
-        {            
-            bytesRead = 0;
-            ReadFile(m_portHandle, pData+bytesReadTotal, dataLength, &bytesRead, NULL);
-            if (bytesRead)
+        for(i = 0; i<eventCount; i++)
+        {
+            if (m_pDispatcher)
             {
-                dataLength     -= bytesRead;
-                bytesReadTotal += bytesRead;
-                if (dataLength==0) break;
-                timeOutCounter = timeOutMS;
+                event.kind = SERIALPORT_POSTED_LINE_EVENT;
+                event.u.lineEvent = pEvents[i];
+                __PostEvent(&event);
             } else {
-                timeOutCounter -= SERIALPORT_INTERNAL_TIMEOUT;
-            }            
+                m_OnLineErrorHandler(m_pLineErrorContext, &pEvents[i]);
+            }
         }
     }
-    if (bytesReadTotal)
+}
+
+void TSerialPort::__PostEvent(const TSerialPortPostedEvent* pEvent)
+{
+    SerialPortDispatcher_Post(m_pDispatcher, SerialPort_DispatchEvents, this, (const unsigned char*)pEvent, sizeof(TSerialPortPostedEvent), 0);
+}
+
+//runs on the dispatcher (or the thread discarding them), coalesced events follow each other
+void TSerialPort::__HandleEvents(const unsigned char* pData, int dataLength, bool discarded)
+{
+    TSerialPortPostedEvent event;
+    SERIALPORT_TIMESTAMP   startTime;
+    
+    for(; dataLength>=(int)sizeof(event); pData += sizeof(event), dataLength -= sizeof(event))
     {
-        if (m_OnDataReceivedHandler)
+        memcpy(&event, pData, sizeof(event));
+        if (discarded)
+        {
+            //leased buffers go back to the pool
+            if (event.kind==SERIALPORT_POSTED_BUFFER)
+            {
+                SerialPortBuffer_Release(event.u.pBuffer);
+            }
+            continue;
+        }
+        startTime = SerialPortIO_GetTime();
+        switch(event.kind)
         {
-            m_OnDataReceivedHandler(pData, bytesReadTotal);
+        case SERIALPORT_POSTED_NOTIFY:
+            if ((event.u.notification==SERIALPORT_NOTIFY_SENT) && m_OnDataSentHandler)
+            {
+                m_OnDataSentHandler();
+            }
+            if (m_OnNotifyHandler)
+            {
+                m_OnNotifyHandler(m_pNotifyContext, event.u.notification);
+            }
+            break;
+        case SERIALPORT_POSTED_BUFFER:
+            if (m_OnBufferReceivedHandler)
+            {
+                m_OnBufferReceivedHandler(event.u.pBuffer, m_pBufferReceivedContext);
+            }
+            SerialPortBuffer_Release(event.u.pBuffer);
+            break;
+        case SERIALPORT_POSTED_LINE_EVENT:
+            if (m_OnLineErrorHandler)
+            {
+                m_OnLineErrorHandler(m_pLineErrorContext, &event.u.lineEvent);
+            }
+            break;
+        case SERIALPORT_POSTED_WRITE_TIME:
+            if (m_OnWriteTimeHandler)
+            {
+                m_OnWriteTimeHandler(m_pWriteTimeContext, event.u.bytesWritten, event.time);
+            }
+            break;
+        case SERIALPORT_POSTED_MODEM:
+            if (m_OnModemHandler)
+            {
+                m_OnModemHandler(m_pModemContext, event.u.modem.status, event.u.modem.changedLines);
+            }
+            break;
         }
+        SerialPortStatistics_AddCallback(&m_statistics, SerialPortIO_GetTime()-startTime);
     }
-	return bytesReadTotal;
 }
 
-int TSerialPort::ReadBuffer(unsigned char* pData, int dataLength, int timeOutMS)
+void TSerialPort::GetStatistics(TSerialPortStatistics* pStatistics)
 {
-    EnterCriticalSection(&m_criticalSectionRead);
-    int result = __ReadBuffer(pData, dataLength, timeOutMS);
-    LeaveCriticalSection(&m_criticalSectionRead);
-    return result;
+    SerialPortStatistics_GetSnapshot(&m_statistics, pStatistics);
+    pStatistics->writeQueueDepth = SerialPortWriteQueue_GetCount(&m_writeQueue);
 }
 
+void TSerialPort::ResetStatistics()
+{
+    SerialPortStatistics_Reset(&m_statistics);
+}
 
-int TSerialPort::WriteBuffer(const unsigned char* pData, int dataLength)
+int TSerialPort::GetReceivedCount()
 {
-    EnterCriticalSection(&m_criticalSectionWrite);
-    int result = __WriteBuffer(pData, dataLength);
-    LeaveCriticalSection(&m_criticalSectionWrite);
-    if (m_OnDataSentHandler)
+    if (m_receiveRing.pBuffer==NULL)
     {
-        m_OnDataSentHandler();
+        return 0;
     }
-    return result;
+    return SerialPortRing_GetCount(&m_receiveRing);
 }
 
+unsigned int TSerialPort::GetReceiveOverflow()
+{
+    return SERIALPORT_ATOMIC_LOAD(&m_receiveOverflow);
+}
 
-int TSerialPort::WriteLine(char* pLine, bool addCRatEnd)
+void TSerialPort::ClearReceiveBuffer()
 {
-    
-    if (m_portHandle==NULL)
+    SerialPortIO_Lock(&m_criticalSectionRead);
+    if (m_receiveRing.pBuffer)
+    {
+        SerialPortRing_Clear(&m_receiveRing);
+    }
+    SerialPortIO_Unlock(&m_criticalSectionRead);
+}
+
+int TSerialPort::ReadUntil(unsigned char* pData, int dataLength, const char* delimiters, int timeOutMS)
+{
+    if ((pData==NULL) || (delimiters==NULL))
     {
         return 0;
     }
-    if (pLine==NULL)
+    
+    SerialPortIO_Lock(&m_criticalSectionRead);
+    int result = __ReadUntil(pData, dataLength, (const unsigned char*)delimiters, strlen(delimiters), timeOutMS);
+    SerialPortStatistics_AddLatency(m_statistics.readLatency, m_lastReadDuration);
+    SerialPortIO_Unlock(&m_criticalSectionRead);
+    return result;
+}
+
+int TSerialPort::ReadLine(char* pLine, int maxBufferSize, int timeOutMS)
+{
+    static const unsigned char lineDelimiters[2] = { 0x0D, 0x0A };
+    
+    if (m_portHandle==SERIALPORT_INVALID_HANDLE)
     {
         return 0;
     }
-    int lineLength = strlen(pLine);
-    if (lineLength==0)
+    if ((pLine==NULL) || (maxBufferSize<=0))
     {
         return 0;
     }
     
-    EnterCriticalSection(&m_criticalSectionWrite);
-    int result = __WriteBuffer((unsigned char*)pLine, lineLength);
-    if (pLine[lineLength-1]!=0x0D)
+    SerialPortIO_Lock(&m_criticalSectionRead);
+    int result = __ReadUntil((unsigned char*)pLine, maxBufferSize-1, lineDelimiters, 2, timeOutMS);	
+    if (m_skipLineFeed && (result==1) && (pLine[0]==0x0A))
     {
-        char cr = 13;
-        result+=__WriteBuffer((unsigned char*)&cr, 1);
+        //LF of the CR LF pair which ended the previous line
+        m_skipLineFeed = false;
+        result = __ReadUntil((unsigned char*)pLine, maxBufferSize-1, lineDelimiters, 2, timeOutMS);	
     }
-    LeaveCriticalSection(&m_criticalSectionWrite);
-    if (m_OnDataSentHandler)
+    if (result>0)
     {
-        m_OnDataSentHandler();
+        //a timeout keeps waiting for the LF
+        m_skipLineFeed = (pLine[result-1]==0x0D);
     }
+    if ((result>0) && ((pLine[result-1]==0x0D) || (pLine[result-1]==0x0A)))
+    {
+        result--;
+    }
+    pLine[result] = 0;
+    SerialPortStatistics_AddLatency(m_statistics.readLatency, m_lastReadDuration);
+    SerialPortIO_Unlock(&m_criticalSectionRead);
     return result;
 }
 
-int TSerialPort::ReadLine(char* pLine, int maxBufferSize, int timeOutMS)
+int TSerialPort::ReadVector(const SERIALPORT_READ_BUFFER* pBuffers, int bufferCount, int minLength, int timeOutMS)
 {
-    if (m_portHandle==NULL)
+    if ((pBuffers==NULL) || (bufferCount<=0))
     {
         return 0;
     }
-    if (pLine==NULL)
+    
+    SerialPortIO_Lock(&m_criticalSectionRead);
+    int result = __ReadVector(pBuffers, bufferCount, minLength, timeOutMS);
+    SerialPortStatistics_AddLatency(m_statistics.readLatency, m_lastReadDuration);
+    SerialPortIO_Unlock(&m_criticalSectionRead);
+    return result;
+}
+
+int TSerialPort::ReadAtLeast(unsigned char* pData, int minLength, int maxLength, int timeOutMS)
+{
+    SERIALPORT_READ_BUFFER buffer;
+    
+    buffer.pData      = pData;
+    buffer.dataLength = maxLength;
+    return ReadVector(&buffer, 1, minLength, timeOutMS);
+}
+
+int TSerialPort::ReadExact(unsigned char* pData, int dataLength, int timeOutMS)
+{
+    return ReadAtLeast(pData, dataLength, dataLength, timeOutMS);
+}
+
+int TSerialPort::ReadAvailable(unsigned char* pData, int maxLength)
+{
+    return ReadAtLeast(pData, 0, maxLength, 0);
+}
+
+void SerialPort_WaitForData( void* lpParam )
+{
+    TSerialPort* serialPort = (TSerialPort*)lpParam;
+    
+    while(serialPort->IsOpen() && !SERIALPORT_ATOMIC_LOAD(&serialPort->m_closing))
     {
-        return 0;
+        //no timeout, the thread sleeps until data arrive or Close() sets m_wakeEvent
+        int  waitResult = SerialPortIO_WaitForData(serialPort->m_portHandle, SERIALPORT_INFINITE, &serialPort->m_wakeEvent);
+        bool deviceFailed = (waitResult<0);
+        if (!deviceFailed)
+        {
+            SERIALPORT_ATOMIC_ADD64(&serialPort->m_statistics.wakeups, 1);
+            if (waitResult>0)
+            {
+                deviceFailed = !serialPort->__ReceiveData();
+            }
+        }
+        if (deviceFailed)
+        {
+            //device is gone (unplugged), without auto-reconnect the thread ends
+            if ((!serialPort->m_autoReconnect) || (!serialPort->__Reconnect()))
+            {
+                break;
+            }
+        }
+        if (SERIALPORT_ATOMIC_EXCHANGE(&serialPort->m_writeRequested, 0))
+        {
+            serialPort->__SendWriteQueue(true);
+        }
+    }    
+    //wakes up ReadBuffer waiting for data which will never come
+    SerialPortIO_SetEvent(&serialPort->m_receiveEvent);
+}
+
+BOOL SerialPort_ReceiveData( void* lpParam, BOOL deviceError )
+{
+    TSerialPort* serialPort = (TSerialPort*)lpParam;
+    
+    //called by the reactor whenever the port is readable
+    SERIALPORT_ATOMIC_ADD64(&serialPort->m_statistics.wakeups, 1);
+    if ((!serialPort->__ReceiveData()) || deviceError)
+    {
+        if (serialPort->m_autoReconnect)
+        {
+            //the entry stops here, the reconnecting thread adds a new one
+            serialPort->__StartReconnect();
+            return FALSE;
+        }
+        //wakes up ReadBuffer waiting for data which will never come
+        SerialPortIO_SetEvent(&serialPort->m_receiveEvent);
+        return FALSE;
     }
+    return TRUE;
+}
+
+void SerialPort_Reconnect( void* lpParam )
+{
+    TSerialPort* serialPort = (TSerialPort*)lpParam;
     
-    EnterCriticalSection(&m_criticalSectionRead);
-    int result = __ReadBuffer((unsigned char*)pLine, maxBufferSize-1, timeOutMS);	
-    if (result<maxBufferSize)
+    if (!serialPort->__Reconnect())
     {
-        pLine[result] = 0;
+        //wakes up ReadBuffer waiting for data which will never come
+        SerialPortIO_SetEvent(&serialPort->m_receiveEvent);
     }
-    LeaveCriticalSection(&m_criticalSectionRead);
-    return result;
 }
 
-DWORD WINAPI SerialPort_WaitForData( LPVOID lpParam )
+BOOL SerialPort_SendData( void* lpParam )
 {
     TSerialPort* serialPort = (TSerialPort*)lpParam;
     
-    static unsigned char packet[64];
-    int packetSize = sizeof(packet);   
-    while(serialPort->IsOpen())
+    //called by the reactor after QueueWrite, FALSE waits until the port is writable
+    SERIALPORT_ATOMIC_ADD64(&serialPort->m_statistics.wakeups, 1);
+    return serialPort->__SendWriteQueue(false) ? TRUE : FALSE;
+}
+
+SERIALPORT_TIMESTAMP SerialPort_SendPaced( void* lpParam )
+{
+    TSerialPort* serialPort = (TSerialPort*)lpParam;
+    
+    //called by the pacer thread when paced bytes are due or QueueWrite woke it up
+    return serialPort->__SendPaced();
+}
+
+void SerialPort_DispatchReceived( void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded )
+{
+    TSerialPort* serialPort = (TSerialPort*)pContext;
+    
+    //called on the dispatcher thread (or executor)
+    (void)time;
+    if (!discarded)
     {
-        serialPort->ReadBuffer(packet, packetSize, SERIALPORT_INTERNAL_TIMEOUT);
-    }    
-    return 0;
+        serialPort->__HandleReceived(pData, dataLength);
+    }
+}
+
+void SerialPort_DispatchTimed( void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded )
+{
+    TSerialPort* serialPort = (TSerialPort*)pContext;
+    
+    //engines and the receive time handler get the chunk with its receive time
+    if (!discarded)
+    {
+        serialPort->__HandleTimed(pData, dataLength, time);
+    }
+}
+
+void SerialPort_DispatchEvents( void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded )
+{
+    TSerialPort* serialPort = (TSerialPort*)pContext;
+    
+    (void)time;
+    serialPort->__HandleEvents(pData, dataLength, discarded!=FALSE);
+}
+
+void SerialPort_Written( void* pContext, int bytesWritten, SERIALPORT_TIMESTAMP writeTime )
+{
+    TSerialPort* serialPort = (TSerialPort*)pContext;
+    TSerialPortPostedEvent event;
+    
+    //called on the thread that wrote the data
+    if (serialPort->m_pDispatcher)
+    {
+        event.kind = SERIALPORT_POSTED_WRITE_TIME;
+        event.time = writeTime;
+        event.u.bytesWritten = bytesWritten;
+        serialPort->__PostEvent(&event);
+    } else if (serialPort->m_OnWriteTimeHandler) {
+        serialPort->m_OnWriteTimeHandler(serialPort->m_pWriteTimeContext, bytesWritten, writeTime);
+    }
 }
 
+void SerialPort_ModemChanged( void* pContext, unsigned int modemStatus, unsigned int changedLines )
+{
+    TSerialPort* serialPort = (TSerialPort*)pContext;
+    TSerialPortPostedEvent event;
+    
+    //called on the modem watching thread
+    if (serialPort->m_pDispatcher)
+    {
+        event.kind = SERIALPORT_POSTED_MODEM;
+        event.u.modem.status = modemStatus;
+        event.u.modem.changedLines = changedLines;
+        serialPort->__PostEvent(&event);
+    } else if (serialPort->m_OnModemHandler) {
+        serialPort->m_OnModemHandler(serialPort->m_pModemContext, modemStatus, changedLines);
+    }
+}
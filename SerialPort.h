@@ -17,11 +17,36 @@
 #ifndef SERIALPORT___H
 #define SERIALPORT___H
 
-#include <windows.h>
+#include "SerialPortIO.h"
+#include "SerialPortReactor.h"
+#include "SerialPortWriteQueue.h"
+#include "SerialPortBufferPool.h"
+#include "SerialPortCrc.h"
+#include "SerialPortStatistics.h"
+#include "SerialPortVirtual.h"
+#include "SerialPortTransaction.h"
+#include "SerialPortCapture.h"
+#include "SerialPortDispatcher.h"
+#include "SerialPortBroadcast.h"
+#include "SerialPortModbus.h"
+#include "SerialPortTrace.h"
 
+/*
+* SerialPort_XXX functions work with one default port, SerialPortInstance_XXX
+* with ports created by SerialPortInstance_Create, see README.md.
+*/
+
+typedef struct TSerialPortInstance TSerialPortInstance;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//the default port
 void    SerialPort_Initialize(void);
 void    SerialPort_Uninitialize(void);
 int     SerialPort_GetMaxTimeout();
+SERIALPORT_TIMESTAMP SerialPort_GetLastReadDuration();
 int     SerialPort_GetDataReceivedHandler();
 int     SerialPort_GetDataSentHandler();
 BOOL    SerialPort_OpenAsync(int comPortNumber, 
@@ -29,13 +54,133 @@ BOOL    SerialPort_OpenAsync(int comPortNumber,
                              void (*OnDataReceivedHandler)(const unsigned char* pData, int dataLength),
                              void (*OnDataSentHandler)(void),                         
                              int timeoutMS);
+BOOL    SerialPort_OpenDeviceAsync(const char* deviceName, 
+                                   int baudRate,                             
+                                   void (*OnDataReceivedHandler)(const unsigned char* pData, int dataLength),
+                                   void (*OnDataSentHandler)(void),                         
+                                   int timeoutMS);
 BOOL    SerialPort_Open(int comPortNumber, int baudRate, int timeoutMS);
+BOOL    SerialPort_OpenDevice(const char* deviceName, int baudRate, int timeoutMS);
 void    SerialPort_Close();
 BOOL    SerialPort_IsOpen();
+BOOL    SerialPort_GetPeerName(char* deviceName, int maxLength);
 int     SerialPort_ReadBuffer(unsigned char* pData, int dataLength, int timeOutMS);
 int     SerialPort_WriteBuffer(const unsigned char* pData, int dataLength);
-int     SerialPort_WriteLine(char* pLine, BOOL addCRatEnd);
+int     SerialPort_WriteLine(const char* pLine, BOOL addCRatEnd);
+int     SerialPort_QueueWrite(const unsigned char* pData, int dataLength, BOOL waitForTransmit);
+int     SerialPort_GetWriteQueueCount();
+void    SerialPort_SetWriteCrc(int crcType);
+BOOL    SerialPort_SetPacing(const TSerialPortPacing* pPacing);
+void    SerialPort_GetPacing(TSerialPortPacing* pPacing);
+void    SerialPort_SetTransactions(TSerialPortTransactions* pTransactions);
+void    SerialPort_SetModbusBus(TSerialPortModbusBus* pBus);
+void    SerialPort_SetCapture(TSerialPortCapture* pCapture);
+void    SerialPort_SetTrace(TSerialPortTrace* pTrace, const char* name);
+void    SerialPort_SetDispatcher(TSerialPortDispatcher* pDispatcher);
+void    SerialPort_SetBroadcast(TSerialPortBroadcast* pBroadcast);
+void    SerialPort_SetModemHandler(void (*OnModemHandler)(unsigned int modemStatus, unsigned int changedLines));
+void    SerialPort_SetLineErrorHandler(void (*OnLineErrorHandler)(const TSerialPortLineEvent* pEvent));
+BOOL    SerialPort_GetModemStatus(unsigned int* pModemStatus);
+BOOL    SerialPort_SetRTS(BOOL enable);
+BOOL    SerialPort_SetDTR(BOOL enable);
+BOOL    SerialPort_SetBreak(BOOL enable);
+BOOL    SerialPort_SetSettings(const TSerialPortSettings* pSettings);
+void    SerialPort_GetSettings(TSerialPortSettings* pSettings);
+void    SerialPort_SetAutoReconnect(BOOL enable, int minDelayMS, int maxDelayMS);
+unsigned int SerialPort_GetReconnectCount();
+void    SerialPort_GetStatistics(TSerialPortStatistics* pStatistics);
+void    SerialPort_ResetStatistics();
+int     SerialPort_ReadUntil(unsigned char* pData, int dataLength, const char* delimiters, int timeOutMS);
 int     SerialPort_ReadLine(char* pLine, int maxBufferSize, int timeOutMS);
+int     SerialPort_ReadExact(unsigned char* pData, int dataLength, int timeOutMS);
+int     SerialPort_ReadAtLeast(unsigned char* pData, int minLength, int maxLength, int timeOutMS);
+int     SerialPort_ReadAvailable(unsigned char* pData, int maxLength);
+int     SerialPort_ReadVector(const SERIALPORT_READ_BUFFER* pBuffers, int bufferCount, int minLength, int timeOutMS);
+int     SerialPort_GetReceivedCount();
+unsigned int SerialPort_GetReceiveOverflow();
+void    SerialPort_ClearReceiveBuffer();
+BOOL    SerialPort_SetReceiveBufferPool(int bufferCount, int bufferSize);
+void    SerialPort_SetBufferReceivedHandler(void (*OnBufferReceivedHandler)(TSerialPortBuffer* pBuffer));
+int     SerialPort_GetFreeBufferCount();
+
+//any number of ports, with a reactor (SetReactor) OpenAsync starts no working thread
+TSerialPortInstance* SerialPortInstance_Create(void);
+void    SerialPortInstance_Delete(TSerialPortInstance* pPort);
+void    SerialPortInstance_SetReactor(TSerialPortInstance* pPort, TSerialPortReactor* pReactor);
+void    SerialPortInstance_SetTransactions(TSerialPortInstance* pPort, TSerialPortTransactions* pTransactions);
+TSerialPortTransactions* SerialPortInstance_GetTransactions(TSerialPortInstance* pPort);
+void    SerialPortInstance_SetModbusBus(TSerialPortInstance* pPort, TSerialPortModbusBus* pBus);
+TSerialPortModbusBus* SerialPortInstance_GetModbusBus(TSerialPortInstance* pPort);
+void    SerialPortInstance_SetCapture(TSerialPortInstance* pPort, TSerialPortCapture* pCapture);
+TSerialPortCapture* SerialPortInstance_GetCapture(TSerialPortInstance* pPort);
+void    SerialPortInstance_SetTrace(TSerialPortInstance* pPort, TSerialPortTrace* pTrace, const char* name);
+TSerialPortTrace* SerialPortInstance_GetTrace(TSerialPortInstance* pPort);
+void    SerialPortInstance_SetReceiveTimeHandler(TSerialPortInstance* pPort, void (*OnReceiveTimeHandler)(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP receiveTime));
+void    SerialPortInstance_SetWriteTimeHandler(TSerialPortInstance* pPort, void (*OnWriteTimeHandler)(TSerialPortInstance* pPort, int bytesWritten, SERIALPORT_TIMESTAMP writeTime));
+SERIALPORT_TIMESTAMP SerialPortInstance_GetLastReceiveTime(TSerialPortInstance* pPort);
+SERIALPORT_TIMESTAMP SerialPortInstance_GetLastWriteTime(TSerialPortInstance* pPort);
+void    SerialPortInstance_SetDispatcher(TSerialPortInstance* pPort, TSerialPortDispatcher* pDispatcher);
+TSerialPortDispatcher* SerialPortInstance_GetDispatcher(TSerialPortInstance* pPort);
+void    SerialPortInstance_SetBroadcast(TSerialPortInstance* pPort, TSerialPortBroadcast* pBroadcast);
+TSerialPortBroadcast* SerialPortInstance_GetBroadcast(TSerialPortInstance* pPort);
+void    SerialPortInstance_SetModemHandler(TSerialPortInstance* pPort, void (*OnModemHandler)(TSerialPortInstance* pPort, unsigned int modemStatus, unsigned int changedLines));
+void    SerialPortInstance_SetLineErrorHandler(TSerialPortInstance* pPort, void (*OnLineErrorHandler)(TSerialPortInstance* pPort, const TSerialPortLineEvent* pEvent));
+BOOL    SerialPortInstance_GetModemStatus(TSerialPortInstance* pPort, unsigned int* pModemStatus);
+BOOL    SerialPortInstance_SetRTS(TSerialPortInstance* pPort, BOOL enable);
+BOOL    SerialPortInstance_SetDTR(TSerialPortInstance* pPort, BOOL enable);
+BOOL    SerialPortInstance_SetBreak(TSerialPortInstance* pPort, BOOL enable);
+BOOL    SerialPortInstance_SetSettings(TSerialPortInstance* pPort, const TSerialPortSettings* pSettings);
+void    SerialPortInstance_GetSettings(TSerialPortInstance* pPort, TSerialPortSettings* pSettings);
+void    SerialPortInstance_SetAutoReconnect(TSerialPortInstance* pPort, BOOL enable, int minDelayMS, int maxDelayMS);
+unsigned int SerialPortInstance_GetReconnectCount(TSerialPortInstance* pPort);
+BOOL    SerialPortInstance_SetReceiveBufferPool(TSerialPortInstance* pPort, int bufferCount, int bufferSize);
+void    SerialPortInstance_SetBufferReceivedHandler(TSerialPortInstance* pPort, void (*OnBufferReceivedHandler)(TSerialPortInstance* pPort, TSerialPortBuffer* pBuffer));
+int     SerialPortInstance_GetFreeBufferCount(TSerialPortInstance* pPort);
+void    SerialPortInstance_SetUserData(TSerialPortInstance* pPort, void* pUserData);
+void*   SerialPortInstance_GetUserData(TSerialPortInstance* pPort);
+int     SerialPortInstance_GetMaxTimeout(TSerialPortInstance* pPort);
+SERIALPORT_TIMESTAMP SerialPortInstance_GetLastReadDuration(TSerialPortInstance* pPort);
+BOOL    SerialPortInstance_OpenAsync(TSerialPortInstance* pPort,
+                                     int comPortNumber, 
+                                     int baudRate,                             
+                                     void (*OnDataReceivedHandler)(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength),
+                                     void (*OnDataSentHandler)(TSerialPortInstance* pPort),                         
+                                     int timeoutMS);
+BOOL    SerialPortInstance_OpenDeviceAsync(TSerialPortInstance* pPort,
+                                           const char* deviceName, 
+                                           int baudRate,                             
+                                           void (*OnDataReceivedHandler)(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength),
+                                           void (*OnDataSentHandler)(TSerialPortInstance* pPort),                         
+                                           int timeoutMS);
+BOOL    SerialPortInstance_Open(TSerialPortInstance* pPort, int comPortNumber, int baudRate, int timeoutMS);
+BOOL    SerialPortInstance_OpenDevice(TSerialPortInstance* pPort, const char* deviceName, int baudRate, int timeoutMS);
+void    SerialPortInstance_Close(TSerialPortInstance* pPort);
+BOOL    SerialPortInstance_IsOpen(TSerialPortInstance* pPort);
+BOOL    SerialPortInstance_GetPeerName(TSerialPortInstance* pPort, char* deviceName, int maxLength);
+int     SerialPortInstance_ReadBuffer(TSerialPortInstance* pPort, unsigned char* pData, int dataLength, int timeOutMS);
+int     SerialPortInstance_WriteBuffer(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength);
+int     SerialPortInstance_WriteLine(TSerialPortInstance* pPort, const char* pLine, BOOL addCRatEnd);
+int     SerialPortInstance_QueueWrite(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength, BOOL waitForTransmit);
+int     SerialPortInstance_GetWriteQueueCount(TSerialPortInstance* pPort);
+void    SerialPortInstance_SetWriteCrc(TSerialPortInstance* pPort, int crcType);
+int     SerialPortInstance_GetWriteCrc(TSerialPortInstance* pPort);
+BOOL    SerialPortInstance_SetPacing(TSerialPortInstance* pPort, const TSerialPortPacing* pPacing);
+void    SerialPortInstance_GetPacing(TSerialPortInstance* pPort, TSerialPortPacing* pPacing);
+void    SerialPortInstance_GetStatistics(TSerialPortInstance* pPort, TSerialPortStatistics* pStatistics);
+void    SerialPortInstance_ResetStatistics(TSerialPortInstance* pPort);
+int     SerialPortInstance_ReadUntil(TSerialPortInstance* pPort, unsigned char* pData, int dataLength, const char* delimiters, int timeOutMS);
+int     SerialPortInstance_ReadLine(TSerialPortInstance* pPort, char* pLine, int maxBufferSize, int timeOutMS);
+int     SerialPortInstance_ReadExact(TSerialPortInstance* pPort, unsigned char* pData, int dataLength, int timeOutMS);
+int     SerialPortInstance_ReadAtLeast(TSerialPortInstance* pPort, unsigned char* pData, int minLength, int maxLength, int timeOutMS);
+int     SerialPortInstance_ReadAvailable(TSerialPortInstance* pPort, unsigned char* pData, int maxLength);
+int     SerialPortInstance_ReadVector(TSerialPortInstance* pPort, const SERIALPORT_READ_BUFFER* pBuffers, int bufferCount, int minLength, int timeOutMS);
+int     SerialPortInstance_GetReceivedCount(TSerialPortInstance* pPort);
+unsigned int SerialPortInstance_GetReceiveOverflow(TSerialPortInstance* pPort);
+void    SerialPortInstance_ClearReceiveBuffer(TSerialPortInstance* pPort);
+
+#ifdef __cplusplus
+}
+#endif
 
 
 
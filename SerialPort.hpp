@@ -14,60 +14,283 @@
 *
 */
 
-#ifndef SERIALPORT___H
-#define SERIALPORT___H
+#ifndef SERIALPORT___HPP
+#define SERIALPORT___HPP
 
-#include <windows.h>
+#include "SerialPortIO.h"
+#include "SerialPortRing.h"
+#include "SerialPortReactor.h"
+#include "SerialPortWriteQueue.h"
+#include "SerialPortPacer.h"
+#include "SerialPortBufferPool.h"
+#include "SerialPortCrc.h"
+#include "SerialPortStatistics.h"
+#include "SerialPortVirtual.h"
+#include "SerialPortTransaction.h"
+#include "SerialPortCapture.h"
+#include "SerialPortDispatcher.h"
+#include "SerialPortBroadcast.h"
+#include "SerialPortModbus.h"
+#include "SerialPortTrace.h"
+
+/*
+* TSerialPort reads and writes one device, a pty or a virtual wire.
+* Open() reads the device on the calling thread, OpenAsync() on a working
+* thread (or a reactor, SerialPortReactor.h) which calls the handlers and
+* fills a lock-free receive ring that ReadBuffer/ReadLine drain. The
+* engines a port feeds are described in their own headers, README.md
+* shows how they fit together.
+*/
+
+#define SERIALPORT_NOTIFY_RECEIVED      1
+#define SERIALPORT_NOTIFY_SENT          2
+#define SERIALPORT_NOTIFY_CLOSED        3
+#define SERIALPORT_NOTIFY_DISCONNECTED  4
+#define SERIALPORT_NOTIFY_RECONNECTED   5
+
+class TSerialPortStream;
+struct TSerialPortPostedEvent;
 
 class TSerialPort
 {
 private:
-    HANDLE m_portHandle;
-    HANDLE m_workingThread;
-    DWORD  m_workingThreadId;
+    SERIALPORT_HANDLE m_portHandle;
+    SERIALPORT_THREAD m_workingThread;
+    bool   m_workingThreadStarted;
+    volatile unsigned int m_closing;
+    bool   m_receiveAsync;
+    TSerialPortReactor* m_pReactor;
+    TSerialPortReactorEntry* m_pReactorEntry;
+    
+    char   m_deviceName[SERIALPORT_MAX_DEVICE_NAME];
+    TSerialPortSettings m_settings;
+    bool   m_autoReconnect;
+    int    m_reconnectMinDelayMS;
+    int    m_reconnectMaxDelayMS;
+    volatile unsigned int m_reconnectCount;
+    SERIALPORT_THREAD m_reconnectThread;
+    bool   m_reconnectThreadStarted;
+    
+    TSerialPortWriteQueue m_writeQueue;
+    volatile unsigned int m_writeRequested;
+    SERIALPORT_EVENT m_wakeEvent;
+    int    m_writeCrcType;
+    TSerialPortPacer* m_pPacer;
+    
+    TSerialPortRing  m_receiveRing;
+    SERIALPORT_EVENT m_receiveEvent;
+    volatile unsigned int m_receiveWaiting;
+    volatile unsigned int m_receiveOverflow;
+    bool   m_skipLineFeed;
     
     int    m_timeoutMilliSeconds;
     int    m_maxPacketLength;
+    SERIALPORT_TIMESTAMP m_lastReadDuration;
+    SERIALPORT_TIMESTAMP m_receiveTime;     //when the chunk being handed over was read
+    TSerialPortStatistics m_statistics;
     
     void (*m_OnDataReceivedHandler)(const unsigned char* pData, int dataLength);
     void (*m_OnDataSentHandler)(void);
+    void (*m_OnNotifyHandler)(void* pContext, int notification);
+    void* m_pNotifyContext;
+    void (*m_OnBufferReceivedHandler)(TSerialPortBuffer* pBuffer, void* pContext);
+    void* m_pBufferReceivedContext;
+    TSerialPortBufferPool* m_pBufferPool;
+    TSerialPortTransactions* volatile m_pTransactions;
+    TSerialPortModbusBus* volatile m_pModbusBus;
+    TSerialPortCapture* m_pCapture;
+    TSerialPortTrace* m_pTrace;
+    int m_tracePortId;
+    void (*m_OnReceiveTimeHandler)(void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP receiveTime);
+    void* m_pReceiveTimeContext;
+    void (*m_OnWriteTimeHandler)(void* pContext, int bytesWritten, SERIALPORT_TIMESTAMP writeTime);
+    void* m_pWriteTimeContext;
+    TSerialPortDispatcher* m_pDispatcher;
+    TSerialPortBroadcast* m_pBroadcast;
+    void (*m_OnModemHandler)(void* pContext, unsigned int modemStatus, unsigned int changedLines);
+    void* m_pModemContext;
+    void (*m_OnLineErrorHandler)(void* pContext, const TSerialPortLineEvent* pEvent);
+    void* m_pLineErrorContext;
     
-    CRITICAL_SECTION m_criticalSectionRead;
-    CRITICAL_SECTION m_criticalSectionWrite;
+    SERIALPORT_LOCK m_criticalSectionRead;
+    SERIALPORT_LOCK m_criticalSectionWrite;
+    SERIALPORT_LOCK m_criticalSectionDevice;
+    SERIALPORT_LOCK m_criticalSectionQueue;
     
     int __ReadBuffer(unsigned char* pData, int dataLength, int timeOutMS=-1);		
+    int __ReadReceiveRing(unsigned char* pData, int dataLength, int timeOutMS);
+    int __ReadUntil(unsigned char* pData, int dataLength, const unsigned char* delimiters, int delimiterCount, int timeOutMS);
+    int __ReadVector(const SERIALPORT_READ_BUFFER* pBuffers, int bufferCount, int minLength, int timeOutMS);
+    int __WaitForReceivedData(int timeOutMS);
+    bool __ReceiveData();
     int __WriteBuffer(const unsigned char* pData, int dataLength);	
+    int __QueueWrite(const unsigned char* pData, int dataLength, bool waitForTransmit, int crcType);
+    bool __SendWriteQueue(bool blocking);
+    void __NotifyWriter();
+    SERIALPORT_TIMESTAMP __SendPaced();
+    bool __OnDataRead(const unsigned char* pData, int bytesRead);
+    bool __CallDataReceivedHandler(const unsigned char* pData, int dataLength);
+    void __CallBufferReceivedHandler(TSerialPortBuffer* pBuffer);
+    void __CallDataSentHandler();
+    void __CallNotifyHandler(int notification);
+    void __CallLineErrorHandler(const TSerialPortLineEvent* pEvents, int eventCount);
+    void __HandleTimed(const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP receiveTime);
+    void __HandleReceived(const unsigned char* pData, int dataLength);
+    void __HandleEvents(const unsigned char* pData, int dataLength, bool discarded);
+    void __Notify(int notification);
+    void __PostEvent(const TSerialPortPostedEvent* pEvent);
+    bool __Reconnect();
+    void __StartReconnect();
     
+    friend void SerialPort_WaitForData( void* lpParam );
+    friend void SerialPort_Reconnect( void* lpParam );
+    friend BOOL SerialPort_ReceiveData( void* lpParam, BOOL deviceError );
+    friend BOOL SerialPort_SendData( void* lpParam );
+    friend SERIALPORT_TIMESTAMP SerialPort_SendPaced( void* lpParam );
+    friend int SerialPort_SendRequest( void* pContext, const unsigned char* pData, int dataLength );
+    friend void SerialPort_DispatchReceived( void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded );
+    friend void SerialPort_DispatchTimed( void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded );
+    friend void SerialPort_DispatchEvents( void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded );
+    friend void SerialPort_Written( void* pContext, int bytesWritten, SERIALPORT_TIMESTAMP writeTime );
+    friend void SerialPort_ModemChanged( void* pContext, unsigned int modemStatus, unsigned int changedLines );
+    friend class TSerialPortStream;
     
 public:	
     TSerialPort();
     ~TSerialPort();
     
     int GetMaxTimeout();
+    SERIALPORT_TIMESTAMP GetLastReadDuration();
     void* GetDataReceivedHandler();
     void* GetDataSentHandler();
     
+    //before OpenAsync(), the reactor threads serve the port instead of a working thread of its own
+    void SetReactor(TSerialPortReactor* pReactor);
+    TSerialPortReactor* GetReactor();
+    
+    //requests go out by QueueWrite, received chunks reach the engine before OnDataReceivedHandler
+    void SetTransactions(TSerialPortTransactions* pTransactions);
+    TSerialPortTransactions* GetTransactions();
+    
+    //the same for a Modbus RTU bus, chunks are passed on with their receive time
+    void SetModbusBus(TSerialPortModbusBus* pBus);
+    TSerialPortModbusBus* GetModbusBus();
+    
+    //records every chunk read or written, the capture must outlive the open port
+    void SetCapture(TSerialPortCapture* pCapture);
+    TSerialPortCapture* GetCapture();
+    
+    //the trace is named after the device unless a name is given, handlers get the time of the syscall
+    void SetTrace(TSerialPortTrace* pTrace, const char* name=NULL);
+    TSerialPortTrace* GetTrace();
+    void SetReceiveTimeHandler(void (*OnReceiveTimeHandler)(void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP receiveTime), void* pContext);
+    void SetWriteTimeHandler(void (*OnWriteTimeHandler)(void* pContext, int bytesWritten, SERIALPORT_TIMESTAMP writeTime), void* pContext);
+    SERIALPORT_TIMESTAMP GetLastReceiveTime();
+    SERIALPORT_TIMESTAMP GetLastWriteTime();
+    
+    //before opening, every handler runs on the dispatcher, only SERIALPORT_NOTIFY_CLOSED is called by Close()
+    void SetDispatcher(TSerialPortDispatcher* pDispatcher);
+    TSerialPortDispatcher* GetDispatcher();
+    
+    //before OpenAsync(), received data go to the broadcast ring instead of the receive ring
+    void SetBroadcast(TSerialPortBroadcast* pBroadcast);
+    TSerialPortBroadcast* GetBroadcast();
+    
+    //modem changes come from a thread of their own, line errors from the reading thread before the data
+    void SetModemHandler(void (*OnModemHandler)(void* pContext, unsigned int modemStatus, unsigned int changedLines), void* pContext);
+    void SetLineErrorHandler(void (*OnLineErrorHandler)(void* pContext, const TSerialPortLineEvent* pEvent), void* pContext);
+    bool GetModemStatus(unsigned int* pModemStatus);
+    bool SetRTS(bool enable);
+    bool SetDTR(bool enable);
+    bool SetBreak(bool enable);
+    
+    //before OpenAsync(), received data are handed over in leased pool buffers, the receive ring is not fed
+    bool SetReceiveBufferPool(int bufferCount, int bufferSize);
+    void SetBufferReceivedHandler(void (*OnBufferReceivedHandler)(TSerialPortBuffer* pBuffer, void* pContext), void* pContext);
+    int GetFreeBufferCount();
+    
+    //before OpenAsync(), SERIALPORT_NOTIFY_XXX on the I/O thread
+    void SetNotifyHandler(void (*OnNotifyHandler)(void* pContext, int notification), void* pContext);
+    
+    //applied to an open port at once, false keeps the previous configuration
+    bool SetSettings(const TSerialPortSettings* pSettings);
+    void GetSettings(TSerialPortSettings* pSettings);
+    
+    //an asynchronously opened port reopens its device with backoff, data and queued writes are kept
+    void SetAutoReconnect(bool enable, int minDelayMS=SERIALPORT_RECONNECT_MIN_DELAY, int maxDelayMS=SERIALPORT_RECONNECT_MAX_DELAY);
+    bool GetAutoReconnect();
+    unsigned int GetReconnectCount();
+    
+    //fail on a port which is already open, deviceName may be "pty:" or "virtual:NAME"
     bool Open(int comPortNumber, int baudRate, int timeoutMS=1000);
+    bool Open(const char* deviceName, int baudRate, int timeoutMS=1000);
     
     bool OpenAsync( int comPortNumber, int baudRate, 
                     void (*OnDataReceivedHandler)(const unsigned char* pData, int dataLength),
                     void (*OnDataSentHandler)(void),            
                     int timeoutMS=100
                    );
+    bool OpenAsync( const char* deviceName, int baudRate, 
+                    void (*OnDataReceivedHandler)(const unsigned char* pData, int dataLength),
+                    void (*OnDataSentHandler)(void),            
+                    int timeoutMS=100
+                   );
     
+    //returns once the working thread has left, called from a handler the next open joins it
     void Close();
     bool IsOpen();
+    //what the other side opens: the pty slave or the same "virtual:NAME"
+    bool GetPeerName(char* deviceName, int maxLength);
     
     int ReadBuffer(unsigned char* pData, int dataLength, int timeOutMS=-1);		
     int WriteBuffer(const unsigned char* pData, int dataLength);	
     
+    //return once a delimiter arrived or the line was quiet for the timeout, ReadLine strips CR/LF
+    int ReadUntil(unsigned char* pData, int dataLength, const char* delimiters, int timeOutMS=-1);
     int ReadLine(char* pLine, int maxBufferSize, int timeOutMS=-1);
-    int WriteLine(char* pLine, bool addCRatEnd=true);
+    
+    //the timeout is a deadline from the call, ReadAvailable never waits
+    int ReadExact(unsigned char* pData, int dataLength, int timeOutMS=-1);
+    int ReadAtLeast(unsigned char* pData, int minLength, int maxLength, int timeOutMS=-1);
+    int ReadAvailable(unsigned char* pData, int maxLength);
+    int ReadVector(const SERIALPORT_READ_BUFFER* pBuffers, int bufferCount, int minLength, int timeOutMS=-1);
+    int WriteLine(const char* pLine, bool addCRatEnd=true);
+    
+    //never waits, OnDataSentHandler once the queue is empty (and transmitted with waitForTransmit)
+    int QueueWrite(const unsigned char* pData, int dataLength, bool waitForTransmit=false);
+    int GetWriteQueueCount();
+    
+    //SERIALPORT_CRC_XXX appended to WriteBuffer and QueueWrite frames, not to transaction and Modbus frames
+    void SetWriteCrc(int crcType);
+    int GetWriteCrc();
+    
+    //byte rate and gaps of queued frames, see SerialPortWriteQueue.h
+    bool SetPacing(const TSerialPortPacing* pPacing);
+    void GetPacing(TSerialPortPacing* pPacing);
+    
+    //counters updated during ResetStatistics() may be lost
+    void GetStatistics(TSerialPortStatistics* pStatistics);
+    void ResetStatistics();
+    
+    //bytes beyond SERIALPORT_RECEIVE_BUFFER_SIZE nobody read are counted by GetReceiveOverflow
+    int GetReceivedCount();
+    unsigned int GetReceiveOverflow();
+    void ClearReceiveBuffer();
     
     
 };
 
-DWORD WINAPI SerialPort_WaitForData( LPVOID lpParam );
+void SerialPort_WaitForData( void* lpParam );
+void SerialPort_Reconnect( void* lpParam );
+BOOL SerialPort_ReceiveData( void* lpParam, BOOL deviceError );
+BOOL SerialPort_SendData( void* lpParam );
+SERIALPORT_TIMESTAMP SerialPort_SendPaced( void* lpParam );
+int SerialPort_SendRequest( void* pContext, const unsigned char* pData, int dataLength );
+void SerialPort_DispatchReceived( void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded );
+void SerialPort_DispatchTimed( void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded );
+void SerialPort_DispatchEvents( void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded );
+void SerialPort_Written( void* pContext, int bytesWritten, SERIALPORT_TIMESTAMP writeTime );
+void SerialPort_ModemChanged( void* pContext, unsigned int modemStatus, unsigned int changedLines );
 
 
 #endif
\ No newline at end of file
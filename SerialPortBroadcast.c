@@ -0,0 +1,308 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+
+#include "SerialPortBroadcast.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct TSerialPortSubscriber
+{
+    TSerialPortSubscriber* pNext;
+    TSerialPortBroadcast*  pBroadcast;
+    unsigned int           cursor;          //written by the subscriber only
+    unsigned int           waiting;
+    unsigned int           lapCount;
+    unsigned long long     lostBytes;
+    SERIALPORT_EVENT       dataEvent;
+};
+
+struct TSerialPortBroadcast
+{
+    unsigned char*         pBuffer;
+    unsigned int           capacity;
+    unsigned int           head;            //end of the committed data
+    unsigned int           reserved;        //end of the region the producer may be writing
+    unsigned int           waiterCount;
+    unsigned int           subscriberCount;
+    TSerialPortSubscriber* pSubscribers;
+    SERIALPORT_LOCK        lock;            //subscriber list
+};
+
+TSerialPortBroadcast* SerialPortBroadcast_Create(int capacity)
+{
+    TSerialPortBroadcast* pBroadcast;
+    unsigned int          ringCapacity = 256;
+
+    if ((capacity<=0) || (capacity>0x40000000)) return NULL;
+
+    while(ringCapacity<(unsigned int)capacity)
+    {
+        ringCapacity <<= 1;
+    }
+    pBroadcast = (TSerialPortBroadcast*)malloc(sizeof(TSerialPortBroadcast));
+    if (pBroadcast==NULL)
+    {
+        return NULL;
+    }
+    pBroadcast->pBuffer = (unsigned char*)malloc(ringCapacity);
+    if (pBroadcast->pBuffer==NULL)
+    {
+        free(pBroadcast);
+        return NULL;
+    }
+    pBroadcast->capacity        = ringCapacity;
+    pBroadcast->head            = 0;
+    pBroadcast->reserved        = 0;
+    pBroadcast->waiterCount     = 0;
+    pBroadcast->subscriberCount = 0;
+    pBroadcast->pSubscribers    = NULL;
+    SerialPortIO_InitLock(&pBroadcast->lock);
+    return pBroadcast;
+}
+
+void SerialPortBroadcast_Delete(TSerialPortBroadcast* pBroadcast)
+{
+    TSerialPortSubscriber* pSubscriber;
+
+    if (pBroadcast==NULL) return;
+
+    //subscribers left are freed with it
+    while(pBroadcast->pSubscribers)
+    {
+        pSubscriber = pBroadcast->pSubscribers;
+        pBroadcast->pSubscribers = pSubscriber->pNext;
+        SerialPortIO_DeleteEvent(&pSubscriber->dataEvent);
+        free(pSubscriber);
+    }
+    SerialPortIO_DeleteLock(&pBroadcast->lock);
+    free(pBroadcast->pBuffer);
+    free(pBroadcast);
+}
+
+int SerialPortBroadcast_GetSubscriberCount(TSerialPortBroadcast* pBroadcast)
+{
+    return (int)SERIALPORT_ATOMIC_LOAD(&pBroadcast->subscriberCount);
+}
+
+int SerialPortBroadcast_GetWriteBuffer(TSerialPortBroadcast* pBroadcast, unsigned char** ppData)
+{
+    unsigned int head   = pBroadcast->head;
+    unsigned int offset = head & (pBroadcast->capacity-1);
+    unsigned int length = pBroadcast->capacity - offset;
+
+    //a quarter at most, subscribers close behind are not lapped by one write
+    if (length>pBroadcast->capacity/4)
+    {
+        length = pBroadcast->capacity/4;
+    }
+    //subscribers must see the reservation before the data change
+    SERIALPORT_ATOMIC_STORE(&pBroadcast->reserved, head + length);
+    SERIALPORT_ATOMIC_FENCE();
+    *ppData = pBroadcast->pBuffer + offset;
+    return (int)length;
+}
+
+void SerialPortBroadcast_CommitWrite(TSerialPortBroadcast* pBroadcast, int dataLength)
+{
+    TSerialPortSubscriber* pSubscriber;
+    unsigned int           head = pBroadcast->head + (unsigned int)dataLength;
+
+    SERIALPORT_ATOMIC_STORE(&pBroadcast->head, head);
+    SERIALPORT_ATOMIC_STORE(&pBroadcast->reserved, head);
+    if ((dataLength>0) && SERIALPORT_ATOMIC_LOAD(&pBroadcast->waiterCount))
+    {
+        SerialPortIO_Lock(&pBroadcast->lock);
+        for(pSubscriber = pBroadcast->pSubscribers; pSubscriber; pSubscriber = pSubscriber->pNext)
+        {
+            if (SERIALPORT_ATOMIC_LOAD(&pSubscriber->waiting))
+            {
+                SerialPortIO_SetEvent(&pSubscriber->dataEvent);
+            }
+        }
+        SerialPortIO_Unlock(&pBroadcast->lock);
+    }
+}
+
+int SerialPortBroadcast_Write(TSerialPortBroadcast* pBroadcast, const unsigned char* pData, int dataLength)
+{
+    unsigned char* pWrite;
+    int            writeLength, bytesWritten = 0;
+
+    while(bytesWritten<dataLength)
+    {
+        writeLength = SerialPortBroadcast_GetWriteBuffer(pBroadcast, &pWrite);
+        if (writeLength>dataLength-bytesWritten)
+        {
+            writeLength = dataLength-bytesWritten;
+        }
+        memcpy(pWrite, pData+bytesWritten, writeLength);
+        SerialPortBroadcast_CommitWrite(pBroadcast, writeLength);
+        bytesWritten += writeLength;
+    }
+    return bytesWritten;
+}
+
+TSerialPortSubscriber* SerialPortBroadcast_Subscribe(TSerialPortBroadcast* pBroadcast)
+{
+    TSerialPortSubscriber* pSubscriber = (TSerialPortSubscriber*)malloc(sizeof(TSerialPortSubscriber));
+    if (pSubscriber==NULL)
+    {
+        return NULL;
+    }
+    if (!SerialPortIO_CreateEvent(&pSubscriber->dataEvent))
+    {
+        free(pSubscriber);
+        return NULL;
+    }
+    pSubscriber->pBroadcast = pBroadcast;
+    pSubscriber->waiting    = 0;
+    pSubscriber->lapCount   = 0;
+    pSubscriber->lostBytes  = 0;
+
+    SerialPortIO_Lock(&pBroadcast->lock);
+    pSubscriber->cursor = SERIALPORT_ATOMIC_LOAD(&pBroadcast->head);
+    pSubscriber->pNext  = pBroadcast->pSubscribers;
+    pBroadcast->pSubscribers = pSubscriber;
+    SERIALPORT_ATOMIC_INCREMENT(&pBroadcast->subscriberCount);
+    SerialPortIO_Unlock(&pBroadcast->lock);
+    return pSubscriber;
+}
+
+void SerialPortBroadcast_Unsubscribe(TSerialPortSubscriber* pSubscriber)
+{
+    TSerialPortBroadcast*   pBroadcast;
+    TSerialPortSubscriber** ppLink;
+
+    if (pSubscriber==NULL) return;
+
+    pBroadcast = pSubscriber->pBroadcast;
+    SerialPortIO_Lock(&pBroadcast->lock);
+    for(ppLink = &pBroadcast->pSubscribers; *ppLink; ppLink = &(*ppLink)->pNext)
+    {
+        if (*ppLink==pSubscriber)
+        {
+            *ppLink = pSubscriber->pNext;
+            SERIALPORT_ATOMIC_DECREMENT(&pBroadcast->subscriberCount);
+            break;
+        }
+    }
+    SerialPortIO_Unlock(&pBroadcast->lock);
+    SerialPortIO_DeleteEvent(&pSubscriber->dataEvent);
+    free(pSubscriber);
+}
+
+//a subscriber whose data are being overwritten skips to the newest ones
+static void SerialPortBroadcast__SkipLapped(TSerialPortSubscriber* pSubscriber)
+{
+    TSerialPortBroadcast* pBroadcast = pSubscriber->pBroadcast;
+    unsigned int          head;
+
+    if (SERIALPORT_ATOMIC_LOAD(&pBroadcast->reserved) - pSubscriber->cursor > pBroadcast->capacity)
+    {
+        head = SERIALPORT_ATOMIC_LOAD(&pBroadcast->head);
+        pSubscriber->lostBytes += head - pSubscriber->cursor;
+        pSubscriber->lapCount++;
+        SERIALPORT_ATOMIC_STORE(&pSubscriber->cursor, head);
+    }
+}
+
+int SerialPortBroadcast_GetReadBuffer(TSerialPortSubscriber* pSubscriber, const unsigned char** ppData)
+{
+    TSerialPortBroadcast* pBroadcast = pSubscriber->pBroadcast;
+    unsigned int          head, offset, length, contiguousLength;
+
+    SerialPortBroadcast__SkipLapped(pSubscriber);
+    head   = SERIALPORT_ATOMIC_LOAD_ACQUIRE(&pBroadcast->head);
+    offset = pSubscriber->cursor & (pBroadcast->capacity-1);
+    length = head - pSubscriber->cursor;
+    contiguousLength = pBroadcast->capacity - offset;
+
+    *ppData = pBroadcast->pBuffer + offset;
+    return (int)((length<contiguousLength) ? length : contiguousLength);
+}
+
+BOOL SerialPortBroadcast_CommitRead(TSerialPortSubscriber* pSubscriber, int dataLength)
+{
+    TSerialPortBroadcast* pBroadcast = pSubscriber->pBroadcast;
+    BOOL                  intact;
+
+    //the data were used before the reservation is checked
+    SERIALPORT_ATOMIC_FENCE();
+    intact = (SERIALPORT_ATOMIC_LOAD(&pBroadcast->reserved) - pSubscriber->cursor <= pBroadcast->capacity);
+    SERIALPORT_ATOMIC_STORE(&pSubscriber->cursor, pSubscriber->cursor + (unsigned int)dataLength);
+    return intact;
+}
+
+int SerialPortBroadcast_Read(TSerialPortSubscriber* pSubscriber, unsigned char* pData, int dataLength)
+{
+    const unsigned char* pRead;
+    int                  readLength, bytesRead = 0;
+
+    while(bytesRead<dataLength)
+    {
+        readLength = SerialPortBroadcast_GetReadBuffer(pSubscriber, &pRead);
+        if (readLength==0)
+        {
+            break;
+        }
+        if (readLength>dataLength-bytesRead)
+        {
+            readLength = dataLength-bytesRead;
+        }
+        memcpy(pData+bytesRead, pRead, readLength);
+        if (SerialPortBroadcast_CommitRead(pSubscriber, readLength))
+        {
+            bytesRead += readLength;
+        }
+    }
+    return bytesRead;
+}
+
+BOOL SerialPortBroadcast_Wait(TSerialPortSubscriber* pSubscriber, int timeOutMS)
+{
+    TSerialPortBroadcast* pBroadcast = pSubscriber->pBroadcast;
+
+    if (SerialPortBroadcast_GetLag(pSubscriber)>0)
+    {
+        return TRUE;
+    }
+    //the producer checks waiterCount after storing head, one of both sees the other
+    SERIALPORT_ATOMIC_STORE(&pSubscriber->waiting, 1);
+    SERIALPORT_ATOMIC_INCREMENT(&pBroadcast->waiterCount);
+    if (SerialPortBroadcast_GetLag(pSubscriber)==0)
+    {
+        SerialPortIO_WaitEvent(&pSubscriber->dataEvent, timeOutMS);
+    }
+    SERIALPORT_ATOMIC_DECREMENT(&pBroadcast->waiterCount);
+    SERIALPORT_ATOMIC_STORE(&pSubscriber->waiting, 0);
+    return (SerialPortBroadcast_GetLag(pSubscriber)>0);
+}
+
+int SerialPortBroadcast_GetLag(TSerialPortSubscriber* pSubscriber)
+{
+    return (int)(SERIALPORT_ATOMIC_LOAD(&pSubscriber->pBroadcast->head) - SERIALPORT_ATOMIC_LOAD(&pSubscriber->cursor));
+}
+
+unsigned long long SerialPortBroadcast_GetLostBytes(TSerialPortSubscriber* pSubscriber)
+{
+    return pSubscriber->lostBytes;
+}
+
+unsigned int SerialPortBroadcast_GetLapCount(TSerialPortSubscriber* pSubscriber)
+{
+    return pSubscriber->lapCount;
+}
@@ -0,0 +1,81 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+
+#ifndef SERIALPORTBROADCAST___H
+#define SERIALPORTBROADCAST___H
+
+#include "SerialPortIO.h"
+
+/*
+* Broadcast receive ring: one producer (the I/O thread of a port) and
+* any number of subscribers, each with its own read cursor. A received
+* chunk is stored once, every subscriber reads it in place.
+*
+* The producer never waits for subscribers, it overwrites the oldest
+* data. A subscriber which falls more than the capacity behind is
+* lapped: its next GetReadBuffer/Read skips to the newest data and the
+* skipped bytes are counted (GetLostBytes, GetLapCount). GetLag tells
+* how far behind a subscriber is before that happens. Other subscribers
+* are not affected by a slow one.
+*
+* GetReadBuffer returns a pointer into the ring, valid until the
+* producer laps the subscriber. CommitRead returns FALSE when that
+* happened while the data were being used (they may be overwritten,
+* discard the result). Read copies and checks the same way. The
+* producer writes at most a quarter of the capacity at once, so a
+* subscriber keeping within 3/4 of the capacity is never lapped.
+*
+* Subscribe and Unsubscribe may be called at any time from any thread,
+* a new subscriber starts with the data received after it subscribed.
+* The calls of one subscriber must come from one thread at a time.
+* Wait sleeps until new data arrive for the subscriber.
+*/
+
+#define SERIALPORT_DEFAULT_BROADCAST_SIZE 262144
+
+typedef struct TSerialPortBroadcast  TSerialPortBroadcast;
+typedef struct TSerialPortSubscriber TSerialPortSubscriber;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+TSerialPortBroadcast* SerialPortBroadcast_Create(int capacity);
+void    SerialPortBroadcast_Delete(TSerialPortBroadcast* pBroadcast);
+int     SerialPortBroadcast_GetSubscriberCount(TSerialPortBroadcast* pBroadcast);
+
+//producer side
+int     SerialPortBroadcast_GetWriteBuffer(TSerialPortBroadcast* pBroadcast, unsigned char** ppData);
+void    SerialPortBroadcast_CommitWrite(TSerialPortBroadcast* pBroadcast, int dataLength);
+int     SerialPortBroadcast_Write(TSerialPortBroadcast* pBroadcast, const unsigned char* pData, int dataLength);
+
+//subscriber side
+TSerialPortSubscriber* SerialPortBroadcast_Subscribe(TSerialPortBroadcast* pBroadcast);
+void    SerialPortBroadcast_Unsubscribe(TSerialPortSubscriber* pSubscriber);
+int     SerialPortBroadcast_GetReadBuffer(TSerialPortSubscriber* pSubscriber, const unsigned char** ppData);
+BOOL    SerialPortBroadcast_CommitRead(TSerialPortSubscriber* pSubscriber, int dataLength);
+int     SerialPortBroadcast_Read(TSerialPortSubscriber* pSubscriber, unsigned char* pData, int dataLength);
+BOOL    SerialPortBroadcast_Wait(TSerialPortSubscriber* pSubscriber, int timeOutMS);
+int     SerialPortBroadcast_GetLag(TSerialPortSubscriber* pSubscriber);
+unsigned long long SerialPortBroadcast_GetLostBytes(TSerialPortSubscriber* pSubscriber);
+unsigned int SerialPortBroadcast_GetLapCount(TSerialPortSubscriber* pSubscriber);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
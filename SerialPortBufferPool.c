@@ -0,0 +1,146 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#include "SerialPortBufferPool.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct TSerialPortBufferPool
+{
+    TSerialPortBuffer* volatile pFree;      //Treiber stack, single consumer so no ABA
+    volatile unsigned int freeCount;
+    volatile unsigned int refCount;         //owner + leased buffers
+    int                   bufferCount;
+    int                   bufferSize;
+    TSerialPortBuffer*    pBuffers;
+    unsigned char*        pMemory;
+};
+
+static void SerialPortBufferPool__Release(TSerialPortBufferPool* pPool)
+{
+    if (SERIALPORT_ATOMIC_DECREMENT(&pPool->refCount)==0)
+    {
+        free(pPool->pMemory);
+        free(pPool->pBuffers);
+        free(pPool);
+    }
+}
+
+TSerialPortBufferPool* SerialPortBufferPool_Create(int bufferCount, int bufferSize)
+{
+    TSerialPortBufferPool* pPool;
+    int                    i;
+
+    if ((bufferCount<=0) || (bufferSize<=0))
+    {
+        return NULL;
+    }
+    pPool = (TSerialPortBufferPool*)malloc(sizeof(TSerialPortBufferPool));
+    if (pPool==NULL)
+    {
+        return NULL;
+    }
+    memset(pPool, 0, sizeof(TSerialPortBufferPool));
+    pPool->pBuffers = (TSerialPortBuffer*)malloc(bufferCount*sizeof(TSerialPortBuffer));
+    pPool->pMemory  = (unsigned char*)malloc((size_t)bufferCount*bufferSize);
+    if ((pPool->pBuffers==NULL) || (pPool->pMemory==NULL))
+    {
+        free(pPool->pBuffers);
+        free(pPool->pMemory);
+        free(pPool);
+        return NULL;
+    }
+    pPool->bufferCount = bufferCount;
+    pPool->bufferSize  = bufferSize;
+    pPool->refCount    = 1;
+
+    for(i = bufferCount-1; i>=0; i--)
+    {
+        pPool->pBuffers[i].pData      = pPool->pMemory + (size_t)i*bufferSize;
+        pPool->pBuffers[i].dataLength = 0;
+        pPool->pBuffers[i].capacity   = bufferSize;
+        pPool->pBuffers[i].refCount   = 0;
+        pPool->pBuffers[i].pPool      = pPool;
+        pPool->pBuffers[i].pNext      = pPool->pFree;
+        pPool->pFree = &pPool->pBuffers[i];
+    }
+    pPool->freeCount = bufferCount;
+    return pPool;
+}
+
+void SerialPortBufferPool_Delete(TSerialPortBufferPool* pPool)
+{
+    if (pPool)
+    {
+        SerialPortBufferPool__Release(pPool);
+    }
+}
+
+TSerialPortBuffer* SerialPortBufferPool_Get(TSerialPortBufferPool* pPool)
+{
+    TSerialPortBuffer* pBuffer;
+    TSerialPortBuffer* pNext;
+
+    do
+    {
+        pBuffer = pPool->pFree;
+        if (pBuffer==NULL)
+        {
+            return NULL;
+        }
+        pNext = pBuffer->pNext;
+    } while(!SERIALPORT_ATOMIC_CAS_POINTER(&pPool->pFree, pBuffer, pNext));
+
+    SERIALPORT_ATOMIC_ADD(&pPool->freeCount, (unsigned int)-1);
+    SERIALPORT_ATOMIC_INCREMENT(&pPool->refCount);
+    pBuffer->pNext      = NULL;
+    pBuffer->dataLength = 0;
+    pBuffer->refCount   = 1;
+    return pBuffer;
+}
+
+int SerialPortBufferPool_GetFreeCount(TSerialPortBufferPool* pPool)
+{
+    return (int)SERIALPORT_ATOMIC_LOAD(&pPool->freeCount);
+}
+
+int SerialPortBufferPool_GetBufferSize(TSerialPortBufferPool* pPool)
+{
+    return pPool->bufferSize;
+}
+
+void SerialPortBuffer_AddRef(TSerialPortBuffer* pBuffer)
+{
+    SERIALPORT_ATOMIC_INCREMENT(&pBuffer->refCount);
+}
+
+void SerialPortBuffer_Release(TSerialPortBuffer* pBuffer)
+{
+    TSerialPortBufferPool* pPool = pBuffer->pPool;
+    TSerialPortBuffer*     pHead;
+
+    if (SERIALPORT_ATOMIC_DECREMENT(&pBuffer->refCount)!=0)
+    {
+        return;
+    }
+    do
+    {
+        pHead = pPool->pFree;
+        pBuffer->pNext = pHead;
+    } while(!SERIALPORT_ATOMIC_CAS_POINTER(&pPool->pFree, pHead, pBuffer));
+    SERIALPORT_ATOMIC_ADD(&pPool->freeCount, 1);
+    SerialPortBufferPool__Release(pPool);
+}
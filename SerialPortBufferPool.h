@@ -0,0 +1,67 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef SERIALPORTBUFFERPOOL___H
+#define SERIALPORTBUFFERPOOL___H
+
+#include "SerialPortIO.h"
+
+/*
+* Preallocated pool of receive buffers. The I/O thread is the only one
+* taking buffers (SerialPortBufferPool_Get), any thread can give them
+* back by SerialPortBuffer_Release, so no lock is needed.
+*
+* A buffer handed to OnBufferReceivedHandler is leased: the port
+* releases its reference when the handler returns, a handler keeping
+* the data for later calls SerialPortBuffer_AddRef and releases the
+* buffer once it is done. The pool itself lives until the owner deletes
+* it and the last leased buffer is released.
+*/
+
+#define SERIALPORT_DEFAULT_BUFFER_COUNT 32
+#define SERIALPORT_DEFAULT_BUFFER_SIZE  4096
+
+typedef struct TSerialPortBufferPool TSerialPortBufferPool;
+
+typedef struct TSerialPortBuffer
+{
+    unsigned char*            pData;
+    int                       dataLength;
+    int                       capacity;
+    SERIALPORT_TIMESTAMP      receiveTime;
+    volatile unsigned int     refCount;
+    TSerialPortBufferPool*    pPool;
+    struct TSerialPortBuffer* pNext;
+} TSerialPortBuffer;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+TSerialPortBufferPool* SerialPortBufferPool_Create(int bufferCount, int bufferSize);
+void    SerialPortBufferPool_Delete(TSerialPortBufferPool* pPool);
+TSerialPortBuffer* SerialPortBufferPool_Get(TSerialPortBufferPool* pPool);
+int     SerialPortBufferPool_GetFreeCount(TSerialPortBufferPool* pPool);
+int     SerialPortBufferPool_GetBufferSize(TSerialPortBufferPool* pPool);
+
+void    SerialPortBuffer_AddRef(TSerialPortBuffer* pBuffer);
+void    SerialPortBuffer_Release(TSerialPortBuffer* pBuffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
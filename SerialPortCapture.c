@@ -0,0 +1,433 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+
+#include "SerialPortCapture.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define SERIALPORT_CAPTURE_INITIAL_SIZE  (1<<20)
+#define SERIALPORT_CAPTURE_MAX_GROWTH    (1<<28)    //the mapping grows by 256 MB at most
+#define SERIALPORT_CAPTURE_ALIGN(length) (((unsigned long long)(length)+7) & ~7ULL)
+
+//a whole file mapped into memory
+typedef struct
+{
+#ifdef _WIN32
+    HANDLE              fileHandle;
+    HANDLE              mappingHandle;
+#else
+    int                 fileHandle;
+#endif
+    unsigned char*      pData;
+    unsigned long long  size;
+} TSerialPortMapping;
+
+struct TSerialPortCapture
+{
+    TSerialPortMapping   mapping;
+    unsigned long long   maxFileSize;
+    unsigned long long   offset;            //end of the records written
+    unsigned long long   droppedCount;
+    SERIALPORT_TIMESTAMP startTime;
+    SERIALPORT_LOCK      lock;
+};
+
+struct TSerialPortCaptureLog
+{
+    TSerialPortMapping   mapping;
+    unsigned long long   end;
+    unsigned long long   offset;
+};
+
+#ifdef _WIN32
+
+static BOOL SerialPortCapture__OpenFile(TSerialPortMapping* pMapping, const char* fileName, BOOL writable)
+{
+    DWORD sizeLow, sizeHigh;
+
+    pMapping->mappingHandle = NULL;
+    pMapping->pData = NULL;
+    pMapping->fileHandle = CreateFileA(fileName, writable ? GENERIC_READ|GENERIC_WRITE : GENERIC_READ,
+                                       writable ? FILE_SHARE_READ : FILE_SHARE_READ|FILE_SHARE_WRITE, NULL,
+                                       writable ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (pMapping->fileHandle==INVALID_HANDLE_VALUE)
+    {
+        return FALSE;
+    }
+    sizeLow = GetFileSize(pMapping->fileHandle, &sizeHigh);
+    pMapping->size = ((unsigned long long)sizeHigh<<32) | sizeLow;
+    return TRUE;
+}
+
+static void SerialPortCapture__CloseFile(TSerialPortMapping* pMapping, BOOL truncate, unsigned long long size)
+{
+    LONG sizeHigh = (LONG)(size>>32);
+
+    if (truncate)
+    {
+        SetFilePointer(pMapping->fileHandle, (LONG)(size & 0xFFFFFFFF), &sizeHigh, FILE_BEGIN);
+        SetEndOfFile(pMapping->fileHandle);
+    }
+    CloseHandle(pMapping->fileHandle);
+}
+
+//maps size bytes, a writable file is extended to size
+static BOOL SerialPortCapture__Map(TSerialPortMapping* pMapping, unsigned long long size, BOOL writable)
+{
+    if ((size==0) || (size!=(unsigned long long)(SIZE_T)size))
+    {
+        return FALSE;
+    }
+    pMapping->mappingHandle = CreateFileMapping(pMapping->fileHandle, NULL, writable ? PAGE_READWRITE : PAGE_READONLY,
+                                                (DWORD)(size>>32), (DWORD)(size & 0xFFFFFFFF), NULL);
+    if (pMapping->mappingHandle==NULL)
+    {
+        return FALSE;
+    }
+    pMapping->pData = (unsigned char*)MapViewOfFile(pMapping->mappingHandle, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, (SIZE_T)size);
+    if (pMapping->pData==NULL)
+    {
+        CloseHandle(pMapping->mappingHandle);
+        pMapping->mappingHandle = NULL;
+        return FALSE;
+    }
+    pMapping->size = size;
+    return TRUE;
+}
+
+static void SerialPortCapture__Unmap(TSerialPortMapping* pMapping)
+{
+    if (pMapping->pData)
+    {
+        UnmapViewOfFile(pMapping->pData);
+        CloseHandle(pMapping->mappingHandle);
+        pMapping->pData = NULL;
+        pMapping->mappingHandle = NULL;
+    }
+}
+
+#else
+
+static BOOL SerialPortCapture__OpenFile(TSerialPortMapping* pMapping, const char* fileName, BOOL writable)
+{
+    struct stat fileStatus;
+
+    pMapping->pData = NULL;
+    pMapping->fileHandle = writable ? open(fileName, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644) : open(fileName, O_RDONLY|O_CLOEXEC);
+    if (pMapping->fileHandle<0)
+    {
+        return FALSE;
+    }
+    if (fstat(pMapping->fileHandle, &fileStatus)!=0)
+    {
+        close(pMapping->fileHandle);
+        return FALSE;
+    }
+    pMapping->size = (unsigned long long)fileStatus.st_size;
+    return TRUE;
+}
+
+static void SerialPortCapture__CloseFile(TSerialPortMapping* pMapping, BOOL truncate, unsigned long long size)
+{
+    if (truncate)
+    {
+        while((ftruncate(pMapping->fileHandle, (off_t)size)!=0) && (errno==EINTR));
+    }
+    close(pMapping->fileHandle);
+}
+
+//maps size bytes, a writable file is extended to size
+static BOOL SerialPortCapture__Map(TSerialPortMapping* pMapping, unsigned long long size, BOOL writable)
+{
+    void* pData;
+
+    if ((size==0) || (size!=(unsigned long long)(size_t)size))
+    {
+        return FALSE;
+    }
+    if (writable && (ftruncate(pMapping->fileHandle, (off_t)size)!=0))
+    {
+        return FALSE;
+    }
+    pData = mmap(NULL, (size_t)size, writable ? PROT_READ|PROT_WRITE : PROT_READ, MAP_SHARED, pMapping->fileHandle, 0);
+    if (pData==MAP_FAILED)
+    {
+        return FALSE;
+    }
+    pMapping->pData = (unsigned char*)pData;
+    pMapping->size = size;
+    return TRUE;
+}
+
+static void SerialPortCapture__Unmap(TSerialPortMapping* pMapping)
+{
+    if (pMapping->pData)
+    {
+        munmap(pMapping->pData, (size_t)pMapping->size);
+        pMapping->pData = NULL;
+    }
+}
+
+#endif
+
+//makes room for recordLength more bytes, called locked
+static BOOL SerialPortCapture__Reserve(TSerialPortCapture* pCapture, unsigned long long recordLength)
+{
+    unsigned long long requiredSize = pCapture->offset+recordLength;
+    unsigned long long oldSize = pCapture->mapping.size;
+    unsigned long long newSize = oldSize;
+
+    if (requiredSize<=oldSize)
+    {
+        return (pCapture->mapping.pData!=NULL);
+    }
+    if ((pCapture->maxFileSize>0) && (requiredSize>pCapture->maxFileSize))
+    {
+        return FALSE;
+    }
+    while(newSize<requiredSize)
+    {
+        newSize += (newSize<SERIALPORT_CAPTURE_MAX_GROWTH) ? newSize : SERIALPORT_CAPTURE_MAX_GROWTH;
+    }
+    if ((pCapture->maxFileSize>0) && (newSize>pCapture->maxFileSize))
+    {
+        newSize = pCapture->maxFileSize;
+    }
+    SerialPortCapture__Unmap(&pCapture->mapping);
+    if (SerialPortCapture__Map(&pCapture->mapping, newSize, TRUE))
+    {
+        return TRUE;
+    }
+    //out of disk or address space, the records so far stay
+    SerialPortCapture__Map(&pCapture->mapping, oldSize, TRUE);
+    return FALSE;
+}
+
+TSerialPortCapture* SerialPortCapture_Create(const char* fileName, unsigned long long maxFileSize)
+{
+    TSerialPortCapture*       pCapture;
+    TSerialPortCaptureHeader* pHeader;
+    unsigned long long        initialSize = SERIALPORT_CAPTURE_INITIAL_SIZE;
+
+    if (fileName==NULL) return NULL;
+    if ((maxFileSize>0) && (maxFileSize<sizeof(TSerialPortCaptureHeader))) return NULL;
+
+    pCapture = (TSerialPortCapture*)malloc(sizeof(TSerialPortCapture));
+    if (pCapture==NULL)
+    {
+        return NULL;
+    }
+    memset(pCapture, 0, sizeof(TSerialPortCapture));
+    if (!SerialPortCapture__OpenFile(&pCapture->mapping, fileName, TRUE))
+    {
+        free(pCapture);
+        return NULL;
+    }
+    if ((maxFileSize>0) && (initialSize>maxFileSize))
+    {
+        initialSize = maxFileSize;
+    }
+    if (!SerialPortCapture__Map(&pCapture->mapping, initialSize, TRUE))
+    {
+        SerialPortCapture__CloseFile(&pCapture->mapping, FALSE, 0);
+        free(pCapture);
+        return NULL;
+    }
+    pCapture->maxFileSize = maxFileSize;
+    pCapture->offset      = sizeof(TSerialPortCaptureHeader);
+    pCapture->startTime   = SerialPortIO_GetTime();
+
+    pHeader = (TSerialPortCaptureHeader*)pCapture->mapping.pData;
+    memcpy(pHeader->magic, SERIALPORT_CAPTURE_MAGIC, sizeof(pHeader->magic));
+    pHeader->version    = SERIALPORT_CAPTURE_VERSION;
+    pHeader->headerSize = sizeof(TSerialPortCaptureHeader);
+    pHeader->dataLength = 0;
+    pHeader->startTime  = pCapture->startTime;
+    SerialPortIO_InitLock(&pCapture->lock);
+    return pCapture;
+}
+
+void SerialPortCapture_Delete(TSerialPortCapture* pCapture)
+{
+    if (pCapture==NULL) return;
+
+    if (pCapture->mapping.pData)
+    {
+        ((TSerialPortCaptureHeader*)pCapture->mapping.pData)->dataLength = pCapture->offset-sizeof(TSerialPortCaptureHeader);
+    }
+    SerialPortCapture__Unmap(&pCapture->mapping);
+    SerialPortCapture__CloseFile(&pCapture->mapping, TRUE, pCapture->offset);
+    SerialPortIO_DeleteLock(&pCapture->lock);
+    free(pCapture);
+}
+
+void SerialPortCapture_Append(TSerialPortCapture* pCapture, int direction, const unsigned char* pData, int dataLength)
+{
+    SERIALPORT_BUFFER buffer;
+
+    buffer.pData      = pData;
+    buffer.dataLength = dataLength;
+    SerialPortCapture_AppendVector(pCapture, direction, &buffer, 1, dataLength);
+}
+
+//dataLength bytes from the start of pBuffers (a partially written vector)
+void SerialPortCapture_AppendVector(TSerialPortCapture* pCapture, int direction, const SERIALPORT_BUFFER* pBuffers, int bufferCount, int dataLength)
+{
+    TSerialPortCaptureRecord* pRecord;
+    unsigned char*            pWrite;
+    unsigned long long        recordLength;
+    int                       length, i;
+
+    if (dataLength<=0) return;
+
+    recordLength = SERIALPORT_CAPTURE_ALIGN(sizeof(TSerialPortCaptureRecord)+dataLength);
+    SerialPortIO_Lock(&pCapture->lock);
+    if (!SerialPortCapture__Reserve(pCapture, recordLength))
+    {
+        pCapture->droppedCount++;
+        SerialPortIO_Unlock(&pCapture->lock);
+        return;
+    }
+    //taken under the lock, so timestamps never go back in the file
+    pRecord = (TSerialPortCaptureRecord*)(pCapture->mapping.pData+pCapture->offset);
+    pRecord->timestamp  = SerialPortIO_GetTime()-pCapture->startTime;
+    pRecord->dataLength = (unsigned int)dataLength;
+    pRecord->direction  = (unsigned short)direction;
+    pRecord->reserved   = 0;
+    pWrite = (unsigned char*)(pRecord+1);
+    for(i = 0; (i<bufferCount) && (dataLength>0); i++)
+    {
+        length = (pBuffers[i].dataLength<dataLength) ? pBuffers[i].dataLength : dataLength;
+        memcpy(pWrite, pBuffers[i].pData, length);
+        pWrite += length;
+        dataLength -= length;
+    }
+    pCapture->offset += recordLength;
+    SerialPortIO_Unlock(&pCapture->lock);
+}
+
+unsigned long long SerialPortCapture_GetLength(TSerialPortCapture* pCapture)
+{
+    unsigned long long result;
+
+    SerialPortIO_Lock(&pCapture->lock);
+    result = pCapture->offset;
+    SerialPortIO_Unlock(&pCapture->lock);
+    return result;
+}
+
+unsigned long long SerialPortCapture_GetDroppedCount(TSerialPortCapture* pCapture)
+{
+    unsigned long long result;
+
+    SerialPortIO_Lock(&pCapture->lock);
+    result = pCapture->droppedCount;
+    SerialPortIO_Unlock(&pCapture->lock);
+    return result;
+}
+
+TSerialPortCaptureLog* SerialPortCaptureLog_Open(const char* fileName)
+{
+    TSerialPortCaptureLog*          pLog;
+    const TSerialPortCaptureHeader* pHeader;
+
+    if (fileName==NULL) return NULL;
+
+    pLog = (TSerialPortCaptureLog*)malloc(sizeof(TSerialPortCaptureLog));
+    if (pLog==NULL)
+    {
+        return NULL;
+    }
+    if (!SerialPortCapture__OpenFile(&pLog->mapping, fileName, FALSE))
+    {
+        free(pLog);
+        return NULL;
+    }
+    if ((pLog->mapping.size<sizeof(TSerialPortCaptureHeader)) || 
+        (!SerialPortCapture__Map(&pLog->mapping, pLog->mapping.size, FALSE)))
+    {
+        SerialPortCapture__CloseFile(&pLog->mapping, FALSE, 0);
+        free(pLog);
+        return NULL;
+    }
+    pHeader = (const TSerialPortCaptureHeader*)pLog->mapping.pData;
+    if ((memcmp(pHeader->magic, SERIALPORT_CAPTURE_MAGIC, sizeof(pHeader->magic))!=0) ||
+        (pHeader->version!=SERIALPORT_CAPTURE_VERSION) || 
+        (pHeader->headerSize<sizeof(TSerialPortCaptureHeader)) || (pHeader->headerSize>pLog->mapping.size))
+    {
+        SerialPortCaptureLog_Close(pLog);
+        return NULL;
+    }
+    //a log of a capture still running or never deleted ends at the first empty record
+    pLog->end = pLog->mapping.size;
+    if ((pHeader->dataLength>0) && (pHeader->dataLength<=pLog->mapping.size-pHeader->headerSize))
+    {
+        pLog->end = pHeader->headerSize+pHeader->dataLength;
+    }
+    pLog->offset = pHeader->headerSize;
+    return pLog;
+}
+
+void SerialPortCaptureLog_Close(TSerialPortCaptureLog* pLog)
+{
+    if (pLog==NULL) return;
+
+    SerialPortCapture__Unmap(&pLog->mapping);
+    SerialPortCapture__CloseFile(&pLog->mapping, FALSE, 0);
+    free(pLog);
+}
+
+//the next record, its data follow it in the mapping, NULL at the end
+const TSerialPortCaptureRecord* SerialPortCaptureLog_Next(TSerialPortCaptureLog* pLog)
+{
+    const TSerialPortCaptureRecord* pRecord;
+
+    if (pLog->offset+sizeof(TSerialPortCaptureRecord)>pLog->end)
+    {
+        return NULL;
+    }
+    pRecord = (const TSerialPortCaptureRecord*)(pLog->mapping.pData+pLog->offset);
+    if ((pRecord->dataLength==0) || (pRecord->dataLength>pLog->end-pLog->offset-sizeof(TSerialPortCaptureRecord)))
+    {
+        return NULL;
+    }
+    pLog->offset += SERIALPORT_CAPTURE_ALIGN(sizeof(TSerialPortCaptureRecord)+pRecord->dataLength);
+    return pRecord;
+}
+
+void SerialPortCaptureLog_Rewind(TSerialPortCaptureLog* pLog)
+{
+    pLog->offset = ((const TSerialPortCaptureHeader*)pLog->mapping.pData)->headerSize;
+}
+
+unsigned long long SerialPortCaptureLog_GetStartTime(TSerialPortCaptureLog* pLog)
+{
+    return ((const TSerialPortCaptureHeader*)pLog->mapping.pData)->startTime;
+}
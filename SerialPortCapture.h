@@ -0,0 +1,90 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+
+#ifndef SERIALPORTCAPTURE___H
+#define SERIALPORTCAPTURE___H
+
+#include "SerialPortIO.h"
+
+/*
+* Capture of the raw traffic of one or more ports into a memory-mapped
+* binary log. A port with a capture (SetCapture) appends every chunk its
+* device reads or writes, tagged with the direction and the monotonic
+* time in microseconds since the capture was created. Appending is a
+* memcpy into the mapping under a short lock, the file grows by doubling
+* its mapping. Chunks which would exceed maxFileSize (0 = no limit) are
+* dropped and counted.
+*
+* The file is a TSerialPortCaptureHeader followed by records aligned to
+* 8 bytes, each a TSerialPortCaptureRecord followed by its data. Delete
+* trims the file to the records written. After a crash the rest of the
+* file is zero and readers stop at the first record of length 0.
+*
+* SerialPortCaptureLog maps a log read-only and walks its records
+* without copying, SerialPortReplay.h sends them to a port again.
+*/
+
+#define SERIALPORT_CAPTURE_RX  0    //read from the device
+#define SERIALPORT_CAPTURE_TX  1    //written to the device
+
+#define SERIALPORT_CAPTURE_MAGIC    "SPCAPTUR"
+#define SERIALPORT_CAPTURE_VERSION  1
+
+typedef struct
+{
+    char               magic[8];
+    unsigned int       version;
+    unsigned int       headerSize;
+    unsigned long long dataLength;      //bytes of records, 0 while capturing
+    unsigned long long startTime;       //SerialPortIO_GetTime when created
+} TSerialPortCaptureHeader;
+
+typedef struct
+{
+    unsigned long long timestamp;       //microseconds since startTime
+    unsigned int       dataLength;
+    unsigned short     direction;
+    unsigned short     reserved;
+} TSerialPortCaptureRecord;
+
+#define SERIALPORT_CAPTURE_DATA(pRecord) ((const unsigned char*)((pRecord)+1))
+
+typedef struct TSerialPortCapture    TSerialPortCapture;
+typedef struct TSerialPortCaptureLog TSerialPortCaptureLog;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+TSerialPortCapture* SerialPortCapture_Create(const char* fileName, unsigned long long maxFileSize);
+void    SerialPortCapture_Delete(TSerialPortCapture* pCapture);
+void    SerialPortCapture_Append(TSerialPortCapture* pCapture, int direction, const unsigned char* pData, int dataLength);
+void    SerialPortCapture_AppendVector(TSerialPortCapture* pCapture, int direction, const SERIALPORT_BUFFER* pBuffers, int bufferCount, int dataLength);
+unsigned long long SerialPortCapture_GetLength(TSerialPortCapture* pCapture);
+unsigned long long SerialPortCapture_GetDroppedCount(TSerialPortCapture* pCapture);
+
+TSerialPortCaptureLog* SerialPortCaptureLog_Open(const char* fileName);
+void    SerialPortCaptureLog_Close(TSerialPortCaptureLog* pLog);
+const TSerialPortCaptureRecord* SerialPortCaptureLog_Next(TSerialPortCaptureLog* pLog);
+void    SerialPortCaptureLog_Rewind(TSerialPortCaptureLog* pLog);
+unsigned long long SerialPortCaptureLog_GetStartTime(TSerialPortCaptureLog* pLog);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
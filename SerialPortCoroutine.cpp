@@ -0,0 +1,435 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+
+#include "SerialPortCoroutine.hpp"
+#include <string.h>
+
+#ifdef SERIALPORT_COROUTINES
+
+//resumes a spawned coroutine for the first time
+class TSerialPortStartOperation : public TSerialPortOperation
+{
+private:
+    std::coroutine_handle<> m_handle;
+    
+public:
+    explicit TSerialPortStartOperation(std::coroutine_handle<> handle) : m_handle(handle) {}
+    void OnPosted() override
+    {
+        std::coroutine_handle<> handle = m_handle;
+        delete this;
+        handle.resume();
+    }
+};
+
+TSerialPortAwaitable::TSerialPortAwaitable(TSerialPortLoop* pLoop)
+{
+    m_pLoop = pLoop;
+    m_result = 0;
+    memset(&m_timer.timer, 0, sizeof(m_timer.timer));
+    m_timer.pOperation = this;
+}
+
+void TSerialPortAwaitable::__StartTimer(int timeOutMS)
+{
+    if (timeOutMS>=0)
+    {
+        m_pLoop->AddTimer(&m_timer, timeOutMS);
+    }
+}
+
+void TSerialPortAwaitable::Complete(int result)
+{
+    m_pLoop->RemoveTimer(&m_timer);
+    m_result = result;
+    //the awaitable lives in the coroutine frame, it may be gone after resume
+    m_handle.resume();
+}
+
+void TSerialPortDelayAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+    m_handle = handle;
+    __StartTimer(m_timeMS);
+}
+
+TSerialPortReadAwaitable::TSerialPortReadAwaitable(TSerialPortStream* pStream, unsigned char* pData, int dataLength, const char* delimiters, int timeOutMS)
+    : TSerialPortAwaitable(pStream->m_pLoop)
+{
+    m_pStream    = pStream;
+    m_pData      = pData;
+    m_dataLength = dataLength;
+    m_delimiters = delimiters;
+    m_timeOutMS  = timeOutMS;
+    m_bytesRead  = 0;
+}
+
+bool TSerialPortReadAwaitable::await_ready()
+{
+    if (m_pStream->m_pRead)
+    {
+        m_result = -1;
+        return true;
+    }
+    return m_pStream->__Read(this, m_timeOutMS==0);
+}
+
+bool TSerialPortReadAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+    //data arriving from now on post the stream, the loop thread sees m_pRead then
+    m_handle = handle;
+    m_pStream->m_pRead = this;
+    __StartTimer(m_timeOutMS);
+    return true;
+}
+
+void TSerialPortReadAwaitable::OnTimeout()
+{
+    m_pStream->m_pRead = NULL;
+    m_pStream->__Read(this, true);
+    Complete(m_result);
+}
+
+TSerialPortWriteAwaitable::TSerialPortWriteAwaitable(TSerialPortStream* pStream, const unsigned char* pData, int dataLength)
+    : TSerialPortAwaitable(pStream->m_pLoop)
+{
+    m_pStream    = pStream;
+    m_pData      = pData;
+    m_dataLength = dataLength;
+    m_pNextWrite = NULL;
+}
+
+bool TSerialPortWriteAwaitable::await_ready()
+{
+    m_result = m_pStream->m_pPort->QueueWrite(m_pData, m_dataLength);
+    return (m_result<=0) || (m_pStream->m_pPort->GetWriteQueueCount()==0);
+}
+
+bool TSerialPortWriteAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+    m_handle = handle;
+    if (m_pStream->m_pPort->GetWriteQueueCount()==0)
+    {
+        return false;
+    }
+    //SERIALPORT_NOTIFY_SENT once the queue is empty completes it
+    m_pNextWrite = m_pStream->m_pWrites;
+    m_pStream->m_pWrites = this;
+    return true;
+}
+
+TSerialPortTransactAwaitable::TSerialPortTransactAwaitable(TSerialPortStream* pStream, TSerialPortTransaction* pTransaction)
+    : TSerialPortAwaitable(pStream->m_pLoop)
+{
+    m_pStream      = pStream;
+    m_pTransaction = pTransaction;
+}
+
+void TSerialPortTransactAwaitable::__OnCompleted(TSerialPortTransaction* pTransaction)
+{
+    TSerialPortTransactAwaitable* pAwaitable = (TSerialPortTransactAwaitable*)pTransaction->pContext;
+    
+    //any thread, the coroutine goes on on the loop thread
+    pAwaitable->m_pLoop->Post(pAwaitable);
+}
+
+bool TSerialPortTransactAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+    TSerialPortTransactions* pTransactions = m_pStream->m_pPort->GetTransactions();
+    
+    m_handle = handle;
+    m_result = SERIALPORT_TRANSACTION_FAILED;
+    if (pTransactions==NULL)
+    {
+        return false;
+    }
+    m_pTransaction->onCompleted = __OnCompleted;
+    m_pTransaction->pContext    = this;
+    return SerialPortTransactions_Submit(pTransactions, m_pTransaction)!=FALSE;
+}
+
+void SerialPortLoop_Run(void* lpParam)
+{
+    TSerialPortLoop*      pLoop = (TSerialPortLoop*)lpParam;
+    TSerialPortOperation* pOperation;
+    TSerialPortTimer*     pTimer;
+    TSerialPortTimer*     pNextTimer;
+    bool                  idle;
+    
+    while(!SERIALPORT_ATOMIC_LOAD(&pLoop->m_stopping))
+    {
+        //one at a time, so Cancel knows whether an operation may still run
+        for(;;)
+        {
+            SerialPortIO_Lock(&pLoop->m_lock);
+            pOperation = pLoop->m_pPostedHead;
+            if (pOperation)
+            {
+                pLoop->m_pPostedHead = pOperation->m_pNext;
+                if (pLoop->m_pPostedHead==NULL)
+                {
+                    pLoop->m_pPostedTail = NULL;
+                }
+                SERIALPORT_ATOMIC_STORE(&pOperation->m_posted, 0);
+            }
+            pLoop->m_pRunning = pOperation;
+            SerialPortIO_Unlock(&pLoop->m_lock);
+            if (pOperation==NULL)
+            {
+                break;
+            }
+            pOperation->OnPosted();
+        }
+        
+        pTimer = SerialPortTimerWheel_Advance(&pLoop->m_timers, SerialPortIO_GetTime());
+        while(pTimer)
+        {
+            pNextTimer = pTimer->pNext;
+            ((TSerialPortLoopTimer*)pTimer)->pOperation->OnTimeout();
+            pTimer = pNextTimer;
+        }
+        
+        SerialPortIO_Lock(&pLoop->m_lock);
+        idle = (pLoop->m_pPostedHead==NULL);
+        SerialPortIO_Unlock(&pLoop->m_lock);
+        if (idle)
+        {
+            SerialPortIO_WaitEvent(&pLoop->m_wakeEvent, SerialPortTimerWheel_GetNextTimeout(&pLoop->m_timers, SerialPortIO_GetTime()));
+        }
+    }
+}
+
+TSerialPortLoop::TSerialPortLoop()
+{
+    m_threadStarted = false;
+    m_stopping = 0;
+    m_pPostedHead = NULL;
+    m_pPostedTail = NULL;
+    m_pRunning = NULL;
+    SerialPortIO_CreateEvent(&m_wakeEvent);
+    SerialPortIO_InitLock(&m_lock);
+    SerialPortTimerWheel_Init(&m_timers, 1000);
+}
+
+TSerialPortLoop::~TSerialPortLoop()
+{
+    Stop();
+    SerialPortIO_DeleteLock(&m_lock);
+    SerialPortIO_DeleteEvent(&m_wakeEvent);
+}
+
+bool TSerialPortLoop::Start()
+{
+    if (m_threadStarted) return true;
+    
+    m_stopping = 0;
+    m_threadStarted = SerialPortIO_StartThread(&m_thread, SerialPortLoop_Run, this)!=FALSE;
+    return m_threadStarted;
+}
+
+void TSerialPortLoop::Stop()
+{
+    if (m_threadStarted)
+    {
+        SERIALPORT_ATOMIC_STORE(&m_stopping, 1);
+        SerialPortIO_SetEvent(&m_wakeEvent);
+        SerialPortIO_JoinThread(&m_thread);
+        m_threadStarted = false;
+    }
+}
+
+bool TSerialPortLoop::IsLoopThread()
+{
+    return m_threadStarted && SerialPortIO_IsCurrentThread(&m_thread);
+}
+
+void TSerialPortLoop::Post(TSerialPortOperation* pOperation)
+{
+    bool wasEmpty;
+    
+    if (SERIALPORT_ATOMIC_EXCHANGE(&pOperation->m_posted, 1))
+    {
+        return;
+    }
+    SerialPortIO_Lock(&m_lock);
+    pOperation->m_pNext = NULL;
+    wasEmpty = (m_pPostedHead==NULL);
+    if (wasEmpty)
+    {
+        m_pPostedHead = pOperation;
+    } else {
+        m_pPostedTail->m_pNext = pOperation;
+    }
+    m_pPostedTail = pOperation;
+    SerialPortIO_Unlock(&m_lock);
+    if (wasEmpty)
+    {
+        SerialPortIO_SetEvent(&m_wakeEvent);
+    }
+}
+
+//returns once the operation is neither posted nor running on the loop thread
+void TSerialPortLoop::Cancel(TSerialPortOperation* pOperation)
+{
+    TSerialPortOperation** ppOperation;
+    TSerialPortOperation*  pPrevious;
+    bool                   running;
+    
+    for(;;)
+    {
+        SerialPortIO_Lock(&m_lock);
+        pPrevious = NULL;
+        for(ppOperation = &m_pPostedHead; *ppOperation; ppOperation = &(*ppOperation)->m_pNext)
+        {
+            if (*ppOperation==pOperation)
+            {
+                *ppOperation = pOperation->m_pNext;
+                if (m_pPostedTail==pOperation)
+                {
+                    m_pPostedTail = pPrevious;
+                }
+                SERIALPORT_ATOMIC_STORE(&pOperation->m_posted, 0);
+                break;
+            }
+            pPrevious = *ppOperation;
+        }
+        running = (m_pRunning==pOperation);
+        SerialPortIO_Unlock(&m_lock);
+        if ((!running) || IsLoopThread())
+        {
+            break;
+        }
+        SerialPortIO_Sleep(SERIALPORT_INTERNAL_TIMEOUT);
+    }
+}
+
+void TSerialPortLoop::Spawn(TSerialPortTask<void>&& task)
+{
+    Post(new TSerialPortStartOperation(task.Detach()));
+}
+
+void TSerialPortLoop::AddTimer(TSerialPortLoopTimer* pTimer, int timeOutMS)
+{
+    SerialPortTimerWheel_Add(&m_timers, &pTimer->timer, SerialPortIO_GetTime()+(SERIALPORT_TIMESTAMP)timeOutMS*1000);
+}
+
+void TSerialPortLoop::RemoveTimer(TSerialPortLoopTimer* pTimer)
+{
+    SerialPortTimerWheel_Remove(&m_timers, &pTimer->timer);
+}
+
+TSerialPortStream::TSerialPortStream(TSerialPort* pPort, TSerialPortLoop* pLoop)
+{
+    m_pPort = pPort;
+    m_pLoop = pLoop;
+    m_notification.m_pStream = this;
+    m_sent = 0;
+    m_closed = 0;
+    m_pRead = NULL;
+    m_pWrites = NULL;
+    m_pPort->SetNotifyHandler(__OnNotify, this);
+}
+
+TSerialPortStream::~TSerialPortStream()
+{
+    m_pPort->SetNotifyHandler(NULL, NULL);
+    m_pLoop->Cancel(&m_notification);
+}
+
+//I/O thread of the port
+void TSerialPortStream::__OnNotify(void* pContext, int notification)
+{
+    TSerialPortStream* pStream = (TSerialPortStream*)pContext;
+    
+    if (notification==SERIALPORT_NOTIFY_SENT)
+    {
+        SERIALPORT_ATOMIC_STORE(&pStream->m_sent, 1);
+    } else if (notification==SERIALPORT_NOTIFY_CLOSED) {
+        SERIALPORT_ATOMIC_STORE(&pStream->m_closed, 1);
+    }
+    pStream->m_pLoop->Post(&pStream->m_notification);
+}
+
+void TSerialPortStream::__OnNotified()
+{
+    TSerialPortReadAwaitable*  pRead = NULL;
+    TSerialPortWriteAwaitable* pWrite = NULL;
+    TSerialPortWriteAwaitable* pNextWrite;
+    bool                       closed = SERIALPORT_ATOMIC_EXCHANGE(&m_closed, 0)!=0;
+    bool                       sent   = SERIALPORT_ATOMIC_EXCHANGE(&m_sent, 0)!=0;
+    
+    if (m_pRead && __Read(m_pRead, closed))
+    {
+        pRead = m_pRead;
+        m_pRead = NULL;
+    }
+    if ((sent || closed) && (closed || (m_pPort->GetWriteQueueCount()==0)))
+    {
+        pWrite = m_pWrites;
+        m_pWrites = NULL;
+    }
+    //a resumed coroutine may delete the stream, only locals are used from here
+    while(pWrite)
+    {
+        pNextWrite = pWrite->m_pNextWrite;
+        pWrite->Complete(pWrite->m_result);
+        pWrite = pNextWrite;
+    }
+    if (pRead)
+    {
+        pRead->Complete(pRead->m_result);
+    }
+}
+
+//moves received data into the read, true when it is complete
+bool TSerialPortStream::__Read(TSerialPortReadAwaitable* pRead, bool timeout)
+{
+    TSerialPortRing* pRing = &m_pPort->m_receiveRing;
+    int              dataLength = pRead->m_dataLength;
+    int              receivedCount, scanLength, position;
+    
+    if ((pRing->pBuffer==NULL) || (dataLength<=0))
+    {
+        pRead->m_result = 0;
+        return true;
+    }
+    if (pRead->m_delimiters==NULL)
+    {
+        pRead->m_bytesRead += SerialPortRing_Read(pRing, pRead->m_pData+pRead->m_bytesRead, dataLength-pRead->m_bytesRead);
+        pRead->m_result = pRead->m_bytesRead;
+        return (pRead->m_bytesRead==dataLength) || timeout || (!m_pPort->IsOpen());
+    }
+    
+    //data stay in the ring until a delimiter is found, m_bytesRead counts the bytes scanned
+    if (dataLength>(int)pRing->capacity)
+    {
+        dataLength = (int)pRing->capacity;
+    }
+    receivedCount = SerialPortRing_GetCount(pRing);
+    scanLength = (receivedCount<dataLength) ? receivedCount : dataLength;
+    position = SerialPortRing_Find(pRing, pRead->m_bytesRead, scanLength, (const unsigned char*)pRead->m_delimiters, (int)strlen(pRead->m_delimiters));
+    if (position>=0)
+    {
+        scanLength = position+1;
+    } else if ((scanLength<dataLength) && (!timeout) && m_pPort->IsOpen()) {
+        pRead->m_bytesRead = scanLength;
+        return false;
+    }
+    pRead->m_result = SerialPortRing_Read(pRing, pRead->m_pData, scanLength);
+    return true;
+}
+
+#endif
@@ -0,0 +1,398 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+
+#ifndef SERIALPORTCOROUTINE___HPP
+#define SERIALPORTCOROUTINE___HPP
+
+#include "SerialPort.hpp"
+#include "SerialPortTimerWheel.h"
+
+#if (__cplusplus>=202002L) || (defined(_MSVC_LANG) && (_MSVC_LANG>=202002L))
+#define SERIALPORT_COROUTINES
+#endif
+
+#ifdef SERIALPORT_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+/*
+* C++20 coroutine API. A TSerialPortLoop runs coroutines on its thread,
+* a TSerialPortStream makes one TSerialPort awaitable:
+*
+*   TSerialPortTask<> Session(TSerialPortStream* pStream)
+*   {
+*       unsigned char answer[64];
+*       co_await pStream->Write(request, sizeof(request));
+*       int length = co_await pStream->ReadUntil(answer, sizeof(answer), "\n", 100);
+*       ...
+*   }
+*
+*   loop.Start();
+*   TSerialPortStream stream(&port, &loop);     //before OpenAsync
+*   port.OpenAsync("/dev/ttyUSB0", 115200, NULL, NULL);
+*   loop.Spawn(Session(&stream));
+*
+* Received data are stored by the port's I/O thread (working thread or
+* reactor) as usual, its notifications (SetNotifyHandler) post the
+* stream to the loop which completes the waiting operations. Coroutines
+* therefore run on the loop thread only and need no locks among
+* themselves, thousands of them cost one frame each.
+*
+*   Read      completes when dataLength bytes arrived, on timeout or
+*             when the port is closed, returns the bytes read
+*   ReadUntil like TSerialPort::ReadUntil, returns up to and including
+*             the first delimiter, the whole buffer when it is full or
+*             what arrived by the timeout
+*   Write     queues the data (QueueWrite) and completes when the queue
+*             of the port has been sent, returns the queued length
+*   Transact  submits a transaction to the engine of the port
+*             (SetTransactions) and returns its final status, the engine
+*             handles its deadline. onCompleted and pContext are used
+*   Delay     completes after timeMS
+*
+* Timeouts are deadlines counted from the co_await, kept in the timer
+* wheel of the loop (1 ms ticks), SERIALPORT_INFINITE waits forever. One
+* Read/ReadUntil may wait per stream at a time, another one returns -1
+* at once. The receive ring is read by the loop thread, the port must
+* not be read by ReadBuffer/ReadLine meanwhile and must not use a
+* buffer received handler.
+*
+* TSerialPortTask<T> is a lazily started coroutine returning T,
+* co_await starts it and resumes the caller when it is done. Spawn
+* detaches it and starts it on the loop, the frame is freed at its end.
+* Exceptions reach the awaiting coroutine, a detached task throwing
+* terminates. Stop leaves coroutines which still wait suspended, the
+* stream must outlive its coroutines and be destroyed after the port
+* has been closed.
+*/
+
+class TSerialPortLoop;
+class TSerialPortStream;
+
+//something handed over to the loop thread, posted at most once at a time
+class TSerialPortOperation
+{
+public:
+    TSerialPortOperation* m_pNext;
+    volatile unsigned int m_posted;
+    
+    TSerialPortOperation() : m_pNext(NULL), m_posted(0) {}
+    virtual ~TSerialPortOperation() {}
+    virtual void OnPosted() {}
+    virtual void OnTimeout() {}
+};
+
+//timer of the loop's wheel, the wheel hands back the timer only
+struct TSerialPortLoopTimer
+{
+    TSerialPortTimer      timer;
+    TSerialPortOperation* pOperation;
+};
+
+template <typename T>
+class TSerialPortTask;
+
+template <typename T>
+class TSerialPortPromiseBase
+{
+public:
+    std::coroutine_handle<> m_continuation;
+    std::exception_ptr      m_exception;
+    bool                    m_detached = false;
+    
+    class TFinalAwaiter
+    {
+    public:
+        bool await_ready() noexcept { return false; }
+        template <typename TPromise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<TPromise> handle) noexcept
+        {
+            TPromise& promise = handle.promise();
+            if (promise.m_continuation)
+            {
+                return promise.m_continuation;
+            }
+            if (promise.m_detached)
+            {
+                handle.destroy();
+            }
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+    
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    TFinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception()
+    {
+        if (m_detached)
+        {
+            std::terminate();
+        }
+        m_exception = std::current_exception();
+    }
+};
+
+template <typename T>
+class TSerialPortPromise : public TSerialPortPromiseBase<T>
+{
+public:
+    std::optional<T> m_value;
+    
+    TSerialPortTask<T> get_return_object();
+    template <typename TValue>
+    void return_value(TValue&& value) { m_value.emplace(std::forward<TValue>(value)); }
+    T TakeValue() { return std::move(*m_value); }
+};
+
+template <>
+class TSerialPortPromise<void> : public TSerialPortPromiseBase<void>
+{
+public:
+    TSerialPortTask<void> get_return_object();
+    void return_void() {}
+    void TakeValue() {}
+};
+
+template <typename T = void>
+class TSerialPortTask
+{
+public:
+    typedef TSerialPortPromise<T> promise_type;
+    
+private:
+    std::coroutine_handle<promise_type> m_handle;
+    
+public:
+    explicit TSerialPortTask(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+    TSerialPortTask(TSerialPortTask&& task) noexcept : m_handle(std::exchange(task.m_handle, nullptr)) {}
+    TSerialPortTask(const TSerialPortTask&) = delete;
+    TSerialPortTask& operator=(const TSerialPortTask&) = delete;
+    ~TSerialPortTask()
+    {
+        if (m_handle) m_handle.destroy();
+    }
+    
+    bool await_ready() noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+    {
+        m_handle.promise().m_continuation = continuation;
+        return m_handle;
+    }
+    T await_resume()
+    {
+        if (m_handle.promise().m_exception)
+        {
+            std::rethrow_exception(m_handle.promise().m_exception);
+        }
+        return m_handle.promise().TakeValue();
+    }
+    
+    //the frame frees itself when the coroutine ends
+    std::coroutine_handle<> Detach()
+    {
+        m_handle.promise().m_detached = true;
+        return std::exchange(m_handle, nullptr);
+    }
+};
+
+template <typename T>
+inline TSerialPortTask<T> TSerialPortPromise<T>::get_return_object()
+{
+    return TSerialPortTask<T>(std::coroutine_handle<TSerialPortPromise<T> >::from_promise(*this));
+}
+
+inline TSerialPortTask<void> TSerialPortPromise<void>::get_return_object()
+{
+    return TSerialPortTask<void>(std::coroutine_handle<TSerialPortPromise<void> >::from_promise(*this));
+}
+
+//base of the awaitables, completed on the loop thread
+class TSerialPortAwaitable : public TSerialPortOperation
+{
+protected:
+    TSerialPortLoop*        m_pLoop;
+    TSerialPortLoopTimer    m_timer;
+    std::coroutine_handle<> m_handle;
+    int                     m_result;
+    
+    void __StartTimer(int timeOutMS);
+    
+public:
+    explicit TSerialPortAwaitable(TSerialPortLoop* pLoop);
+    TSerialPortAwaitable(const TSerialPortAwaitable&) = delete;
+    
+    void Complete(int result);
+    int await_resume() { return m_result; }
+};
+
+class TSerialPortDelayAwaitable : public TSerialPortAwaitable
+{
+private:
+    int m_timeMS;
+    
+public:
+    TSerialPortDelayAwaitable(TSerialPortLoop* pLoop, int timeMS) : TSerialPortAwaitable(pLoop), m_timeMS(timeMS) {}
+    bool await_ready() { return m_timeMS<=0; }
+    void await_suspend(std::coroutine_handle<> handle);
+    void OnTimeout() override { Complete(0); }
+};
+
+class TSerialPortReadAwaitable : public TSerialPortAwaitable
+{
+private:
+    TSerialPortStream*   m_pStream;
+    unsigned char*       m_pData;
+    int                  m_dataLength;
+    const char*          m_delimiters;      //NULL for Read
+    int                  m_timeOutMS;
+    int                  m_bytesRead;
+    
+    friend class TSerialPortStream;
+    
+public:
+    TSerialPortReadAwaitable(TSerialPortStream* pStream, unsigned char* pData, int dataLength, const char* delimiters, int timeOutMS);
+    bool await_ready();
+    bool await_suspend(std::coroutine_handle<> handle);
+    void OnTimeout() override;
+};
+
+class TSerialPortWriteAwaitable : public TSerialPortAwaitable
+{
+private:
+    TSerialPortStream*         m_pStream;
+    const unsigned char*       m_pData;
+    int                        m_dataLength;
+    TSerialPortWriteAwaitable* m_pNextWrite;
+    
+    friend class TSerialPortStream;
+    
+public:
+    TSerialPortWriteAwaitable(TSerialPortStream* pStream, const unsigned char* pData, int dataLength);
+    bool await_ready();
+    bool await_suspend(std::coroutine_handle<> handle);
+};
+
+class TSerialPortTransactAwaitable : public TSerialPortAwaitable
+{
+private:
+    TSerialPortStream*       m_pStream;
+    TSerialPortTransaction*  m_pTransaction;
+    
+    static void __OnCompleted(TSerialPortTransaction* pTransaction);
+    
+public:
+    TSerialPortTransactAwaitable(TSerialPortStream* pStream, TSerialPortTransaction* pTransaction);
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> handle);
+    void OnPosted() override { Complete(m_pTransaction->status); }
+};
+
+class TSerialPortLoop
+{
+private:
+    SERIALPORT_THREAD     m_thread;
+    bool                  m_threadStarted;
+    volatile unsigned int m_stopping;
+    SERIALPORT_EVENT      m_wakeEvent;
+    SERIALPORT_LOCK       m_lock;
+    TSerialPortOperation* m_pPostedHead;
+    TSerialPortOperation* m_pPostedTail;
+    TSerialPortOperation* m_pRunning;
+    TSerialPortTimerWheel m_timers;         //loop thread only
+    
+    friend void SerialPortLoop_Run(void* lpParam);
+    
+public:
+    TSerialPortLoop();
+    ~TSerialPortLoop();
+    
+    bool Start();
+    void Stop();
+    bool IsLoopThread();
+    
+    void Post(TSerialPortOperation* pOperation);
+    void Cancel(TSerialPortOperation* pOperation);
+    void Spawn(TSerialPortTask<void>&& task);
+    TSerialPortDelayAwaitable Delay(int timeMS) { return TSerialPortDelayAwaitable(this, timeMS); }
+    
+    void AddTimer(TSerialPortLoopTimer* pTimer, int timeOutMS);
+    void RemoveTimer(TSerialPortLoopTimer* pTimer);
+};
+
+class TSerialPortStream
+{
+private:
+    //posted by the port's notifications
+    class TNotification : public TSerialPortOperation
+    {
+    public:
+        TSerialPortStream* m_pStream;
+        void OnPosted() override { m_pStream->__OnNotified(); }
+    };
+    
+    TSerialPort*               m_pPort;
+    TSerialPortLoop*           m_pLoop;
+    TNotification              m_notification;
+    volatile unsigned int      m_sent;
+    volatile unsigned int      m_closed;
+    TSerialPortReadAwaitable*  m_pRead;             //loop thread only
+    TSerialPortWriteAwaitable* m_pWrites;
+    
+    static void __OnNotify(void* pContext, int notification);
+    void __OnNotified();
+    bool __Read(TSerialPortReadAwaitable* pRead, bool timeout);
+    
+    friend class TSerialPortReadAwaitable;
+    friend class TSerialPortWriteAwaitable;
+    friend class TSerialPortTransactAwaitable;
+    
+public:
+    TSerialPortStream(TSerialPort* pPort, TSerialPortLoop* pLoop);
+    ~TSerialPortStream();
+    
+    TSerialPort* GetPort() { return m_pPort; }
+    TSerialPortLoop* GetLoop() { return m_pLoop; }
+    
+    TSerialPortReadAwaitable Read(unsigned char* pData, int dataLength, int timeOutMS=SERIALPORT_INFINITE)
+    {
+        return TSerialPortReadAwaitable(this, pData, dataLength, NULL, timeOutMS);
+    }
+    TSerialPortReadAwaitable ReadUntil(unsigned char* pData, int dataLength, const char* delimiters, int timeOutMS=SERIALPORT_INFINITE)
+    {
+        return TSerialPortReadAwaitable(this, pData, dataLength, delimiters, timeOutMS);
+    }
+    TSerialPortWriteAwaitable Write(const unsigned char* pData, int dataLength)
+    {
+        return TSerialPortWriteAwaitable(this, pData, dataLength);
+    }
+    TSerialPortTransactAwaitable Transact(TSerialPortTransaction* pTransaction)
+    {
+        return TSerialPortTransactAwaitable(this, pTransaction);
+    }
+    TSerialPortDelayAwaitable Delay(int timeMS)
+    {
+        return TSerialPortDelayAwaitable(m_pLoop, timeMS);
+    }
+};
+
+#endif
+
+#endif
@@ -0,0 +1,312 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#include "SerialPortCrc.h"
+#include <string.h>
+
+#if !defined(SERIALPORT_CRC_NO_PCLMUL) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SERIALPORT_CRC_PCLMUL
+#include <immintrin.h>
+#endif
+
+#define SERIALPORT_CRC_TYPES 4
+
+//Tables[crcType][k][b] is the CRC of byte b followed by k zero bytes
+static unsigned int          m_crcTables[SERIALPORT_CRC_TYPES][8][256];
+static volatile unsigned int m_crcTablesReady;
+#ifdef SERIALPORT_CRC_PCLMUL
+static int                   m_crcPclmul;
+#endif
+
+static void SerialPortCrc__BuildTables(void)
+{
+    unsigned int value;
+    int          b, i, k;
+
+    for(b = 0; b<256; b++)
+    {
+        value = (unsigned int)b;
+        for(i = 0; i<8; i++) value = (value & 1) ? (value>>1) ^ 0xA001 : (value>>1);
+        m_crcTables[SERIALPORT_CRC16_MODBUS][0][b] = value;
+
+        value = (unsigned int)b<<8;
+        for(i = 0; i<8; i++) value = (value & 0x8000) ? ((value<<1) ^ 0x1021) & 0xFFFF : (value<<1) & 0xFFFF;
+        m_crcTables[SERIALPORT_CRC16_CCITT][0][b] = value;
+
+        value = (unsigned int)b;
+        for(i = 0; i<8; i++) value = (value & 1) ? (value>>1) ^ 0xEDB88320 : (value>>1);
+        m_crcTables[SERIALPORT_CRC32][0][b] = value;
+    }
+    for(k = 1; k<8; k++)
+    {
+        for(b = 0; b<256; b++)
+        {
+            value = m_crcTables[SERIALPORT_CRC16_MODBUS][k-1][b];
+            m_crcTables[SERIALPORT_CRC16_MODBUS][k][b] = (value>>8) ^ m_crcTables[SERIALPORT_CRC16_MODBUS][0][value & 0xFF];
+
+            value = m_crcTables[SERIALPORT_CRC16_CCITT][k-1][b];
+            m_crcTables[SERIALPORT_CRC16_CCITT][k][b] = ((value<<8) & 0xFFFF) ^ m_crcTables[SERIALPORT_CRC16_CCITT][0][value>>8];
+
+            value = m_crcTables[SERIALPORT_CRC32][k-1][b];
+            m_crcTables[SERIALPORT_CRC32][k][b] = (value>>8) ^ m_crcTables[SERIALPORT_CRC32][0][value & 0xFF];
+        }
+    }
+#ifdef SERIALPORT_CRC_PCLMUL
+    m_crcPclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+static void SerialPortCrc__InitTables(void)
+{
+    //racing threads compute the same values, the flag only saves the work
+    if (!SERIALPORT_ATOMIC_LOAD_ACQUIRE(&m_crcTablesReady))
+    {
+        SerialPortCrc__BuildTables();
+        SERIALPORT_ATOMIC_STORE_RELEASE(&m_crcTablesReady, 1);
+    }
+}
+
+static unsigned int SerialPortCrc__ReadLE32(const unsigned char* pData)
+{
+    return (unsigned int)pData[0] | ((unsigned int)pData[1]<<8) | ((unsigned int)pData[2]<<16) | ((unsigned int)pData[3]<<24);
+}
+
+//CRC-16/MODBUS and CRC-32, the register is shifted towards bit 0
+static unsigned int SerialPortCrc__UpdateReflected(unsigned int (*pTables)[256], unsigned int crc, const unsigned char* pData, int dataLength)
+{
+    unsigned int low, high;
+
+    while(dataLength>=8)
+    {
+        low  = SerialPortCrc__ReadLE32(pData) ^ crc;
+        high = SerialPortCrc__ReadLE32(pData+4);
+        crc = pTables[7][low & 0xFF] ^ pTables[6][(low>>8) & 0xFF] ^ pTables[5][(low>>16) & 0xFF] ^ pTables[4][low>>24] ^
+              pTables[3][high & 0xFF] ^ pTables[2][(high>>8) & 0xFF] ^ pTables[1][(high>>16) & 0xFF] ^ pTables[0][high>>24];
+        pData += 8;
+        dataLength -= 8;
+    }
+    while(dataLength-->0)
+    {
+        crc = (crc>>8) ^ pTables[0][(crc ^ *pData++) & 0xFF];
+    }
+    return crc;
+}
+
+//CRC-16/CCITT, the register is shifted towards bit 15
+static unsigned int SerialPortCrc__UpdateCcitt(unsigned int (*pTables)[256], unsigned int crc, const unsigned char* pData, int dataLength)
+{
+    while(dataLength>=8)
+    {
+        crc = pTables[7][pData[0] ^ (crc>>8)] ^ pTables[6][pData[1] ^ (crc & 0xFF)] ^ pTables[5][pData[2]] ^ pTables[4][pData[3]] ^
+              pTables[3][pData[4]] ^ pTables[2][pData[5]] ^ pTables[1][pData[6]] ^ pTables[0][pData[7]];
+        pData += 8;
+        dataLength -= 8;
+    }
+    while(dataLength-->0)
+    {
+        crc = ((crc<<8) & 0xFFFF) ^ pTables[0][(crc>>8) ^ *pData++];
+    }
+    return crc;
+}
+
+#ifdef SERIALPORT_CRC_PCLMUL
+
+//folds 64 bytes per step (Intel, "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ"),
+//dataLength is at least 64 and a multiple of 16
+__attribute__((target("pclmul,sse4.1")))
+static unsigned int SerialPortCrc__UpdateCrc32Pclmul(unsigned int crc, const unsigned char* pData, int dataLength)
+{
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i*)(pData+0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(pData+0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(pData+0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(pData+0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    x0 = _mm_set_epi64x(0x01C6E41596LL, 0x0154442BD4LL);
+    pData += 64;
+    dataLength -= 64;
+
+    while(dataLength>=64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128((const __m128i*)(pData+0x00));
+        y6 = _mm_loadu_si128((const __m128i*)(pData+0x10));
+        y7 = _mm_loadu_si128((const __m128i*)(pData+0x20));
+        y8 = _mm_loadu_si128((const __m128i*)(pData+0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        pData += 64;
+        dataLength -= 64;
+    }
+
+    //four lanes into one
+    x0 = _mm_set_epi64x(0x00CCAA009ELL, 0x01751997D0LL);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while(dataLength>=16)
+    {
+        x2 = _mm_loadu_si128((const __m128i*)pData);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        pData += 16;
+        dataLength -= 16;
+    }
+
+    //128 bits to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_set_epi64x(0, 0x0163CD6124LL);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    //Barrett reduction to 32 bits
+    x0 = _mm_set_epi64x(0x01F7011641LL, 0x01DB710641LL);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return (unsigned int)_mm_extract_epi32(x1, 1);
+}
+
+#endif
+
+static unsigned int SerialPortCrc__Update(int crcType, unsigned int crc, const unsigned char* pData, int dataLength)
+{
+#ifdef SERIALPORT_CRC_PCLMUL
+    int foldLength;
+#endif
+
+    switch(crcType)
+    {
+    case SERIALPORT_CRC16_MODBUS:
+        return SerialPortCrc__UpdateReflected(m_crcTables[SERIALPORT_CRC16_MODBUS], crc, pData, dataLength);
+    case SERIALPORT_CRC16_CCITT:
+        return SerialPortCrc__UpdateCcitt(m_crcTables[SERIALPORT_CRC16_CCITT], crc, pData, dataLength);
+    case SERIALPORT_CRC32:
+#ifdef SERIALPORT_CRC_PCLMUL
+        if (m_crcPclmul && (dataLength>=64))
+        {
+            foldLength = dataLength & ~15;
+            crc = SerialPortCrc__UpdateCrc32Pclmul(crc, pData, foldLength);
+            pData += foldLength;
+            dataLength -= foldLength;
+        }
+#endif
+        return SerialPortCrc__UpdateReflected(m_crcTables[SERIALPORT_CRC32], crc, pData, dataLength);
+    }
+    return crc;
+}
+
+void SerialPortCrc_Init(TSerialPortCrc* pCrc, int crcType)
+{
+    SerialPortCrc__InitTables();
+    pCrc->crcType = crcType;
+    pCrc->value   = (crcType==SERIALPORT_CRC32) ? 0xFFFFFFFF : 0xFFFF;
+}
+
+void SerialPortCrc_Update(TSerialPortCrc* pCrc, const unsigned char* pData, int dataLength)
+{
+    if ((pData==NULL) || (dataLength<=0))
+    {
+        return;
+    }
+    pCrc->value = SerialPortCrc__Update(pCrc->crcType, pCrc->value, pData, dataLength);
+}
+
+unsigned int SerialPortCrc_GetValue(TSerialPortCrc* pCrc)
+{
+    return (pCrc->crcType==SERIALPORT_CRC32) ? ~pCrc->value : pCrc->value;
+}
+
+int SerialPortCrc_GetSize(int crcType)
+{
+    switch(crcType)
+    {
+    case SERIALPORT_CRC16_MODBUS:
+    case SERIALPORT_CRC16_CCITT:
+        return 2;
+    case SERIALPORT_CRC32:
+        return 4;
+    }
+    return 0;
+}
+
+unsigned int SerialPortCrc_Compute(int crcType, const unsigned char* pData, int dataLength)
+{
+    TSerialPortCrc crc;
+    SerialPortCrc_Init(&crc, crcType);
+    SerialPortCrc_Update(&crc, pData, dataLength);
+    return SerialPortCrc_GetValue(&crc);
+}
+
+int SerialPortCrc_Append(int crcType, unsigned int value, unsigned char* pOutput)
+{
+    switch(crcType)
+    {
+    case SERIALPORT_CRC16_MODBUS:
+        pOutput[0] = (unsigned char)value;
+        pOutput[1] = (unsigned char)(value>>8);
+        return 2;
+    case SERIALPORT_CRC16_CCITT:
+        pOutput[0] = (unsigned char)(value>>8);
+        pOutput[1] = (unsigned char)value;
+        return 2;
+    case SERIALPORT_CRC32:
+        pOutput[0] = (unsigned char)value;
+        pOutput[1] = (unsigned char)(value>>8);
+        pOutput[2] = (unsigned char)(value>>16);
+        pOutput[3] = (unsigned char)(value>>24);
+        return 4;
+    }
+    return 0;
+}
+
+BOOL SerialPortCrc_Check(int crcType, const unsigned char* pFrame, int frameLength)
+{
+    unsigned char crcBytes[SERIALPORT_CRC_MAX_SIZE];
+    int           crcSize = SerialPortCrc_GetSize(crcType);
+
+    if ((crcSize==0) || (frameLength<crcSize))
+    {
+        return FALSE;
+    }
+    SerialPortCrc_Append(crcType, SerialPortCrc_Compute(crcType, pFrame, frameLength-crcSize), crcBytes);
+    return memcmp(crcBytes, pFrame+frameLength-crcSize, crcSize)==0;
+}
@@ -0,0 +1,70 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef SERIALPORTCRC___H
+#define SERIALPORTCRC___H
+
+#include "SerialPortIO.h"
+
+/*
+* Checksums used by device protocols:
+*
+*   SERIALPORT_CRC16_MODBUS  poly 0x8005 reflected, init 0xFFFF, sent low byte first
+*   SERIALPORT_CRC16_CCITT   poly 0x1021, init 0xFFFF (CCITT-FALSE), sent high byte first
+*   SERIALPORT_CRC32         poly 0x04C11DB7 reflected, init/xor 0xFFFFFFFF, sent low byte first
+*
+* Tables are built on first use, 8 bytes are processed per step
+* (slicing-by-8). CRC-32 of longer blocks uses carry-less multiplication
+* (PCLMULQDQ) when the CPU supports it, define SERIALPORT_CRC_NO_PCLMUL
+* to leave it out.
+*
+* TSerialPortCrc keeps the running value, so a checksum can be updated
+* chunk by chunk as data are received. Append stores the checksum in
+* wire byte order and returns its size, Check tells whether a frame
+* ends with the right checksum.
+*/
+
+#define SERIALPORT_CRC_NONE      0
+#define SERIALPORT_CRC16_MODBUS  1
+#define SERIALPORT_CRC16_CCITT   2
+#define SERIALPORT_CRC32         3
+
+#define SERIALPORT_CRC_MAX_SIZE  4
+
+typedef struct
+{
+    int          crcType;
+    unsigned int value;
+} TSerialPortCrc;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void    SerialPortCrc_Init(TSerialPortCrc* pCrc, int crcType);
+void    SerialPortCrc_Update(TSerialPortCrc* pCrc, const unsigned char* pData, int dataLength);
+unsigned int SerialPortCrc_GetValue(TSerialPortCrc* pCrc);
+
+int     SerialPortCrc_GetSize(int crcType);
+unsigned int SerialPortCrc_Compute(int crcType, const unsigned char* pData, int dataLength);
+int     SerialPortCrc_Append(int crcType, unsigned int value, unsigned char* pOutput);
+BOOL    SerialPortCrc_Check(int crcType, const unsigned char* pFrame, int frameLength);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
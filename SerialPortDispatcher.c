@@ -0,0 +1,494 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+
+#include "SerialPortDispatcher.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define SERIALPORT_THREAD_LOCAL __declspec(thread)
+#else
+#define SERIALPORT_THREAD_LOCAL __thread
+#endif
+
+#define SERIALPORT_DISPATCH_WAIT 10     //milliseconds, Cancel and Delete recheck at least this often
+
+typedef struct TSerialPortDispatchItem
+{
+    struct TSerialPortDispatchItem* pNext;
+    SERIALPORT_DISPATCH_HANDLER     handler;
+    void*                           pContext;
+    SERIALPORT_TIMESTAMP            time;
+    int                             dataLength;
+    unsigned char                   data[1];
+} TSerialPortDispatchItem;
+
+struct TSerialPortDispatcher
+{
+    SERIALPORT_LOCK               lock;
+    SERIALPORT_EVENT              workEvent;        //chunk queued or stopping (dispatcher thread)
+    SERIALPORT_EVENT              roomEvent;        //chunk taken, for blocked posts
+    SERIALPORT_EVENT              idleEvent;        //handler returned, for Cancel and Delete
+    TSerialPortDispatchItem*      pHead;
+    TSerialPortDispatchItem*      pTail;
+    int                           maxChunks;
+    int                           maxBytes;
+    int                           policy;
+    SERIALPORT_EXECUTOR           executor;
+    void*                         pExecutorContext;
+    BOOL                          scheduled;        //thread woken up or executor task pending, until the queue is empty
+    SERIALPORT_THREAD             thread;
+    BOOL                          threadStarted;
+    volatile unsigned int         stopping;
+    int                           blockedCount;     //posts waiting for room
+    int                           idleWaiters;      //Cancel and Delete waiting for a handler to return
+    void*                         pDeliveringContext;
+    TSerialPortDispatchStatistics statistics;
+};
+
+//dispatcher whose handler runs on this thread
+static SERIALPORT_THREAD_LOCAL TSerialPortDispatcher* m_pDeliveringDispatcher = NULL;
+
+//passes chunks which will never be delivered to their handlers, called without the lock
+static void SerialPortDispatcher__Discard(TSerialPortDispatchItem* pItem)
+{
+    TSerialPortDispatchItem* pNext;
+
+    while(pItem)
+    {
+        pNext = pItem->pNext;
+        pItem->handler(pItem->pContext, pItem->data, pItem->dataLength, pItem->time, TRUE);
+        free(pItem);
+        pItem = pNext;
+    }
+}
+
+static void SerialPortDispatcher__Free(TSerialPortDispatcher* pDispatcher)
+{
+    SerialPortDispatcher__Discard(pDispatcher->pHead);
+    pDispatcher->pHead = NULL;
+    SerialPortIO_DeleteEvent(&pDispatcher->workEvent);
+    SerialPortIO_DeleteEvent(&pDispatcher->roomEvent);
+    SerialPortIO_DeleteEvent(&pDispatcher->idleEvent);
+    SerialPortIO_DeleteLock(&pDispatcher->lock);
+    free(pDispatcher);
+}
+
+static TSerialPortDispatchItem* SerialPortDispatcher__Pop(TSerialPortDispatcher* pDispatcher)
+{
+    TSerialPortDispatchItem* pItem = pDispatcher->pHead;
+
+    if (pItem)
+    {
+        pDispatcher->pHead = pItem->pNext;
+        if (pDispatcher->pHead==NULL)
+        {
+            pDispatcher->pTail = NULL;
+        }
+        pDispatcher->statistics.queuedChunks--;
+        pDispatcher->statistics.queuedBytes -= (unsigned int)pItem->dataLength;
+    }
+    return pItem;
+}
+
+static BOOL SerialPortDispatcher__Fits(TSerialPortDispatcher* pDispatcher, int dataLength)
+{
+    if (pDispatcher->pHead==NULL)
+    {
+        return TRUE;
+    }
+    if ((pDispatcher->maxChunks>0) && (pDispatcher->statistics.queuedChunks>=(unsigned int)pDispatcher->maxChunks))
+    {
+        return FALSE;
+    }
+    if ((pDispatcher->maxBytes>0) && (pDispatcher->statistics.queuedBytes+(unsigned int)dataLength>(unsigned int)pDispatcher->maxBytes))
+    {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+//appends to the last queued chunk of the same handler and context, chunks with a time keep it
+static BOOL SerialPortDispatcher__Coalesce(TSerialPortDispatcher* pDispatcher, TSerialPortDispatchItem* pNewItem)
+{
+    TSerialPortDispatchItem** ppLink;
+    TSerialPortDispatchItem** ppLast = NULL;
+    TSerialPortDispatchItem*  pItem;
+    BOOL                      isTail;
+
+    if (pNewItem->time)
+    {
+        return FALSE;
+    }
+    if ((pDispatcher->maxBytes>0) && (pDispatcher->statistics.queuedBytes+(unsigned int)pNewItem->dataLength>(unsigned int)pDispatcher->maxBytes))
+    {
+        return FALSE;
+    }
+    for(ppLink = &pDispatcher->pHead; *ppLink; ppLink = &(*ppLink)->pNext)
+    {
+        if (((*ppLink)->handler==pNewItem->handler) && ((*ppLink)->pContext==pNewItem->pContext) && ((*ppLink)->time==0))
+        {
+            ppLast = ppLink;
+        }
+    }
+    if (ppLast==NULL)
+    {
+        return FALSE;
+    }
+    isTail = (*ppLast==pDispatcher->pTail);
+    pItem  = (TSerialPortDispatchItem*)realloc(*ppLast, sizeof(TSerialPortDispatchItem)+(*ppLast)->dataLength+pNewItem->dataLength);
+    if (pItem==NULL)
+    {
+        return FALSE;
+    }
+    *ppLast = pItem;
+    if (isTail)
+    {
+        pDispatcher->pTail = pItem;
+    }
+    memcpy(pItem->data+pItem->dataLength, pNewItem->data, pNewItem->dataLength);
+    pItem->dataLength += pNewItem->dataLength;
+    pDispatcher->statistics.queuedBytes += (unsigned int)pNewItem->dataLength;
+    pDispatcher->statistics.coalescedChunks++;
+    return TRUE;
+}
+
+//delivers everything queued, runs on the dispatcher thread or as the executor task
+static void SerialPortDispatcher__Deliver(void* lpParam)
+{
+    TSerialPortDispatcher*   pDispatcher = (TSerialPortDispatcher*)lpParam;
+    TSerialPortDispatcher*   pPrevious   = m_pDeliveringDispatcher;
+    TSerialPortDispatchItem* pItem;
+
+    m_pDeliveringDispatcher = pDispatcher;
+    SerialPortIO_Lock(&pDispatcher->lock);
+    for(;;)
+    {
+        pItem = pDispatcher->stopping ? NULL : SerialPortDispatcher__Pop(pDispatcher);
+        if (pItem==NULL)
+        {
+            break;
+        }
+        pDispatcher->pDeliveringContext = pItem->pContext;
+        if (pDispatcher->blockedCount>0)
+        {
+            SerialPortIO_SetEvent(&pDispatcher->roomEvent);
+        }
+        SerialPortIO_Unlock(&pDispatcher->lock);
+
+        pItem->handler(pItem->pContext, pItem->data, pItem->dataLength, pItem->time, FALSE);
+        free(pItem);
+
+        SerialPortIO_Lock(&pDispatcher->lock);
+        pDispatcher->pDeliveringContext = NULL;
+        pDispatcher->statistics.deliveredChunks++;
+        if (pDispatcher->idleWaiters>0)
+        {
+            SerialPortIO_SetEvent(&pDispatcher->idleEvent);
+        }
+    }
+    pDispatcher->scheduled = FALSE;
+    if (pDispatcher->idleWaiters>0)
+    {
+        SerialPortIO_SetEvent(&pDispatcher->idleEvent);
+    }
+    //Delete may free the dispatcher right after this
+    SerialPortIO_Unlock(&pDispatcher->lock);
+    m_pDeliveringDispatcher = pPrevious;
+}
+
+static void SerialPortDispatcher__Thread(void* lpParam)
+{
+    TSerialPortDispatcher* pDispatcher = (TSerialPortDispatcher*)lpParam;
+
+    for(;;)
+    {
+        SerialPortIO_WaitEvent(&pDispatcher->workEvent, SERIALPORT_INFINITE);
+        if (SERIALPORT_ATOMIC_LOAD(&pDispatcher->stopping))
+        {
+            break;
+        }
+        SerialPortDispatcher__Deliver(pDispatcher);
+    }
+}
+
+TSerialPortDispatcher* SerialPortDispatcher_Create(int maxChunks, int maxBytes, int policy, SERIALPORT_EXECUTOR executor, void* pExecutorContext)
+{
+    TSerialPortDispatcher* pDispatcher;
+
+    if ((policy<SERIALPORT_DISPATCH_BLOCK) || (policy>SERIALPORT_DISPATCH_COALESCE))
+    {
+        return NULL;
+    }
+    pDispatcher = (TSerialPortDispatcher*)malloc(sizeof(TSerialPortDispatcher));
+    if (pDispatcher==NULL)
+    {
+        return NULL;
+    }
+    memset(pDispatcher, 0, sizeof(TSerialPortDispatcher));
+    pDispatcher->maxChunks        = (maxChunks>0) ? maxChunks : 0;
+    pDispatcher->maxBytes         = (maxBytes>0) ? maxBytes : 0;
+    pDispatcher->policy           = policy;
+    pDispatcher->executor         = executor;
+    pDispatcher->pExecutorContext = pExecutorContext;
+    SerialPortIO_InitLock(&pDispatcher->lock);
+    if (!SerialPortIO_CreateEvent(&pDispatcher->workEvent))
+    {
+        SerialPortIO_DeleteLock(&pDispatcher->lock);
+        free(pDispatcher);
+        return NULL;
+    }
+    if (!SerialPortIO_CreateEvent(&pDispatcher->roomEvent))
+    {
+        SerialPortIO_DeleteEvent(&pDispatcher->workEvent);
+        SerialPortIO_DeleteLock(&pDispatcher->lock);
+        free(pDispatcher);
+        return NULL;
+    }
+    if (!SerialPortIO_CreateEvent(&pDispatcher->idleEvent))
+    {
+        SerialPortIO_DeleteEvent(&pDispatcher->roomEvent);
+        SerialPortIO_DeleteEvent(&pDispatcher->workEvent);
+        SerialPortIO_DeleteLock(&pDispatcher->lock);
+        free(pDispatcher);
+        return NULL;
+    }
+    if (executor==NULL)
+    {
+        pDispatcher->threadStarted = SerialPortIO_StartThread(&pDispatcher->thread, SerialPortDispatcher__Thread, pDispatcher);
+        if (!pDispatcher->threadStarted)
+        {
+            SerialPortDispatcher__Free(pDispatcher);
+            return NULL;
+        }
+    }
+    return pDispatcher;
+}
+
+void SerialPortDispatcher_Delete(TSerialPortDispatcher* pDispatcher)
+{
+    if (pDispatcher==NULL)
+    {
+        return;
+    }
+    SerialPortIO_Lock(&pDispatcher->lock);
+    SERIALPORT_ATOMIC_STORE(&pDispatcher->stopping, 1);
+    SerialPortIO_Unlock(&pDispatcher->lock);
+
+    if (pDispatcher->threadStarted)
+    {
+        SerialPortIO_SetEvent(&pDispatcher->workEvent);
+        SerialPortIO_JoinThread(&pDispatcher->thread);
+    }
+
+    //executor task still running, posts still blocked
+    SerialPortIO_Lock(&pDispatcher->lock);
+    pDispatcher->idleWaiters++;
+    while((pDispatcher->executor && pDispatcher->scheduled) || (pDispatcher->blockedCount>0))
+    {
+        if (pDispatcher->blockedCount>0)
+        {
+            SerialPortIO_SetEvent(&pDispatcher->roomEvent);
+        }
+        SerialPortIO_Unlock(&pDispatcher->lock);
+        SerialPortIO_WaitEvent(&pDispatcher->idleEvent, SERIALPORT_DISPATCH_WAIT);
+        SerialPortIO_Lock(&pDispatcher->lock);
+    }
+    pDispatcher->idleWaiters--;
+    SerialPortIO_Unlock(&pDispatcher->lock);
+
+    SerialPortDispatcher__Free(pDispatcher);
+}
+
+BOOL SerialPortDispatcher_Post(TSerialPortDispatcher* pDispatcher, SERIALPORT_DISPATCH_HANDLER handler, void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time)
+{
+    TSerialPortDispatchItem* pItem;
+    TSerialPortDispatchItem* pOldest;
+    TSerialPortDispatchItem* pDiscarded = NULL;
+    SERIALPORT_TIMESTAMP     startTime;
+    BOOL                     queued   = FALSE;
+    BOOL                     schedule = FALSE;
+    BOOL                     copied;
+
+    if ((handler==NULL) || (pData==NULL) || (dataLength<=0))
+    {
+        return FALSE;
+    }
+    if (pDispatcher==NULL)
+    {
+        handler(pContext, pData, dataLength, time, TRUE);
+        return FALSE;
+    }
+    //copied before taking the lock, freed again when the chunk is dropped or coalesced
+    pItem = (TSerialPortDispatchItem*)malloc(sizeof(TSerialPortDispatchItem)+dataLength);
+    if (pItem)
+    {
+        pItem->pNext      = NULL;
+        pItem->handler    = handler;
+        pItem->pContext   = pContext;
+        pItem->time       = time;
+        pItem->dataLength = dataLength;
+        memcpy(pItem->data, pData, dataLength);
+    }
+    copied = (pItem!=NULL);
+
+    SerialPortIO_Lock(&pDispatcher->lock);
+    pDispatcher->statistics.postedChunks++;
+    while(pItem && !pDispatcher->stopping && !SerialPortDispatcher__Fits(pDispatcher, dataLength))
+    {
+        if ((pDispatcher->policy==SERIALPORT_DISPATCH_BLOCK) && (m_pDeliveringDispatcher!=pDispatcher))
+        {
+            pDispatcher->statistics.blockedPosts++;
+            pDispatcher->blockedCount++;
+            SerialPortIO_Unlock(&pDispatcher->lock);
+            startTime = SerialPortIO_GetTime();
+            SerialPortIO_WaitEvent(&pDispatcher->roomEvent, SERIALPORT_INFINITE);
+            SerialPortIO_Lock(&pDispatcher->lock);
+            pDispatcher->blockedCount--;
+            pDispatcher->statistics.blockedTime += SerialPortIO_GetTime()-startTime;
+            continue;
+        }
+        if (pDispatcher->policy==SERIALPORT_DISPATCH_DROP_OLDEST)
+        {
+            pOldest = SerialPortDispatcher__Pop(pDispatcher);
+            pDispatcher->statistics.droppedChunks++;
+            pDispatcher->statistics.droppedBytes += pOldest->dataLength;
+            pOldest->pNext = pDiscarded;
+            pDiscarded = pOldest;
+            continue;
+        }
+        if ((pDispatcher->policy==SERIALPORT_DISPATCH_COALESCE) && SerialPortDispatcher__Coalesce(pDispatcher, pItem))
+        {
+            queued = TRUE;
+            free(pItem);
+        } else {
+            pItem->pNext = pDiscarded;
+            pDiscarded = pItem;
+        }
+        pItem = NULL;
+    }
+    if (pItem && !pDispatcher->stopping)
+    {
+        if (pDispatcher->pTail)
+        {
+            pDispatcher->pTail->pNext = pItem;
+        } else {
+            pDispatcher->pHead = pItem;
+        }
+        pDispatcher->pTail = pItem;
+        pDispatcher->statistics.queuedChunks++;
+        pDispatcher->statistics.queuedBytes += (unsigned int)dataLength;
+        if (pDispatcher->statistics.queuedChunks>pDispatcher->statistics.queueHighWater)
+        {
+            pDispatcher->statistics.queueHighWater = pDispatcher->statistics.queuedChunks;
+        }
+        pItem  = NULL;
+        queued = TRUE;
+    }
+    if (pItem)
+    {
+        pItem->pNext = pDiscarded;
+        pDiscarded = pItem;
+    }
+    if (!queued)
+    {
+        pDispatcher->statistics.droppedChunks++;
+        pDispatcher->statistics.droppedBytes += dataLength;
+    }
+    //another blocked post may fit as well
+    if ((pDispatcher->blockedCount>0) && (pDispatcher->stopping || SerialPortDispatcher__Fits(pDispatcher, 1)))
+    {
+        SerialPortIO_SetEvent(&pDispatcher->roomEvent);
+    }
+    if (queued && !pDispatcher->scheduled)
+    {
+        pDispatcher->scheduled = TRUE;
+        schedule = TRUE;
+    }
+    SerialPortIO_Unlock(&pDispatcher->lock);
+
+    if (!copied)
+    {
+        //out of memory, nothing was copied
+        handler(pContext, pData, dataLength, time, TRUE);
+    }
+    SerialPortDispatcher__Discard(pDiscarded);
+    if (schedule)
+    {
+        if (pDispatcher->executor)
+        {
+            pDispatcher->executor(pDispatcher->pExecutorContext, SerialPortDispatcher__Deliver, pDispatcher);
+        } else {
+            SerialPortIO_SetEvent(&pDispatcher->workEvent);
+        }
+    }
+    return queued;
+}
+
+void SerialPortDispatcher_Cancel(TSerialPortDispatcher* pDispatcher, void* pContext)
+{
+    TSerialPortDispatchItem** ppLink;
+    TSerialPortDispatchItem*  pItem;
+    TSerialPortDispatchItem*  pDiscarded = NULL;
+
+    if (pDispatcher==NULL)
+    {
+        return;
+    }
+    SerialPortIO_Lock(&pDispatcher->lock);
+    ppLink = &pDispatcher->pHead;
+    pDispatcher->pTail = NULL;
+    while(*ppLink)
+    {
+        pItem = *ppLink;
+        if (pItem->pContext==pContext)
+        {
+            *ppLink = pItem->pNext;
+            pDispatcher->statistics.queuedChunks--;
+            pDispatcher->statistics.queuedBytes -= (unsigned int)pItem->dataLength;
+            pItem->pNext = pDiscarded;
+            pDiscarded = pItem;
+        } else {
+            pDispatcher->pTail = pItem;
+            ppLink = &pItem->pNext;
+        }
+    }
+    if (pDispatcher->blockedCount>0)
+    {
+        SerialPortIO_SetEvent(&pDispatcher->roomEvent);
+    }
+    if (m_pDeliveringDispatcher!=pDispatcher)
+    {
+        pDispatcher->idleWaiters++;
+        while(pDispatcher->pDeliveringContext==pContext)
+        {
+            SerialPortIO_Unlock(&pDispatcher->lock);
+            SerialPortIO_WaitEvent(&pDispatcher->idleEvent, SERIALPORT_DISPATCH_WAIT);
+            SerialPortIO_Lock(&pDispatcher->lock);
+        }
+        pDispatcher->idleWaiters--;
+    }
+    SerialPortIO_Unlock(&pDispatcher->lock);
+    SerialPortDispatcher__Discard(pDiscarded);
+}
+
+void SerialPortDispatcher_GetStatistics(TSerialPortDispatcher* pDispatcher, TSerialPortDispatchStatistics* pStatistics)
+{
+    SerialPortIO_Lock(&pDispatcher->lock);
+    *pStatistics = pDispatcher->statistics;
+    SerialPortIO_Unlock(&pDispatcher->lock);
+}
@@ -0,0 +1,102 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+
+#ifndef SERIALPORTDISPATCHER___H
+#define SERIALPORTDISPATCHER___H
+
+#include "SerialPortIO.h"
+
+/*
+* Delivers received data to handlers away from the I/O thread. Post
+* copies a chunk into the queue and returns, the handler runs later on
+* the dispatcher thread or, when an executor is given to Create, on
+* whatever thread the executor runs its tasks. The executor gets one
+* task at a time and must run every task it gets: the task delivers
+* everything queued and returns, handlers are never called
+* concurrently and see the chunks of one context in order.
+*
+* maxChunks/maxBytes (0 = unlimited) bound the queue, the policy says
+* what Post does when a chunk does not fit:
+*
+*   BLOCK        waits until the handler catches up (the I/O thread
+*                stalls, the driver buffers meanwhile)
+*   DROP_OLDEST  discards queued chunks from the head until it fits
+*   DROP_NEWEST  discards the chunk being posted
+*   COALESCE     appends the chunk to the last queued chunk of the same
+*                context, so a slow handler gets fewer, bigger chunks.
+*                Only the chunk limit is relaxed this way, beyond
+*                maxBytes the chunk is dropped
+*
+* An empty queue accepts any chunk. A handler posting to its own
+* dispatcher never blocks, the chunk is dropped instead.
+*
+* A chunk posted with a time (not 0) gets it back in the handler and is
+* never coalesced. A chunk which is not delivered (dropped, cancelled
+* or left at Delete) still goes to its handler with discarded TRUE, on
+* the thread discarding it, so whatever the chunk refers to can be
+* released.
+*
+* One dispatcher may serve several ports. Cancel removes the queued
+* chunks of a context and waits until its handler call in progress (if
+* any, and not on the calling thread) returns, ports call it when they
+* close. Delete discards whatever was not delivered, it must not be
+* called from a handler of the dispatcher.
+*/
+
+#define SERIALPORT_DISPATCH_BLOCK       0
+#define SERIALPORT_DISPATCH_DROP_OLDEST 1
+#define SERIALPORT_DISPATCH_DROP_NEWEST 2
+#define SERIALPORT_DISPATCH_COALESCE    3
+
+#define SERIALPORT_DEFAULT_DISPATCH_CHUNKS 256
+#define SERIALPORT_DEFAULT_DISPATCH_BYTES  (1024*1024)
+
+typedef struct TSerialPortDispatcher TSerialPortDispatcher;
+
+typedef void (*SERIALPORT_DISPATCH_HANDLER)(void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time, BOOL discarded);
+typedef void (*SERIALPORT_DISPATCH_TASK)(void* pTask);
+typedef void (*SERIALPORT_EXECUTOR)(void* pExecutorContext, SERIALPORT_DISPATCH_TASK task, void* pTask);
+
+typedef struct
+{
+    unsigned long long postedChunks;
+    unsigned long long deliveredChunks;
+    unsigned long long droppedChunks;       //overruns of DROP_OLDEST/DROP_NEWEST/COALESCE
+    unsigned long long droppedBytes;
+    unsigned long long coalescedChunks;     //appended to a queued chunk
+    unsigned long long blockedPosts;        //posts which waited for room (BLOCK)
+    unsigned long long blockedTime;         //microseconds they waited
+    unsigned int       queuedChunks;
+    unsigned int       queuedBytes;
+    unsigned int       queueHighWater;      //most chunks queued
+} TSerialPortDispatchStatistics;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+TSerialPortDispatcher* SerialPortDispatcher_Create(int maxChunks, int maxBytes, int policy, SERIALPORT_EXECUTOR executor, void* pExecutorContext);
+void    SerialPortDispatcher_Delete(TSerialPortDispatcher* pDispatcher);
+BOOL    SerialPortDispatcher_Post(TSerialPortDispatcher* pDispatcher, SERIALPORT_DISPATCH_HANDLER handler, void* pContext, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP time);
+void    SerialPortDispatcher_Cancel(TSerialPortDispatcher* pDispatcher, void* pContext);
+void    SerialPortDispatcher_GetStatistics(TSerialPortDispatcher* pDispatcher, TSerialPortDispatchStatistics* pStatistics);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,426 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef SERIALPORTFRAMER___HPP
+#define SERIALPORTFRAMER___HPP
+
+#include "SerialPortCrc.h"
+#include <string.h>
+
+/*
+* TSerialPortFramer cuts received chunks into frames. It is fed whole
+* chunks (call OnDataReceived from the data received handler) and hands
+* decoded frames to THandler::OnFramesReceived in batches of up to
+* SERIALPORT_FRAMER_BATCH frames, at least once per chunk with frames.
+* Frame data are valid during that call only. Frames lying completely
+* inside a chunk are not copied unless the framing has to decode them
+* (SLIP, COBS).
+*
+* TFraming selects the frame format at compile time, so the whole path
+* is inlined:
+*
+*   TSerialPortFixedFraming<MAGIC, LENGTH>     magic byte + LENGTH-1 bytes
+*   TSerialPortLengthFraming<BYTES, MAX>       1 or 2 byte big endian length + payload
+*   TSerialPortDelimiterFraming<DELIMITER, MAX> payload + delimiter
+*   TSerialPortSlipFraming<MAX>                RFC 1055 SLIP
+*   TSerialPortCobsFraming<MAX>                COBS, 0x00 terminated
+*
+* MAX is the longest frame on the wire including framing bytes. Framing
+* classes provide:
+*
+*   Measure - length of the frame starting at pData[0], 0 when more data
+*             are needed, -1 when no valid frame starts there. Bytes
+*             below offset were already measured before.
+*   Resync  - bytes to skip to reach a possible frame start, -1 if
+*             there is none within pData.
+*   Decode  - payload of a complete frame, pOutput has room for
+*             frameLength bytes and is used only when the payload has to
+*             be unescaped. Returns -1 for a corrupted frame.
+*
+* TSerialPortCrcFraming<TFraming, CRCTYPE> adds a checksum check to any
+* of them: the decoded payload has to end with a CRC (SerialPortCrc.h)
+* over the rest of it, the CRC is stripped before delivery.
+*
+* Invalid, too long and corrupted frames are dropped and counted by
+* GetErrorCount, empty frames are skipped.
+*/
+
+#define SERIALPORT_MAX_FRAME_LENGTH 256
+#define SERIALPORT_FRAMER_BATCH     32
+
+typedef struct
+{
+    const unsigned char* pData;
+    int                  dataLength;
+} TSerialPortFrame;
+
+template <unsigned char MAGIC, int LENGTH>
+class TSerialPortFixedFraming
+{
+public:
+    enum { MaxFrameLength = LENGTH };
+    
+    static int Measure(const unsigned char* pData, int dataLength, int offset)
+    {
+        (void)offset;
+        if (pData[0]!=MAGIC) return -1;
+        if (dataLength<LENGTH) return 0;
+        return LENGTH;
+    }
+    
+    static int Resync(const unsigned char* pData, int dataLength)
+    {
+        const unsigned char* pMagic = (const unsigned char*)memchr(pData, MAGIC, dataLength);
+        if (pMagic==NULL) return -1;
+        return (int)(pMagic-pData);
+    }
+    
+    static int Decode(const unsigned char* pFrame, int frameLength, unsigned char* pOutput, const unsigned char** ppPayload)
+    {
+        (void)pOutput;
+        *ppPayload = pFrame+1;
+        return frameLength-1;
+    }
+};
+
+template <int LENGTHBYTES = 1, int MAX = SERIALPORT_MAX_FRAME_LENGTH>
+class TSerialPortLengthFraming
+{
+public:
+    enum { MaxFrameLength = MAX };
+    
+    static int Measure(const unsigned char* pData, int dataLength, int offset)
+    {
+        int payloadLength;
+        
+        (void)offset;
+        if (dataLength<LENGTHBYTES) return 0;
+        payloadLength = pData[0];
+        if (LENGTHBYTES==2)
+        {
+            payloadLength = (payloadLength<<8) | pData[1];
+        }
+        if (payloadLength>MAX-LENGTHBYTES) return -1;
+        if (dataLength<LENGTHBYTES+payloadLength) return 0;
+        return LENGTHBYTES+payloadLength;
+    }
+    
+    static int Resync(const unsigned char* pData, int dataLength)
+    {
+        //there is nothing to synchronize on, next byte is tried
+        (void)pData;
+        (void)dataLength;
+        return 1;
+    }
+    
+    static int Decode(const unsigned char* pFrame, int frameLength, unsigned char* pOutput, const unsigned char** ppPayload)
+    {
+        (void)pOutput;
+        *ppPayload = pFrame+LENGTHBYTES;
+        return frameLength-LENGTHBYTES;
+    }
+};
+
+//frame ends with DELIMITER, shared by delimiter, SLIP and COBS framing
+template <unsigned char DELIMITER, int MAX>
+class TSerialPortTerminatedFraming
+{
+public:
+    enum { MaxFrameLength = MAX };
+    
+    static int Measure(const unsigned char* pData, int dataLength, int offset)
+    {
+        const unsigned char* pEnd;
+        int scanLength = dataLength<MAX ? dataLength : MAX;
+        
+        if (offset<scanLength)
+        {
+            pEnd = (const unsigned char*)memchr(pData+offset, DELIMITER, scanLength-offset);
+            if (pEnd) return (int)(pEnd-pData)+1;
+        }
+        return dataLength<MAX ? 0 : -1;
+    }
+    
+    static int Resync(const unsigned char* pData, int dataLength)
+    {
+        const unsigned char* pEnd = (const unsigned char*)memchr(pData, DELIMITER, dataLength);
+        if (pEnd==NULL) return -1;
+        return (int)(pEnd-pData)+1;
+    }
+};
+
+template <unsigned char DELIMITER = '\n', int MAX = SERIALPORT_MAX_FRAME_LENGTH>
+class TSerialPortDelimiterFraming : public TSerialPortTerminatedFraming<DELIMITER, MAX>
+{
+public:
+    static int Decode(const unsigned char* pFrame, int frameLength, unsigned char* pOutput, const unsigned char** ppPayload)
+    {
+        (void)pOutput;
+        *ppPayload = pFrame;
+        return frameLength-1;
+    }
+};
+
+#define SERIALPORT_SLIP_END     0xC0
+#define SERIALPORT_SLIP_ESC     0xDB
+#define SERIALPORT_SLIP_ESC_END 0xDC
+#define SERIALPORT_SLIP_ESC_ESC 0xDD
+
+template <int MAX = SERIALPORT_MAX_FRAME_LENGTH>
+class TSerialPortSlipFraming : public TSerialPortTerminatedFraming<SERIALPORT_SLIP_END, MAX>
+{
+public:
+    static int Decode(const unsigned char* pFrame, int frameLength, unsigned char* pOutput, const unsigned char** ppPayload)
+    {
+        const unsigned char* pEnd = pFrame+frameLength-1;
+        const unsigned char* pEscape;
+        unsigned char*       pWrite = pOutput;
+        int                  runLength;
+        
+        pEscape = (const unsigned char*)memchr(pFrame, SERIALPORT_SLIP_ESC, pEnd-pFrame);
+        if (pEscape==NULL)
+        {
+            //nothing escaped, payload is used in place
+            *ppPayload = pFrame;
+            return frameLength-1;
+        }
+        while(pEscape)
+        {
+            runLength = (int)(pEscape-pFrame);
+            memcpy(pWrite, pFrame, runLength);
+            pWrite += runLength;
+            if (pEscape+1>=pEnd) return -1;
+            if (pEscape[1]==SERIALPORT_SLIP_ESC_END)
+            {
+                *pWrite++ = SERIALPORT_SLIP_END;
+            } else if (pEscape[1]==SERIALPORT_SLIP_ESC_ESC) {
+                *pWrite++ = SERIALPORT_SLIP_ESC;
+            } else {
+                return -1;
+            }
+            pFrame = pEscape+2;
+            pEscape = (const unsigned char*)memchr(pFrame, SERIALPORT_SLIP_ESC, pEnd-pFrame);
+        }
+        runLength = (int)(pEnd-pFrame);
+        memcpy(pWrite, pFrame, runLength);
+        pWrite += runLength;
+        *ppPayload = pOutput;
+        return (int)(pWrite-pOutput);
+    }
+};
+
+template <int MAX = SERIALPORT_MAX_FRAME_LENGTH>
+class TSerialPortCobsFraming : public TSerialPortTerminatedFraming<0, MAX>
+{
+public:
+    static int Decode(const unsigned char* pFrame, int frameLength, unsigned char* pOutput, const unsigned char** ppPayload)
+    {
+        const unsigned char* pEnd = pFrame+frameLength-1;
+        unsigned char*       pWrite = pOutput;
+        int                  code, runLength;
+        
+        while(pFrame<pEnd)
+        {
+            code = *pFrame++;
+            runLength = code-1;
+            if (runLength>pEnd-pFrame) return -1;
+            memcpy(pWrite, pFrame, runLength);
+            pWrite += runLength;
+            pFrame += runLength;
+            if ((code<0xFF) && (pFrame<pEnd))
+            {
+                *pWrite++ = 0;
+            }
+        }
+        *ppPayload = pOutput;
+        return (int)(pWrite-pOutput);
+    }
+};
+
+template <class TFraming, int CRCTYPE>
+class TSerialPortCrcFraming : public TFraming
+{
+public:
+    static int Decode(const unsigned char* pFrame, int frameLength, unsigned char* pOutput, const unsigned char** ppPayload)
+    {
+        int payloadLength = TFraming::Decode(pFrame, frameLength, pOutput, ppPayload);
+        if (payloadLength<0) return -1;
+        if (!SerialPortCrc_Check(CRCTYPE, *ppPayload, payloadLength)) return -1;
+        return payloadLength-SerialPortCrc_GetSize(CRCTYPE);
+    }
+};
+
+template <class TFraming, class THandler>
+class TSerialPortFramer
+{
+private:
+    THandler*        m_pHandler;
+    unsigned char    m_pending[TFraming::MaxFrameLength];
+    int              m_pendingLength;
+    bool             m_resync;
+    unsigned char    m_decoded[4*TFraming::MaxFrameLength];
+    int              m_decodedLength;
+    TSerialPortFrame m_frames[SERIALPORT_FRAMER_BATCH];
+    int              m_frameCount;
+    unsigned int     m_receivedFrames;
+    unsigned int     m_errorCount;
+    
+    void __Deliver(const unsigned char* pFrame, int frameLength);
+    void __Flush();
+    
+public:
+    TSerialPortFramer(THandler* pHandler);
+    
+    void OnDataReceived(const unsigned char* pData, int dataLength);
+    void Reset();
+    
+    unsigned int GetFrameCount();
+    unsigned int GetErrorCount();
+};
+
+template <class TFraming, class THandler>
+TSerialPortFramer<TFraming, THandler>::TSerialPortFramer(THandler* pHandler)
+{
+    m_pHandler = pHandler;
+    m_receivedFrames = 0;
+    m_errorCount = 0;
+    Reset();
+}
+
+template <class TFraming, class THandler>
+void TSerialPortFramer<TFraming, THandler>::Reset()
+{
+    m_pendingLength = 0;
+    m_resync = false;
+    m_decodedLength = 0;
+    m_frameCount = 0;
+}
+
+template <class TFraming, class THandler>
+unsigned int TSerialPortFramer<TFraming, THandler>::GetFrameCount()
+{
+    return m_receivedFrames;
+}
+
+template <class TFraming, class THandler>
+unsigned int TSerialPortFramer<TFraming, THandler>::GetErrorCount()
+{
+    return m_errorCount;
+}
+
+template <class TFraming, class THandler>
+void TSerialPortFramer<TFraming, THandler>::__Flush()
+{
+    if (m_frameCount>0)
+    {
+        m_pHandler->OnFramesReceived(m_frames, m_frameCount);
+    }
+    m_frameCount = 0;
+    m_decodedLength = 0;
+}
+
+template <class TFraming, class THandler>
+void TSerialPortFramer<TFraming, THandler>::__Deliver(const unsigned char* pFrame, int frameLength)
+{
+    const unsigned char* pPayload;
+    int                  payloadLength;
+    
+    if (m_decodedLength+frameLength>(int)sizeof(m_decoded))
+    {
+        __Flush();
+    }
+    payloadLength = TFraming::Decode(pFrame, frameLength, m_decoded+m_decodedLength, &pPayload);
+    if (payloadLength<0)
+    {
+        m_errorCount++;
+        return;
+    }
+    if (payloadLength==0) return;
+    if (pPayload==m_decoded+m_decodedLength)
+    {
+        m_decodedLength += payloadLength;
+    }
+    m_frames[m_frameCount].pData = pPayload;
+    m_frames[m_frameCount].dataLength = payloadLength;
+    m_frameCount++;
+    m_receivedFrames++;
+    if (m_frameCount==SERIALPORT_FRAMER_BATCH)
+    {
+        __Flush();
+    }
+}
+
+template <class TFraming, class THandler>
+void TSerialPortFramer<TFraming, THandler>::OnDataReceived(const unsigned char* pData, int dataLength)
+{
+    int frameLength, copyLength, skipLength;
+    
+    while(dataLength>0)
+    {
+        if (m_resync)
+        {
+            skipLength = TFraming::Resync(pData, dataLength);
+            if (skipLength<0) break;
+            m_resync = false;
+            pData += skipLength;
+            dataLength -= skipLength;
+            continue;
+        }
+        if (m_pendingLength>0)
+        {
+            //frame started in one of previous chunks
+            copyLength = TFraming::MaxFrameLength-m_pendingLength;
+            if (copyLength>dataLength) copyLength = dataLength;
+            memcpy(m_pending+m_pendingLength, pData, copyLength);
+            frameLength = TFraming::Measure(m_pending, m_pendingLength+copyLength, m_pendingLength);
+            if (frameLength>0)
+            {
+                copyLength = frameLength-m_pendingLength;
+                m_pendingLength = 0;
+                __Deliver(m_pending, frameLength);
+                pData += copyLength;
+                dataLength -= copyLength;
+            } else if ((frameLength==0) && (copyLength==dataLength)) {
+                m_pendingLength += copyLength;
+                break;
+            } else {
+                m_errorCount++;
+                m_pendingLength = 0;
+                m_resync = true;
+            }
+            continue;
+        }
+        frameLength = TFraming::Measure(pData, dataLength, 0);
+        if (frameLength>0)
+        {
+            __Deliver(pData, frameLength);
+            pData += frameLength;
+            dataLength -= frameLength;
+        } else if (frameLength==0) {
+            //rest of the frame comes with the next chunk
+            __Flush();
+            memcpy(m_pending, pData, dataLength);
+            m_pendingLength = dataLength;
+            break;
+        } else {
+            m_errorCount++;
+            m_resync = true;
+        }
+    }
+    __Flush();
+}
+
+#endif
@@ -0,0 +1,1973 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include "SerialPortIO.h"
+#include "SerialPortVirtual.h"
+#include "SerialPortCapture.h"
+#include "SerialPortTrace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+#endif
+
+typedef struct
+{
+    SERIALPORT_THREAD_ROUTINE threadRoutine;
+    void*                     lpParam;
+} TSerialPortThreadStart;
+
+typedef struct TSerialPortModemWatch
+{
+    TSerialPortDevice*       pDevice;
+    SERIALPORT_MODEM_HANDLER handler;
+    void*                    pContext;
+    unsigned int             modemStatus;
+    SERIALPORT_THREAD        thread;
+    SERIALPORT_EVENT         stopEvent;
+    unsigned int             stopping;
+    unsigned int             state;         //SERIALPORT_WATCH_XXX
+} TSerialPortModemWatch;
+
+#define SERIALPORT_WATCH_FINISHED  0
+#define SERIALPORT_WATCH_RUNNING   1
+#define SERIALPORT_WATCH_ORPHANED  2       //nobody joins the thread, it frees the watch itself
+
+#define SERIALPORT_MODEM_STOP_TRIES 100    //signals sent to a thread in TIOCMIWAIT, 1 ms apart
+
+static void SerialPortIO__AddLineEvent(TSerialPortDevice* pDevice, int errors, unsigned long long position, unsigned char data);
+
+#ifdef _WIN32
+
+BOOL SerialPortIO_GetDeviceName(int comPortNumber, char* deviceName, int maxLength)
+{
+    if (comPortNumber<0) return FALSE;
+    if (comPortNumber>255) return FALSE;
+    if (maxLength<12) return FALSE;
+
+    sprintf(deviceName, "\\\\.\\COM%i", comPortNumber);
+    return TRUE;
+}
+
+static BOOL SerialPortIO__DeviceConfigure(TSerialPortDevice* pDevice, const TSerialPortSettings* pSettings)
+{
+    DCB portSettings;
+
+    if ((pSettings->baudRate<=0) || (pSettings->dataBits<5) || (pSettings->dataBits>8) ||
+        (pSettings->parity<SERIALPORT_PARITY_NONE) || (pSettings->parity>SERIALPORT_PARITY_SPACE) ||
+        (pSettings->stopBits<SERIALPORT_STOPBITS_ONE) || (pSettings->stopBits>SERIALPORT_STOPBITS_TWO))
+    {
+        return FALSE;
+    }
+
+    memset(&portSettings, 0, sizeof(portSettings));
+    portSettings.DCBlength = sizeof(portSettings);
+    GetCommState(pDevice->nativeHandle, &portSettings);
+
+    //SERIALPORT_PARITY_XXX and SERIALPORT_STOPBITS_XXX have the DCB values
+    portSettings.BaudRate = pSettings->baudRate;
+    portSettings.fBinary  = TRUE;
+    portSettings.ByteSize = (BYTE)pSettings->dataBits;
+    portSettings.Parity   = (BYTE)pSettings->parity;
+    portSettings.fParity  = (pSettings->parity!=SERIALPORT_PARITY_NONE);
+    portSettings.StopBits = (BYTE)pSettings->stopBits;
+    portSettings.fAbortOnError = FALSE;
+
+    portSettings.fOutxCtsFlow = (pSettings->flowControl & SERIALPORT_FLOW_RTSCTS)!=0;
+    if (pSettings->flowControl & SERIALPORT_FLOW_RTSCTS)
+    {
+        portSettings.fRtsControl = RTS_CONTROL_HANDSHAKE;
+    } else if (portSettings.fRtsControl==RTS_CONTROL_HANDSHAKE) {
+        portSettings.fRtsControl = RTS_CONTROL_ENABLE;
+    }
+    portSettings.fOutX    = (pSettings->flowControl & SERIALPORT_FLOW_XONXOFF)!=0;
+    portSettings.fInX     = portSettings.fOutX;
+    portSettings.XonChar  = 0x11;
+    portSettings.XoffChar = 0x13;
+
+    if (!SetCommState(pDevice->nativeHandle, &portSettings))
+    {
+        return FALSE;
+    }
+    pDevice->reportLineErrors = pSettings->reportLineErrors;
+    return TRUE;
+}
+
+static BOOL SerialPortIO__DeviceOpen(TSerialPortDevice* pDevice, const char* deviceName, const TSerialPortSettings* pSettings)
+{
+    HANDLE       portHandle;
+    COMMTIMEOUTS portTimeOuts;
+    char         portName[SERIALPORT_MAX_DEVICE_NAME];
+
+    if (deviceName==NULL) return FALSE;
+
+    //"COM12" has to be passed as "\\.\COM12", full paths are used as they are
+    if (strncmp(deviceName, "\\\\.\\", 4)==0)
+    {
+        _snprintf(portName, sizeof(portName), "%s", deviceName);
+    } else {
+        _snprintf(portName, sizeof(portName), "\\\\.\\%s", deviceName);
+    }
+    portName[sizeof(portName)-1] = 0;
+
+    portHandle = CreateFileA(portName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+    if ((portHandle==0) || (portHandle==INVALID_HANDLE_VALUE))
+    {
+        return FALSE;
+    }
+
+    pDevice->nativeHandle = portHandle;
+    if (!SerialPortIO__DeviceConfigure(pDevice, pSettings))
+    {
+        CloseHandle(portHandle);
+        return FALSE;
+    }
+
+    //ReadFile completes as soon as at least one byte is available,
+    //the timeout itself is handled by WaitForMultipleObjects
+    memset(&portTimeOuts, 0, sizeof(portTimeOuts));
+    portTimeOuts.ReadIntervalTimeout = MAXDWORD;
+    portTimeOuts.ReadTotalTimeoutMultiplier = MAXDWORD;
+    portTimeOuts.ReadTotalTimeoutConstant = MAXDWORD-1;
+
+    if (!SetCommTimeouts(portHandle, &portTimeOuts))
+    {
+        CloseHandle(portHandle);
+        return FALSE;
+    }
+    SetCommMask(portHandle, EV_RXCHAR);
+    return TRUE;
+}
+
+static void SerialPortIO__DeviceClose(TSerialPortDevice* pDevice)
+{
+    CloseHandle(pDevice->nativeHandle);
+}
+
+static BOOL SerialPortIO__WaitForOverlapped(HANDLE portHandle, OVERLAPPED* pOverlapped, int timeOutMS, SERIALPORT_EVENT* pWakeEvent)
+{
+    HANDLE waitHandles[2];
+    DWORD  waitCount = 0;
+    DWORD  waitResult;
+
+    waitHandles[waitCount++] = pOverlapped->hEvent;
+    if (pWakeEvent)
+    {
+        waitHandles[waitCount++] = *pWakeEvent;
+    }
+    waitResult = WaitForMultipleObjects(waitCount, waitHandles, FALSE, (timeOutMS<0) ? INFINITE : (DWORD)timeOutMS);
+    if (waitResult!=WAIT_OBJECT_0)
+    {
+        CancelIo(portHandle);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int SerialPortIO__DeviceRead(TSerialPortDevice* pDevice, unsigned char* pData, int dataLength, int timeOutMS, SERIALPORT_EVENT* pWakeEvent)
+{
+    HANDLE     portHandle = pDevice->nativeHandle;
+    OVERLAPPED overlapped;
+    DWORD      bytesRead = 0;
+    DWORD      portErrors;
+    int        result = 0;
+    int        errors = 0;
+
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (overlapped.hEvent==NULL)
+    {
+        return -1;
+    }
+
+    if (!ReadFile(portHandle, pData, dataLength, &bytesRead, &overlapped))
+    {
+        if (GetLastError()!=ERROR_IO_PENDING)
+        {
+            CloseHandle(overlapped.hEvent);
+            return -1;
+        }
+        SerialPortIO__WaitForOverlapped(portHandle, &overlapped, timeOutMS, pWakeEvent);
+        if (!GetOverlappedResult(portHandle, &overlapped, &bytesRead, TRUE))
+        {
+            result = (GetLastError()==ERROR_OPERATION_ABORTED) ? 0 : -1;
+        }
+    }
+    CloseHandle(overlapped.hEvent);
+
+    //errors are not marked in the data, they are reported at the end of the chunk
+    if ((result>=0) && pDevice->reportLineErrors && ClearCommError(portHandle, &portErrors, NULL))
+    {
+        if (portErrors & CE_BREAK)                   errors |= SERIALPORT_LINE_BREAK;
+        if (portErrors & CE_FRAME)                   errors |= SERIALPORT_LINE_FRAMING;
+        if (portErrors & CE_RXPARITY)                errors |= SERIALPORT_LINE_PARITY;
+        if (portErrors & (CE_OVERRUN | CE_RXOVER))   errors |= SERIALPORT_LINE_OVERRUN;
+        if (errors)
+        {
+            SerialPortIO__AddLineEvent(pDevice, errors, pDevice->receivedBytes+bytesRead, 0);
+        }
+    }
+    return (result<0) ? result : (int)bytesRead;
+}
+
+static int SerialPortIO__DeviceWaitForData(TSerialPortDevice* pDevice, int timeOutMS, SERIALPORT_EVENT* pWakeEvent)
+{
+    HANDLE     portHandle = pDevice->nativeHandle;
+    OVERLAPPED overlapped;
+    COMSTAT    portStatus;
+    DWORD      portErrors;
+    DWORD      eventMask = 0;
+    DWORD      bytesTransferred;
+    int        result = 0;
+
+    if (!ClearCommError(portHandle, &portErrors, &portStatus))
+    {
+        return -1;
+    }
+    if (portStatus.cbInQue)
+    {
+        return 1;
+    }
+
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (overlapped.hEvent==NULL)
+    {
+        return -1;
+    }
+    if (WaitCommEvent(portHandle, &eventMask, &overlapped))
+    {
+        result = 1;
+    } else if (GetLastError()!=ERROR_IO_PENDING) {
+        result = -1;
+    } else {
+        result = SerialPortIO__WaitForOverlapped(portHandle, &overlapped, timeOutMS, pWakeEvent) ? 1 : 0;
+        if (!GetOverlappedResult(portHandle, &overlapped, &bytesTransferred, TRUE))
+        {
+            result = (GetLastError()==ERROR_OPERATION_ABORTED) ? 0 : -1;
+        }
+    }
+    CloseHandle(overlapped.hEvent);
+    return result;
+}
+
+static int SerialPortIO__DeviceWrite(TSerialPortDevice* pDevice, const unsigned char* pData, int dataLength)
+{
+    HANDLE     portHandle = pDevice->nativeHandle;
+    OVERLAPPED overlapped;
+    DWORD      bytesWritten = 0;
+
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (overlapped.hEvent==NULL)
+    {
+        return 0;
+    }
+    if (!WriteFile(portHandle, pData, dataLength, &bytesWritten, &overlapped))
+    {
+        if ((GetLastError()!=ERROR_IO_PENDING) ||
+            (!GetOverlappedResult(portHandle, &overlapped, &bytesWritten, TRUE)))
+        {
+            bytesWritten = 0;
+        }
+    }
+    CloseHandle(overlapped.hEvent);
+    return (int)bytesWritten;
+}
+
+static int SerialPortIO__DeviceWriteVector(TSerialPortDevice* pDevice, const SERIALPORT_BUFFER* pBuffers, int bufferCount, BOOL blocking)
+{
+    unsigned char coalesced[4096];
+    int           coalescedLength = 0;
+    int           bytesWrittenTotal = 0;
+    int           i, offset, chunkLength;
+
+    //overlapped writes cannot be gathered, small buffers are copied into one WriteFile
+    for(i = 0; i<bufferCount; i++)
+    {
+        offset = 0;
+        while(offset<pBuffers[i].dataLength)
+        {
+            chunkLength = pBuffers[i].dataLength - offset;
+            if ((coalescedLength==0) && (chunkLength>=(int)sizeof(coalesced)))
+            {
+                if (SerialPortIO__DeviceWrite(pDevice, pBuffers[i].pData+offset, chunkLength)!=chunkLength)
+                {
+                    return -1;
+                }
+                bytesWrittenTotal += chunkLength;
+                break;
+            }
+            if (chunkLength>(int)sizeof(coalesced)-coalescedLength)
+            {
+                chunkLength = (int)sizeof(coalesced)-coalescedLength;
+            }
+            memcpy(coalesced+coalescedLength, pBuffers[i].pData+offset, chunkLength);
+            coalescedLength += chunkLength;
+            offset += chunkLength;
+            if (coalescedLength==(int)sizeof(coalesced))
+            {
+                if (SerialPortIO__DeviceWrite(pDevice, coalesced, coalescedLength)!=coalescedLength)
+                {
+                    return -1;
+                }
+                bytesWrittenTotal += coalescedLength;
+                coalescedLength = 0;
+            }
+        }
+    }
+    if (coalescedLength)
+    {
+        if (SerialPortIO__DeviceWrite(pDevice, coalesced, coalescedLength)!=coalescedLength)
+        {
+            return -1;
+        }
+        bytesWrittenTotal += coalescedLength;
+    }
+    return bytesWrittenTotal;
+}
+
+static BOOL SerialPortIO__DeviceDrain(TSerialPortDevice* pDevice)
+{
+    return FlushFileBuffers(pDevice->nativeHandle);
+}
+
+//Windows cannot read back RTS and DTR, only the inputs are reported
+static BOOL SerialPortIO__DeviceGetModemStatus(TSerialPortDevice* pDevice, unsigned int* pModemStatus)
+{
+    DWORD modemStatus;
+
+    if (!GetCommModemStatus(pDevice->nativeHandle, &modemStatus))
+    {
+        return FALSE;
+    }
+    *pModemStatus = ((modemStatus & MS_CTS_ON)  ? SERIALPORT_MODEM_CTS : 0) |
+                    ((modemStatus & MS_DSR_ON)  ? SERIALPORT_MODEM_DSR : 0) |
+                    ((modemStatus & MS_RING_ON) ? SERIALPORT_MODEM_RI  : 0) |
+                    ((modemStatus & MS_RLSD_ON) ? SERIALPORT_MODEM_DCD : 0);
+    return TRUE;
+}
+
+static BOOL SerialPortIO__DeviceSetModemLines(TSerialPortDevice* pDevice, unsigned int lines, unsigned int mask)
+{
+    if ((mask & SERIALPORT_MODEM_RTS) && !EscapeCommFunction(pDevice->nativeHandle, (lines & SERIALPORT_MODEM_RTS) ? SETRTS : CLRRTS))
+    {
+        return FALSE;
+    }
+    if ((mask & SERIALPORT_MODEM_DTR) && !EscapeCommFunction(pDevice->nativeHandle, (lines & SERIALPORT_MODEM_DTR) ? SETDTR : CLRDTR))
+    {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static BOOL SerialPortIO__DeviceSetBreak(TSerialPortDevice* pDevice, BOOL enable)
+{
+    return enable ? SetCommBreak(pDevice->nativeHandle) : ClearCommBreak(pDevice->nativeHandle);
+}
+
+//no wait needs to be interrupted on Windows, modem lines are polled
+static void SerialPortIO__InterruptThread(SERIALPORT_THREAD* pThread)
+{
+}
+
+static void SerialPortIO__DetachThread(SERIALPORT_THREAD* pThread)
+{
+    CloseHandle(*pThread);
+}
+
+void SerialPortIO_Sleep(int timeMS)
+{
+    Sleep(timeMS);
+}
+
+SERIALPORT_TIMESTAMP SerialPortIO_GetTime(void)
+{
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart==0)
+    {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (SERIALPORT_TIMESTAMP)((counter.QuadPart / frequency.QuadPart) * 1000000 +
+                                  (counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart);
+}
+
+void SerialPortIO_InitLock(SERIALPORT_LOCK* pLock)
+{
+    InitializeCriticalSection(pLock);
+}
+
+void SerialPortIO_DeleteLock(SERIALPORT_LOCK* pLock)
+{
+    DeleteCriticalSection(pLock);
+}
+
+void SerialPortIO_Lock(SERIALPORT_LOCK* pLock)
+{
+    EnterCriticalSection(pLock);
+}
+
+void SerialPortIO_Unlock(SERIALPORT_LOCK* pLock)
+{
+    LeaveCriticalSection(pLock);
+}
+
+BOOL SerialPortIO_CreateEvent(SERIALPORT_EVENT* pEvent)
+{
+    *pEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    return (*pEvent!=NULL);
+}
+
+void SerialPortIO_DeleteEvent(SERIALPORT_EVENT* pEvent)
+{
+    if (*pEvent!=NULL)
+    {
+        CloseHandle(*pEvent);
+        *pEvent = NULL;
+    }
+}
+
+void SerialPortIO_SetEvent(SERIALPORT_EVENT* pEvent)
+{
+    SetEvent(*pEvent);
+}
+
+void SerialPortIO_ResetEvent(SERIALPORT_EVENT* pEvent)
+{
+    ResetEvent(*pEvent);
+}
+
+BOOL SerialPortIO_WaitEvent(SERIALPORT_EVENT* pEvent, int timeOutMS)
+{
+    return WaitForSingleObject(*pEvent, (timeOutMS<0) ? INFINITE : (DWORD)timeOutMS)==WAIT_OBJECT_0;
+}
+
+int SerialPortIO_WaitEvents(SERIALPORT_EVENT* pEvent, SERIALPORT_EVENT* pWakeEvent, int timeOutMS)
+{
+    HANDLE waitHandles[2];
+    DWORD  waitCount = 0;
+    DWORD  waitResult;
+
+    waitHandles[waitCount++] = *pEvent;
+    if (pWakeEvent)
+    {
+        waitHandles[waitCount++] = *pWakeEvent;
+    }
+    waitResult = WaitForMultipleObjects(waitCount, waitHandles, FALSE, (timeOutMS<0) ? INFINITE : (DWORD)timeOutMS);
+    if (waitResult==WAIT_FAILED)
+    {
+        return -1;
+    }
+    return (waitResult==WAIT_OBJECT_0) ? 1 : 0;
+}
+
+static DWORD WINAPI SerialPortIO__ThreadStart(LPVOID lpParam)
+{
+    TSerialPortThreadStart threadStart = *(TSerialPortThreadStart*)lpParam;
+    free(lpParam);
+    threadStart.threadRoutine(threadStart.lpParam);
+    return 0;
+}
+
+BOOL SerialPortIO_StartThread(SERIALPORT_THREAD* pThread, SERIALPORT_THREAD_ROUTINE threadRoutine, void* lpParam)
+{
+    DWORD threadId;
+    TSerialPortThreadStart* pThreadStart = (TSerialPortThreadStart*)malloc(sizeof(TSerialPortThreadStart));
+    if (pThreadStart==NULL)
+    {
+        return FALSE;
+    }
+    pThreadStart->threadRoutine = threadRoutine;
+    pThreadStart->lpParam       = lpParam;
+
+    *pThread = CreateThread(NULL, 0, SerialPortIO__ThreadStart, pThreadStart, 0, &threadId);
+    if (*pThread==NULL)
+    {
+        free(pThreadStart);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void SerialPortIO_JoinThread(SERIALPORT_THREAD* pThread)
+{
+    WaitForSingleObject(*pThread, INFINITE);
+    CloseHandle(*pThread);
+}
+
+BOOL SerialPortIO_IsCurrentThread(SERIALPORT_THREAD* pThread)
+{
+    return (GetThreadId(*pThread)==GetCurrentThreadId());
+}
+
+#else
+
+BOOL SerialPortIO_GetDeviceName(int comPortNumber, char* deviceName, int maxLength)
+{
+    if (comPortNumber<0) return FALSE;
+    if (comPortNumber>255) return FALSE;
+    if (maxLength<14) return FALSE;
+
+    sprintf(deviceName, "/dev/ttyS%i", comPortNumber);
+    return TRUE;
+}
+
+static speed_t SerialPortIO__GetSpeed(int baudRate)
+{
+    switch(baudRate)
+    {
+    case 50:      return B50;
+    case 75:      return B75;
+    case 110:     return B110;
+    case 134:     return B134;
+    case 150:     return B150;
+    case 200:     return B200;
+    case 300:     return B300;
+    case 600:     return B600;
+    case 1200:    return B1200;
+    case 1800:    return B1800;
+    case 2400:    return B2400;
+    case 4800:    return B4800;
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+#ifdef B57600
+    case 57600:   return B57600;
+#endif
+#ifdef B115200
+    case 115200:  return B115200;
+#endif
+#ifdef B230400
+    case 230400:  return B230400;
+#endif
+#ifdef B460800
+    case 460800:  return B460800;
+#endif
+#ifdef B500000
+    case 500000:  return B500000;
+#endif
+#ifdef B576000
+    case 576000:  return B576000;
+#endif
+#ifdef B921600
+    case 921600:  return B921600;
+#endif
+#ifdef B1000000
+    case 1000000: return B1000000;
+#endif
+#ifdef B1152000
+    case 1152000: return B1152000;
+#endif
+#ifdef B1500000
+    case 1500000: return B1500000;
+#endif
+#ifdef B2000000
+    case 2000000: return B2000000;
+#endif
+#ifdef B2500000
+    case 2500000: return B2500000;
+#endif
+#ifdef B3000000
+    case 3000000: return B3000000;
+#endif
+#ifdef B3500000
+    case 3500000: return B3500000;
+#endif
+#ifdef B4000000
+    case 4000000: return B4000000;
+#endif
+    }
+    return B0;
+}
+
+#if defined(__linux__) && defined(TCGETS2)
+//struct termios2 of <asm/termbits.h>, which cannot be included together with <termios.h>
+typedef struct
+{
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t     c_line;
+    cc_t     c_cc[19];
+    speed_t  c_ispeed;
+    speed_t  c_ospeed;
+} TSerialPortTermios2;
+
+#define SERIALPORT_TCGETS2 _IOR('T', 0x2A, TSerialPortTermios2)
+#define SERIALPORT_TCSETS2 _IOW('T', 0x2B, TSerialPortTermios2)
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+#ifndef IBSHIFT
+#define IBSHIFT 16
+#endif
+#endif
+
+static BOOL SerialPortIO__SetCustomSpeed(int portHandle, int baudRate)
+{
+#if defined(__linux__) && defined(TCGETS2)
+    TSerialPortTermios2 portSettings;
+
+    //the driver derives the divisor from c_ospeed itself
+    if (ioctl(portHandle, SERIALPORT_TCGETS2, &portSettings)!=0)
+    {
+        return FALSE;
+    }
+    portSettings.c_cflag &= ~(CBAUD | (CBAUD<<IBSHIFT));
+    portSettings.c_cflag |= BOTHER | (BOTHER<<IBSHIFT);
+    portSettings.c_ispeed = (speed_t)baudRate;
+    portSettings.c_ospeed = (speed_t)baudRate;
+    return (ioctl(portHandle, SERIALPORT_TCSETS2, &portSettings)==0);
+#else
+    (void)portHandle;
+    (void)baudRate;
+    return FALSE;
+#endif
+}
+
+static BOOL SerialPortIO__SetTermios(int portHandle, const TSerialPortSettings* pSettings)
+{
+    struct termios portSettings;
+    speed_t        speed;
+    tcflag_t       dataBits;
+
+    switch(pSettings->dataBits)
+    {
+    case 5:  dataBits = CS5; break;
+    case 6:  dataBits = CS6; break;
+    case 7:  dataBits = CS7; break;
+    case 8:  dataBits = CS8; break;
+    default: return FALSE;
+    }
+    if ((pSettings->baudRate<=0) || (tcgetattr(portHandle, &portSettings)!=0))
+    {
+        return FALSE;
+    }
+
+    cfmakeraw(&portSettings);
+    portSettings.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB);
+#ifdef CMSPAR
+    portSettings.c_cflag &= ~CMSPAR;
+#endif
+    portSettings.c_cflag |= dataBits | CLOCAL | CREAD;
+    switch(pSettings->parity)
+    {
+    case SERIALPORT_PARITY_NONE:  break;
+    case SERIALPORT_PARITY_ODD:   portSettings.c_cflag |= PARENB | PARODD; break;
+    case SERIALPORT_PARITY_EVEN:  portSettings.c_cflag |= PARENB; break;
+#ifdef CMSPAR
+    case SERIALPORT_PARITY_MARK:  portSettings.c_cflag |= PARENB | CMSPAR | PARODD; break;
+    case SERIALPORT_PARITY_SPACE: portSettings.c_cflag |= PARENB | CMSPAR; break;
+#endif
+    default: return FALSE;
+    }
+    //CSTOPB means 1.5 stop bits with 5 data bits
+    if ((pSettings->stopBits==SERIALPORT_STOPBITS_TWO) ||
+        ((pSettings->stopBits==SERIALPORT_STOPBITS_ONE5) && (pSettings->dataBits==5)))
+    {
+        portSettings.c_cflag |= CSTOPB;
+    } else if (pSettings->stopBits!=SERIALPORT_STOPBITS_ONE) {
+        return FALSE;
+    }
+#ifdef CRTSCTS
+    portSettings.c_cflag &= ~CRTSCTS;
+    if (pSettings->flowControl & SERIALPORT_FLOW_RTSCTS)
+    {
+        portSettings.c_cflag |= CRTSCTS;
+    }
+#else
+    if (pSettings->flowControl & SERIALPORT_FLOW_RTSCTS)
+    {
+        return FALSE;
+    }
+#endif
+    portSettings.c_iflag &= ~(IXON | IXOFF | IXANY);
+    if (pSettings->flowControl & SERIALPORT_FLOW_XONXOFF)
+    {
+        portSettings.c_iflag |= IXON | IXOFF;
+        portSettings.c_cc[VSTART] = 0x11;
+        portSettings.c_cc[VSTOP]  = 0x13;
+    }
+    portSettings.c_cc[VMIN]  = (cc_t)((pSettings->readMinBytes<0) ? 0 : (pSettings->readMinBytes>255) ? 255 : pSettings->readMinBytes);
+    portSettings.c_cc[VTIME] = (cc_t)((pSettings->readIntervalMS<=0) ? 0 : (pSettings->readIntervalMS>=25500) ? 255 : (pSettings->readIntervalMS+99)/100);
+
+    //rates without a Bxxx constant go through B38400 and are replaced right after
+    speed = SerialPortIO__GetSpeed(pSettings->baudRate);
+    cfsetispeed(&portSettings, (speed!=B0) ? speed : B38400);
+    cfsetospeed(&portSettings, (speed!=B0) ? speed : B38400);
+    if (tcsetattr(portHandle, TCSANOW, &portSettings)!=0)
+    {
+        return FALSE;
+    }
+    if (speed==B0)
+    {
+        return SerialPortIO__SetCustomSpeed(portHandle, pSettings->baudRate);
+    }
+    return TRUE;
+}
+
+#ifdef __linux__
+static void SerialPortIO__WriteDriverAttribute(int portHandle, const char* attributeName, int value)
+{
+    char        path[SERIALPORT_MAX_DEVICE_NAME+64];
+    char        ttyName[SERIALPORT_MAX_DEVICE_NAME];
+    char        text[16];
+    const char* pName;
+    int         fileHandle, textLength;
+
+    //"/dev/ttyUSB0" has its attributes in "/sys/class/tty/ttyUSB0/"
+    if (ttyname_r(portHandle, ttyName, sizeof(ttyName))!=0)
+    {
+        return;
+    }
+    pName = strrchr(ttyName, '/');
+    pName = pName ? pName+1 : ttyName;
+    snprintf(path, sizeof(path), "/sys/class/tty/%s/%s", pName, attributeName);
+    fileHandle = open(path, O_WRONLY | O_CLOEXEC);
+    if (fileHandle<0)
+    {
+        return;
+    }
+    textLength = snprintf(text, sizeof(text), "%d", value);
+    if (write(fileHandle, text, textLength)!=textLength)
+    {
+        //the driver rejected the value, the old one stays
+    }
+    close(fileHandle);
+}
+#endif
+
+static void SerialPortIO__SetDriverOptions(int portHandle, const TSerialPortSettings* pSettings)
+{
+#ifdef __linux__
+    struct serial_struct serialInfo;
+
+    if (pSettings->lowLatency && (ioctl(portHandle, TIOCGSERIAL, &serialInfo)==0) && !(serialInfo.flags & ASYNC_LOW_LATENCY))
+    {
+        serialInfo.flags |= ASYNC_LOW_LATENCY;
+        ioctl(portHandle, TIOCSSERIAL, &serialInfo);
+    }
+    if (pSettings->latencyTimerMS>0)
+    {
+        SerialPortIO__WriteDriverAttribute(portHandle, "device/latency_timer", pSettings->latencyTimerMS);
+    }
+    if (pSettings->fifoTriggerBytes>0)
+    {
+        SerialPortIO__WriteDriverAttribute(portHandle, "rx_trig_bytes", pSettings->fifoTriggerBytes);
+    }
+#else
+    (void)portHandle;
+    (void)pSettings;
+#endif
+}
+
+#if defined(__linux__) && defined(TIOCGICOUNT)
+static BOOL SerialPortIO__GetErrorCounts(int portHandle, unsigned int* pCounts)
+{
+    struct serial_icounter_struct counters;
+
+    if (ioctl(portHandle, TIOCGICOUNT, &counters)!=0)
+    {
+        return FALSE;
+    }
+    pCounts[0] = (unsigned int)counters.brk;
+    pCounts[1] = (unsigned int)counters.frame;
+    pCounts[2] = (unsigned int)counters.parity;
+    pCounts[3] = (unsigned int)(counters.overrun + counters.buf_overrun);
+    return TRUE;
+}
+#else
+static BOOL SerialPortIO__GetErrorCounts(int portHandle, unsigned int* pCounts)
+{
+    (void)portHandle;
+    (void)pCounts;
+    return FALSE;
+}
+#endif
+
+//PARMRK marks errors in the data, INPCK checks parity, breaks are marked instead of read as 0
+static BOOL SerialPortIO__SetErrorMarking(int portHandle, BOOL enable)
+{
+    struct termios portSettings;
+
+    if (tcgetattr(portHandle, &portSettings)!=0)
+    {
+        return FALSE;
+    }
+    portSettings.c_iflag &= ~(PARMRK | INPCK | IGNPAR | IGNBRK | BRKINT | ISTRIP);
+    if (enable)
+    {
+        portSettings.c_iflag |= PARMRK | INPCK;
+    }
+    return (tcsetattr(portHandle, TCSANOW, &portSettings)==0);
+}
+
+static BOOL SerialPortIO__DeviceConfigure(TSerialPortDevice* pDevice, const TSerialPortSettings* pSettings)
+{
+    if (!SerialPortIO__SetTermios(pDevice->nativeHandle, pSettings))
+    {
+        return FALSE;
+    }
+    if (pSettings->reportLineErrors && !SerialPortIO__SetErrorMarking(pDevice->nativeHandle, TRUE))
+    {
+        return FALSE;
+    }
+    if (pSettings->reportLineErrors && !pDevice->reportLineErrors)
+    {
+        //errors counted before are not ours
+        SerialPortIO__GetErrorCounts(pDevice->nativeHandle, pDevice->errorCounts);
+    }
+    if (pSettings->reportLineErrors!=pDevice->reportLineErrors)
+    {
+        //a mark split between two reads belongs to the old mode
+        pDevice->markState = 0;
+    }
+    pDevice->reportLineErrors = pSettings->reportLineErrors;
+    SerialPortIO__SetDriverOptions(pDevice->nativeHandle, pSettings);
+    return TRUE;
+}
+
+static BOOL SerialPortIO__DeviceOpen(TSerialPortDevice* pDevice, const char* deviceName, const TSerialPortSettings* pSettings)
+{
+    int portHandle;
+
+    portHandle = open(deviceName, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (portHandle<0)
+    {
+        return FALSE;
+    }
+
+    //same exclusive access as CreateFile with dwShareMode==0, not all drivers support it
+    ioctl(portHandle, TIOCEXCL);
+
+    pDevice->nativeHandle = portHandle;
+    if (!SerialPortIO__DeviceConfigure(pDevice, pSettings))
+    {
+        close(portHandle);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void SerialPortIO__DeviceClose(TSerialPortDevice* pDevice)
+{
+    close(pDevice->nativeHandle);
+}
+
+static void SerialPortIO__DrainEvent(SERIALPORT_EVENT* pEvent)
+{
+    unsigned char drain[16];
+    while (read(pEvent->readHandle, drain, sizeof(drain))>0);
+}
+
+static int SerialPortIO__Poll(int portHandle, short events, int timeOutMS, SERIALPORT_EVENT* pWakeEvent)
+{
+    struct pollfd pollHandles[2];
+    nfds_t        pollCount = 1;
+    int           result;
+
+    pollHandles[0].fd      = portHandle;
+    pollHandles[0].events  = events;
+    pollHandles[0].revents = 0;
+    if (pWakeEvent)
+    {
+        pollHandles[1].fd      = pWakeEvent->readHandle;
+        pollHandles[1].events  = POLLIN;
+        pollHandles[1].revents = 0;
+        pollCount++;
+    }
+
+    result = poll(pollHandles, pollCount, (timeOutMS<0) ? -1 : timeOutMS);
+    if (result<0)
+    {
+        return (errno==EINTR) ? 0 : -1;
+    }
+    if ((pollCount>1) && (pollHandles[1].revents & POLLIN))
+    {
+        SerialPortIO__DrainEvent(pWakeEvent);
+        return 0;
+    }
+    if (pollHandles[0].revents & (POLLNVAL | POLLERR))
+    {
+        return -1;
+    }
+    if ((pollHandles[0].revents & POLLHUP) && !(pollHandles[0].revents & events))
+    {
+        return -1;
+    }
+    return (pollHandles[0].revents!=0) ? 1 : 0;
+}
+
+//removes the PARMRK sequences in place: 0xFF 0xFF is 0xFF, 0xFF 0x00 X an error on X (a break with X==0)
+static int SerialPortIO__DecodeMarks(TSerialPortDevice* pDevice, unsigned char* pData, int dataLength)
+{
+    unsigned int  counts[4];
+    unsigned int  newErrors[4] = { 0, 0, 0, 0 };
+    BOOL          countsRead = FALSE;
+    int           i, j, errors, length = 0;
+    unsigned char value;
+
+    for(i = 0; i<dataLength; i++)
+    {
+        value = pData[i];
+        if (pDevice->markState==0)
+        {
+            if (value==0xFF)
+            {
+                pDevice->markState = 1;
+            } else {
+                pData[length++] = value;
+            }
+            continue;
+        }
+        if (pDevice->markState==1)
+        {
+            pDevice->markState = (value==0x00) ? 2 : 0;
+            if (value!=0x00)
+            {
+                pData[length++] = value;
+            }
+            continue;
+        }
+        pDevice->markState = 0;
+
+        //the driver counters tell the kind of error, read once per chunk
+        if (!countsRead)
+        {
+            countsRead = TRUE;
+            if (SerialPortIO__GetErrorCounts(pDevice->nativeHandle, counts))
+            {
+                for(j = 0; j<4; j++)
+                {
+                    newErrors[j] = counts[j] - pDevice->errorCounts[j];
+                    pDevice->errorCounts[j] = counts[j];
+                }
+            }
+        }
+        if ((value==0) && newErrors[0])
+        {
+            errors = SERIALPORT_LINE_BREAK;
+            newErrors[0]--;
+        } else if (newErrors[1]) {
+            errors = SERIALPORT_LINE_FRAMING;
+            newErrors[1]--;
+        } else if (newErrors[2]) {
+            errors = SERIALPORT_LINE_PARITY;
+            newErrors[2]--;
+        } else {
+            errors = (value==0) ? SERIALPORT_LINE_BREAK : (SERIALPORT_LINE_FRAMING | SERIALPORT_LINE_PARITY);
+        }
+        if (newErrors[3])
+        {
+            errors |= SERIALPORT_LINE_OVERRUN;
+            newErrors[3] = 0;
+        }
+        SerialPortIO__AddLineEvent(pDevice, errors, pDevice->receivedBytes+length, value);
+        if (!(errors & SERIALPORT_LINE_BREAK))
+        {
+            pData[length++] = value;
+        }
+    }
+    return length;
+}
+
+static int SerialPortIO__DeviceReadRaw(TSerialPortDevice* pDevice, unsigned char* pData, int dataLength, int timeOutMS, SERIALPORT_EVENT* pWakeEvent)
+{
+    int     portHandle = pDevice->nativeHandle;
+    ssize_t bytesRead;
+    int     pollResult;
+
+    //data already waiting in the driver cost a single syscall
+    bytesRead = read(portHandle, pData, dataLength);
+    if (bytesRead>0)
+    {
+        return (int)bytesRead;
+    }
+    if ((bytesRead<0) && (errno!=EAGAIN) && (errno!=EWOULDBLOCK) && (errno!=EINTR))
+    {
+        return -1;
+    }
+    if (timeOutMS==0)
+    {
+        return 0;
+    }
+
+    pollResult = SerialPortIO__Poll(portHandle, POLLIN, timeOutMS, pWakeEvent);
+    if (pollResult<=0)
+    {
+        return pollResult;
+    }
+
+    bytesRead = read(portHandle, pData, dataLength);
+    if (bytesRead<0)
+    {
+        return ((errno==EAGAIN) || (errno==EWOULDBLOCK) || (errno==EINTR)) ? 0 : -1;
+    }
+    return (int)bytesRead;
+}
+
+static int SerialPortIO__DeviceRead(TSerialPortDevice* pDevice, unsigned char* pData, int dataLength, int timeOutMS, SERIALPORT_EVENT* pWakeEvent)
+{
+    int bytesRead = SerialPortIO__DeviceReadRaw(pDevice, pData, dataLength, timeOutMS, pWakeEvent);
+
+    if ((bytesRead>0) && pDevice->reportLineErrors)
+    {
+        return SerialPortIO__DecodeMarks(pDevice, pData, bytesRead);
+    }
+    return bytesRead;
+}
+
+static int SerialPortIO__DeviceWaitForData(TSerialPortDevice* pDevice, int timeOutMS, SERIALPORT_EVENT* pWakeEvent)
+{
+    return SerialPortIO__Poll(pDevice->nativeHandle, POLLIN, timeOutMS, pWakeEvent);
+}
+
+static int SerialPortIO__DeviceWrite(TSerialPortDevice* pDevice, const unsigned char* pData, int dataLength)
+{
+    int     portHandle = pDevice->nativeHandle;
+    ssize_t bytesWritten;
+    int     bytesWrittenTotal = 0;
+
+    //fd is non-blocking, but WriteBuffer keeps WriteFile semantics and returns when everything is queued
+    while(bytesWrittenTotal<dataLength)
+    {
+        bytesWritten = write(portHandle, pData+bytesWrittenTotal, dataLength-bytesWrittenTotal);
+        if (bytesWritten>0)
+        {
+            bytesWrittenTotal += (int)bytesWritten;
+            continue;
+        }
+        if ((bytesWritten<0) && (errno==EINTR))
+        {
+            continue;
+        }
+        if ((bytesWritten<0) && (errno!=EAGAIN) && (errno!=EWOULDBLOCK))
+        {
+            break;
+        }
+        if (SerialPortIO__Poll(portHandle, POLLOUT, SERIALPORT_INFINITE, NULL)<0)
+        {
+            break;
+        }
+    }
+    return bytesWrittenTotal;
+}
+
+static int SerialPortIO__DeviceWriteVector(TSerialPortDevice* pDevice, const SERIALPORT_BUFFER* pBuffers, int bufferCount, BOOL blocking)
+{
+    int          portHandle = pDevice->nativeHandle;
+    struct iovec vectors[SERIALPORT_MAX_WRITE_BUFFERS];
+    ssize_t      bytesWritten;
+    int          bytesWrittenTotal = 0;
+    int          index = 0, offset = 0;
+    int          vectorCount, i;
+
+    while(index<bufferCount)
+    {
+        vectorCount = 0;
+        for(i = index; (i<bufferCount) && (vectorCount<SERIALPORT_MAX_WRITE_BUFFERS); i++)
+        {
+            vectors[vectorCount].iov_base = (void*)(pBuffers[i].pData + ((i==index) ? offset : 0));
+            vectors[vectorCount].iov_len  = pBuffers[i].dataLength - ((i==index) ? offset : 0);
+            vectorCount++;
+        }
+        bytesWritten = writev(portHandle, vectors, vectorCount);
+        if (bytesWritten<0)
+        {
+            if (errno==EINTR)
+            {
+                continue;
+            }
+            if ((errno!=EAGAIN) && (errno!=EWOULDBLOCK))
+            {
+                return -1;
+            }
+            if (!blocking)
+            {
+                break;
+            }
+            if (SerialPortIO__Poll(portHandle, POLLOUT, SERIALPORT_INFINITE, NULL)<0)
+            {
+                return -1;
+            }
+            continue;
+        }
+        bytesWrittenTotal += (int)bytesWritten;
+
+        //buffers written completely are skipped, the rest continues at offset
+        while((index<bufferCount) && (bytesWritten>=pBuffers[index].dataLength-offset))
+        {
+            bytesWritten -= pBuffers[index].dataLength-offset;
+            offset = 0;
+            index++;
+        }
+        offset += (int)bytesWritten;
+    }
+    return bytesWrittenTotal;
+}
+
+static BOOL SerialPortIO__DeviceDrain(TSerialPortDevice* pDevice)
+{
+    while(tcdrain(pDevice->nativeHandle)!=0)
+    {
+        if (errno!=EINTR)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static BOOL SerialPortIO__DeviceGetModemStatus(TSerialPortDevice* pDevice, unsigned int* pModemStatus)
+{
+    int lines;
+
+    if (ioctl(pDevice->nativeHandle, TIOCMGET, &lines)!=0)
+    {
+        return FALSE;
+    }
+    *pModemStatus = ((lines & TIOCM_CTS) ? SERIALPORT_MODEM_CTS : 0) |
+                    ((lines & TIOCM_DSR) ? SERIALPORT_MODEM_DSR : 0) |
+                    ((lines & TIOCM_RNG) ? SERIALPORT_MODEM_RI  : 0) |
+                    ((lines & TIOCM_CAR) ? SERIALPORT_MODEM_DCD : 0) |
+                    ((lines & TIOCM_RTS) ? SERIALPORT_MODEM_RTS : 0) |
+                    ((lines & TIOCM_DTR) ? SERIALPORT_MODEM_DTR : 0);
+    return TRUE;
+}
+
+static BOOL SerialPortIO__DeviceSetModemLines(TSerialPortDevice* pDevice, unsigned int lines, unsigned int mask)
+{
+    int setLines = 0, clearLines = 0;
+
+    if (mask & SERIALPORT_MODEM_RTS)
+    {
+        *((lines & SERIALPORT_MODEM_RTS) ? &setLines : &clearLines) |= TIOCM_RTS;
+    }
+    if (mask & SERIALPORT_MODEM_DTR)
+    {
+        *((lines & SERIALPORT_MODEM_DTR) ? &setLines : &clearLines) |= TIOCM_DTR;
+    }
+    if (setLines && (ioctl(pDevice->nativeHandle, TIOCMBIS, &setLines)!=0))
+    {
+        return FALSE;
+    }
+    if (clearLines && (ioctl(pDevice->nativeHandle, TIOCMBIC, &clearLines)!=0))
+    {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static BOOL SerialPortIO__DeviceSetBreak(TSerialPortDevice* pDevice, BOOL enable)
+{
+#ifdef TIOCSBRK
+    return (ioctl(pDevice->nativeHandle, enable ? TIOCSBRK : TIOCCBRK)==0);
+#else
+    return FALSE;
+#endif
+}
+
+#ifdef TIOCMIWAIT
+//sleeps in the driver until an input line changes, SERIALPORT_WAKE_SIGNAL interrupts it
+static int SerialPortIO__DeviceWaitModemChange(TSerialPortDevice* pDevice)
+{
+    if (ioctl(pDevice->nativeHandle, TIOCMIWAIT, TIOCM_CTS | TIOCM_DSR | TIOCM_CAR | TIOCM_RNG)==0)
+    {
+        return 1;
+    }
+    return (errno==EINTR) ? 0 : -1;
+}
+#define SERIALPORT_DEVICE_WAIT_MODEM_CHANGE SerialPortIO__DeviceWaitModemChange
+#else
+#define SERIALPORT_DEVICE_WAIT_MODEM_CHANGE NULL
+#endif
+
+#ifndef SERIALPORT_WAKE_SIGNAL
+#define SERIALPORT_WAKE_SIGNAL (SIGRTMAX-1)
+#endif
+
+static pthread_once_t m_wakeSignalOnce = PTHREAD_ONCE_INIT;
+
+static void SerialPortIO__WakeSignalHandler(int signalNumber)
+{
+    //only interrupts the blocking call
+    (void)signalNumber;
+}
+
+//installed without SA_RESTART so the interrupted ioctl returns, a handler of the application is kept
+static void SerialPortIO__InstallWakeSignal(void)
+{
+    struct sigaction action;
+
+    if ((sigaction(SERIALPORT_WAKE_SIGNAL, NULL, &action)==0) && (action.sa_handler==SIG_DFL))
+    {
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = SerialPortIO__WakeSignalHandler;
+        sigemptyset(&action.sa_mask);
+        sigaction(SERIALPORT_WAKE_SIGNAL, &action, NULL);
+    }
+}
+
+static void SerialPortIO__InterruptThread(SERIALPORT_THREAD* pThread)
+{
+    pthread_once(&m_wakeSignalOnce, SerialPortIO__InstallWakeSignal);
+    pthread_kill(*pThread, SERIALPORT_WAKE_SIGNAL);
+}
+
+static void SerialPortIO__DetachThread(SERIALPORT_THREAD* pThread)
+{
+    pthread_detach(*pThread);
+}
+
+typedef struct
+{
+    int  slaveHandle;
+    char slaveName[SERIALPORT_MAX_DEVICE_NAME];
+} TSerialPortPty;
+
+static BOOL SerialPortIO__PtyConfigure(TSerialPortDevice* pDevice, const TSerialPortSettings* pSettings)
+{
+    TSerialPortPty* pPty = (TSerialPortPty*)pDevice->pContext;
+
+    //the line discipline of the slave is the one the peer sees
+    return SerialPortIO__SetTermios(pPty->slaveHandle, pSettings);
+}
+
+static BOOL SerialPortIO__PtyOpen(TSerialPortDevice* pDevice, const char* deviceName, const TSerialPortSettings* pSettings)
+{
+    TSerialPortPty* pPty;
+    const char*     slaveName;
+    int             masterHandle;
+
+    //"pty:" names no device, the system picks the slave
+    (void)deviceName;
+    masterHandle = posix_openpt(O_RDWR | O_NOCTTY);
+    if (masterHandle<0)
+    {
+        return FALSE;
+    }
+    slaveName = ((grantpt(masterHandle)==0) && (unlockpt(masterHandle)==0)) ? ptsname(masterHandle) : NULL;
+    pPty = (TSerialPortPty*)malloc(sizeof(TSerialPortPty));
+    if ((slaveName==NULL) || (pPty==NULL))
+    {
+        free(pPty);
+        close(masterHandle);
+        return FALSE;
+    }
+    snprintf(pPty->slaveName, sizeof(pPty->slaveName), "%s", slaveName);
+
+    //the slave is held open as well, otherwise reads of the master fail
+    //with EIO whenever the peer has it closed (e.g. while reconnecting)
+    pPty->slaveHandle = open(pPty->slaveName, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (pPty->slaveHandle<0)
+    {
+        free(pPty);
+        close(masterHandle);
+        return FALSE;
+    }
+
+    //raw line discipline, bytes pass unchanged both ways
+    pDevice->nativeHandle = masterHandle;
+    pDevice->pContext     = pPty;
+    if (!SerialPortIO__PtyConfigure(pDevice, pSettings))
+    {
+        close(pPty->slaveHandle);
+        free(pPty);
+        close(masterHandle);
+        return FALSE;
+    }
+    fcntl(masterHandle, F_SETFL, O_NONBLOCK);
+    fcntl(masterHandle, F_SETFD, FD_CLOEXEC);
+    return TRUE;
+}
+
+static void SerialPortIO__PtyClose(TSerialPortDevice* pDevice)
+{
+    TSerialPortPty* pPty = (TSerialPortPty*)pDevice->pContext;
+
+    close(pPty->slaveHandle);
+    close(pDevice->nativeHandle);
+    free(pPty);
+}
+
+static BOOL SerialPortIO__PtyGetPeerName(TSerialPortDevice* pDevice, char* deviceName, int maxLength)
+{
+    TSerialPortPty* pPty = (TSerialPortPty*)pDevice->pContext;
+
+    if ((int)strlen(pPty->slaveName)>=maxLength)
+    {
+        return FALSE;
+    }
+    strcpy(deviceName, pPty->slaveName);
+    return TRUE;
+}
+
+void SerialPortIO_Sleep(int timeMS)
+{
+    struct timespec sleepTime;
+    sleepTime.tv_sec  = timeMS / 1000;
+    sleepTime.tv_nsec = (timeMS % 1000) * 1000000L;
+    while ((nanosleep(&sleepTime, &sleepTime)!=0) && (errno==EINTR));
+}
+
+SERIALPORT_TIMESTAMP SerialPortIO_GetTime(void)
+{
+    struct timespec currentTime;
+    clock_gettime(CLOCK_MONOTONIC, &currentTime);
+    return (SERIALPORT_TIMESTAMP)currentTime.tv_sec * 1000000 + currentTime.tv_nsec / 1000;
+}
+
+void SerialPortIO_InitLock(SERIALPORT_LOCK* pLock)
+{
+    //critical sections are recursive, mutexes have to behave the same way
+    pthread_mutexattr_t lockAttributes;
+    pthread_mutexattr_init(&lockAttributes);
+    pthread_mutexattr_settype(&lockAttributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(pLock, &lockAttributes);
+    pthread_mutexattr_destroy(&lockAttributes);
+}
+
+void SerialPortIO_DeleteLock(SERIALPORT_LOCK* pLock)
+{
+    pthread_mutex_destroy(pLock);
+}
+
+void SerialPortIO_Lock(SERIALPORT_LOCK* pLock)
+{
+    pthread_mutex_lock(pLock);
+}
+
+void SerialPortIO_Unlock(SERIALPORT_LOCK* pLock)
+{
+    pthread_mutex_unlock(pLock);
+}
+
+BOOL SerialPortIO_CreateEvent(SERIALPORT_EVENT* pEvent)
+{
+    int pipeHandles[2];
+
+    //self-pipe, so the event can be polled together with the port
+    if (pipe(pipeHandles)!=0)
+    {
+        pEvent->readHandle  = -1;
+        pEvent->writeHandle = -1;
+        return FALSE;
+    }
+    fcntl(pipeHandles[0], F_SETFL, O_NONBLOCK);
+    fcntl(pipeHandles[1], F_SETFL, O_NONBLOCK);
+    fcntl(pipeHandles[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipeHandles[1], F_SETFD, FD_CLOEXEC);
+    pEvent->readHandle  = pipeHandles[0];
+    pEvent->writeHandle = pipeHandles[1];
+    return TRUE;
+}
+
+void SerialPortIO_DeleteEvent(SERIALPORT_EVENT* pEvent)
+{
+    if (pEvent->readHandle>=0)
+    {
+        close(pEvent->readHandle);
+        close(pEvent->writeHandle);
+        pEvent->readHandle  = -1;
+        pEvent->writeHandle = -1;
+    }
+}
+
+void SerialPortIO_SetEvent(SERIALPORT_EVENT* pEvent)
+{
+    unsigned char signal = 1;
+    //a full pipe means the event is already set
+    while ((write(pEvent->writeHandle, &signal, 1)<0) && (errno==EINTR));
+}
+
+void SerialPortIO_ResetEvent(SERIALPORT_EVENT* pEvent)
+{
+    SerialPortIO__DrainEvent(pEvent);
+}
+
+BOOL SerialPortIO_WaitEvent(SERIALPORT_EVENT* pEvent, int timeOutMS)
+{
+    struct pollfd pollHandle;
+
+    pollHandle.fd      = pEvent->readHandle;
+    pollHandle.events  = POLLIN;
+    pollHandle.revents = 0;
+    if (poll(&pollHandle, 1, (timeOutMS<0) ? -1 : timeOutMS)<=0)
+    {
+        return FALSE;
+    }
+    SerialPortIO__DrainEvent(pEvent);
+    return TRUE;
+}
+
+int SerialPortIO_WaitEvents(SERIALPORT_EVENT* pEvent, SERIALPORT_EVENT* pWakeEvent, int timeOutMS)
+{
+    struct pollfd pollHandles[2];
+    nfds_t        pollCount = 1;
+    int           result;
+
+    //pEvent stays set, it is the readiness of something the caller checks
+    pollHandles[0].fd      = pEvent->readHandle;
+    pollHandles[0].events  = POLLIN;
+    pollHandles[0].revents = 0;
+    if (pWakeEvent)
+    {
+        pollHandles[1].fd      = pWakeEvent->readHandle;
+        pollHandles[1].events  = POLLIN;
+        pollHandles[1].revents = 0;
+        pollCount++;
+    }
+    result = poll(pollHandles, pollCount, (timeOutMS<0) ? -1 : timeOutMS);
+    if (result<0)
+    {
+        return (errno==EINTR) ? 0 : -1;
+    }
+    if ((pollCount>1) && (pollHandles[1].revents & POLLIN))
+    {
+        SerialPortIO__DrainEvent(pWakeEvent);
+        return 0;
+    }
+    return (pollHandles[0].revents & POLLIN) ? 1 : 0;
+}
+
+static void* SerialPortIO__ThreadStart(void* lpParam)
+{
+    TSerialPortThreadStart threadStart = *(TSerialPortThreadStart*)lpParam;
+    free(lpParam);
+    threadStart.threadRoutine(threadStart.lpParam);
+    return NULL;
+}
+
+BOOL SerialPortIO_StartThread(SERIALPORT_THREAD* pThread, SERIALPORT_THREAD_ROUTINE threadRoutine, void* lpParam)
+{
+    TSerialPortThreadStart* pThreadStart = (TSerialPortThreadStart*)malloc(sizeof(TSerialPortThreadStart));
+    if (pThreadStart==NULL)
+    {
+        return FALSE;
+    }
+    pThreadStart->threadRoutine = threadRoutine;
+    pThreadStart->lpParam       = lpParam;
+
+    if (pthread_create(pThread, NULL, SerialPortIO__ThreadStart, pThreadStart)!=0)
+    {
+        free(pThreadStart);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void SerialPortIO_JoinThread(SERIALPORT_THREAD* pThread)
+{
+    pthread_join(*pThread, NULL);
+}
+
+BOOL SerialPortIO_IsCurrentThread(SERIALPORT_THREAD* pThread)
+{
+    return pthread_equal(*pThread, pthread_self()) ? TRUE : FALSE;
+}
+
+#endif
+
+static const TSerialPortTransport m_deviceTransport =
+{
+    NULL,
+    SerialPortIO__DeviceOpen,
+    SerialPortIO__DeviceClose,
+    SerialPortIO__DeviceRead,
+    SerialPortIO__DeviceWaitForData,
+    SerialPortIO__DeviceWrite,
+    SerialPortIO__DeviceWriteVector,
+    SerialPortIO__DeviceDrain,
+    NULL,
+    SerialPortIO__DeviceConfigure,
+    SerialPortIO__DeviceGetModemStatus,
+    SerialPortIO__DeviceSetModemLines,
+    SerialPortIO__DeviceSetBreak,
+#ifdef _WIN32
+    NULL
+#else
+    SERIALPORT_DEVICE_WAIT_MODEM_CHANGE
+#endif
+};
+
+#ifndef _WIN32
+//the master side of a pty is read and written like the device
+static const TSerialPortTransport m_ptyTransport =
+{
+    "pty:",
+    SerialPortIO__PtyOpen,
+    SerialPortIO__PtyClose,
+    SerialPortIO__DeviceRead,
+    SerialPortIO__DeviceWaitForData,
+    SerialPortIO__DeviceWrite,
+    SerialPortIO__DeviceWriteVector,
+    SerialPortIO__DeviceDrain,
+    SerialPortIO__PtyGetPeerName,
+    SerialPortIO__PtyConfigure,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+#endif
+
+static const TSerialPortTransport* m_transports[] =
+{
+#ifndef _WIN32
+    &m_ptyTransport,
+#endif
+    &SerialPortVirtual_Transport
+};
+
+void SerialPortIO_InitSettings(TSerialPortSettings* pSettings, int baudRate)
+{
+    memset(pSettings, 0, sizeof(TSerialPortSettings));
+    pSettings->baudRate    = baudRate;
+    pSettings->dataBits    = 8;
+    pSettings->parity      = SERIALPORT_PARITY_NONE;
+    pSettings->stopBits    = SERIALPORT_STOPBITS_ONE;
+    pSettings->flowControl = SERIALPORT_FLOW_NONE;
+}
+
+//time of one character on the line in ns, 0 without a baud rate
+unsigned long long SerialPortIO_GetCharTime(const TSerialPortSettings* pSettings)
+{
+    int halfBits;
+
+    //start bit, data bits, parity and stop bits, in half bits because of 1.5 stop bits
+    halfBits = 2 * (1 + (((pSettings->dataBits>=5) && (pSettings->dataBits<=8)) ? pSettings->dataBits : 8));
+    if (pSettings->parity!=SERIALPORT_PARITY_NONE)
+    {
+        halfBits += 2;
+    }
+    switch(pSettings->stopBits)
+    {
+        case SERIALPORT_STOPBITS_ONE5: halfBits += 3; break;
+        case SERIALPORT_STOPBITS_TWO:  halfBits += 4; break;
+        default:                       halfBits += 2; break;
+    }
+    return (pSettings->baudRate>0) ? (unsigned long long)halfBits * 500000000ULL / (unsigned int)pSettings->baudRate : 0;
+}
+
+SERIALPORT_HANDLE SerialPortIO_Open(const char* deviceName, int baudRate)
+{
+    TSerialPortSettings settings;
+
+    SerialPortIO_InitSettings(&settings, baudRate);
+    return SerialPortIO_OpenWithSettings(deviceName, &settings);
+}
+
+SERIALPORT_HANDLE SerialPortIO_OpenWithSettings(const char* deviceName, const TSerialPortSettings* pSettings)
+{
+    const TSerialPortTransport* pTransport = &m_deviceTransport;
+    TSerialPortDevice*          pDevice;
+    int                         i;
+
+    if ((deviceName==NULL) || (pSettings==NULL)) return SERIALPORT_INVALID_HANDLE;
+
+    for(i = 0; i<(int)(sizeof(m_transports)/sizeof(m_transports[0])); i++)
+    {
+        if (strncmp(deviceName, m_transports[i]->prefix, strlen(m_transports[i]->prefix))==0)
+        {
+            pTransport = m_transports[i];
+            deviceName += strlen(pTransport->prefix);
+            break;
+        }
+    }
+
+    pDevice = (TSerialPortDevice*)malloc(sizeof(TSerialPortDevice));
+    if (pDevice==NULL)
+    {
+        return SERIALPORT_INVALID_HANDLE;
+    }
+    pDevice->pTransport   = pTransport;
+    pDevice->nativeHandle = SERIALPORT_INVALID_NATIVE_HANDLE;
+    pDevice->pContext     = NULL;
+    pDevice->pCapture     = NULL;
+    pDevice->pTrace       = NULL;
+    pDevice->tracePortId  = -1;
+    pDevice->writeHandler = NULL;
+    pDevice->pWriteContext = NULL;
+    pDevice->lastReadTime  = 0;
+    pDevice->lastWriteTime = 0;
+    pDevice->pModemWatch  = NULL;
+    pDevice->reportLineErrors = FALSE;
+    pDevice->markState      = 0;
+    pDevice->receivedBytes  = 0;
+    pDevice->lineEventCount = 0;
+    memset(pDevice->errorCounts, 0, sizeof(pDevice->errorCounts));
+    if (!pTransport->Open(pDevice, deviceName, pSettings))
+    {
+        free(pDevice);
+        return SERIALPORT_INVALID_HANDLE;
+    }
+    return pDevice;
+}
+
+void SerialPortIO_Close(SERIALPORT_HANDLE portHandle)
+{
+    if (portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        SerialPortIO_SetModemHandler(portHandle, NULL, NULL);
+        portHandle->pTransport->Close(portHandle);
+        free(portHandle);
+    }
+}
+
+int SerialPortIO_Read(SERIALPORT_HANDLE portHandle, unsigned char* pData, int dataLength, int timeOutMS, SERIALPORT_EVENT* pWakeEvent)
+{
+    int result = portHandle->pTransport->Read(portHandle, pData, dataLength, timeOutMS, pWakeEvent);
+    if (result>0)
+    {
+        portHandle->lastReadTime   = SerialPortIO_GetTime();
+        portHandle->receivedBytes += (unsigned long long)result;
+        if (portHandle->pTrace)
+        {
+            SerialPortTrace_OnRead(portHandle->pTrace, portHandle->tracePortId, portHandle->lastReadTime, result);
+        }
+        if (portHandle->pCapture)
+        {
+            SerialPortCapture_Append(portHandle->pCapture, SERIALPORT_CAPTURE_RX, pData, result);
+        }
+    }
+    return result;
+}
+
+int SerialPortIO_WaitForData(SERIALPORT_HANDLE portHandle, int timeOutMS, SERIALPORT_EVENT* pWakeEvent)
+{
+    return portHandle->pTransport->WaitForData(portHandle, timeOutMS, pWakeEvent);
+}
+
+//timestamps a completed write and passes it on, startTime is taken only while tracing
+static void SerialPortIO__OnWritten(SERIALPORT_HANDLE portHandle, SERIALPORT_TIMESTAMP startTime, int bytesWritten)
+{
+    portHandle->lastWriteTime = SerialPortIO_GetTime();
+    if (portHandle->pTrace)
+    {
+        SerialPortTrace_OnWrite(portHandle->pTrace, portHandle->tracePortId, startTime, portHandle->lastWriteTime, bytesWritten);
+    }
+    if (portHandle->writeHandler)
+    {
+        portHandle->writeHandler(portHandle->pWriteContext, bytesWritten, portHandle->lastWriteTime);
+    }
+}
+
+int SerialPortIO_Write(SERIALPORT_HANDLE portHandle, const unsigned char* pData, int dataLength)
+{
+    SERIALPORT_TIMESTAMP startTime = portHandle->pTrace ? SerialPortIO_GetTime() : 0;
+    int                  result = portHandle->pTransport->Write(portHandle, pData, dataLength);
+
+    if (result>0)
+    {
+        SerialPortIO__OnWritten(portHandle, startTime, result);
+        if (portHandle->pCapture)
+        {
+            SerialPortCapture_Append(portHandle->pCapture, SERIALPORT_CAPTURE_TX, pData, result);
+        }
+    }
+    return result;
+}
+
+int SerialPortIO_WriteVector(SERIALPORT_HANDLE portHandle, const SERIALPORT_BUFFER* pBuffers, int bufferCount, BOOL blocking)
+{
+    SERIALPORT_TIMESTAMP startTime = portHandle->pTrace ? SerialPortIO_GetTime() : 0;
+    int                  result = portHandle->pTransport->WriteVector(portHandle, pBuffers, bufferCount, blocking);
+
+    if (result>0)
+    {
+        SerialPortIO__OnWritten(portHandle, startTime, result);
+        if (portHandle->pCapture)
+        {
+            SerialPortCapture_AppendVector(portHandle->pCapture, SERIALPORT_CAPTURE_TX, pBuffers, bufferCount, result);
+        }
+    }
+    return result;
+}
+
+BOOL SerialPortIO_Drain(SERIALPORT_HANDLE portHandle)
+{
+    return portHandle->pTransport->Drain(portHandle);
+}
+
+SERIALPORT_NATIVE_HANDLE SerialPortIO_GetNativeHandle(SERIALPORT_HANDLE portHandle)
+{
+    if (portHandle==SERIALPORT_INVALID_HANDLE)
+    {
+        return SERIALPORT_INVALID_NATIVE_HANDLE;
+    }
+    return portHandle->nativeHandle;
+}
+
+BOOL SerialPortIO_GetPeerName(SERIALPORT_HANDLE portHandle, char* deviceName, int maxLength)
+{
+    if ((portHandle==SERIALPORT_INVALID_HANDLE) || (portHandle->pTransport->GetPeerName==NULL))
+    {
+        return FALSE;
+    }
+    return portHandle->pTransport->GetPeerName(portHandle, deviceName, maxLength);
+}
+
+BOOL SerialPortIO_Configure(SERIALPORT_HANDLE portHandle, const TSerialPortSettings* pSettings)
+{
+    if ((portHandle==SERIALPORT_INVALID_HANDLE) || (pSettings==NULL) || (portHandle->pTransport->Configure==NULL))
+    {
+        return FALSE;
+    }
+    return portHandle->pTransport->Configure(portHandle, pSettings);
+}
+
+void SerialPortIO_SetCapture(SERIALPORT_HANDLE portHandle, struct TSerialPortCapture* pCapture)
+{
+    if (portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        portHandle->pCapture = pCapture;
+    }
+}
+
+void SerialPortIO_SetTrace(SERIALPORT_HANDLE portHandle, struct TSerialPortTrace* pTrace, int portId)
+{
+    if (portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        portHandle->tracePortId = portId;
+        portHandle->pTrace      = (portId>=0) ? pTrace : NULL;
+    }
+}
+
+void SerialPortIO_SetWriteHandler(SERIALPORT_HANDLE portHandle, SERIALPORT_WRITE_HANDLER handler, void* pContext)
+{
+    if (portHandle!=SERIALPORT_INVALID_HANDLE)
+    {
+        portHandle->pWriteContext = pContext;
+        portHandle->writeHandler  = handler;
+    }
+}
+
+SERIALPORT_TIMESTAMP SerialPortIO_GetLastReadTime(SERIALPORT_HANDLE portHandle)
+{
+    return (portHandle!=SERIALPORT_INVALID_HANDLE) ? portHandle->lastReadTime : 0;
+}
+
+SERIALPORT_TIMESTAMP SerialPortIO_GetLastWriteTime(SERIALPORT_HANDLE portHandle)
+{
+    return (portHandle!=SERIALPORT_INVALID_HANDLE) ? portHandle->lastWriteTime : 0;
+}
+
+BOOL SerialPortIO_GetModemStatus(SERIALPORT_HANDLE portHandle, unsigned int* pModemStatus)
+{
+    if ((portHandle==SERIALPORT_INVALID_HANDLE) || (pModemStatus==NULL) || (portHandle->pTransport->GetModemStatus==NULL))
+    {
+        return FALSE;
+    }
+    return portHandle->pTransport->GetModemStatus(portHandle, pModemStatus);
+}
+
+BOOL SerialPortIO_SetModemLines(SERIALPORT_HANDLE portHandle, unsigned int lines, unsigned int mask)
+{
+    if ((portHandle==SERIALPORT_INVALID_HANDLE) || (portHandle->pTransport->SetModemLines==NULL))
+    {
+        return FALSE;
+    }
+    return portHandle->pTransport->SetModemLines(portHandle, lines, mask & (SERIALPORT_MODEM_RTS | SERIALPORT_MODEM_DTR));
+}
+
+BOOL SerialPortIO_SetBreak(SERIALPORT_HANDLE portHandle, BOOL enable)
+{
+    if ((portHandle==SERIALPORT_INVALID_HANDLE) || (portHandle->pTransport->SetBreak==NULL))
+    {
+        return FALSE;
+    }
+    return portHandle->pTransport->SetBreak(portHandle, enable);
+}
+
+static void SerialPortIO__AddLineEvent(TSerialPortDevice* pDevice, int errors, unsigned long long position, unsigned char data)
+{
+    TSerialPortLineEvent* pEvent;
+
+    //nobody collects the events, the last one gathers the rest
+    if (pDevice->lineEventCount==SERIALPORT_MAX_LINE_EVENTS)
+    {
+        pDevice->lineEvents[SERIALPORT_MAX_LINE_EVENTS-1].errors |= errors;
+        return;
+    }
+    pEvent = &pDevice->lineEvents[pDevice->lineEventCount++];
+    pEvent->errors   = errors;
+    pEvent->position = position;
+    pEvent->data     = data;
+}
+
+int SerialPortIO_GetLineEvents(SERIALPORT_HANDLE portHandle, TSerialPortLineEvent* pEvents, int maxEvents)
+{
+    int eventCount;
+
+    if ((portHandle==SERIALPORT_INVALID_HANDLE) || (portHandle->lineEventCount==0) || (maxEvents<=0))
+    {
+        return 0;
+    }
+    eventCount = (portHandle->lineEventCount<maxEvents) ? portHandle->lineEventCount : maxEvents;
+    memcpy(pEvents, portHandle->lineEvents, eventCount*sizeof(TSerialPortLineEvent));
+    portHandle->lineEventCount -= eventCount;
+    memmove(portHandle->lineEvents, portHandle->lineEvents+eventCount, portHandle->lineEventCount*sizeof(TSerialPortLineEvent));
+    return eventCount;
+}
+
+static void SerialPortIO__ModemWatchThread(void* lpParam)
+{
+    TSerialPortModemWatch*      pWatch     = (TSerialPortModemWatch*)lpParam;
+    TSerialPortDevice*          pDevice    = pWatch->pDevice;
+    const TSerialPortTransport* pTransport = pDevice->pTransport;
+    BOOL                        polling    = (pTransport->WaitModemChange==NULL);
+    unsigned int                modemStatus, changedLines;
+
+    while(!SERIALPORT_ATOMIC_LOAD(&pWatch->stopping))
+    {
+        if (polling)
+        {
+            if (SerialPortIO_WaitEvent(&pWatch->stopEvent, SERIALPORT_MODEM_POLL_INTERVAL))
+            {
+                break;
+            }
+        } else if (pTransport->WaitModemChange(pDevice)<0) {
+            //the driver does not support waiting
+            polling = TRUE;
+        }
+        //the device may be gone once stopping is set
+        if (SERIALPORT_ATOMIC_LOAD(&pWatch->stopping) || !pTransport->GetModemStatus(pDevice, &modemStatus))
+        {
+            break;
+        }
+        changedLines = (modemStatus ^ pWatch->modemStatus) & SERIALPORT_MODEM_INPUTS;
+        pWatch->modemStatus = modemStatus;
+        if (changedLines)
+        {
+            pWatch->handler(pWatch->pContext, modemStatus, changedLines);
+        }
+    }
+    if (!SERIALPORT_ATOMIC_CAS(&pWatch->state, SERIALPORT_WATCH_RUNNING, SERIALPORT_WATCH_FINISHED))
+    {
+        SerialPortIO_DeleteEvent(&pWatch->stopEvent);
+        free(pWatch);
+    }
+}
+
+static void SerialPortIO__StopModemWatch(TSerialPortModemWatch* pWatch)
+{
+    int tries;
+
+    SERIALPORT_ATOMIC_STORE(&pWatch->stopping, 1);
+    if (SerialPortIO_IsCurrentThread(&pWatch->thread))
+    {
+        //stopped from the handler, the thread exits when it returns
+        if (SERIALPORT_ATOMIC_CAS(&pWatch->state, SERIALPORT_WATCH_RUNNING, SERIALPORT_WATCH_ORPHANED))
+        {
+            SerialPortIO__DetachThread(&pWatch->thread);
+            return;
+        }
+    } else {
+        SerialPortIO_SetEvent(&pWatch->stopEvent);
+        if (pWatch->pDevice->pTransport->WaitModemChange)
+        {
+            for(tries = 0; (tries<SERIALPORT_MODEM_STOP_TRIES) && (SERIALPORT_ATOMIC_LOAD(&pWatch->state)==SERIALPORT_WATCH_RUNNING); tries++)
+            {
+                SerialPortIO__InterruptThread(&pWatch->thread);
+                SerialPortIO_Sleep(1);
+            }
+            //a wait that cannot be interrupted ends with the next line change
+            if (SERIALPORT_ATOMIC_CAS(&pWatch->state, SERIALPORT_WATCH_RUNNING, SERIALPORT_WATCH_ORPHANED))
+            {
+                SerialPortIO__DetachThread(&pWatch->thread);
+                return;
+            }
+        }
+    }
+    SerialPortIO_JoinThread(&pWatch->thread);
+    SerialPortIO_DeleteEvent(&pWatch->stopEvent);
+    free(pWatch);
+}
+
+BOOL SerialPortIO_SetModemHandler(SERIALPORT_HANDLE portHandle, SERIALPORT_MODEM_HANDLER handler, void* pContext)
+{
+    TSerialPortModemWatch* pWatch;
+
+    if (portHandle==SERIALPORT_INVALID_HANDLE)
+    {
+        return FALSE;
+    }
+    if (portHandle->pModemWatch)
+    {
+        pWatch = portHandle->pModemWatch;
+        portHandle->pModemWatch = NULL;
+        SerialPortIO__StopModemWatch(pWatch);
+    }
+    if (handler==NULL)
+    {
+        return TRUE;
+    }
+    if (portHandle->pTransport->GetModemStatus==NULL)
+    {
+        return FALSE;
+    }
+
+    pWatch = (TSerialPortModemWatch*)malloc(sizeof(TSerialPortModemWatch));
+    if (pWatch==NULL)
+    {
+        return FALSE;
+    }
+    pWatch->pDevice  = portHandle;
+    pWatch->handler  = handler;
+    pWatch->pContext = pContext;
+    pWatch->stopping = 0;
+    pWatch->state    = SERIALPORT_WATCH_RUNNING;
+    if (!portHandle->pTransport->GetModemStatus(portHandle, &pWatch->modemStatus))
+    {
+        free(pWatch);
+        return FALSE;
+    }
+    if (!SerialPortIO_CreateEvent(&pWatch->stopEvent))
+    {
+        free(pWatch);
+        return FALSE;
+    }
+    if (!SerialPortIO_StartThread(&pWatch->thread, SerialPortIO__ModemWatchThread, pWatch))
+    {
+        SerialPortIO_DeleteEvent(&pWatch->stopEvent);
+        free(pWatch);
+        return FALSE;
+    }
+    portHandle->pModemWatch = pWatch;
+    return TRUE;
+}
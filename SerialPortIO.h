@@ -0,0 +1,280 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef SERIALPORTIO___H
+#define SERIALPORTIO___H
+
+/*
+* Platform layer shared by the C API (SerialPort.c) and TSerialPort:
+* Win32 overlapped handles on Windows, termios descriptors elsewhere.
+*/
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+typedef HANDLE           SERIALPORT_NATIVE_HANDLE;
+typedef HANDLE           SERIALPORT_THREAD;
+typedef CRITICAL_SECTION SERIALPORT_LOCK;
+typedef HANDLE           SERIALPORT_EVENT;
+
+#define SERIALPORT_INVALID_NATIVE_HANDLE NULL
+
+#else
+
+#include <pthread.h>
+
+typedef int              SERIALPORT_NATIVE_HANDLE;
+typedef pthread_t        SERIALPORT_THREAD;
+typedef pthread_mutex_t  SERIALPORT_LOCK;
+
+typedef struct
+{
+    int readHandle;
+    int writeHandle;
+} SERIALPORT_EVENT;
+
+#define SERIALPORT_INVALID_NATIVE_HANDLE (-1)
+
+#ifndef BOOL
+typedef int BOOL;
+#endif
+#ifndef TRUE
+#define TRUE  1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#endif
+
+#define SERIALPORT_INTERNAL_TIMEOUT 1
+#define SERIALPORT_MAX_DEVICE_NAME  256
+#define SERIALPORT_INFINITE         (-1)
+
+#define SERIALPORT_PARITY_NONE      0
+#define SERIALPORT_PARITY_ODD       1
+#define SERIALPORT_PARITY_EVEN      2
+#define SERIALPORT_PARITY_MARK      3
+#define SERIALPORT_PARITY_SPACE     4
+
+#define SERIALPORT_STOPBITS_ONE     0
+#define SERIALPORT_STOPBITS_ONE5    1       //POSIX only with 5 data bits
+#define SERIALPORT_STOPBITS_TWO     2
+
+#define SERIALPORT_FLOW_NONE        0
+#define SERIALPORT_FLOW_RTSCTS      1
+#define SERIALPORT_FLOW_XONXOFF     2
+
+#define SERIALPORT_MODEM_CTS        0x01
+#define SERIALPORT_MODEM_DSR        0x02
+#define SERIALPORT_MODEM_RI         0x04
+#define SERIALPORT_MODEM_DCD        0x08
+#define SERIALPORT_MODEM_RTS        0x10    //outputs
+#define SERIALPORT_MODEM_DTR        0x20
+#define SERIALPORT_MODEM_INPUTS     (SERIALPORT_MODEM_CTS | SERIALPORT_MODEM_DSR | SERIALPORT_MODEM_RI | SERIALPORT_MODEM_DCD)
+
+#define SERIALPORT_MODEM_POLL_INTERVAL 10   //milliseconds
+
+#define SERIALPORT_LINE_BREAK       0x01
+#define SERIALPORT_LINE_FRAMING     0x02
+#define SERIALPORT_LINE_PARITY      0x04
+#define SERIALPORT_LINE_OVERRUN     0x08
+
+#define SERIALPORT_MAX_LINE_EVENTS  32
+
+#define SERIALPORT_RECONNECT_MIN_DELAY 50   //milliseconds, doubled after every failed reconnect
+#define SERIALPORT_RECONNECT_MAX_DELAY 2000 //up to this
+
+typedef unsigned long long SERIALPORT_TIMESTAMP;   //monotonic time in microseconds
+
+#define SERIALPORT_MAX_WRITE_BUFFERS 64     //buffers gathered by one writev
+
+typedef struct
+{
+    const unsigned char* pData;
+    int                  dataLength;
+} SERIALPORT_BUFFER;
+
+typedef struct
+{
+    unsigned char* pData;
+    int            dataLength;
+} SERIALPORT_READ_BUFFER;
+
+typedef struct
+{
+    int  baudRate;
+    int  dataBits;          //5 to 8
+    int  parity;            //SERIALPORT_PARITY_XXX
+    int  stopBits;          //SERIALPORT_STOPBITS_XXX
+    int  flowControl;       //SERIALPORT_FLOW_XXX flags
+    int  readMinBytes;      //VMIN
+    int  readIntervalMS;    //VTIME, rounded up to 100 ms steps
+    BOOL lowLatency;
+    int  latencyTimerMS;
+    int  fifoTriggerBytes;
+    BOOL reportLineErrors;  //queue line events for breaks and parity/framing errors
+} TSerialPortSettings;
+
+typedef struct
+{
+    int                errors;      //SERIALPORT_LINE_XXX flags
+    unsigned long long position;    //received bytes before the event
+    unsigned char      data;        //the byte with the error, 0 for a break
+} TSerialPortLineEvent;
+
+typedef void (*SERIALPORT_MODEM_HANDLER)(void* pContext, unsigned int modemStatus, unsigned int changedLines);
+typedef void (*SERIALPORT_WRITE_HANDLER)(void* pContext, int bytesWritten, SERIALPORT_TIMESTAMP writeTime);
+
+typedef struct TSerialPortDevice* SERIALPORT_HANDLE;
+
+#define SERIALPORT_INVALID_HANDLE NULL
+
+//functions of one transport, SerialPortIO_XXX dispatch to them
+typedef struct
+{
+    const char* prefix;
+    BOOL (*Open)(struct TSerialPortDevice* pDevice, const char* deviceName, const TSerialPortSettings* pSettings);
+    void (*Close)(struct TSerialPortDevice* pDevice);
+    int  (*Read)(struct TSerialPortDevice* pDevice, unsigned char* pData, int dataLength, int timeOutMS, SERIALPORT_EVENT* pWakeEvent);
+    int  (*WaitForData)(struct TSerialPortDevice* pDevice, int timeOutMS, SERIALPORT_EVENT* pWakeEvent);
+    int  (*Write)(struct TSerialPortDevice* pDevice, const unsigned char* pData, int dataLength);
+    int  (*WriteVector)(struct TSerialPortDevice* pDevice, const SERIALPORT_BUFFER* pBuffers, int bufferCount, BOOL blocking);
+    BOOL (*Drain)(struct TSerialPortDevice* pDevice);
+    BOOL (*GetPeerName)(struct TSerialPortDevice* pDevice, char* deviceName, int maxLength);
+    BOOL (*Configure)(struct TSerialPortDevice* pDevice, const TSerialPortSettings* pSettings);
+    BOOL (*GetModemStatus)(struct TSerialPortDevice* pDevice, unsigned int* pModemStatus);
+    BOOL (*SetModemLines)(struct TSerialPortDevice* pDevice, unsigned int lines, unsigned int mask);
+    BOOL (*SetBreak)(struct TSerialPortDevice* pDevice, BOOL enable);
+    int  (*WaitModemChange)(struct TSerialPortDevice* pDevice);    //NULL polls
+} TSerialPortTransport;
+
+typedef struct TSerialPortDevice
+{
+    const TSerialPortTransport* pTransport;
+    SERIALPORT_NATIVE_HANDLE    nativeHandle;
+    void*                       pContext;       //transport data
+    struct TSerialPortCapture*  pCapture;
+    struct TSerialPortTrace*    pTrace;
+    int                         tracePortId;
+    SERIALPORT_WRITE_HANDLER    writeHandler;
+    void*                       pWriteContext;
+    SERIALPORT_TIMESTAMP        lastReadTime;   //when the transport returned the last chunk
+    SERIALPORT_TIMESTAMP        lastWriteTime;
+    struct TSerialPortModemWatch* pModemWatch;
+    BOOL                        reportLineErrors;
+    int                         markState;      //bytes of a PARMRK sequence split by the last read
+    unsigned int                errorCounts[4]; //driver counters of breaks, framing, parity and overrun errors
+    unsigned long long          receivedBytes;
+    int                         lineEventCount;
+    TSerialPortLineEvent        lineEvents[SERIALPORT_MAX_LINE_EVENTS];
+} TSerialPortDevice;
+
+//32-bit atomics for the lock-free parts (receive ring, working thread handshakes), 64-bit ones for statistics counters
+#if defined(__GNUC__) || defined(__clang__)
+#define SERIALPORT_ATOMIC_LOAD(pValue)                  __atomic_load_n((pValue), __ATOMIC_SEQ_CST)
+#define SERIALPORT_ATOMIC_STORE(pValue, value)          __atomic_store_n((pValue), (value), __ATOMIC_SEQ_CST)
+#define SERIALPORT_ATOMIC_LOAD_ACQUIRE(pValue)          __atomic_load_n((pValue), __ATOMIC_ACQUIRE)
+#define SERIALPORT_ATOMIC_STORE_RELEASE(pValue, value)  __atomic_store_n((pValue), (value), __ATOMIC_RELEASE)
+#define SERIALPORT_ATOMIC_ADD(pValue, value)            __atomic_fetch_add((pValue), (value), __ATOMIC_RELAXED)
+#define SERIALPORT_ATOMIC_EXCHANGE(pValue, value)       __atomic_exchange_n((pValue), (value), __ATOMIC_SEQ_CST)
+#define SERIALPORT_ATOMIC_INCREMENT(pValue)             __atomic_add_fetch((pValue), 1, __ATOMIC_ACQ_REL)
+#define SERIALPORT_ATOMIC_DECREMENT(pValue)             __atomic_sub_fetch((pValue), 1, __ATOMIC_ACQ_REL)
+#define SERIALPORT_ATOMIC_EXCHANGE_POINTER(ppValue, pValue)      __atomic_exchange_n((ppValue), (pValue), __ATOMIC_SEQ_CST)
+#define SERIALPORT_ATOMIC_CAS_POINTER(ppValue, pExpected, pValue) __sync_bool_compare_and_swap((ppValue), (pExpected), (pValue))
+#define SERIALPORT_ATOMIC_CAS(pValue, expected, value)  __sync_bool_compare_and_swap((pValue), (expected), (value))
+#define SERIALPORT_ATOMIC_LOAD64(pValue)                __atomic_load_n((pValue), __ATOMIC_RELAXED)
+#define SERIALPORT_ATOMIC_ADD64(pValue, value)          __atomic_fetch_add((pValue), (value), __ATOMIC_RELAXED)
+#define SERIALPORT_ATOMIC_FENCE()                       __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#define SERIALPORT_ATOMIC_LOAD(pValue)                  InterlockedCompareExchange((volatile LONG*)(pValue), 0, 0)
+#define SERIALPORT_ATOMIC_STORE(pValue, value)          InterlockedExchange((volatile LONG*)(pValue), (LONG)(value))
+#define SERIALPORT_ATOMIC_LOAD_ACQUIRE(pValue)          (*(volatile LONG*)(pValue))
+#define SERIALPORT_ATOMIC_STORE_RELEASE(pValue, value)  (*(volatile LONG*)(pValue) = (LONG)(value))
+#define SERIALPORT_ATOMIC_ADD(pValue, value)            InterlockedExchangeAdd((volatile LONG*)(pValue), (LONG)(value))
+#define SERIALPORT_ATOMIC_EXCHANGE(pValue, value)       InterlockedExchange((volatile LONG*)(pValue), (LONG)(value))
+#define SERIALPORT_ATOMIC_INCREMENT(pValue)             InterlockedIncrement((volatile LONG*)(pValue))
+#define SERIALPORT_ATOMIC_DECREMENT(pValue)             InterlockedDecrement((volatile LONG*)(pValue))
+#define SERIALPORT_ATOMIC_EXCHANGE_POINTER(ppValue, pValue)      InterlockedExchangePointer((PVOID volatile*)(ppValue), (PVOID)(pValue))
+#define SERIALPORT_ATOMIC_CAS_POINTER(ppValue, pExpected, pValue) (InterlockedCompareExchangePointer((PVOID volatile*)(ppValue), (PVOID)(pValue), (PVOID)(pExpected))==(PVOID)(pExpected))
+#define SERIALPORT_ATOMIC_CAS(pValue, expected, value)  (InterlockedCompareExchange((volatile LONG*)(pValue), (LONG)(value), (LONG)(expected))==(LONG)(expected))
+#define SERIALPORT_ATOMIC_LOAD64(pValue)                InterlockedCompareExchange64((volatile LONGLONG*)(pValue), 0, 0)
+#define SERIALPORT_ATOMIC_ADD64(pValue, value)          InterlockedExchangeAdd64((volatile LONGLONG*)(pValue), (LONGLONG)(value))
+#define SERIALPORT_ATOMIC_FENCE()                       MemoryBarrier()
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*SERIALPORT_THREAD_ROUTINE)(void* lpParam);
+
+//the device name prefix chooses the transport ("pty:", "virtual:NAME"), see README.md
+BOOL    SerialPortIO_GetDeviceName(int comPortNumber, char* deviceName, int maxLength);
+SERIALPORT_HANDLE SerialPortIO_Open(const char* deviceName, int baudRate);
+SERIALPORT_HANDLE SerialPortIO_OpenWithSettings(const char* deviceName, const TSerialPortSettings* pSettings);
+BOOL    SerialPortIO_Configure(SERIALPORT_HANDLE portHandle, const TSerialPortSettings* pSettings);
+void    SerialPortIO_InitSettings(TSerialPortSettings* pSettings, int baudRate);
+unsigned long long SerialPortIO_GetCharTime(const TSerialPortSettings* pSettings);
+void    SerialPortIO_Close(SERIALPORT_HANDLE portHandle);
+//SERIALPORT_INFINITE waits forever, 0 never blocks, a set pWakeEvent ends the wait
+int     SerialPortIO_Read(SERIALPORT_HANDLE portHandle, unsigned char* pData, int dataLength, int timeOutMS, SERIALPORT_EVENT* pWakeEvent);
+int     SerialPortIO_WaitForData(SERIALPORT_HANDLE portHandle, int timeOutMS, SERIALPORT_EVENT* pWakeEvent);
+//WriteVector without blocking writes what the driver takes now, 0 when it would wait
+int     SerialPortIO_Write(SERIALPORT_HANDLE portHandle, const unsigned char* pData, int dataLength);
+int     SerialPortIO_WriteVector(SERIALPORT_HANDLE portHandle, const SERIALPORT_BUFFER* pBuffers, int bufferCount, BOOL blocking);
+BOOL    SerialPortIO_Drain(SERIALPORT_HANDLE portHandle);
+//what the reactor waits on: the device, the pty master, the readiness event of a virtual end
+SERIALPORT_NATIVE_HANDLE SerialPortIO_GetNativeHandle(SERIALPORT_HANDLE portHandle);
+BOOL    SerialPortIO_GetPeerName(SERIALPORT_HANDLE portHandle, char* deviceName, int maxLength);
+//chunks are captured and timestamped when the transport returns, the write handler must not write
+void    SerialPortIO_SetCapture(SERIALPORT_HANDLE portHandle, struct TSerialPortCapture* pCapture);
+void    SerialPortIO_SetTrace(SERIALPORT_HANDLE portHandle, struct TSerialPortTrace* pTrace, int portId);
+void    SerialPortIO_SetWriteHandler(SERIALPORT_HANDLE portHandle, SERIALPORT_WRITE_HANDLER handler, void* pContext);
+SERIALPORT_TIMESTAMP SerialPortIO_GetLastReadTime(SERIALPORT_HANDLE portHandle);
+SERIALPORT_TIMESTAMP SerialPortIO_GetLastWriteTime(SERIALPORT_HANDLE portHandle);
+//the modem handler runs on a thread of its own, the reading thread takes the line events after Read
+BOOL    SerialPortIO_GetModemStatus(SERIALPORT_HANDLE portHandle, unsigned int* pModemStatus);
+BOOL    SerialPortIO_SetModemLines(SERIALPORT_HANDLE portHandle, unsigned int lines, unsigned int mask);
+BOOL    SerialPortIO_SetBreak(SERIALPORT_HANDLE portHandle, BOOL enable);
+BOOL    SerialPortIO_SetModemHandler(SERIALPORT_HANDLE portHandle, SERIALPORT_MODEM_HANDLER handler, void* pContext);
+int     SerialPortIO_GetLineEvents(SERIALPORT_HANDLE portHandle, TSerialPortLineEvent* pEvents, int maxEvents);
+
+void    SerialPortIO_Sleep(int timeMS);
+SERIALPORT_TIMESTAMP SerialPortIO_GetTime(void);
+
+void    SerialPortIO_InitLock(SERIALPORT_LOCK* pLock);
+void    SerialPortIO_DeleteLock(SERIALPORT_LOCK* pLock);
+void    SerialPortIO_Lock(SERIALPORT_LOCK* pLock);
+void    SerialPortIO_Unlock(SERIALPORT_LOCK* pLock);
+
+BOOL    SerialPortIO_CreateEvent(SERIALPORT_EVENT* pEvent);
+void    SerialPortIO_DeleteEvent(SERIALPORT_EVENT* pEvent);
+void    SerialPortIO_SetEvent(SERIALPORT_EVENT* pEvent);
+void    SerialPortIO_ResetEvent(SERIALPORT_EVENT* pEvent);
+BOOL    SerialPortIO_WaitEvent(SERIALPORT_EVENT* pEvent, int timeOutMS);
+int     SerialPortIO_WaitEvents(SERIALPORT_EVENT* pEvent, SERIALPORT_EVENT* pWakeEvent, int timeOutMS);
+
+BOOL    SerialPortIO_StartThread(SERIALPORT_THREAD* pThread, SERIALPORT_THREAD_ROUTINE threadRoutine, void* lpParam);
+void    SerialPortIO_JoinThread(SERIALPORT_THREAD* pThread);
+BOOL    SerialPortIO_IsCurrentThread(SERIALPORT_THREAD* pThread);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
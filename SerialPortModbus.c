@@ -0,0 +1,800 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#include "SerialPortModbus.h"
+#include "SerialPortCrc.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SERIALPORT_MODBUS__IDLE     0       //nothing on the line, the next request goes out at readyTime
+#define SERIALPORT_MODBUS__WAITING  1       //request sent, waiting for the response
+
+struct TSerialPortModbusBus
+{
+    TSerialPortModbus*          pModbus;
+    TSerialPortModbusBus*       pNextBus;
+    SERIALPORT_SEND_HANDLER     sendHandler;
+    void*                       pSendContext;
+
+    int                         charTimeUS;
+    int                         t15US;
+    int                         t35US;
+    int                         toleranceUS;
+    int                         broadcastDelayMS;
+
+    TSerialPortModbusRequest*   pQueuedFirst;
+    TSerialPortModbusRequest*   pQueuedLast;
+    int                         queuedCount;
+    TSerialPortModbusRequest*   pCurrent;           //NULL when cancelled while its response may still come
+    int                         state;
+    unsigned char               slave;              //of the request on the line
+    unsigned char               function;
+    SERIALPORT_TIMESTAMP        requestEndTime;
+    SERIALPORT_TIMESTAMP        responseDeadline;
+    SERIALPORT_TIMESTAMP        readyTime;
+    TSerialPortTimer            timer;
+
+    unsigned char               frame[SERIALPORT_MODBUS_MAX_FRAME];
+    int                         frameLength;
+    BOOL                        frameBroken;        //t1.5 exceeded or too long
+    SERIALPORT_TIMESTAMP        lastReceiveTime;
+
+    TSerialPortModbusStatistics statistics;
+};
+
+//a thread in Wait for a request without pCompletedEvent
+typedef struct TSerialPortModbusWaiter
+{
+    TSerialPortModbusRequest*       pRequest;
+    SERIALPORT_EVENT                event;
+    struct TSerialPortModbusWaiter* pNext;
+} TSerialPortModbusWaiter;
+
+struct TSerialPortModbus
+{
+    SERIALPORT_LOCK             lock;
+    TSerialPortTimerWheel       wheel;
+    SERIALPORT_TIMESTAMP        nextWakeTime;       //0 when the engine thread sleeps without a timeout
+    TSerialPortPacer*           pPacer;
+    TSerialPortModbusBus*       pFirstBus;
+    TSerialPortModbusWaiter*    pFirstWaiter;
+};
+
+//length of a response frame with the CRC, 0 while more bytes are needed to tell, -1 when only silence ends it
+static int SerialPortModbus__GetResponseLength(const unsigned char* pFrame, int frameLength)
+{
+    if (frameLength<2)
+    {
+        return 0;
+    }
+    if (pFrame[1] & 0x80)
+    {
+        return 5;
+    }
+    switch(pFrame[1])
+    {
+        case 1: case 2: case 3: case 4: case 12: case 17: case 20: case 21: case 23:
+            return (frameLength<3) ? 0 : 3 + pFrame[2] + 2;
+        case 5: case 6: case 8: case 11: case 15: case 16:
+            return 8;
+        case 7:
+            return 5;
+        case 22:
+            return 10;
+        case 24:
+            return (frameLength<4) ? 0 : 4 + ((pFrame[2]<<8) | pFrame[3]) + 2;
+        default:
+            return -1;
+    }
+}
+
+static void SerialPortModbus__SetTiming(TSerialPortModbusBus* pBus, const TSerialPortSettings* pSettings)
+{
+    pBus->charTimeUS = (int)((SerialPortIO_GetCharTime(pSettings) + 999) / 1000);
+
+    //the standard fixes both above 19200 baud
+    if ((pSettings->baudRate<=0) || (pSettings->baudRate>19200))
+    {
+        pBus->t15US = 750;
+        pBus->t35US = 1750;
+    } else {
+        pBus->t15US = (pBus->charTimeUS*3 + 1) / 2;
+        pBus->t35US = (pBus->charTimeUS*7 + 1) / 2;
+    }
+}
+
+//called locked
+static void SerialPortModbus__Finish(TSerialPortModbusRequest* pRequest, int status, SERIALPORT_TIMESTAMP completeTime, TSerialPortModbusRequest** ppCompleted)
+{
+    TSerialPortModbusWaiter* pWaiter;
+
+    pRequest->completeTime = completeTime;
+    SERIALPORT_ATOMIC_STORE(&pRequest->status, status);
+    pRequest->pNext = *ppCompleted;
+    *ppCompleted = pRequest;
+    for(pWaiter = pRequest->pModbus->pFirstWaiter; pWaiter!=NULL; pWaiter = pWaiter->pNext)
+    {
+        if (pWaiter->pRequest==pRequest)
+        {
+            SerialPortIO_SetEvent(&pWaiter->event);
+        }
+    }
+}
+
+//sends the next request when the line has been silent long enough, called locked
+static void SerialPortModbus__Send(TSerialPortModbusBus* pBus, SERIALPORT_TIMESTAMP currentTime, TSerialPortModbusRequest** ppCompleted)
+{
+    TSerialPortModbusRequest* pRequest;
+    int                       bytesSent;
+
+    while((pBus->state==SERIALPORT_MODBUS__IDLE) && (pBus->pQueuedFirst!=NULL) && (currentTime>=pBus->readyTime))
+    {
+        pRequest = pBus->pQueuedFirst;
+        pBus->pQueuedFirst = pRequest->pNext;
+        if (pBus->pQueuedFirst==NULL)
+        {
+            pBus->pQueuedLast = NULL;
+        }
+        pBus->queuedCount--;
+        pRequest->pNext = NULL;
+
+        //waiting before sending, the response may arrive before the send handler returns
+        pRequest->attempts++;
+        pRequest->sendTime     = currentTime;
+        pBus->pCurrent         = pRequest;
+        pBus->state            = SERIALPORT_MODBUS__WAITING;
+        pBus->slave            = pRequest->request[0];
+        pBus->function         = pRequest->request[1];
+        pBus->requestEndTime   = currentTime + (SERIALPORT_TIMESTAMP)pRequest->requestLength*pBus->charTimeUS;
+        pBus->responseDeadline = pBus->requestEndTime + (SERIALPORT_TIMESTAMP)pRequest->timeOutMS*1000;
+        pBus->frameLength      = 0;
+        pBus->frameBroken      = FALSE;
+        SERIALPORT_ATOMIC_STORE(&pRequest->status, SERIALPORT_TRANSACTION_PENDING);
+        pBus->statistics.requests++;
+
+        bytesSent = 0;
+        if (pBus->sendHandler)
+        {
+            bytesSent = pBus->sendHandler(pBus->pSendContext, pRequest->request, pRequest->requestLength);
+        }
+        if (pBus->pCurrent!=pRequest)
+        {
+            continue;
+        }
+        if (bytesSent<pRequest->requestLength)
+        {
+            pBus->pCurrent  = NULL;
+            pBus->state     = SERIALPORT_MODBUS__IDLE;
+            pBus->readyTime = currentTime;
+            SerialPortModbus__Finish(pRequest, SERIALPORT_TRANSACTION_FAILED, currentTime, ppCompleted);
+        } else if (pBus->slave==SERIALPORT_MODBUS_BROADCAST) {
+            //nobody answers, the slaves get time to carry it out
+            pBus->pCurrent  = NULL;
+            pBus->state     = SERIALPORT_MODBUS__IDLE;
+            pBus->readyTime = pBus->requestEndTime + (SERIALPORT_TIMESTAMP)pBus->broadcastDelayMS*1000;
+            SerialPortModbus__Finish(pRequest, SERIALPORT_TRANSACTION_COMPLETED, pBus->requestEndTime, ppCompleted);
+        }
+    }
+}
+
+//ends the exchange on the line, the request is sent again while it has retries left, called locked
+static void SerialPortModbus__EndExchange(TSerialPortModbusBus* pBus, int status, SERIALPORT_TIMESTAMP completeTime, TSerialPortModbusRequest** ppCompleted)
+{
+    TSerialPortModbusRequest* pRequest = pBus->pCurrent;
+
+    pBus->pCurrent    = NULL;
+    pBus->state       = SERIALPORT_MODBUS__IDLE;
+    pBus->frameLength = 0;
+    pBus->frameBroken = FALSE;
+    if (pRequest==NULL)
+    {
+        return;
+    }
+    if ((status!=SERIALPORT_TRANSACTION_COMPLETED) && (pRequest->attempts<=pRequest->retries))
+    {
+        pRequest->pNext = pBus->pQueuedFirst;
+        pBus->pQueuedFirst = pRequest;
+        if (pBus->pQueuedLast==NULL)
+        {
+            pBus->pQueuedLast = pRequest;
+        }
+        pBus->queuedCount++;
+        SERIALPORT_ATOMIC_STORE(&pRequest->status, SERIALPORT_TRANSACTION_QUEUED);
+        pBus->statistics.retries++;
+        return;
+    }
+    SerialPortModbus__Finish(pRequest, status, completeTime, ppCompleted);
+}
+
+//handles a complete frame at the start of the frame buffer, called locked
+static void SerialPortModbus__OnFrame(TSerialPortModbusBus* pBus, int frameLength, SERIALPORT_TIMESTAMP receiveTime, TSerialPortModbusRequest** ppCompleted)
+{
+    TSerialPortModbusRequest* pRequest = pBus->pCurrent;
+    int                       status = SERIALPORT_TRANSACTION_FAILED;
+
+    if (pBus->frameBroken)
+    {
+        pBus->statistics.timingErrors++;
+    } else if (!SerialPortCrc_Check(SERIALPORT_CRC16_MODBUS, pBus->frame, frameLength)) {
+        pBus->statistics.crcErrors++;
+    } else if ((pBus->frame[0]==pBus->slave) && ((pBus->frame[1] & 0x7F)==pBus->function)) {
+        status = SERIALPORT_TRANSACTION_COMPLETED;
+    }
+    pBus->statistics.discardedBytes += pBus->frameLength - ((status==SERIALPORT_TRANSACTION_COMPLETED) ? frameLength : 0);
+    if (status==SERIALPORT_TRANSACTION_COMPLETED)
+    {
+        pBus->statistics.responses++;
+        if (pBus->frame[1] & 0x80)
+        {
+            pBus->statistics.exceptions++;
+        }
+        if (receiveTime>pBus->requestEndTime)
+        {
+            pBus->statistics.responseTime += receiveTime - pBus->requestEndTime;
+        }
+        if (pRequest)
+        {
+            memcpy(pRequest->response, pBus->frame, frameLength);
+            pRequest->responseLength = frameLength;
+        }
+    }
+    //a broken response ends the exchange too, the slave has finished talking
+    pBus->readyTime = receiveTime + pBus->t35US;
+    SerialPortModbus__EndExchange(pBus, status, receiveTime, ppCompleted);
+}
+
+//runs the timer of the bus for its next deadline and wakes the engine thread when it is due earlier, called locked
+static void SerialPortModbus__Arm(TSerialPortModbusBus* pBus)
+{
+    TSerialPortModbus*   pModbus = pBus->pModbus;
+    SERIALPORT_TIMESTAMP deadline = 0;
+    SERIALPORT_TIMESTAMP silenceTime;
+
+    if (pBus->state==SERIALPORT_MODBUS__WAITING)
+    {
+        deadline = pBus->responseDeadline;
+        if (pBus->frameLength>0)
+        {
+            silenceTime = pBus->lastReceiveTime + pBus->t35US + pBus->toleranceUS;
+            if (silenceTime<deadline)
+            {
+                deadline = silenceTime;
+            }
+        }
+    } else if (pBus->pQueuedFirst) {
+        deadline = pBus->readyTime;
+    }
+
+    SerialPortTimerWheel_Remove(&pModbus->wheel, &pBus->timer);
+    if (deadline==0)
+    {
+        return;
+    }
+    SerialPortTimerWheel_Add(&pModbus->wheel, &pBus->timer, deadline);
+    if ((pModbus->nextWakeTime==0) || (deadline<pModbus->nextWakeTime))
+    {
+        pModbus->nextWakeTime = deadline;
+        SerialPortPacer_Wake(pModbus->pPacer);
+    }
+}
+
+//timer of the bus expired, called locked
+static void SerialPortModbus__OnTimer(TSerialPortModbusBus* pBus, SERIALPORT_TIMESTAMP currentTime, TSerialPortModbusRequest** ppCompleted)
+{
+    if (pBus->state==SERIALPORT_MODBUS__WAITING)
+    {
+        //t3.5 of silence ends the frame, a frame of known length is incomplete then
+        if ((pBus->frameLength>0) && (currentTime>=pBus->lastReceiveTime + pBus->t35US + pBus->toleranceUS))
+        {
+            if (SerialPortModbus__GetResponseLength(pBus->frame, pBus->frameLength)<0)
+            {
+                SerialPortModbus__OnFrame(pBus, pBus->frameLength, pBus->lastReceiveTime, ppCompleted);
+            } else {
+                pBus->statistics.timingErrors++;
+                pBus->readyTime = pBus->lastReceiveTime + pBus->t35US;
+                pBus->statistics.discardedBytes += pBus->frameLength;
+                SerialPortModbus__EndExchange(pBus, SERIALPORT_TRANSACTION_FAILED, currentTime, ppCompleted);
+            }
+        }
+        if ((pBus->state==SERIALPORT_MODBUS__WAITING) && (currentTime>=pBus->responseDeadline))
+        {
+            pBus->statistics.timeouts++;
+            pBus->statistics.discardedBytes += pBus->frameLength;
+            if (pBus->frameLength>0)
+            {
+                pBus->readyTime = pBus->lastReceiveTime + pBus->t35US;
+            }
+            SerialPortModbus__EndExchange(pBus, SERIALPORT_TRANSACTION_TIMEOUT, currentTime, ppCompleted);
+        }
+    }
+    SerialPortModbus__Send(pBus, currentTime, ppCompleted);
+}
+
+static void SerialPortModbus__Complete(TSerialPortModbusRequest* pCompleted)
+{
+    TSerialPortModbusRequest* pNext;
+
+    //handlers may submit the request again, pNext is taken first
+    while(pCompleted)
+    {
+        pNext = pCompleted->pNext;
+        pCompleted->pNext = NULL;
+        if (pCompleted->onCompleted)
+        {
+            pCompleted->onCompleted(pCompleted);
+        }
+        if (pCompleted->pCompletedEvent)
+        {
+            SerialPortIO_SetEvent(pCompleted->pCompletedEvent);
+        }
+        pCompleted = pNext;
+    }
+}
+
+static SERIALPORT_TIMESTAMP SerialPortModbus__Service(void* pContext)
+{
+    TSerialPortModbus*        pModbus = (TSerialPortModbus*)pContext;
+    TSerialPortModbusRequest* pCompleted = NULL;
+    TSerialPortModbusBus*     pBus;
+    TSerialPortTimer*         pTimer;
+    TSerialPortTimer*         pNext;
+    SERIALPORT_TIMESTAMP      currentTime, nextTime;
+
+    SerialPortIO_Lock(&pModbus->lock);
+    currentTime = SerialPortIO_GetTime();
+    pTimer = SerialPortTimerWheel_Advance(&pModbus->wheel, currentTime);
+    while(pTimer)
+    {
+        pNext = pTimer->pNext;
+        pBus = (TSerialPortModbusBus*)((char*)pTimer - offsetof(TSerialPortModbusBus, timer));
+        SerialPortModbus__OnTimer(pBus, currentTime, &pCompleted);
+        SerialPortModbus__Arm(pBus);
+        pTimer = pNext;
+    }
+    nextTime = SerialPortTimerWheel_GetNextTime(&pModbus->wheel);
+    pModbus->nextWakeTime = nextTime;
+    SerialPortIO_Unlock(&pModbus->lock);
+
+    SerialPortModbus__Complete(pCompleted);
+    return nextTime;
+}
+
+void SerialPortModbus_InitRequest(TSerialPortModbusRequest* pRequest, int slave, int function,
+                                  const unsigned char* pData, int dataLength, int timeOutMS)
+{
+    unsigned int crc;
+
+    memset(pRequest, 0, sizeof(TSerialPortModbusRequest));
+    if ((dataLength<0) || (dataLength>SERIALPORT_MODBUS_MAX_FRAME-4))
+    {
+        dataLength = 0;
+    }
+    pRequest->request[0] = (unsigned char)slave;
+    pRequest->request[1] = (unsigned char)function;
+    if (pData && (dataLength>0))
+    {
+        memcpy(pRequest->request + 2, pData, dataLength);
+    }
+    crc = SerialPortCrc_Compute(SERIALPORT_CRC16_MODBUS, pRequest->request, 2 + dataLength);
+    pRequest->requestLength = 2 + dataLength + SerialPortCrc_Append(SERIALPORT_CRC16_MODBUS, crc, pRequest->request + 2 + dataLength);
+    pRequest->timeOutMS     = timeOutMS;
+}
+
+void SerialPortModbus_InitRead(TSerialPortModbusRequest* pRequest, int slave, int function, int address, int count, int timeOutMS)
+{
+    unsigned char data[4];
+
+    data[0] = (unsigned char)(address>>8);
+    data[1] = (unsigned char)address;
+    data[2] = (unsigned char)(count>>8);
+    data[3] = (unsigned char)count;
+    SerialPortModbus_InitRequest(pRequest, slave, function, data, 4, timeOutMS);
+}
+
+void SerialPortModbus_InitWriteRegister(TSerialPortModbusRequest* pRequest, int slave, int address, int value, int timeOutMS)
+{
+    unsigned char data[4];
+
+    data[0] = (unsigned char)(address>>8);
+    data[1] = (unsigned char)address;
+    data[2] = (unsigned char)(value>>8);
+    data[3] = (unsigned char)value;
+    SerialPortModbus_InitRequest(pRequest, slave, SERIALPORT_MODBUS_WRITE_REGISTER, data, 4, timeOutMS);
+}
+
+void SerialPortModbus_InitWriteRegisters(TSerialPortModbusRequest* pRequest, int slave, int address,
+                                         const unsigned short* pValues, int count, int timeOutMS)
+{
+    unsigned char data[5 + 2*123];
+    int           i;
+
+    if (count<0)   count = 0;
+    if (count>123) count = 123;     //most registers one frame can carry
+    data[0] = (unsigned char)(address>>8);
+    data[1] = (unsigned char)address;
+    data[2] = (unsigned char)(count>>8);
+    data[3] = (unsigned char)count;
+    data[4] = (unsigned char)(count*2);
+    for(i = 0; i<count; i++)
+    {
+        data[5 + 2*i]     = (unsigned char)(pValues[i]>>8);
+        data[5 + 2*i + 1] = (unsigned char)pValues[i];
+    }
+    SerialPortModbus_InitRequest(pRequest, slave, SERIALPORT_MODBUS_WRITE_REGISTERS, data, 5 + 2*count, timeOutMS);
+}
+
+int SerialPortModbus_GetRegisters(const TSerialPortModbusRequest* pRequest, unsigned short* pValues, int maxCount)
+{
+    int count, i;
+
+    //slave, function, byte count, registers, CRC
+    if ((pRequest->status!=SERIALPORT_TRANSACTION_COMPLETED) || (pRequest->responseLength<5) || (pRequest->response[1] & 0x80))
+    {
+        return -1;
+    }
+    count = pRequest->response[2] / 2;
+    if (count>maxCount)
+    {
+        count = maxCount;
+    }
+    for(i = 0; i<count; i++)
+    {
+        pValues[i] = (unsigned short)((pRequest->response[3 + 2*i]<<8) | pRequest->response[3 + 2*i + 1]);
+    }
+    return count;
+}
+
+int SerialPortModbus_GetException(const TSerialPortModbusRequest* pRequest)
+{
+    if ((pRequest->status!=SERIALPORT_TRANSACTION_COMPLETED) || (pRequest->responseLength<5) || !(pRequest->response[1] & 0x80))
+    {
+        return 0;
+    }
+    return pRequest->response[2];
+}
+
+//sleeps until Finish signals the request or the timeout expires
+static void SerialPortModbus__WaitFinish(TSerialPortModbusRequest* pRequest, int timeOutMS)
+{
+    TSerialPortModbus*        pModbus = pRequest->pModbus;
+    TSerialPortModbusWaiter   waiter;
+    TSerialPortModbusWaiter** ppWaiter;
+    int                       status;
+
+    if (!SerialPortIO_CreateEvent(&waiter.event))
+    {
+        SerialPortIO_Sleep(SERIALPORT_INTERNAL_TIMEOUT);
+        return;
+    }
+    waiter.pRequest = pRequest;
+    SerialPortIO_Lock(&pModbus->lock);
+    //it may have finished since the caller looked
+    status = pRequest->status;
+    if ((status==SERIALPORT_TRANSACTION_QUEUED) || (status==SERIALPORT_TRANSACTION_PENDING))
+    {
+        waiter.pNext = pModbus->pFirstWaiter;
+        pModbus->pFirstWaiter = &waiter;
+        SerialPortIO_Unlock(&pModbus->lock);
+        SerialPortIO_WaitEvent(&waiter.event, timeOutMS);
+        SerialPortIO_Lock(&pModbus->lock);
+        for(ppWaiter = &pModbus->pFirstWaiter; *ppWaiter!=&waiter; ppWaiter = &(*ppWaiter)->pNext);
+        *ppWaiter = waiter.pNext;
+    }
+    SerialPortIO_Unlock(&pModbus->lock);
+    SerialPortIO_DeleteEvent(&waiter.event);
+}
+
+int SerialPortModbus_Wait(TSerialPortModbusRequest* pRequest, int timeOutMS)
+{
+    SERIALPORT_TIMESTAMP startTime = SerialPortIO_GetTime();
+    SERIALPORT_TIMESTAMP elapsed;
+    int                  status, waitTime;
+
+    while(1)
+    {
+        status = SERIALPORT_ATOMIC_LOAD(&pRequest->status);
+        if ((status>=SERIALPORT_TRANSACTION_COMPLETED) || (status==SERIALPORT_TRANSACTION_IDLE) || (timeOutMS==0))
+        {
+            return status;
+        }
+        waitTime = timeOutMS;
+        if (timeOutMS>0)
+        {
+            elapsed = (SerialPortIO_GetTime() - startTime) / 1000;
+            if (elapsed>=(SERIALPORT_TIMESTAMP)timeOutMS)
+            {
+                return status;
+            }
+            waitTime = timeOutMS - (int)elapsed;
+        }
+        if (pRequest->pCompletedEvent)
+        {
+            SerialPortIO_WaitEvent(pRequest->pCompletedEvent, waitTime);
+        } else {
+            SerialPortModbus__WaitFinish(pRequest, waitTime);
+        }
+    }
+}
+
+TSerialPortModbus* SerialPortModbus_Create(void)
+{
+    TSerialPortModbus* pModbus;
+
+    pModbus = (TSerialPortModbus*)calloc(1, sizeof(TSerialPortModbus));
+    if (pModbus==NULL)
+    {
+        return NULL;
+    }
+    SerialPortTimerWheel_Init(&pModbus->wheel, SERIALPORT_MODBUS_TICK);
+    SerialPortIO_InitLock(&pModbus->lock);
+
+    pModbus->pPacer = SerialPortPacer_Create(SerialPortModbus__Service, pModbus);
+    if (pModbus->pPacer==NULL)
+    {
+        SerialPortIO_DeleteLock(&pModbus->lock);
+        free(pModbus);
+        return NULL;
+    }
+    return pModbus;
+}
+
+void SerialPortModbus_Delete(TSerialPortModbus* pModbus)
+{
+    if (pModbus==NULL)
+    {
+        return;
+    }
+    SerialPortPacer_Delete(pModbus->pPacer);
+    while(pModbus->pFirstBus)
+    {
+        SerialPortModbus_RemoveBus(pModbus->pFirstBus);
+    }
+    SerialPortIO_DeleteLock(&pModbus->lock);
+    free(pModbus);
+}
+
+TSerialPortModbusBus* SerialPortModbus_AddBus(TSerialPortModbus* pModbus, const TSerialPortSettings* pSettings)
+{
+    TSerialPortModbusBus* pBus;
+
+    pBus = (TSerialPortModbusBus*)calloc(1, sizeof(TSerialPortModbusBus));
+    if (pBus==NULL)
+    {
+        return NULL;
+    }
+    pBus->pModbus          = pModbus;
+    pBus->toleranceUS      = SERIALPORT_MODBUS_DEFAULT_TOLERANCE;
+    pBus->broadcastDelayMS = SERIALPORT_MODBUS_BROADCAST_DELAY;
+    SerialPortModbus__SetTiming(pBus, pSettings);
+
+    SerialPortIO_Lock(&pModbus->lock);
+    pBus->pNextBus = pModbus->pFirstBus;
+    pModbus->pFirstBus = pBus;
+    SerialPortIO_Unlock(&pModbus->lock);
+    return pBus;
+}
+
+void SerialPortModbus_RemoveBus(TSerialPortModbusBus* pBus)
+{
+    TSerialPortModbus*        pModbus = pBus->pModbus;
+    TSerialPortModbusRequest* pCompleted = NULL;
+    TSerialPortModbusRequest* pRequest;
+    TSerialPortModbusBus**    ppBus;
+    SERIALPORT_TIMESTAMP      currentTime;
+
+    SerialPortIO_Lock(&pModbus->lock);
+    for(ppBus = &pModbus->pFirstBus; *ppBus!=NULL; ppBus = &(*ppBus)->pNextBus)
+    {
+        if (*ppBus==pBus)
+        {
+            *ppBus = pBus->pNextBus;
+            break;
+        }
+    }
+    SerialPortTimerWheel_Remove(&pModbus->wheel, &pBus->timer);
+    currentTime = SerialPortIO_GetTime();
+    if (pBus->pCurrent)
+    {
+        SerialPortModbus__Finish(pBus->pCurrent, SERIALPORT_TRANSACTION_CANCELLED, currentTime, &pCompleted);
+    }
+    while(pBus->pQueuedFirst)
+    {
+        pRequest = pBus->pQueuedFirst;
+        pBus->pQueuedFirst = pRequest->pNext;
+        SerialPortModbus__Finish(pRequest, SERIALPORT_TRANSACTION_CANCELLED, currentTime, &pCompleted);
+    }
+    SerialPortIO_Unlock(&pModbus->lock);
+
+    SerialPortModbus__Complete(pCompleted);
+    free(pBus);
+}
+
+void SerialPortModbus_SetSendHandler(TSerialPortModbusBus* pBus, SERIALPORT_SEND_HANDLER sendHandler, void* pContext)
+{
+    SerialPortIO_Lock(&pBus->pModbus->lock);
+    pBus->sendHandler  = sendHandler;
+    pBus->pSendContext = pContext;
+    SerialPortIO_Unlock(&pBus->pModbus->lock);
+}
+
+void SerialPortModbus_SetTiming(TSerialPortModbusBus* pBus, int t15US, int t35US, int toleranceUS, int broadcastDelayMS)
+{
+    //negative values keep the current ones
+    SerialPortIO_Lock(&pBus->pModbus->lock);
+    if (t15US>=0)            pBus->t15US = t15US;
+    if (t35US>=0)            pBus->t35US = t35US;
+    if (toleranceUS>=0)      pBus->toleranceUS = toleranceUS;
+    if (broadcastDelayMS>=0) pBus->broadcastDelayMS = broadcastDelayMS;
+    SerialPortIO_Unlock(&pBus->pModbus->lock);
+}
+
+BOOL SerialPortModbus_Submit(TSerialPortModbusBus* pBus, TSerialPortModbusRequest* pRequest)
+{
+    TSerialPortModbusRequest*  pCompleted = NULL;
+    TSerialPortModbusRequest** ppCompleted;
+    BOOL                       result;
+
+    if ((pRequest->status==SERIALPORT_TRANSACTION_QUEUED) || (pRequest->status==SERIALPORT_TRANSACTION_PENDING) ||
+        (pRequest->requestLength<4) || (pRequest->requestLength>SERIALPORT_MODBUS_MAX_FRAME))
+    {
+        return FALSE;
+    }
+    pRequest->responseLength = 0;
+    pRequest->attempts       = 0;
+    pRequest->sendTime       = 0;
+    pRequest->completeTime   = 0;
+    pRequest->pNext          = NULL;
+    pRequest->pModbus        = pBus->pModbus;
+
+    SerialPortIO_Lock(&pBus->pModbus->lock);
+    SERIALPORT_ATOMIC_STORE(&pRequest->status, SERIALPORT_TRANSACTION_QUEUED);
+    if (pBus->pQueuedLast)
+    {
+        pBus->pQueuedLast->pNext = pRequest;
+    } else {
+        pBus->pQueuedFirst = pRequest;
+    }
+    pBus->pQueuedLast = pRequest;
+    pBus->queuedCount++;
+    SerialPortModbus__Send(pBus, SerialPortIO_GetTime(), &pCompleted);
+    SerialPortModbus__Arm(pBus);
+
+    //a request which could not be sent right away is reported by the result only
+    result = (pRequest->status!=SERIALPORT_TRANSACTION_FAILED);
+    for(ppCompleted = &pCompleted; !result && (*ppCompleted!=NULL); ppCompleted = &(*ppCompleted)->pNext)
+    {
+        if (*ppCompleted==pRequest)
+        {
+            *ppCompleted = pRequest->pNext;
+            pRequest->pNext = NULL;
+            break;
+        }
+    }
+    SerialPortIO_Unlock(&pBus->pModbus->lock);
+
+    SerialPortModbus__Complete(pCompleted);
+    return result;
+}
+
+BOOL SerialPortModbus_Cancel(TSerialPortModbusBus* pBus, TSerialPortModbusRequest* pRequest)
+{
+    TSerialPortModbusRequest*  pCompleted = NULL;
+    TSerialPortModbusRequest** ppRequest;
+    TSerialPortModbusRequest*  pPrev;
+
+    SerialPortIO_Lock(&pBus->pModbus->lock);
+    if (pBus->pCurrent==pRequest)
+    {
+        //the response may still come, the bus keeps waiting for it
+        pBus->pCurrent = NULL;
+        SerialPortModbus__Finish(pRequest, SERIALPORT_TRANSACTION_CANCELLED, SerialPortIO_GetTime(), &pCompleted);
+    } else {
+        for(pPrev = NULL, ppRequest = &pBus->pQueuedFirst; *ppRequest!=NULL; pPrev = *ppRequest, ppRequest = &(*ppRequest)->pNext)
+        {
+            if (*ppRequest==pRequest)
+            {
+                *ppRequest = pRequest->pNext;
+                if (pBus->pQueuedLast==pRequest)
+                {
+                    pBus->pQueuedLast = pPrev;
+                }
+                pBus->queuedCount--;
+                SerialPortModbus__Finish(pRequest, SERIALPORT_TRANSACTION_CANCELLED, SerialPortIO_GetTime(), &pCompleted);
+                break;
+            }
+        }
+        SerialPortModbus__Arm(pBus);
+    }
+    SerialPortIO_Unlock(&pBus->pModbus->lock);
+
+    SerialPortModbus__Complete(pCompleted);
+    return (pCompleted!=NULL);
+}
+
+void SerialPortModbus_OnDataReceived(TSerialPortModbusBus* pBus, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP receiveTime)
+{
+    TSerialPortModbusRequest* pCompleted = NULL;
+    long long                 silence;
+    int                       copyLength, frameLength;
+
+    if (dataLength<=0)
+    {
+        return;
+    }
+    SerialPortIO_Lock(&pBus->pModbus->lock);
+    if (pBus->frameLength>0)
+    {
+        //from the end of the previous chunk to the start of the first byte of this one
+        silence = (long long)(receiveTime - pBus->lastReceiveTime) - (long long)dataLength*pBus->charTimeUS;
+        if (silence>pBus->t35US + pBus->toleranceUS)
+        {
+            pBus->statistics.discardedBytes += pBus->frameLength;
+            pBus->frameLength = 0;
+            pBus->frameBroken = FALSE;
+        } else if (silence>pBus->t15US + pBus->toleranceUS) {
+            pBus->frameBroken = TRUE;
+        }
+    }
+    pBus->lastReceiveTime = receiveTime;
+
+    if (pBus->state!=SERIALPORT_MODBUS__WAITING)
+    {
+        //nobody asked, the line must still be silent for t3.5 before the next request
+        pBus->statistics.discardedBytes += dataLength;
+        pBus->readyTime = receiveTime + pBus->t35US;
+    } else {
+        copyLength = dataLength;
+        if (copyLength>SERIALPORT_MODBUS_MAX_FRAME - pBus->frameLength)
+        {
+            copyLength = SERIALPORT_MODBUS_MAX_FRAME - pBus->frameLength;
+            pBus->statistics.discardedBytes += dataLength - copyLength;
+            pBus->frameBroken = TRUE;
+        }
+        memcpy(pBus->frame + pBus->frameLength, pData, copyLength);
+        pBus->frameLength += copyLength;
+
+        frameLength = SerialPortModbus__GetResponseLength(pBus->frame, pBus->frameLength);
+        if ((frameLength>0) && (pBus->frameLength>=frameLength) && (frameLength<=SERIALPORT_MODBUS_MAX_FRAME))
+        {
+            SerialPortModbus__OnFrame(pBus, frameLength, receiveTime, &pCompleted);
+        } else if ((frameLength>SERIALPORT_MODBUS_MAX_FRAME) && (pBus->frameLength==SERIALPORT_MODBUS_MAX_FRAME)) {
+            SerialPortModbus__OnFrame(pBus, pBus->frameLength, receiveTime, &pCompleted);
+        }
+    }
+    SerialPortModbus__Send(pBus, SerialPortIO_GetTime(), &pCompleted);
+    SerialPortModbus__Arm(pBus);
+    SerialPortIO_Unlock(&pBus->pModbus->lock);
+
+    SerialPortModbus__Complete(pCompleted);
+}
+
+int SerialPortModbus_GetQueuedCount(TSerialPortModbusBus* pBus)
+{
+    int count;
+
+    SerialPortIO_Lock(&pBus->pModbus->lock);
+    count = pBus->queuedCount;
+    SerialPortIO_Unlock(&pBus->pModbus->lock);
+    return count;
+}
+
+void SerialPortModbus_GetStatistics(TSerialPortModbusBus* pBus, TSerialPortModbusStatistics* pStatistics)
+{
+    SerialPortIO_Lock(&pBus->pModbus->lock);
+    *pStatistics = pBus->statistics;
+    SerialPortIO_Unlock(&pBus->pModbus->lock);
+}
@@ -0,0 +1,149 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef SERIALPORTMODBUS___H
+#define SERIALPORTMODBUS___H
+
+#include "SerialPortIO.h"
+#include "SerialPortTimerWheel.h"
+#include "SerialPortTransaction.h"
+#include "SerialPortPacer.h"
+
+/*
+* Modbus RTU master. One engine serves any number of buses (ports) from
+* one thread, every bus polls its queue of requests (any number of
+* slaves) one after another: the next request goes out t3.5 after the
+* end of the previous response instead of after a guard timeout.
+*
+* Received chunks come with the time they were read (microseconds).
+* A response ends as soon as its length (known from the function code)
+* has arrived and the CRC-16 matches, without waiting for silence.
+* Responses of unknown functions end after t3.5 of silence, measured
+* from the timestamp of their last chunk. Silence inside a frame is the
+* gap between two chunks less the time the bytes of the later one took
+* on the line: above t3.5 the partial frame is dropped and a new one
+* starts, above t1.5 the frame is discarded as the standard says
+* (timingErrors). toleranceUS is added to both, chunk timestamps carry
+* the latency of the driver (USB adapters: about a millisecond).
+*
+* t1.5 and t3.5 are 1.5 and 3.5 character times of the line settings
+* given to AddBus (fixed 750/1750 us above 19200 baud), SetTiming
+* overrides them. Broadcasts (slave 0) complete when sent, the next
+* request waits broadcastDelayMS.
+*
+* A request is Init'ed with its slave, function and data, Init appends
+* the CRC, a request may be submitted again once completed. The status
+* values are those of SerialPortTransaction.h, an exception response
+* completes the request as well (GetException). A response with a wrong
+* CRC or from another slave is dropped, the request times out or is sent
+* again up to retries times. timeOutMS counts from the end of the
+* request on the line.
+*
+* onCompleted (optional) is called and pCompletedEvent (optional) is set
+* on the thread receiving the response or the engine thread, the request
+* must stay untouched until then. Wait sleeps on pCompletedEvent when
+* there is one, otherwise until the engine finishes the request. The
+* send handler is called with the engine locked, it must not call the
+* engine. OnDataReceived is called by the port (TSerialPort::SetModbusBus)
+* or by the owner of the bus, it must not be called any more when
+* RemoveBus is.
+*/
+
+#define SERIALPORT_MODBUS_MAX_FRAME          256
+#define SERIALPORT_MODBUS_BROADCAST          0
+#define SERIALPORT_MODBUS_DEFAULT_TOLERANCE  1000   //microseconds
+#define SERIALPORT_MODBUS_BROADCAST_DELAY    100    //milliseconds
+#define SERIALPORT_MODBUS_TICK               20     //microseconds per timer tick
+
+#define SERIALPORT_MODBUS_READ_COILS          1
+#define SERIALPORT_MODBUS_READ_INPUTS         2
+#define SERIALPORT_MODBUS_READ_HOLDING        3
+#define SERIALPORT_MODBUS_READ_INPUT_REGS     4
+#define SERIALPORT_MODBUS_WRITE_COIL          5
+#define SERIALPORT_MODBUS_WRITE_REGISTER      6
+#define SERIALPORT_MODBUS_WRITE_COILS         15
+#define SERIALPORT_MODBUS_WRITE_REGISTERS     16
+
+typedef struct TSerialPortModbus        TSerialPortModbus;
+typedef struct TSerialPortModbusBus     TSerialPortModbusBus;
+typedef struct TSerialPortModbusRequest TSerialPortModbusRequest;
+
+typedef void (*SERIALPORT_MODBUS_HANDLER)(TSerialPortModbusRequest* pRequest);
+
+struct TSerialPortModbusRequest
+{
+    unsigned char             request[SERIALPORT_MODBUS_MAX_FRAME];    //slave, function, data, CRC
+    int                       requestLength;
+    unsigned char             response[SERIALPORT_MODBUS_MAX_FRAME];   //whole frame, CRC included
+    int                       responseLength;
+    int                       timeOutMS;
+    int                       retries;
+    SERIALPORT_MODBUS_HANDLER onCompleted;
+    SERIALPORT_EVENT*         pCompletedEvent;
+    void*                     pContext;
+
+    volatile int              status;
+    int                       attempts;
+    SERIALPORT_TIMESTAMP      sendTime;
+    SERIALPORT_TIMESTAMP      completeTime;     //for a response, when its last chunk was read
+    TSerialPortModbusRequest* pNext;
+    TSerialPortModbus*        pModbus;          //engine of the bus it was submitted to
+};
+
+typedef struct
+{
+    unsigned long long requests;        //frames sent, retries included
+    unsigned long long responses;
+    unsigned long long exceptions;
+    unsigned long long timeouts;
+    unsigned long long retries;
+    unsigned long long crcErrors;
+    unsigned long long timingErrors;    //t1.5 exceeded inside a frame
+    unsigned long long discardedBytes;  //not part of a valid response
+    unsigned long long responseTime;    //microseconds from the end of the request to the response, summed
+} TSerialPortModbusStatistics;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void    SerialPortModbus_InitRequest(TSerialPortModbusRequest* pRequest, int slave, int function,
+                                     const unsigned char* pData, int dataLength, int timeOutMS);
+void    SerialPortModbus_InitRead(TSerialPortModbusRequest* pRequest, int slave, int function, int address, int count, int timeOutMS);
+void    SerialPortModbus_InitWriteRegister(TSerialPortModbusRequest* pRequest, int slave, int address, int value, int timeOutMS);
+void    SerialPortModbus_InitWriteRegisters(TSerialPortModbusRequest* pRequest, int slave, int address,
+                                            const unsigned short* pValues, int count, int timeOutMS);
+int     SerialPortModbus_GetRegisters(const TSerialPortModbusRequest* pRequest, unsigned short* pValues, int maxCount);
+int     SerialPortModbus_GetException(const TSerialPortModbusRequest* pRequest);
+int     SerialPortModbus_Wait(TSerialPortModbusRequest* pRequest, int timeOutMS);
+
+TSerialPortModbus* SerialPortModbus_Create(void);
+void    SerialPortModbus_Delete(TSerialPortModbus* pModbus);
+TSerialPortModbusBus* SerialPortModbus_AddBus(TSerialPortModbus* pModbus, const TSerialPortSettings* pSettings);
+void    SerialPortModbus_RemoveBus(TSerialPortModbusBus* pBus);
+void    SerialPortModbus_SetSendHandler(TSerialPortModbusBus* pBus, SERIALPORT_SEND_HANDLER sendHandler, void* pContext);
+void    SerialPortModbus_SetTiming(TSerialPortModbusBus* pBus, int t15US, int t35US, int toleranceUS, int broadcastDelayMS);
+BOOL    SerialPortModbus_Submit(TSerialPortModbusBus* pBus, TSerialPortModbusRequest* pRequest);
+BOOL    SerialPortModbus_Cancel(TSerialPortModbusBus* pBus, TSerialPortModbusRequest* pRequest);
+void    SerialPortModbus_OnDataReceived(TSerialPortModbusBus* pBus, const unsigned char* pData, int dataLength, SERIALPORT_TIMESTAMP receiveTime);
+int     SerialPortModbus_GetQueuedCount(TSerialPortModbusBus* pBus);
+void    SerialPortModbus_GetStatistics(TSerialPortModbusBus* pBus, TSerialPortModbusStatistics* pStatistics);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
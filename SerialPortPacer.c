@@ -0,0 +1,294 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include "SerialPortPacer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#else
+#include <errno.h>
+#include <time.h>
+#endif
+
+#if defined(__linux__)
+#define SERIALPORT_PACER_TIMERFD
+#include <poll.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+#endif
+
+#define SERIALPORT_PACER_SLEEP_US 2000  //microseconds, shorter waits do not watch Wake (without timerfd)
+
+struct TSerialPortPacer
+{
+    SERIALPORT_PACER_HANDLER onSend;
+    void*                    pContext;
+    SERIALPORT_EVENT         wakeEvent;
+    SERIALPORT_THREAD        thread;
+    volatile unsigned int    stopping;
+#if defined(SERIALPORT_PACER_TIMERFD)
+    int                      timerHandle;
+#elif defined(_WIN32)
+    HANDLE                   timerHandle;
+#endif
+};
+
+#if defined(SERIALPORT_PACER_TIMERFD)
+
+static BOOL SerialPortPacer__CreateTimer(TSerialPortPacer* pPacer)
+{
+    pPacer->timerHandle = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return (pPacer->timerHandle>=0);
+}
+
+static void SerialPortPacer__DeleteTimer(TSerialPortPacer* pPacer)
+{
+    close(pPacer->timerHandle);
+}
+
+static void SerialPortPacer__SetThreadTimer(void)
+{
+    //default slack of 50 us would be added to every gap
+    prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+}
+
+static void SerialPortPacer__WaitUntil(TSerialPortPacer* pPacer, SERIALPORT_TIMESTAMP releaseTime)
+{
+    struct itimerspec timerValue;
+    struct pollfd     pollHandles[2];
+    unsigned long long expirations;
+
+    //SerialPortIO_GetTime is CLOCK_MONOTONIC as well
+    memset(&timerValue, 0, sizeof(timerValue));
+    timerValue.it_value.tv_sec  = (time_t)(releaseTime / 1000000);
+    timerValue.it_value.tv_nsec = (long)(releaseTime % 1000000) * 1000;
+    if (timerfd_settime(pPacer->timerHandle, TFD_TIMER_ABSTIME, &timerValue, NULL)!=0)
+    {
+        return;
+    }
+    pollHandles[0].fd      = pPacer->timerHandle;
+    pollHandles[0].events  = POLLIN;
+    pollHandles[0].revents = 0;
+    pollHandles[1].fd      = pPacer->wakeEvent.readHandle;
+    pollHandles[1].events  = POLLIN;
+    pollHandles[1].revents = 0;
+    if (poll(pollHandles, 2, -1)>0)
+    {
+        if (pollHandles[0].revents & POLLIN)
+        {
+            while((read(pPacer->timerHandle, &expirations, sizeof(expirations))<0) && (errno==EINTR));
+        }
+        if (pollHandles[1].revents & POLLIN)
+        {
+            //the caller looks at the queue again anyway
+            SerialPortIO_WaitEvent(&pPacer->wakeEvent, 0);
+        }
+    }
+}
+
+#elif defined(_WIN32)
+
+static BOOL SerialPortPacer__CreateTimer(TSerialPortPacer* pPacer)
+{
+    //high resolution timers exist since Windows 10 1803
+    pPacer->timerHandle = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (pPacer->timerHandle==NULL)
+    {
+        pPacer->timerHandle = CreateWaitableTimer(NULL, FALSE, NULL);
+    }
+    return (pPacer->timerHandle!=NULL);
+}
+
+static void SerialPortPacer__DeleteTimer(TSerialPortPacer* pPacer)
+{
+    CloseHandle(pPacer->timerHandle);
+}
+
+static void SerialPortPacer__SetThreadTimer(void)
+{
+}
+
+static void SerialPortPacer__WaitUntil(TSerialPortPacer* pPacer, SERIALPORT_TIMESTAMP releaseTime)
+{
+    SERIALPORT_TIMESTAMP currentTime = SerialPortIO_GetTime();
+    LARGE_INTEGER        dueTime;
+    HANDLE               handles[2];
+
+    if (releaseTime<=currentTime)
+    {
+        return;
+    }
+    //negative due time is relative, in 100 ns units
+    dueTime.QuadPart = -(LONGLONG)(releaseTime - currentTime) * 10;
+    if (!SetWaitableTimer(pPacer->timerHandle, &dueTime, 0, NULL, NULL, FALSE))
+    {
+        return;
+    }
+    handles[0] = pPacer->timerHandle;
+    handles[1] = pPacer->wakeEvent;
+    if (WaitForMultipleObjects(2, handles, FALSE, INFINITE)!=WAIT_OBJECT_0)
+    {
+        CancelWaitableTimer(pPacer->timerHandle);
+    }
+}
+
+#else
+
+static BOOL SerialPortPacer__CreateTimer(TSerialPortPacer* pPacer)
+{
+    (void)pPacer;
+    return TRUE;
+}
+
+static void SerialPortPacer__DeleteTimer(TSerialPortPacer* pPacer)
+{
+    (void)pPacer;
+}
+
+static void SerialPortPacer__SetThreadTimer(void)
+{
+}
+
+static void SerialPortPacer__WaitUntil(TSerialPortPacer* pPacer, SERIALPORT_TIMESTAMP releaseTime)
+{
+    SERIALPORT_TIMESTAMP currentTime = SerialPortIO_GetTime();
+    struct timespec      sleepTime;
+
+    if (releaseTime>currentTime+SERIALPORT_PACER_SLEEP_US)
+    {
+        //long waits can be interrupted, the event has millisecond resolution
+        if (SerialPortIO_WaitEvent(&pPacer->wakeEvent, (int)((releaseTime - currentTime - SERIALPORT_PACER_SLEEP_US/2) / 1000)))
+        {
+            return;
+        }
+    }
+#ifdef TIMER_ABSTIME
+    sleepTime.tv_sec  = (time_t)(releaseTime / 1000000);
+    sleepTime.tv_nsec = (long)(releaseTime % 1000000) * 1000;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sleepTime, NULL)==EINTR);
+#else
+    currentTime = SerialPortIO_GetTime();
+    if (releaseTime>currentTime)
+    {
+        sleepTime.tv_sec  = (time_t)((releaseTime - currentTime) / 1000000);
+        sleepTime.tv_nsec = (long)((releaseTime - currentTime) % 1000000) * 1000;
+        while((nanosleep(&sleepTime, &sleepTime)!=0) && (errno==EINTR));
+    }
+#endif
+}
+
+#endif
+
+static void SerialPortPacer__Thread(void* lpParam)
+{
+    TSerialPortPacer*    pPacer = (TSerialPortPacer*)lpParam;
+    SERIALPORT_TIMESTAMP releaseTime;
+
+    SerialPortPacer__SetThreadTimer();
+    while(!SERIALPORT_ATOMIC_LOAD(&pPacer->stopping))
+    {
+        releaseTime = pPacer->onSend(pPacer->pContext);
+        if (releaseTime==0)
+        {
+            SerialPortIO_WaitEvent(&pPacer->wakeEvent, SERIALPORT_INFINITE);
+        } else if (releaseTime>SerialPortIO_GetTime())
+        {
+            SerialPortPacer__WaitUntil(pPacer, releaseTime);
+        }
+    }
+}
+
+TSerialPortPacer* SerialPortPacer_Create(SERIALPORT_PACER_HANDLER onSend, void* pContext)
+{
+    TSerialPortPacer* pPacer;
+
+    if (onSend==NULL)
+    {
+        return NULL;
+    }
+    pPacer = (TSerialPortPacer*)malloc(sizeof(TSerialPortPacer));
+    if (pPacer==NULL)
+    {
+        return NULL;
+    }
+    memset(pPacer, 0, sizeof(TSerialPortPacer));
+    pPacer->onSend   = onSend;
+    pPacer->pContext = pContext;
+    if (!SerialPortIO_CreateEvent(&pPacer->wakeEvent))
+    {
+        free(pPacer);
+        return NULL;
+    }
+    if (!SerialPortPacer__CreateTimer(pPacer))
+    {
+        SerialPortIO_DeleteEvent(&pPacer->wakeEvent);
+        free(pPacer);
+        return NULL;
+    }
+    if (!SerialPortIO_StartThread(&pPacer->thread, SerialPortPacer__Thread, pPacer))
+    {
+        SerialPortPacer__DeleteTimer(pPacer);
+        SerialPortIO_DeleteEvent(&pPacer->wakeEvent);
+        free(pPacer);
+        return NULL;
+    }
+    return pPacer;
+}
+
+void SerialPortPacer_Delete(TSerialPortPacer* pPacer)
+{
+    if (pPacer==NULL)
+    {
+        return;
+    }
+    SERIALPORT_ATOMIC_STORE(&pPacer->stopping, 1);
+    SerialPortIO_SetEvent(&pPacer->wakeEvent);
+    SerialPortIO_JoinThread(&pPacer->thread);
+    SerialPortPacer__DeleteTimer(pPacer);
+    SerialPortIO_DeleteEvent(&pPacer->wakeEvent);
+    free(pPacer);
+}
+
+void SerialPortPacer_Wake(TSerialPortPacer* pPacer)
+{
+    if (pPacer)
+    {
+        SerialPortIO_SetEvent(&pPacer->wakeEvent);
+    }
+}
+
+void SerialPortPacer_SetTimeCritical(TSerialPortPacer* pPacer, BOOL timeCritical)
+{
+#ifdef _WIN32
+    if (pPacer)
+    {
+        SetThreadPriority(pPacer->thread, timeCritical ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_NORMAL);
+    }
+#else
+    (void)pPacer;
+    (void)timeCritical;
+#endif
+}
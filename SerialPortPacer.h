@@ -0,0 +1,57 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef SERIALPORTPACER___H
+#define SERIALPORTPACER___H
+
+#include "SerialPortIO.h"
+
+/*
+* Runs paced writes on a thread of their own, so neither the caller of
+* QueueWrite nor the thread receiving data waits for gaps. onSend
+* writes what is due and returns when the next bytes are due (0 when
+* nothing waits), the thread sleeps until then or until Wake.
+*
+* Sleeps use a high resolution timer: a timerfd polled together with
+* the wake event and 1 ns timer slack on Linux, clock_nanosleep with an
+* absolute deadline on other POSIX systems (longer waits on the wake
+* event first), a high resolution waitable timer on Windows.
+*
+* SetTimeCritical raises the thread to time critical priority on
+* Windows, where the scheduler would otherwise delay short gaps. POSIX
+* threads keep their priority.
+*
+* Delete waits for onSend in progress, it must not be called from it.
+*/
+
+typedef struct TSerialPortPacer TSerialPortPacer;
+
+typedef SERIALPORT_TIMESTAMP (*SERIALPORT_PACER_HANDLER)(void* pContext);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+TSerialPortPacer* SerialPortPacer_Create(SERIALPORT_PACER_HANDLER onSend, void* pContext);
+void    SerialPortPacer_Delete(TSerialPortPacer* pPacer);
+void    SerialPortPacer_Wake(TSerialPortPacer* pPacer);
+void    SerialPortPacer_SetTimeCritical(TSerialPortPacer* pPacer, BOOL timeCritical);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
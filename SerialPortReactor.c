@@ -0,0 +1,667 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef _WIN32
+#define _DEFAULT_SOURCE
+#endif
+
+#include "SerialPortReactor.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#define SERIALPORT_REACTOR_EPOLL
+#include <sys/epoll.h>
+#include <unistd.h>
+#elif !defined(_WIN32)
+#include <poll.h>
+#endif
+
+#define SERIALPORT_REACTOR_MAX_EVENTS 64
+
+#ifdef _WIN32
+#define SERIALPORT_REACTOR_MAX_PORTS  (MAXIMUM_WAIT_OBJECTS-1)
+#else
+#define SERIALPORT_REACTOR_MAX_PORTS  0x7FFFFFFF
+#endif
+
+typedef struct TSerialPortReactorLoop TSerialPortReactorLoop;
+
+struct TSerialPortReactorEntry
+{
+    TSerialPortReactorLoop*          pLoop;
+    SERIALPORT_NATIVE_HANDLE         portHandle;     //what the loop waits on
+    SERIALPORT_REACTOR_HANDLER       onDataReceived;
+    SERIALPORT_REACTOR_WRITE_HANDLER onWriteReady;
+    void*                            pContext;
+    BOOL                             detached;          //not watched any more (device error or removed)
+    BOOL                             removed;
+    BOOL                             watchWritable;     //write handler waits until the device accepts more data
+    volatile unsigned int            writeRequested;
+#ifdef _WIN32
+    OVERLAPPED                       overlapped;
+    DWORD                            eventMask;
+    BOOL                             waitPending;
+    BOOL                             deviceError;
+#endif
+    struct TSerialPortReactorEntry*  pNext;
+};
+
+struct TSerialPortReactorLoop
+{
+    SERIALPORT_THREAD        thread;
+    BOOL                     threadStarted;
+    SERIALPORT_LOCK          dispatchLock;      //held while handlers run or the entry list changes
+    SERIALPORT_EVENT         wakeEvent;
+    volatile unsigned int    running;
+    volatile unsigned int    writeRequested;    //some entry has writeRequested set
+    TSerialPortReactorEntry* pEntries;
+    TSerialPortReactorEntry* pRemoved;          //freed by the I/O thread once the current batch is done
+    int                      portCount;
+#ifdef SERIALPORT_REACTOR_EPOLL
+    int                      epollHandle;
+#endif
+};
+
+struct TSerialPortReactor
+{
+    int                     loopCount;
+    TSerialPortReactorLoop  loops[SERIALPORT_REACTOR_MAX_THREADS];
+};
+
+static void SerialPortReactor__WatchWritable(TSerialPortReactorLoop* pLoop, TSerialPortReactorEntry* pEntry, BOOL watchWritable);
+static void SerialPortReactor__DispatchWrite(TSerialPortReactorLoop* pLoop, TSerialPortReactorEntry* pEntry);
+
+static void SerialPortReactor__FreeRemoved(TSerialPortReactorLoop* pLoop)
+{
+    TSerialPortReactorEntry* pEntry;
+    while(pLoop->pRemoved)
+    {
+        pEntry = pLoop->pRemoved;
+        pLoop->pRemoved = pEntry->pNext;
+#ifdef _WIN32
+        if (pEntry->overlapped.hEvent)
+        {
+            CloseHandle(pEntry->overlapped.hEvent);
+        }
+#endif
+        free(pEntry);
+    }
+}
+
+static void SerialPortReactor__Detach(TSerialPortReactorLoop* pLoop, TSerialPortReactorEntry* pEntry)
+{
+    TSerialPortReactorEntry** ppEntry = &pLoop->pEntries;
+
+    if (pEntry->detached)
+    {
+        return;
+    }
+    while(*ppEntry)
+    {
+        if (*ppEntry==pEntry)
+        {
+            *ppEntry = pEntry->pNext;
+            break;
+        }
+        ppEntry = &(*ppEntry)->pNext;
+    }
+    pEntry->pNext = NULL;
+
+#ifdef SERIALPORT_REACTOR_EPOLL
+    epoll_ctl(pLoop->epollHandle, EPOLL_CTL_DEL, pEntry->portHandle, NULL);
+#endif
+#ifdef _WIN32
+    if (pEntry->waitPending)
+    {
+        DWORD bytesTransferred;
+        CancelIoEx(pEntry->portHandle, &pEntry->overlapped);
+        GetOverlappedResult(pEntry->portHandle, &pEntry->overlapped, &bytesTransferred, TRUE);
+        pEntry->waitPending = FALSE;
+    }
+#endif
+    pEntry->detached = TRUE;
+    pLoop->portCount--;
+}
+
+static void SerialPortReactor__Dispatch(TSerialPortReactorLoop* pLoop, TSerialPortReactorEntry* pEntry, BOOL deviceError)
+{
+    if (pEntry->detached)
+    {
+        return;
+    }
+    //level triggered, a hung up device would be reported forever
+    if ((!pEntry->onDataReceived(pEntry->pContext, deviceError)) || deviceError)
+    {
+        SerialPortReactor__Detach(pLoop, pEntry);
+    } else if (pEntry->watchWritable)
+    {
+        //virtual wires have no writable state, they report room as readable
+        SerialPortReactor__DispatchWrite(pLoop, pEntry);
+    }
+}
+
+static void SerialPortReactor__DispatchWrite(TSerialPortReactorLoop* pLoop, TSerialPortReactorEntry* pEntry)
+{
+    BOOL writeComplete;
+
+    if ((pEntry->detached) || (pEntry->onWriteReady==NULL))
+    {
+        return;
+    }
+    writeComplete = pEntry->onWriteReady(pEntry->pContext);
+    if ((!pEntry->detached) && (writeComplete==pEntry->watchWritable))
+    {
+        SerialPortReactor__WatchWritable(pLoop, pEntry, !writeComplete);
+    }
+}
+
+static void SerialPortReactor__DispatchWriteRequests(TSerialPortReactorLoop* pLoop)
+{
+    TSerialPortReactorEntry* pEntry;
+    TSerialPortReactorEntry* pNext;
+
+    if (!SERIALPORT_ATOMIC_EXCHANGE(&pLoop->writeRequested, 0))
+    {
+        return;
+    }
+    for(pEntry = pLoop->pEntries; pEntry; pEntry = pNext)
+    {
+        pNext = pEntry->pNext;
+        if (SERIALPORT_ATOMIC_EXCHANGE(&pEntry->writeRequested, 0))
+        {
+            SerialPortReactor__DispatchWrite(pLoop, pEntry);
+        }
+    }
+}
+
+#if defined(SERIALPORT_REACTOR_EPOLL)
+
+static void SerialPortReactor__Run(void* lpParam)
+{
+    TSerialPortReactorLoop*  pLoop = (TSerialPortReactorLoop*)lpParam;
+    struct epoll_event       events[SERIALPORT_REACTOR_MAX_EVENTS];
+    TSerialPortReactorEntry* pEntry;
+    int                      eventCount, i;
+
+    while(SERIALPORT_ATOMIC_LOAD(&pLoop->running))
+    {
+        eventCount = epoll_wait(pLoop->epollHandle, events, SERIALPORT_REACTOR_MAX_EVENTS, -1);
+
+        SerialPortIO_Lock(&pLoop->dispatchLock);
+        for(i = 0; i<eventCount; i++)
+        {
+            pEntry = (TSerialPortReactorEntry*)events[i].data.ptr;
+            if (pEntry==NULL)
+            {
+                SerialPortIO_ResetEvent(&pLoop->wakeEvent);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            {
+                SerialPortReactor__Dispatch(pLoop, pEntry,
+                                            (events[i].events & EPOLLERR) || ((events[i].events & EPOLLHUP) && !(events[i].events & EPOLLIN)));
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                SerialPortReactor__DispatchWrite(pLoop, pEntry);
+            }
+        }
+        SerialPortReactor__DispatchWriteRequests(pLoop);
+        SerialPortReactor__FreeRemoved(pLoop);
+        SerialPortIO_Unlock(&pLoop->dispatchLock);
+    }
+}
+
+static BOOL SerialPortReactor__InitLoop(TSerialPortReactorLoop* pLoop)
+{
+    struct epoll_event event;
+
+    pLoop->epollHandle = epoll_create1(EPOLL_CLOEXEC);
+    if (pLoop->epollHandle<0)
+    {
+        return FALSE;
+    }
+    memset(&event, 0, sizeof(event));
+    event.events   = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(pLoop->epollHandle, EPOLL_CTL_ADD, pLoop->wakeEvent.readHandle, &event)!=0)
+    {
+        close(pLoop->epollHandle);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void SerialPortReactor__DeleteLoop(TSerialPortReactorLoop* pLoop)
+{
+    close(pLoop->epollHandle);
+}
+
+static BOOL SerialPortReactor__Register(TSerialPortReactorLoop* pLoop, TSerialPortReactorEntry* pEntry)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events   = EPOLLIN;
+    event.data.ptr = pEntry;
+    return epoll_ctl(pLoop->epollHandle, EPOLL_CTL_ADD, pEntry->portHandle, &event)==0;
+}
+
+static void SerialPortReactor__WatchWritable(TSerialPortReactorLoop* pLoop, TSerialPortReactorEntry* pEntry, BOOL watchWritable)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events   = watchWritable ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    event.data.ptr = pEntry;
+    epoll_ctl(pLoop->epollHandle, EPOLL_CTL_MOD, pEntry->portHandle, &event);
+    pEntry->watchWritable = watchWritable;
+}
+
+#elif !defined(_WIN32)
+
+static void SerialPortReactor__Run(void* lpParam)
+{
+    TSerialPortReactorLoop*   pLoop = (TSerialPortReactorLoop*)lpParam;
+    struct pollfd*            pPollHandles = NULL;
+    TSerialPortReactorEntry** ppEntries = NULL;
+    TSerialPortReactorEntry*  pEntry;
+    short                     revents;
+    int                       capacity = 0, count, i;
+
+    while(SERIALPORT_ATOMIC_LOAD(&pLoop->running))
+    {
+        //wait set is rebuilt from the entry list, Add/Remove wake the loop up
+        SerialPortIO_Lock(&pLoop->dispatchLock);
+        if (capacity<pLoop->portCount+1)
+        {
+            capacity = pLoop->portCount+16;
+            pPollHandles = (struct pollfd*)realloc(pPollHandles, capacity*sizeof(struct pollfd));
+            ppEntries = (TSerialPortReactorEntry**)realloc(ppEntries, capacity*sizeof(TSerialPortReactorEntry*));
+        }
+        pPollHandles[0].fd     = pLoop->wakeEvent.readHandle;
+        pPollHandles[0].events = POLLIN;
+        count = 1;
+        for(pEntry = pLoop->pEntries; pEntry; pEntry = pEntry->pNext)
+        {
+            pPollHandles[count].fd     = pEntry->portHandle;
+            pPollHandles[count].events = pEntry->watchWritable ? (POLLIN | POLLOUT) : POLLIN;
+            ppEntries[count] = pEntry;
+            count++;
+        }
+        SerialPortIO_Unlock(&pLoop->dispatchLock);
+
+        if (poll(pPollHandles, count, -1)<=0)
+        {
+            continue;
+        }
+
+        SerialPortIO_Lock(&pLoop->dispatchLock);
+        if (pPollHandles[0].revents)
+        {
+            SerialPortIO_ResetEvent(&pLoop->wakeEvent);
+        }
+        for(i = 1; i<count; i++)
+        {
+            revents = pPollHandles[i].revents;
+            if (revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL))
+            {
+                SerialPortReactor__Dispatch(pLoop, ppEntries[i],
+                                            (revents & (POLLERR | POLLNVAL)) || ((revents & POLLHUP) && !(revents & POLLIN)));
+            }
+            if (revents & POLLOUT)
+            {
+                SerialPortReactor__DispatchWrite(pLoop, ppEntries[i]);
+            }
+        }
+        SerialPortReactor__DispatchWriteRequests(pLoop);
+        SerialPortReactor__FreeRemoved(pLoop);
+        SerialPortIO_Unlock(&pLoop->dispatchLock);
+    }
+    free(pPollHandles);
+    free(ppEntries);
+}
+
+static BOOL SerialPortReactor__InitLoop(TSerialPortReactorLoop* pLoop)
+{
+    (void)pLoop;
+    return TRUE;
+}
+
+static void SerialPortReactor__DeleteLoop(TSerialPortReactorLoop* pLoop)
+{
+    (void)pLoop;
+}
+
+static BOOL SerialPortReactor__Register(TSerialPortReactorLoop* pLoop, TSerialPortReactorEntry* pEntry)
+{
+    (void)pEntry;
+    SerialPortIO_SetEvent(&pLoop->wakeEvent);
+    return TRUE;
+}
+
+static void SerialPortReactor__WatchWritable(TSerialPortReactorLoop* pLoop, TSerialPortReactorEntry* pEntry, BOOL watchWritable)
+{
+    //takes effect when the wait set is rebuilt
+    (void)pLoop;
+    pEntry->watchWritable = watchWritable;
+}
+
+#else
+
+static void SerialPortReactor__Arm(TSerialPortReactorEntry* pEntry)
+{
+    COMSTAT portStatus;
+    DWORD   portErrors;
+
+    if (pEntry->waitPending)
+    {
+        return;
+    }
+    ResetEvent(pEntry->overlapped.hEvent);
+    if (!ClearCommError(pEntry->portHandle, &portErrors, &portStatus))
+    {
+        pEntry->deviceError = TRUE;
+        SetEvent(pEntry->overlapped.hEvent);
+        return;
+    }
+    if (portStatus.cbInQue)
+    {
+        //EV_RXCHAR is not reported for bytes received before WaitCommEvent
+        SetEvent(pEntry->overlapped.hEvent);
+        return;
+    }
+    if (WaitCommEvent(pEntry->portHandle, &pEntry->eventMask, &pEntry->overlapped))
+    {
+        //completed immediately, event stays signaled
+        SetEvent(pEntry->overlapped.hEvent);
+    } else if (GetLastError()==ERROR_IO_PENDING) {
+        pEntry->waitPending = TRUE;
+    } else {
+        pEntry->deviceError = TRUE;
+        SetEvent(pEntry->overlapped.hEvent);
+    }
+}
+
+static void SerialPortReactor__Run(void* lpParam)
+{
+    TSerialPortReactorLoop*  pLoop = (TSerialPortReactorLoop*)lpParam;
+    HANDLE                   waitHandles[MAXIMUM_WAIT_OBJECTS];
+    TSerialPortReactorEntry* ppEntries[MAXIMUM_WAIT_OBJECTS];
+    TSerialPortReactorEntry* pEntry;
+    DWORD                    count, waitResult, bytesTransferred;
+
+    while(SERIALPORT_ATOMIC_LOAD(&pLoop->running))
+    {
+        SerialPortIO_Lock(&pLoop->dispatchLock);
+        waitHandles[0] = pLoop->wakeEvent;
+        count = 1;
+        for(pEntry = pLoop->pEntries; pEntry; pEntry = pEntry->pNext)
+        {
+            SerialPortReactor__Arm(pEntry);
+            waitHandles[count] = pEntry->overlapped.hEvent;
+            ppEntries[count] = pEntry;
+            count++;
+        }
+        SerialPortIO_Unlock(&pLoop->dispatchLock);
+
+        waitResult = WaitForMultipleObjects(count, waitHandles, FALSE, INFINITE);
+
+        SerialPortIO_Lock(&pLoop->dispatchLock);
+        if ((waitResult>WAIT_OBJECT_0) && (waitResult<WAIT_OBJECT_0+count))
+        {
+            pEntry = ppEntries[waitResult-WAIT_OBJECT_0];
+            if (!pEntry->detached)
+            {
+                if (pEntry->waitPending)
+                {
+                    if (!GetOverlappedResult(pEntry->portHandle, &pEntry->overlapped, &bytesTransferred, TRUE))
+                    {
+                        pEntry->deviceError = TRUE;
+                    }
+                    pEntry->waitPending = FALSE;
+                }
+                ResetEvent(pEntry->overlapped.hEvent);
+                SerialPortReactor__Dispatch(pLoop, pEntry, pEntry->deviceError);
+            }
+        }
+        SerialPortReactor__DispatchWriteRequests(pLoop);
+        SerialPortReactor__FreeRemoved(pLoop);
+        SerialPortIO_Unlock(&pLoop->dispatchLock);
+    }
+}
+
+static BOOL SerialPortReactor__InitLoop(TSerialPortReactorLoop* pLoop)
+{
+    (void)pLoop;
+    return TRUE;
+}
+
+static void SerialPortReactor__DeleteLoop(TSerialPortReactorLoop* pLoop)
+{
+    (void)pLoop;
+}
+
+static BOOL SerialPortReactor__Register(TSerialPortReactorLoop* pLoop, TSerialPortReactorEntry* pEntry)
+{
+    pEntry->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (pEntry->overlapped.hEvent==NULL)
+    {
+        return FALSE;
+    }
+    SerialPortIO_SetEvent(&pLoop->wakeEvent);
+    return TRUE;
+}
+
+static void SerialPortReactor__WatchWritable(TSerialPortReactorLoop* pLoop, TSerialPortReactorEntry* pEntry, BOOL watchWritable)
+{
+    //write handlers complete their WriteFile on Windows, a retry is just requested again
+    pEntry->watchWritable = FALSE;
+    if (watchWritable)
+    {
+        SERIALPORT_ATOMIC_STORE(&pEntry->writeRequested, 1);
+        SERIALPORT_ATOMIC_STORE(&pLoop->writeRequested, 1);
+        SerialPortIO_SetEvent(&pLoop->wakeEvent);
+    }
+}
+
+#endif
+
+TSerialPortReactor* SerialPortReactor_Create(int threadCount)
+{
+    TSerialPortReactor*     pReactor;
+    TSerialPortReactorLoop* pLoop;
+    int                     i;
+
+    if (threadCount<=0) threadCount = 1;
+    if (threadCount>SERIALPORT_REACTOR_MAX_THREADS) threadCount = SERIALPORT_REACTOR_MAX_THREADS;
+
+    pReactor = (TSerialPortReactor*)malloc(sizeof(TSerialPortReactor));
+    if (pReactor==NULL)
+    {
+        return NULL;
+    }
+    memset(pReactor, 0, sizeof(TSerialPortReactor));
+
+    for(i = 0; i<threadCount; i++)
+    {
+        pLoop = &pReactor->loops[i];
+        SerialPortIO_InitLock(&pLoop->dispatchLock);
+        pLoop->running = 1;
+        if ((!SerialPortIO_CreateEvent(&pLoop->wakeEvent)) || (!SerialPortReactor__InitLoop(pLoop)))
+        {
+            SerialPortIO_DeleteEvent(&pLoop->wakeEvent);
+            SerialPortIO_DeleteLock(&pLoop->dispatchLock);
+            break;
+        }
+        pReactor->loopCount++;
+        pLoop->threadStarted = SerialPortIO_StartThread(&pLoop->thread, SerialPortReactor__Run, pLoop);
+        if (!pLoop->threadStarted)
+        {
+            break;
+        }
+    }
+    if ((pReactor->loopCount<threadCount) || (!pReactor->loops[pReactor->loopCount-1].threadStarted))
+    {
+        SerialPortReactor_Delete(pReactor);
+        return NULL;
+    }
+    return pReactor;
+}
+
+void SerialPortReactor_Delete(TSerialPortReactor* pReactor)
+{
+    TSerialPortReactorLoop*  pLoop;
+    TSerialPortReactorEntry* pEntry;
+    int                      i;
+
+    if (pReactor==NULL)
+    {
+        return;
+    }
+    for(i = 0; i<pReactor->loopCount; i++)
+    {
+        pLoop = &pReactor->loops[i];
+        SERIALPORT_ATOMIC_STORE(&pLoop->running, 0);
+        SerialPortIO_SetEvent(&pLoop->wakeEvent);
+        if (pLoop->threadStarted)
+        {
+            SerialPortIO_JoinThread(&pLoop->thread);
+        }
+        //ports still attached are dropped, they must not be used any more
+        while(pLoop->pEntries)
+        {
+            pEntry = pLoop->pEntries;
+            SerialPortReactor__Detach(pLoop, pEntry);
+            pEntry->pNext = pLoop->pRemoved;
+            pLoop->pRemoved = pEntry;
+        }
+        SerialPortReactor__FreeRemoved(pLoop);
+        SerialPortReactor__DeleteLoop(pLoop);
+        SerialPortIO_DeleteEvent(&pLoop->wakeEvent);
+        SerialPortIO_DeleteLock(&pLoop->dispatchLock);
+    }
+    free(pReactor);
+}
+
+TSerialPortReactorEntry* SerialPortReactor_Add(TSerialPortReactor* pReactor, SERIALPORT_HANDLE portHandle, 
+                                               SERIALPORT_REACTOR_HANDLER onDataReceived, 
+                                               SERIALPORT_REACTOR_WRITE_HANDLER onWriteReady, 
+                                               void* pContext)
+{
+    TSerialPortReactorLoop*  pLoop = NULL;
+    TSerialPortReactorEntry* pEntry;
+    int                      i;
+
+    if ((pReactor==NULL) || (portHandle==SERIALPORT_INVALID_HANDLE) || (onDataReceived==NULL))
+    {
+        return NULL;
+    }
+
+    //least loaded loop gets the port
+    for(i = 0; i<pReactor->loopCount; i++)
+    {
+        if ((pLoop==NULL) || (pReactor->loops[i].portCount<pLoop->portCount))
+        {
+            pLoop = &pReactor->loops[i];
+        }
+    }
+    if (pLoop->portCount>=SERIALPORT_REACTOR_MAX_PORTS)
+    {
+        return NULL;
+    }
+
+    pEntry = (TSerialPortReactorEntry*)malloc(sizeof(TSerialPortReactorEntry));
+    if (pEntry==NULL)
+    {
+        return NULL;
+    }
+    memset(pEntry, 0, sizeof(TSerialPortReactorEntry));
+    pEntry->pLoop          = pLoop;
+    pEntry->portHandle     = SerialPortIO_GetNativeHandle(portHandle);
+    pEntry->onDataReceived = onDataReceived;
+    pEntry->onWriteReady   = onWriteReady;
+    pEntry->pContext       = pContext;
+
+    SerialPortIO_Lock(&pLoop->dispatchLock);
+    pEntry->pNext = pLoop->pEntries;
+    pLoop->pEntries = pEntry;
+    pLoop->portCount++;
+    if (!SerialPortReactor__Register(pLoop, pEntry))
+    {
+        SerialPortReactor__Detach(pLoop, pEntry);
+        pEntry->pNext = pLoop->pRemoved;
+        pLoop->pRemoved = pEntry;
+        SerialPortReactor__FreeRemoved(pLoop);
+        SerialPortIO_Unlock(&pLoop->dispatchLock);
+        return NULL;
+    }
+    SerialPortIO_Unlock(&pLoop->dispatchLock);
+    return pEntry;
+}
+
+void SerialPortReactor_Remove(TSerialPortReactor* pReactor, TSerialPortReactorEntry* pEntry)
+{
+    TSerialPortReactorLoop* pLoop;
+
+    if ((pReactor==NULL) || (pEntry==NULL))
+    {
+        return;
+    }
+    pLoop = pEntry->pLoop;
+
+    //waits until the loop finishes the current batch of handlers
+    SerialPortIO_Lock(&pLoop->dispatchLock);
+    if (!pEntry->removed)
+    {
+        SerialPortReactor__Detach(pLoop, pEntry);
+        pEntry->removed = TRUE;
+        pEntry->pNext = pLoop->pRemoved;
+        pLoop->pRemoved = pEntry;
+        SerialPortIO_SetEvent(&pLoop->wakeEvent);
+    }
+    SerialPortIO_Unlock(&pLoop->dispatchLock);
+}
+
+void SerialPortReactor_RequestWrite(TSerialPortReactorEntry* pEntry)
+{
+    TSerialPortReactorLoop* pLoop = pEntry->pLoop;
+
+    //lock-free, the loop is woken up only if it does not know about a request yet
+    SERIALPORT_ATOMIC_STORE(&pEntry->writeRequested, 1);
+    if (!SERIALPORT_ATOMIC_EXCHANGE(&pLoop->writeRequested, 1))
+    {
+        SerialPortIO_SetEvent(&pLoop->wakeEvent);
+    }
+}
+
+int SerialPortReactor_GetPortCount(TSerialPortReactor* pReactor)
+{
+    int i, portCount = 0;
+    for(i = 0; i<pReactor->loopCount; i++)
+    {
+        SerialPortIO_Lock(&pReactor->loops[i].dispatchLock);
+        portCount += pReactor->loops[i].portCount;
+        SerialPortIO_Unlock(&pReactor->loops[i].dispatchLock);
+    }
+    return portCount;
+}
+
+int SerialPortReactor_GetThreadCount(TSerialPortReactor* pReactor)
+{
+    return pReactor->loopCount;
+}
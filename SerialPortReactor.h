@@ -0,0 +1,69 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef SERIALPORTREACTOR___H
+#define SERIALPORTREACTOR___H
+
+#include "SerialPortIO.h"
+
+/*
+* Reactor services any number of ports from a small fixed set of I/O
+* threads (epoll on Linux, poll on other POSIX systems, WaitCommEvent +
+* WaitForMultipleObjects on Windows, up to 63 ports per thread there).
+*
+* onDataReceived is called on the I/O thread whenever the port becomes
+* readable. deviceError is set when the device reports an error or a
+* hangup, the handler should still read what is left. Returning FALSE
+* (always done on deviceError) stops watching the port.
+*
+* onWriteReady (optional) is called on the I/O thread after
+* SerialPortReactor_RequestWrite. It returns FALSE when the device does
+* not accept more data, it is called again once the port is writable
+* or readable.
+*
+* After SerialPortReactor_Remove returns, no handler is running and
+* none will be called again. Ports have to be removed before the
+* reactor is deleted.
+*/
+
+#define SERIALPORT_REACTOR_MAX_THREADS 16
+
+typedef BOOL (*SERIALPORT_REACTOR_HANDLER)(void* pContext, BOOL deviceError);
+typedef BOOL (*SERIALPORT_REACTOR_WRITE_HANDLER)(void* pContext);
+
+typedef struct TSerialPortReactor      TSerialPortReactor;
+typedef struct TSerialPortReactorEntry TSerialPortReactorEntry;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+TSerialPortReactor* SerialPortReactor_Create(int threadCount);
+void    SerialPortReactor_Delete(TSerialPortReactor* pReactor);
+TSerialPortReactorEntry* SerialPortReactor_Add(TSerialPortReactor* pReactor, SERIALPORT_HANDLE portHandle, 
+                                               SERIALPORT_REACTOR_HANDLER onDataReceived, 
+                                               SERIALPORT_REACTOR_WRITE_HANDLER onWriteReady, 
+                                               void* pContext);
+void    SerialPortReactor_Remove(TSerialPortReactor* pReactor, TSerialPortReactorEntry* pEntry);
+void    SerialPortReactor_RequestWrite(TSerialPortReactorEntry* pEntry);
+int     SerialPortReactor_GetPortCount(TSerialPortReactor* pReactor);
+int     SerialPortReactor_GetThreadCount(TSerialPortReactor* pReactor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,178 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+
+#include "SerialPortReplay.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct TSerialPortReplay
+{
+    TSerialPortCaptureLog* pLog;
+    SERIALPORT_HANDLE      portHandle;
+    int                    direction;
+    double                 speed;
+    SERIALPORT_THREAD      thread;
+    BOOL                   threadStarted;
+    SERIALPORT_EVENT       stopEvent;
+    SERIALPORT_EVENT       finishedEvent;
+    volatile unsigned int  stopping;
+    volatile unsigned int  finished;
+    unsigned long long     bytesSent;
+    unsigned long long     recordsSent;
+};
+
+static void SerialPortReplay__Run(void* lpParam)
+{
+    TSerialPortReplay*              pReplay = (TSerialPortReplay*)lpParam;
+    const TSerialPortCaptureRecord* pRecord;
+    SERIALPORT_TIMESTAMP            startTime = SerialPortIO_GetTime();
+    SERIALPORT_TIMESTAMP            dueTime, now;
+    unsigned long long              firstTimestamp = 0;
+    BOOL                            firstRecord = TRUE;
+
+    SerialPortCaptureLog_Rewind(pReplay->pLog);
+    while(!SERIALPORT_ATOMIC_LOAD(&pReplay->stopping))
+    {
+        pRecord = SerialPortCaptureLog_Next(pReplay->pLog);
+        if (pRecord==NULL)
+        {
+            break;
+        }
+        if (pRecord->direction!=pReplay->direction)
+        {
+            continue;
+        }
+        if (pReplay->speed>0)
+        {
+            if (firstRecord)
+            {
+                firstTimestamp = pRecord->timestamp;
+                firstRecord = FALSE;
+            }
+            dueTime = startTime+(SERIALPORT_TIMESTAMP)((double)(pRecord->timestamp-firstTimestamp)/pReplay->speed);
+            now = SerialPortIO_GetTime();
+            if ((dueTime>now+1000) && SerialPortIO_WaitEvent(&pReplay->stopEvent, (int)((dueTime-now)/1000)))
+            {
+                break;
+            }
+        }
+        if (SerialPortIO_Write(pReplay->portHandle, SERIALPORT_CAPTURE_DATA(pRecord), (int)pRecord->dataLength)!=(int)pRecord->dataLength)
+        {
+            break;
+        }
+        SERIALPORT_ATOMIC_ADD64(&pReplay->bytesSent, pRecord->dataLength);
+        SERIALPORT_ATOMIC_ADD64(&pReplay->recordsSent, 1);
+    }
+    SERIALPORT_ATOMIC_STORE(&pReplay->finished, 1);
+    SerialPortIO_SetEvent(&pReplay->finishedEvent);
+}
+
+TSerialPortReplay* SerialPortReplay_Create(const char* fileName)
+{
+    TSerialPortReplay* pReplay = (TSerialPortReplay*)malloc(sizeof(TSerialPortReplay));
+    if (pReplay==NULL)
+    {
+        return NULL;
+    }
+    memset(pReplay, 0, sizeof(TSerialPortReplay));
+    pReplay->portHandle = SERIALPORT_INVALID_HANDLE;
+    pReplay->pLog = SerialPortCaptureLog_Open(fileName);
+    if (pReplay->pLog==NULL)
+    {
+        free(pReplay);
+        return NULL;
+    }
+    SerialPortIO_CreateEvent(&pReplay->stopEvent);
+    SerialPortIO_CreateEvent(&pReplay->finishedEvent);
+    return pReplay;
+}
+
+void SerialPortReplay_Delete(TSerialPortReplay* pReplay)
+{
+    if (pReplay==NULL) return;
+
+    SerialPortReplay_Stop(pReplay);
+    SerialPortIO_Close(pReplay->portHandle);
+    SerialPortCaptureLog_Close(pReplay->pLog);
+    SerialPortIO_DeleteEvent(&pReplay->stopEvent);
+    SerialPortIO_DeleteEvent(&pReplay->finishedEvent);
+    free(pReplay);
+}
+
+BOOL SerialPortReplay_Open(TSerialPortReplay* pReplay, const char* deviceName, int baudRate)
+{
+    if (pReplay->portHandle!=SERIALPORT_INVALID_HANDLE) return FALSE;
+
+    pReplay->portHandle = SerialPortIO_Open(deviceName, baudRate);
+    return (pReplay->portHandle!=SERIALPORT_INVALID_HANDLE);
+}
+
+BOOL SerialPortReplay_Start(TSerialPortReplay* pReplay, int direction, double speed)
+{
+    if (pReplay->portHandle==SERIALPORT_INVALID_HANDLE) return FALSE;
+    if (speed<0) return FALSE;
+
+    SerialPortReplay_Stop(pReplay);
+    pReplay->direction   = direction;
+    pReplay->speed       = speed;
+    pReplay->stopping    = 0;
+    pReplay->finished    = 0;
+    pReplay->bytesSent   = 0;
+    pReplay->recordsSent = 0;
+    SerialPortIO_ResetEvent(&pReplay->stopEvent);
+    SerialPortIO_ResetEvent(&pReplay->finishedEvent);
+    pReplay->threadStarted = SerialPortIO_StartThread(&pReplay->thread, SerialPortReplay__Run, pReplay);
+    return pReplay->threadStarted;
+}
+
+BOOL SerialPortReplay_Wait(TSerialPortReplay* pReplay, int timeOutMS)
+{
+    if (!pReplay->threadStarted) return TRUE;
+
+    if (!SERIALPORT_ATOMIC_LOAD(&pReplay->finished) && SerialPortIO_WaitEvent(&pReplay->finishedEvent, timeOutMS))
+    {
+        //for other waiters
+        SerialPortIO_SetEvent(&pReplay->finishedEvent);
+    }
+    return SERIALPORT_ATOMIC_LOAD(&pReplay->finished)!=0;
+}
+
+void SerialPortReplay_Stop(TSerialPortReplay* pReplay)
+{
+    if (pReplay->threadStarted)
+    {
+        SERIALPORT_ATOMIC_STORE(&pReplay->stopping, 1);
+        SerialPortIO_SetEvent(&pReplay->stopEvent);
+        SerialPortIO_JoinThread(&pReplay->thread);
+        pReplay->threadStarted = FALSE;
+    }
+}
+
+BOOL SerialPortReplay_GetPeerName(TSerialPortReplay* pReplay, char* deviceName, int maxLength)
+{
+    return SerialPortIO_GetPeerName(pReplay->portHandle, deviceName, maxLength);
+}
+
+unsigned long long SerialPortReplay_GetBytesSent(TSerialPortReplay* pReplay)
+{
+    return SERIALPORT_ATOMIC_LOAD64(&pReplay->bytesSent);
+}
+
+unsigned long long SerialPortReplay_GetRecordsSent(TSerialPortReplay* pReplay)
+{
+    return SERIALPORT_ATOMIC_LOAD64(&pReplay->recordsSent);
+}
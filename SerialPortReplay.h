@@ -0,0 +1,65 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+
+#ifndef SERIALPORTREPLAY___H
+#define SERIALPORTREPLAY___H
+
+#include "SerialPortIO.h"
+#include "SerialPortCapture.h"
+
+/*
+* Plays a capture log back into a transport, so parsers can be tested
+* against recorded traffic. Open opens deviceName (usually "pty:" or
+* "virtual:NAME"), the code under test opens the other end returned by
+* GetPeerName. Start then writes the data of every record of the given
+* direction (SERIALPORT_CAPTURE_RX replays what the device sent) from a
+* thread of the replay. A finished replay can be started again.
+*
+* speed 1.0 keeps the recorded gaps between records, 10.0 makes them ten
+* times shorter, SERIALPORT_REPLAY_MAX_SPEED writes the records back to
+* back. Gaps are waited out with the resolution of the platform's timed
+* waits (1 ms); whatever the speed the transport paces the writes (the
+* baud rate of a virtual wire, a full pty buffer).
+*
+* Wait returns TRUE once the whole log has been written or the transport
+* failed, Stop ends the replay early. Delete stops it and closes the log
+* and the transport.
+*/
+
+#define SERIALPORT_REPLAY_MAX_SPEED 0.0
+
+typedef struct TSerialPortReplay TSerialPortReplay;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+TSerialPortReplay* SerialPortReplay_Create(const char* fileName);
+void    SerialPortReplay_Delete(TSerialPortReplay* pReplay);
+BOOL    SerialPortReplay_Open(TSerialPortReplay* pReplay, const char* deviceName, int baudRate);
+BOOL    SerialPortReplay_Start(TSerialPortReplay* pReplay, int direction, double speed);
+BOOL    SerialPortReplay_Wait(TSerialPortReplay* pReplay, int timeOutMS);
+void    SerialPortReplay_Stop(TSerialPortReplay* pReplay);
+BOOL    SerialPortReplay_GetPeerName(TSerialPortReplay* pReplay, char* deviceName, int maxLength);
+unsigned long long SerialPortReplay_GetBytesSent(TSerialPortReplay* pReplay);
+unsigned long long SerialPortReplay_GetRecordsSent(TSerialPortReplay* pReplay);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
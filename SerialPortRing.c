@@ -0,0 +1,195 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#include "SerialPortRing.h"
+#include <stdlib.h>
+#include <string.h>
+
+BOOL SerialPortRing_Create(TSerialPortRing* pRing, int capacity)
+{
+    unsigned int ringCapacity = 64;
+
+    if (capacity<=0) return FALSE;
+    if (capacity>0x40000000) return FALSE;
+
+    while(ringCapacity<(unsigned int)capacity)
+    {
+        ringCapacity <<= 1;
+    }
+    pRing->pBuffer  = (unsigned char*)malloc(ringCapacity);
+    pRing->capacity = (pRing->pBuffer!=NULL) ? ringCapacity : 0;
+    pRing->head     = 0;
+    pRing->tail     = 0;
+    return (pRing->pBuffer!=NULL);
+}
+
+void SerialPortRing_Delete(TSerialPortRing* pRing)
+{
+    if (pRing->pBuffer)
+    {
+        free(pRing->pBuffer);
+    }
+    pRing->pBuffer  = NULL;
+    pRing->capacity = 0;
+    pRing->head     = 0;
+    pRing->tail     = 0;
+}
+
+int SerialPortRing_GetCount(TSerialPortRing* pRing)
+{
+    unsigned int head = SERIALPORT_ATOMIC_LOAD_ACQUIRE(&pRing->head);
+    unsigned int tail = SERIALPORT_ATOMIC_LOAD_ACQUIRE(&pRing->tail);
+    return (int)(head - tail);
+}
+
+int SerialPortRing_GetFree(TSerialPortRing* pRing)
+{
+    return (int)pRing->capacity - SerialPortRing_GetCount(pRing);
+}
+
+int SerialPortRing_GetWriteBuffer(TSerialPortRing* pRing, unsigned char** ppData)
+{
+    unsigned int head = pRing->head;
+    unsigned int tail = SERIALPORT_ATOMIC_LOAD_ACQUIRE(&pRing->tail);
+    unsigned int offset = head & (pRing->capacity-1);
+    unsigned int freeLength = pRing->capacity - (head - tail);
+    unsigned int contiguousLength = pRing->capacity - offset;
+
+    *ppData = pRing->pBuffer + offset;
+    return (int)((freeLength<contiguousLength) ? freeLength : contiguousLength);
+}
+
+void SerialPortRing_CommitWrite(TSerialPortRing* pRing, int dataLength)
+{
+    SERIALPORT_ATOMIC_STORE_RELEASE(&pRing->head, pRing->head + (unsigned int)dataLength);
+}
+
+int SerialPortRing_Write(TSerialPortRing* pRing, const unsigned char* pData, int dataLength)
+{
+    unsigned char* pWrite;
+    int            writeLength;
+    int            bytesWritten = 0;
+
+    //at most two rounds, the second one continues from the beginning of the buffer
+    while(bytesWritten<dataLength)
+    {
+        writeLength = SerialPortRing_GetWriteBuffer(pRing, &pWrite);
+        if (writeLength==0) break;
+        if (writeLength>dataLength-bytesWritten)
+        {
+            writeLength = dataLength-bytesWritten;
+        }
+        memcpy(pWrite, pData+bytesWritten, writeLength);
+        SerialPortRing_CommitWrite(pRing, writeLength);
+        bytesWritten += writeLength;
+    }
+    return bytesWritten;
+}
+
+int SerialPortRing_GetReadBuffer(TSerialPortRing* pRing, const unsigned char** ppData)
+{
+    unsigned int head = SERIALPORT_ATOMIC_LOAD_ACQUIRE(&pRing->head);
+    unsigned int tail = pRing->tail;
+    unsigned int offset = tail & (pRing->capacity-1);
+    unsigned int dataLength = head - tail;
+    unsigned int contiguousLength = pRing->capacity - offset;
+
+    *ppData = pRing->pBuffer + offset;
+    return (int)((dataLength<contiguousLength) ? dataLength : contiguousLength);
+}
+
+void SerialPortRing_CommitRead(TSerialPortRing* pRing, int dataLength)
+{
+    SERIALPORT_ATOMIC_STORE_RELEASE(&pRing->tail, pRing->tail + (unsigned int)dataLength);
+}
+
+int SerialPortRing_Read(TSerialPortRing* pRing, unsigned char* pData, int dataLength)
+{
+    const unsigned char* pRead;
+    int                  readLength;
+    int                  bytesRead = 0;
+
+    while(bytesRead<dataLength)
+    {
+        readLength = SerialPortRing_GetReadBuffer(pRing, &pRead);
+        if (readLength==0) break;
+        if (readLength>dataLength-bytesRead)
+        {
+            readLength = dataLength-bytesRead;
+        }
+        memcpy(pData+bytesRead, pRead, readLength);
+        SerialPortRing_CommitRead(pRing, readLength);
+        bytesRead += readLength;
+    }
+    return bytesRead;
+}
+
+void SerialPortRing_Clear(TSerialPortRing* pRing)
+{
+    SERIALPORT_ATOMIC_STORE_RELEASE(&pRing->tail, SERIALPORT_ATOMIC_LOAD_ACQUIRE(&pRing->head));
+}
+
+static const unsigned char* SerialPortRing__FindDelimiter(const unsigned char* pData, int dataLength, const unsigned char* delimiters, int delimiterCount)
+{
+    const unsigned char* pFound = NULL;
+    const unsigned char* pDelimiter;
+    int                  i;
+
+    //memchr is vectorized by the C runtime, every next delimiter is searched only before the best match so far
+    for(i = 0; i<delimiterCount; i++)
+    {
+        pDelimiter = (const unsigned char*)memchr(pData, delimiters[i], dataLength);
+        if (pDelimiter)
+        {
+            pFound = pDelimiter;
+            dataLength = (int)(pDelimiter - pData);
+        }
+    }
+    return pFound;
+}
+
+int SerialPortRing_Find(TSerialPortRing* pRing, int offset, int dataLength, const unsigned char* delimiters, int delimiterCount)
+{
+    const unsigned char* pFound;
+    unsigned int tail = pRing->tail;
+    unsigned int start, firstLength;
+
+    if (offset>=dataLength)
+    {
+        return -1;
+    }
+    start = (tail + (unsigned int)offset) & (pRing->capacity-1);
+    firstLength = pRing->capacity - start;
+    if (firstLength>(unsigned int)(dataLength-offset))
+    {
+        firstLength = (unsigned int)(dataLength-offset);
+    }
+
+    pFound = SerialPortRing__FindDelimiter(pRing->pBuffer+start, (int)firstLength, delimiters, delimiterCount);
+    if (pFound)
+    {
+        return offset + (int)(pFound - (pRing->pBuffer+start));
+    }
+    if ((int)firstLength<dataLength-offset)
+    {
+        pFound = SerialPortRing__FindDelimiter(pRing->pBuffer, dataLength-offset-(int)firstLength, delimiters, delimiterCount);
+        if (pFound)
+        {
+            return offset + (int)firstLength + (int)(pFound - pRing->pBuffer);
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,71 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef SERIALPORTRING___H
+#define SERIALPORTRING___H
+
+#include "SerialPortIO.h"
+
+/*
+* Lock-free single-producer/single-consumer byte ring. The working
+* thread is the only producer, ReadBuffer/ReadLine callers are the
+* consumer. Capacity is rounded up to a power of two, head and tail
+* run freely and wrap around.
+*
+* GetWriteBuffer/CommitWrite and GetReadBuffer/CommitRead give direct
+* access to the contiguous part of the ring, so the device can read
+* straight into it.
+*
+* Find returns position (relative to the oldest byte) of the first byte
+* from delimiters found within <offset, dataLength), -1 if none.
+*/
+
+#define SERIALPORT_RECEIVE_BUFFER_SIZE 65536
+
+typedef struct
+{
+    unsigned char*        pBuffer;
+    unsigned int          capacity;
+    volatile unsigned int head;      //written by producer only
+    volatile unsigned int tail;      //written by consumer only
+} TSerialPortRing;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+BOOL    SerialPortRing_Create(TSerialPortRing* pRing, int capacity);
+void    SerialPortRing_Delete(TSerialPortRing* pRing);
+int     SerialPortRing_GetCount(TSerialPortRing* pRing);
+int     SerialPortRing_GetFree(TSerialPortRing* pRing);
+
+//producer side
+int     SerialPortRing_Write(TSerialPortRing* pRing, const unsigned char* pData, int dataLength);
+int     SerialPortRing_GetWriteBuffer(TSerialPortRing* pRing, unsigned char** ppData);
+void    SerialPortRing_CommitWrite(TSerialPortRing* pRing, int dataLength);
+
+//consumer side
+int     SerialPortRing_Read(TSerialPortRing* pRing, unsigned char* pData, int dataLength);
+int     SerialPortRing_GetReadBuffer(TSerialPortRing* pRing, const unsigned char** ppData);
+void    SerialPortRing_CommitRead(TSerialPortRing* pRing, int dataLength);
+void    SerialPortRing_Clear(TSerialPortRing* pRing);
+int     SerialPortRing_Find(TSerialPortRing* pRing, int offset, int dataLength, const unsigned char* delimiters, int delimiterCount);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,609 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#include "SerialPortSimulator.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SERIALPORT_SIMULATOR__TICK  20      //microseconds per timer tick
+
+typedef struct
+{
+    SERIALPORT_TIMESTAMP dueTime;
+    int                  length;
+    unsigned char        data[SERIALPORT_SIMULATOR_MAX_RESPONSE + SERIALPORT_CRC_MAX_SIZE];
+} TSerialPortSimulatorResponse;
+
+struct TSerialPortSimulatorDevice
+{
+    TSerialPortSimulator*              pSimulator;
+    TSerialPortSimulatorDevice*        pNext;
+    TSerialPortInstance*               pPort;
+    const TSerialPortSimulatorProfile* pProfile;
+    BOOL                               removed;
+
+    //receive thread only
+    unsigned int                       random;
+    unsigned char                      request[SERIALPORT_SIMULATOR_MAX_REQUEST];
+    int                                requestLength;
+
+    //simulator locked
+    TSerialPortSimulatorResponse       responses[SERIALPORT_SIMULATOR_MAX_PENDING];
+    int                                firstResponse;
+    int                                responseCount;
+    SERIALPORT_TIMESTAMP               lastDueTime;
+    TSerialPortTimer                   timer;
+    TSerialPortSimulatorStatistics     statistics;
+};
+
+struct TSerialPortSimulator
+{
+    SERIALPORT_LOCK                    lock;
+    TSerialPortTimerWheel              wheel;
+    SERIALPORT_TIMESTAMP               nextWakeTime;    //0 when the timer thread sleeps without a timeout
+    TSerialPortPacer*                  pPacer;
+    TSerialPortReactor*                pReactor;
+    TSerialPortSimulatorDevice*        pFirstDevice;
+    int                                deviceCount;
+};
+
+static unsigned int SerialPortSimulator__Random(TSerialPortSimulatorDevice* pDevice)
+{
+    //xorshift32
+    unsigned int x = pDevice->random;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pDevice->random = x;
+    return x;
+}
+
+static BOOL SerialPortSimulator__Roll(TSerialPortSimulatorDevice* pDevice, int perMillion)
+{
+    return (perMillion>0) && ((int)(SerialPortSimulator__Random(pDevice) % 1000000)<perMillion);
+}
+
+//runs the timer of the device for its oldest response, called locked
+static void SerialPortSimulator__Arm(TSerialPortSimulatorDevice* pDevice)
+{
+    TSerialPortSimulator* pSimulator = pDevice->pSimulator;
+    SERIALPORT_TIMESTAMP  deadline;
+
+    SerialPortTimerWheel_Remove(&pSimulator->wheel, &pDevice->timer);
+    if (pDevice->responseCount==0)
+    {
+        return;
+    }
+    deadline = pDevice->responses[pDevice->firstResponse].dueTime;
+    SerialPortTimerWheel_Add(&pSimulator->wheel, &pDevice->timer, deadline);
+    if ((pSimulator->nextWakeTime==0) || (deadline<pSimulator->nextWakeTime))
+    {
+        pSimulator->nextWakeTime = deadline;
+        SerialPortPacer_Wake(pSimulator->pPacer);
+    }
+}
+
+//sends the responses which are due, called locked
+static void SerialPortSimulator__SendDue(TSerialPortSimulatorDevice* pDevice, SERIALPORT_TIMESTAMP currentTime)
+{
+    TSerialPortSimulatorResponse* pResponse;
+
+    while(pDevice->responseCount>0)
+    {
+        pResponse = &pDevice->responses[pDevice->firstResponse];
+        if (pResponse->dueTime>currentTime)
+        {
+            break;
+        }
+        if (SerialPortInstance_QueueWrite(pDevice->pPort, pResponse->data, pResponse->length, FALSE)>0)
+        {
+            pDevice->statistics.responses++;
+            pDevice->statistics.bytesSent += pResponse->length;
+        }
+        SerialPortStatistics_AddLatency(pDevice->statistics.lateness, currentTime - pResponse->dueTime);
+        pDevice->firstResponse = (pDevice->firstResponse + 1) % SERIALPORT_SIMULATOR_MAX_PENDING;
+        pDevice->responseCount--;
+    }
+}
+
+static SERIALPORT_TIMESTAMP SerialPortSimulator__Service(void* pContext)
+{
+    TSerialPortSimulator*       pSimulator = (TSerialPortSimulator*)pContext;
+    TSerialPortSimulatorDevice* pDevice;
+    TSerialPortTimer*           pTimer;
+    TSerialPortTimer*           pNext;
+    SERIALPORT_TIMESTAMP        currentTime, nextTime;
+
+    SerialPortIO_Lock(&pSimulator->lock);
+    currentTime = SerialPortIO_GetTime();
+    pTimer = SerialPortTimerWheel_Advance(&pSimulator->wheel, currentTime);
+    while(pTimer)
+    {
+        pNext = pTimer->pNext;
+        pDevice = (TSerialPortSimulatorDevice*)((char*)pTimer - offsetof(TSerialPortSimulatorDevice, timer));
+        SerialPortSimulator__SendDue(pDevice, currentTime);
+        SerialPortSimulator__Arm(pDevice);
+        pTimer = pNext;
+    }
+    nextTime = SerialPortTimerWheel_GetNextTime(&pSimulator->wheel);
+    pSimulator->nextWakeTime = nextTime;
+    SerialPortIO_Unlock(&pSimulator->lock);
+    return nextTime;
+}
+
+static const TSerialPortSimulatorRule* SerialPortSimulator__FindRule(const TSerialPortSimulatorProfile* pProfile, const unsigned char* pRequest, int requestLength)
+{
+    const TSerialPortSimulatorRule* pRule;
+    int                             i, j;
+
+    for(i = 0; i<pProfile->ruleCount; i++)
+    {
+        pRule = &pProfile->rules[i];
+        if (pRule->matchLength>requestLength)
+        {
+            continue;
+        }
+        for(j = 0; j<pRule->matchLength; j++)
+        {
+            if ((pRule->match[j]!=SERIALPORT_SIMULATOR_ANY) && (pRule->match[j]!=pRequest[j]))
+            {
+                break;
+            }
+        }
+        if (j==pRule->matchLength)
+        {
+            return pRule;
+        }
+    }
+    return NULL;
+}
+
+//answers one complete request, called on the receive thread
+static void SerialPortSimulator__OnRequest(TSerialPortSimulatorDevice* pDevice, SERIALPORT_TIMESTAMP receiveTime)
+{
+    const TSerialPortSimulatorProfile* pProfile = pDevice->pProfile;
+    const TSerialPortSimulatorRule*    pRule;
+    TSerialPortSimulatorResponse*      pResponse;
+    TSerialPortSimulatorResponse       response;
+    SERIALPORT_TIMESTAMP               dueTime;
+    BOOL                               dropped, corrupted = FALSE, truncated = FALSE;
+    int                                latencyUS, index, i;
+
+    pRule   = SerialPortSimulator__FindRule(pProfile, pDevice->request, pDevice->requestLength);
+    dropped = (pRule!=NULL) && SerialPortSimulator__Roll(pDevice, pProfile->dropPerMillion);
+    if ((pRule!=NULL) && !dropped && (pRule->responseLength>0))
+    {
+        for(i = 0; i<pRule->responseLength; i++)
+        {
+            if (pRule->response[i]>=SERIALPORT_SIMULATOR_COPY(0))
+            {
+                index = pRule->response[i] - SERIALPORT_SIMULATOR_COPY(0);
+                response.data[i] = (index<pDevice->requestLength) ? pDevice->request[index] : 0;
+            } else {
+                response.data[i] = (unsigned char)pRule->response[i];
+            }
+        }
+        response.length = pRule->responseLength;
+        if (pRule->crcType!=SERIALPORT_CRC_NONE)
+        {
+            response.length += SerialPortCrc_Append(pRule->crcType, SerialPortCrc_Compute(pRule->crcType, response.data, response.length),
+                                                    response.data + response.length);
+        }
+        if (SerialPortSimulator__Roll(pDevice, pProfile->corruptPerMillion))
+        {
+            response.data[SerialPortSimulator__Random(pDevice) % response.length] ^= (unsigned char)(1 << (SerialPortSimulator__Random(pDevice) % 8));
+            corrupted = TRUE;
+        }
+        if ((response.length>1) && SerialPortSimulator__Roll(pDevice, pProfile->truncatePerMillion))
+        {
+            response.length = 1 + SerialPortSimulator__Random(pDevice) % (response.length - 1);
+            truncated = TRUE;
+        }
+
+        latencyUS = (pRule->latencyUS>=0) ? pRule->latencyUS : pProfile->latencyUS;
+        dueTime   = receiveTime + latencyUS;
+        if (pProfile->jitterUS>0)
+        {
+            dueTime += SerialPortSimulator__Random(pDevice) % (unsigned int)(pProfile->jitterUS + 1);
+        }
+    } else {
+        response.length = 0;
+        dueTime = 0;
+    }
+
+    SerialPortIO_Lock(&pDevice->pSimulator->lock);
+    pDevice->statistics.requests++;
+    if (pRule==NULL)
+    {
+        pDevice->statistics.unmatched++;
+    }
+    if (dropped)   pDevice->statistics.dropped++;
+    if (corrupted) pDevice->statistics.corrupted++;
+    if (truncated) pDevice->statistics.truncated++;
+    if ((response.length>0) && !pDevice->removed)
+    {
+        //responses keep their order and, at a limited rate, take their time on the line one after another
+        if (dueTime<pDevice->lastDueTime)
+        {
+            dueTime = pDevice->lastDueTime;
+        }
+        if (pProfile->bytesPerSecond>0)
+        {
+            dueTime += (SERIALPORT_TIMESTAMP)response.length*1000000 / (unsigned int)pProfile->bytesPerSecond;
+        }
+        if (pDevice->responseCount==SERIALPORT_SIMULATOR_MAX_PENDING)
+        {
+            pDevice->statistics.overflows++;
+        } else {
+            pDevice->lastDueTime = dueTime;
+            pResponse = &pDevice->responses[(pDevice->firstResponse + pDevice->responseCount) % SERIALPORT_SIMULATOR_MAX_PENDING];
+            pResponse->dueTime = dueTime;
+            pResponse->length  = response.length;
+            memcpy(pResponse->data, response.data, response.length);
+            pDevice->responseCount++;
+
+            //responses due already do not wait for the timer thread
+            SerialPortSimulator__SendDue(pDevice, SerialPortIO_GetTime());
+            if (pDevice->responseCount==1)
+            {
+                SerialPortSimulator__Arm(pDevice);
+            }
+        }
+    }
+    SerialPortIO_Unlock(&pDevice->pSimulator->lock);
+}
+
+static void SerialPortSimulator__OnDataReceived(TSerialPortInstance* pPort, const unsigned char* pData, int dataLength)
+{
+    TSerialPortSimulatorDevice*        pDevice = (TSerialPortSimulatorDevice*)SerialPortInstance_GetUserData(pPort);
+    const TSerialPortSimulatorProfile* pProfile = pDevice->pProfile;
+    SERIALPORT_TIMESTAMP               receiveTime = SerialPortIO_GetTime();
+    int                                i;
+
+    SerialPortIO_Lock(&pDevice->pSimulator->lock);
+    pDevice->statistics.bytesReceived += dataLength;
+    SerialPortIO_Unlock(&pDevice->pSimulator->lock);
+
+    for(i = 0; i<dataLength; i++)
+    {
+        if ((pDevice->requestLength==0) && (pProfile->magic>=0) && (pData[i]!=pProfile->magic))
+        {
+            continue;
+        }
+        pDevice->request[pDevice->requestLength++] = pData[i];
+        if (((pProfile->frameLength>0) && (pDevice->requestLength>=pProfile->frameLength)) ||
+            ((pProfile->frameLength<=0) && (pProfile->delimiter>=0) && (pData[i]==pProfile->delimiter)) ||
+            (pDevice->requestLength==SERIALPORT_SIMULATOR_MAX_REQUEST))
+        {
+            SerialPortSimulator__OnRequest(pDevice, receiveTime);
+            pDevice->requestLength = 0;
+        }
+    }
+    if ((pProfile->frameLength<=0) && (pProfile->delimiter<0) && (pDevice->requestLength>0))
+    {
+        SerialPortSimulator__OnRequest(pDevice, receiveTime);
+        pDevice->requestLength = 0;
+    }
+}
+
+//copies the next whitespace separated token, returns NULL at the end of the line
+static const char* SerialPortSimulator__NextToken(const char* line, char* token, int maxLength)
+{
+    int length = 0;
+
+    while((*line==' ') || (*line=='\t') || (*line=='\r') || (*line=='\n'))
+    {
+        line++;
+    }
+    if ((*line==0) || (*line=='#'))
+    {
+        return NULL;
+    }
+    while((*line!=0) && (*line!=' ') && (*line!='\t') && (*line!='\r') && (*line!='\n'))
+    {
+        if (length<maxLength-1)
+        {
+            token[length++] = *line;
+        }
+        line++;
+    }
+    token[length] = 0;
+    return line;
+}
+
+static BOOL SerialPortSimulator__ParseNumber(const char* text, int base, int* pValue)
+{
+    char* pEnd;
+    long  value = strtol(text, &pEnd, base);
+
+    if ((pEnd==text) || (*pEnd!=0) || (value<0))
+    {
+        return FALSE;
+    }
+    *pValue = (int)value;
+    return TRUE;
+}
+
+static BOOL SerialPortSimulator__ParseRule(TSerialPortSimulatorRule* pRule, const char* line)
+{
+    char token[32];
+    BOOL response = FALSE;
+    int  value;
+
+    memset(pRule, 0, sizeof(TSerialPortSimulatorRule));
+    pRule->latencyUS = -1;
+    while((line = SerialPortSimulator__NextToken(line, token, sizeof(token)))!=NULL)
+    {
+        if (strcmp(token, "->")==0)
+        {
+            if (response) return FALSE;
+            response = TRUE;
+        } else if (!response) {
+            if (pRule->matchLength==SERIALPORT_SIMULATOR_MAX_MATCH)
+            {
+                return FALSE;
+            }
+            if (strcmp(token, "??")==0)
+            {
+                pRule->match[pRule->matchLength++] = SERIALPORT_SIMULATOR_ANY;
+            } else if (SerialPortSimulator__ParseNumber(token, 16, &value) && (value<=0xFF)) {
+                pRule->match[pRule->matchLength++] = (short)value;
+            } else {
+                return FALSE;
+            }
+        } else if (strncmp(token, "crc=", 4)==0) {
+            if      (strcmp(token+4, "modbus")==0) pRule->crcType = SERIALPORT_CRC16_MODBUS;
+            else if (strcmp(token+4, "ccitt")==0)  pRule->crcType = SERIALPORT_CRC16_CCITT;
+            else if (strcmp(token+4, "crc32")==0)  pRule->crcType = SERIALPORT_CRC32;
+            else return FALSE;
+        } else if (strncmp(token, "latency=", 8)==0) {
+            if (!SerialPortSimulator__ParseNumber(token+8, 10, &pRule->latencyUS)) return FALSE;
+        } else {
+            if (pRule->responseLength==SERIALPORT_SIMULATOR_MAX_RESPONSE)
+            {
+                return FALSE;
+            }
+            if ((token[0]=='$') && SerialPortSimulator__ParseNumber(token+1, 10, &value) && (value<SERIALPORT_SIMULATOR_MAX_REQUEST)) {
+                pRule->response[pRule->responseLength++] = (short)SERIALPORT_SIMULATOR_COPY(value);
+            } else if (SerialPortSimulator__ParseNumber(token, 16, &value) && (value<=0xFF)) {
+                pRule->response[pRule->responseLength++] = (short)value;
+            } else {
+                return FALSE;
+            }
+        }
+    }
+    return response;
+}
+
+void SerialPortSimulator_InitProfile(TSerialPortSimulatorProfile* pProfile)
+{
+    memset(pProfile, 0, sizeof(TSerialPortSimulatorProfile));
+    pProfile->magic     = -1;
+    pProfile->delimiter = -1;
+    pProfile->seed      = 1;
+}
+
+BOOL SerialPortSimulator_ParseLine(TSerialPortSimulatorProfile* pProfile, const char* line)
+{
+    char  keyword[16], token[32];
+    int   value;
+    int*  pValue = NULL;
+
+    line = SerialPortSimulator__NextToken(line, keyword, sizeof(keyword));
+    if (line==NULL)
+    {
+        return TRUE;    //empty line or comment
+    }
+    if (strcmp(keyword, "rule")==0)
+    {
+        if ((pProfile->ruleCount==SERIALPORT_SIMULATOR_MAX_RULES) ||
+            !SerialPortSimulator__ParseRule(&pProfile->rules[pProfile->ruleCount], line))
+        {
+            return FALSE;
+        }
+        pProfile->ruleCount++;
+        return TRUE;
+    }
+    if (strcmp(keyword, "frame")==0)
+    {
+        pProfile->magic       = -1;
+        pProfile->frameLength = 0;
+        pProfile->delimiter   = -1;
+        while((line = SerialPortSimulator__NextToken(line, token, sizeof(token)))!=NULL)
+        {
+            if ((strncmp(token, "magic=", 6)==0) && SerialPortSimulator__ParseNumber(token+6, 16, &value) && (value<=0xFF)) {
+                pProfile->magic = value;
+            } else if ((strncmp(token, "delimiter=", 10)==0) && SerialPortSimulator__ParseNumber(token+10, 16, &value) && (value<=0xFF)) {
+                pProfile->delimiter = value;
+            } else if ((strncmp(token, "length=", 7)==0) && SerialPortSimulator__ParseNumber(token+7, 10, &value) &&
+                       (value<=SERIALPORT_SIMULATOR_MAX_REQUEST)) {
+                pProfile->frameLength = value;
+            } else if (strcmp(token, "chunk")!=0) {
+                return FALSE;
+            }
+        }
+        return TRUE;
+    }
+
+    if      (strcmp(keyword, "latency")==0)  pValue = &pProfile->latencyUS;
+    else if (strcmp(keyword, "jitter")==0)   pValue = &pProfile->jitterUS;
+    else if (strcmp(keyword, "rate")==0)     pValue = &pProfile->bytesPerSecond;
+    else if (strcmp(keyword, "drop")==0)     pValue = &pProfile->dropPerMillion;
+    else if (strcmp(keyword, "corrupt")==0)  pValue = &pProfile->corruptPerMillion;
+    else if (strcmp(keyword, "truncate")==0) pValue = &pProfile->truncatePerMillion;
+    else if (strcmp(keyword, "seed")==0)     pValue = (int*)&pProfile->seed;
+    if ((pValue==NULL) || (SerialPortSimulator__NextToken(line, token, sizeof(token))==NULL) ||
+        !SerialPortSimulator__ParseNumber(token, 10, &value))
+    {
+        return FALSE;
+    }
+    *pValue = value;
+    return TRUE;
+}
+
+BOOL SerialPortSimulator_LoadProfile(TSerialPortSimulatorProfile* pProfile, const char* fileName, int* pErrorLine)
+{
+    FILE* pFile;
+    char  line[1024];
+    int   lineNumber = 0;
+    BOOL  result = TRUE;
+
+    if (pErrorLine) *pErrorLine = 0;
+    pFile = fopen(fileName, "r");
+    if (pFile==NULL)
+    {
+        return FALSE;
+    }
+    while(result && (fgets(line, sizeof(line), pFile)!=NULL))
+    {
+        lineNumber++;
+        result = SerialPortSimulator_ParseLine(pProfile, line);
+    }
+    fclose(pFile);
+    if (!result && pErrorLine)
+    {
+        *pErrorLine = lineNumber;
+    }
+    return result;
+}
+
+TSerialPortSimulator* SerialPortSimulator_Create(int threadCount)
+{
+    TSerialPortSimulator* pSimulator;
+
+    pSimulator = (TSerialPortSimulator*)calloc(1, sizeof(TSerialPortSimulator));
+    if (pSimulator==NULL)
+    {
+        return NULL;
+    }
+    SerialPortTimerWheel_Init(&pSimulator->wheel, SERIALPORT_SIMULATOR__TICK);
+    SerialPortIO_InitLock(&pSimulator->lock);
+
+    pSimulator->pReactor = SerialPortReactor_Create(threadCount);
+    pSimulator->pPacer   = SerialPortPacer_Create(SerialPortSimulator__Service, pSimulator);
+    if ((pSimulator->pReactor==NULL) || (pSimulator->pPacer==NULL))
+    {
+        SerialPortPacer_Delete(pSimulator->pPacer);
+        SerialPortReactor_Delete(pSimulator->pReactor);
+        SerialPortIO_DeleteLock(&pSimulator->lock);
+        free(pSimulator);
+        return NULL;
+    }
+    return pSimulator;
+}
+
+void SerialPortSimulator_Delete(TSerialPortSimulator* pSimulator)
+{
+    if (pSimulator==NULL)
+    {
+        return;
+    }
+    while(pSimulator->pFirstDevice)
+    {
+        SerialPortSimulator_RemoveDevice(pSimulator->pFirstDevice);
+    }
+    SerialPortPacer_Delete(pSimulator->pPacer);
+    SerialPortReactor_Delete(pSimulator->pReactor);
+    SerialPortIO_DeleteLock(&pSimulator->lock);
+    free(pSimulator);
+}
+
+TSerialPortSimulatorDevice* SerialPortSimulator_AddDevice(TSerialPortSimulator* pSimulator, const char* deviceName, int baudRate,
+                                                          const TSerialPortSimulatorProfile* pProfile)
+{
+    TSerialPortSimulatorDevice* pDevice;
+
+    pDevice = (TSerialPortSimulatorDevice*)calloc(1, sizeof(TSerialPortSimulatorDevice));
+    if (pDevice==NULL)
+    {
+        return NULL;
+    }
+    pDevice->pPort = SerialPortInstance_Create();
+    if (pDevice->pPort==NULL)
+    {
+        free(pDevice);
+        return NULL;
+    }
+    pDevice->pSimulator = pSimulator;
+    pDevice->pProfile   = pProfile;
+
+    SerialPortIO_Lock(&pSimulator->lock);
+    //every device gets its own sequence, xorshift must not start at 0
+    pDevice->random = (pProfile->seed ^ ((unsigned int)pSimulator->deviceCount * 0x9E3779B9u)) | 1;
+    pDevice->pNext = pSimulator->pFirstDevice;
+    pSimulator->pFirstDevice = pDevice;
+    pSimulator->deviceCount++;
+    SerialPortIO_Unlock(&pSimulator->lock);
+
+    SerialPortInstance_SetUserData(pDevice->pPort, pDevice);
+    SerialPortInstance_SetReactor(pDevice->pPort, pSimulator->pReactor);
+    if (!SerialPortInstance_OpenDeviceAsync(pDevice->pPort, deviceName, baudRate, SerialPortSimulator__OnDataReceived, NULL, SERIALPORT_INTERNAL_TIMEOUT))
+    {
+        SerialPortSimulator_RemoveDevice(pDevice);
+        return NULL;
+    }
+    return pDevice;
+}
+
+void SerialPortSimulator_RemoveDevice(TSerialPortSimulatorDevice* pDevice)
+{
+    TSerialPortSimulator*        pSimulator = pDevice->pSimulator;
+    TSerialPortSimulatorDevice** ppDevice;
+
+    //the timer thread must not send any more, a request being received does not queue its response
+    SerialPortIO_Lock(&pSimulator->lock);
+    for(ppDevice = &pSimulator->pFirstDevice; *ppDevice!=NULL; ppDevice = &(*ppDevice)->pNext)
+    {
+        if (*ppDevice==pDevice)
+        {
+            *ppDevice = pDevice->pNext;
+            pSimulator->deviceCount--;
+            break;
+        }
+    }
+    SerialPortTimerWheel_Remove(&pSimulator->wheel, &pDevice->timer);
+    pDevice->removed = TRUE;
+    pDevice->responseCount = 0;
+    SerialPortIO_Unlock(&pSimulator->lock);
+
+    SerialPortInstance_Delete(pDevice->pPort);
+    free(pDevice);
+}
+
+BOOL SerialPortSimulator_GetPeerName(TSerialPortSimulatorDevice* pDevice, char* deviceName, int maxLength)
+{
+    return SerialPortInstance_GetPeerName(pDevice->pPort, deviceName, maxLength);
+}
+
+void SerialPortSimulator_GetStatistics(TSerialPortSimulatorDevice* pDevice, TSerialPortSimulatorStatistics* pStatistics)
+{
+    SerialPortIO_Lock(&pDevice->pSimulator->lock);
+    *pStatistics = pDevice->statistics;
+    SerialPortIO_Unlock(&pDevice->pSimulator->lock);
+}
+
+int SerialPortSimulator_GetDeviceCount(TSerialPortSimulator* pSimulator)
+{
+    int count;
+
+    SerialPortIO_Lock(&pSimulator->lock);
+    count = pSimulator->deviceCount;
+    SerialPortIO_Unlock(&pSimulator->lock);
+    return count;
+}
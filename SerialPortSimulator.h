@@ -0,0 +1,142 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef SERIALPORTSIMULATOR___H
+#define SERIALPORTSIMULATOR___H
+
+#include "SerialPort.h"
+#include "SerialPortPacer.h"
+
+/*
+* Simulated devices for soak and load tests, built on the C API (needs
+* SerialPort.c). Every device opens a port ("pty:" on POSIX, the client
+* opens GetPeerName, or "virtual:NAME"), splits what it receives into
+* requests and answers by the first matching rule of its profile.
+* Hundreds of devices share the threads of one simulator: a reactor
+* receives for all of them, one thread with a microsecond timer sends
+* the delayed responses.
+*
+* Requests are frames of frameLength bytes starting with magic, or end
+* with delimiter, or (both -1/0) every received chunk is one request.
+* Bytes before magic are skipped.
+*
+* A rule matches the first matchLength bytes of a request
+* (SERIALPORT_SIMULATOR_ANY matches any byte). Its response is made of
+* literal bytes and SERIALPORT_SIMULATOR_COPY(i), the i-th request
+* byte, crcType appends a checksum (SerialPortCrc.h). A response is sent
+* latencyUS plus a uniform random 0..jitterUS after its request was
+* received, with bytesPerSecond it also takes its length at that rate
+* and responses do not overlap. Responses keep the order of requests.
+*
+* Errors are injected per million requests: dropped (no response),
+* corrupted (one bit flipped) and truncated (cut at a random length).
+* Each device has its own random sequence from the profile seed, so runs
+* repeat.
+*
+* Profiles are filled by code or by a script, one setting per line
+* (numbers decimal, bytes hex, # starts a comment):
+*
+*   frame magic=38 length=4         (or: frame delimiter=0A, frame chunk)
+*   latency 2000                    microseconds
+*   jitter 500
+*   rate 960                        bytes per second, 0 for no limit
+*   drop 1000                       per million
+*   corrupt 100
+*   truncate 100
+*   seed 1
+*   rule 38 01 ?? ?? -> 38 81 $2 $3
+*   rule 01 03 -> 01 03 02 00 2A crc=modbus latency=5000
+*   rule -> 38 FF 00 00             (no pattern, matches every request)
+*
+* The profile must outlive the devices using it. Statistics are per
+* device, lateness counts how late responses were sent after they were
+* due (power of two buckets, SerialPortStatistics.h).
+*/
+
+#define SERIALPORT_SIMULATOR_MAX_MATCH      32
+#define SERIALPORT_SIMULATOR_MAX_RESPONSE   256
+#define SERIALPORT_SIMULATOR_MAX_RULES      32
+#define SERIALPORT_SIMULATOR_MAX_REQUEST    256
+#define SERIALPORT_SIMULATOR_MAX_PENDING    16      //responses waiting per device
+
+#define SERIALPORT_SIMULATOR_ANY            (-1)
+#define SERIALPORT_SIMULATOR_COPY(i)        (0x100 + (i))
+
+typedef struct
+{
+    short match[SERIALPORT_SIMULATOR_MAX_MATCH];
+    int   matchLength;
+    short response[SERIALPORT_SIMULATOR_MAX_RESPONSE];
+    int   responseLength;       //0 answers nothing
+    int   crcType;
+    int   latencyUS;            //-1 takes the one of the profile
+} TSerialPortSimulatorRule;
+
+typedef struct
+{
+    int   magic;                //-1 for none
+    int   frameLength;          //0 when requests end with delimiter or with the chunk
+    int   delimiter;            //-1 for none
+    int   latencyUS;
+    int   jitterUS;
+    int   bytesPerSecond;
+    int   dropPerMillion;
+    int   corruptPerMillion;
+    int   truncatePerMillion;
+    unsigned int seed;
+    TSerialPortSimulatorRule rules[SERIALPORT_SIMULATOR_MAX_RULES];
+    int   ruleCount;
+} TSerialPortSimulatorProfile;
+
+typedef struct
+{
+    unsigned long long requests;
+    unsigned long long responses;
+    unsigned long long unmatched;       //requests no rule matched
+    unsigned long long dropped;
+    unsigned long long corrupted;
+    unsigned long long truncated;
+    unsigned long long overflows;       //responses lost, MAX_PENDING were waiting
+    unsigned long long bytesReceived;
+    unsigned long long bytesSent;
+    unsigned int       lateness[SERIALPORT_HISTOGRAM_BUCKETS];
+} TSerialPortSimulatorStatistics;
+
+typedef struct TSerialPortSimulator       TSerialPortSimulator;
+typedef struct TSerialPortSimulatorDevice TSerialPortSimulatorDevice;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void    SerialPortSimulator_InitProfile(TSerialPortSimulatorProfile* pProfile);
+BOOL    SerialPortSimulator_ParseLine(TSerialPortSimulatorProfile* pProfile, const char* line);
+BOOL    SerialPortSimulator_LoadProfile(TSerialPortSimulatorProfile* pProfile, const char* fileName, int* pErrorLine);
+
+TSerialPortSimulator* SerialPortSimulator_Create(int threadCount);
+void    SerialPortSimulator_Delete(TSerialPortSimulator* pSimulator);
+TSerialPortSimulatorDevice* SerialPortSimulator_AddDevice(TSerialPortSimulator* pSimulator, const char* deviceName, int baudRate,
+                                                          const TSerialPortSimulatorProfile* pProfile);
+void    SerialPortSimulator_RemoveDevice(TSerialPortSimulatorDevice* pDevice);
+BOOL    SerialPortSimulator_GetPeerName(TSerialPortSimulatorDevice* pDevice, char* deviceName, int maxLength);
+void    SerialPortSimulator_GetStatistics(TSerialPortSimulatorDevice* pDevice, TSerialPortSimulatorStatistics* pStatistics);
+int     SerialPortSimulator_GetDeviceCount(TSerialPortSimulator* pSimulator);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,127 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#include "SerialPortStatistics.h"
+#include <string.h>
+
+void SerialPortStatistics_Reset(TSerialPortStatistics* pStatistics)
+{
+    memset(pStatistics, 0, sizeof(TSerialPortStatistics));
+}
+
+void SerialPortStatistics_GetSnapshot(TSerialPortStatistics* pStatistics, TSerialPortStatistics* pSnapshot)
+{
+    int i;
+
+    pSnapshot->bytesReceived       = SERIALPORT_ATOMIC_LOAD64(&pStatistics->bytesReceived);
+    pSnapshot->bytesSent           = SERIALPORT_ATOMIC_LOAD64(&pStatistics->bytesSent);
+    pSnapshot->readCalls           = SERIALPORT_ATOMIC_LOAD64(&pStatistics->readCalls);
+    pSnapshot->emptyReads          = SERIALPORT_ATOMIC_LOAD64(&pStatistics->emptyReads);
+    pSnapshot->writeCalls          = SERIALPORT_ATOMIC_LOAD64(&pStatistics->writeCalls);
+    pSnapshot->wakeups             = SERIALPORT_ATOMIC_LOAD64(&pStatistics->wakeups);
+    pSnapshot->droppedBytes        = SERIALPORT_ATOMIC_LOAD64(&pStatistics->droppedBytes);
+    pSnapshot->callbackCount       = SERIALPORT_ATOMIC_LOAD64(&pStatistics->callbackCount);
+    pSnapshot->callbackTime        = SERIALPORT_ATOMIC_LOAD64(&pStatistics->callbackTime);
+    pSnapshot->callbackTimeMax     = SERIALPORT_ATOMIC_LOAD(&pStatistics->callbackTimeMax);
+    pSnapshot->receiveHighWater    = SERIALPORT_ATOMIC_LOAD(&pStatistics->receiveHighWater);
+    pSnapshot->writeQueueDepth     = SERIALPORT_ATOMIC_LOAD(&pStatistics->writeQueueDepth);
+    pSnapshot->writeQueueHighWater = SERIALPORT_ATOMIC_LOAD(&pStatistics->writeQueueHighWater);
+    for(i = 0; i<SERIALPORT_HISTOGRAM_BUCKETS; i++)
+    {
+        pSnapshot->readLatency[i]   = SERIALPORT_ATOMIC_LOAD(&pStatistics->readLatency[i]);
+        pSnapshot->writeLatency[i]  = SERIALPORT_ATOMIC_LOAD(&pStatistics->writeLatency[i]);
+        pSnapshot->pacingLatency[i] = SERIALPORT_ATOMIC_LOAD(&pStatistics->pacingLatency[i]);
+    }
+}
+
+void SerialPortStatistics_AddRead(TSerialPortStatistics* pStatistics, int bytesRead)
+{
+    SERIALPORT_ATOMIC_ADD64(&pStatistics->readCalls, 1);
+    if (bytesRead>0)
+    {
+        SERIALPORT_ATOMIC_ADD64(&pStatistics->bytesReceived, (unsigned long long)bytesRead);
+    } else {
+        SERIALPORT_ATOMIC_ADD64(&pStatistics->emptyReads, 1);
+    }
+}
+
+void SerialPortStatistics_AddWrite(TSerialPortStatistics* pStatistics, int bytesWritten, SERIALPORT_TIMESTAMP duration)
+{
+    SERIALPORT_ATOMIC_ADD64(&pStatistics->writeCalls, 1);
+    if (bytesWritten>0)
+    {
+        SERIALPORT_ATOMIC_ADD64(&pStatistics->bytesSent, (unsigned long long)bytesWritten);
+    }
+    SerialPortStatistics_AddLatency(pStatistics->writeLatency, duration);
+}
+
+void SerialPortStatistics_AddCallback(TSerialPortStatistics* pStatistics, SERIALPORT_TIMESTAMP duration)
+{
+    SERIALPORT_ATOMIC_ADD64(&pStatistics->callbackCount, 1);
+    SERIALPORT_ATOMIC_ADD64(&pStatistics->callbackTime, duration);
+    SerialPortStatistics_UpdateMax(&pStatistics->callbackTimeMax, (duration<0xFFFFFFFF) ? (unsigned int)duration : 0xFFFFFFFF);
+}
+
+void SerialPortStatistics_AddLatency(unsigned int* pHistogram, SERIALPORT_TIMESTAMP duration)
+{
+    int bucket = 0;
+
+    while((duration>0) && (bucket<SERIALPORT_HISTOGRAM_BUCKETS-1))
+    {
+        duration >>= 1;
+        bucket++;
+    }
+    SERIALPORT_ATOMIC_ADD(&pHistogram[bucket], 1);
+}
+
+void SerialPortStatistics_UpdateMax(unsigned int* pValue, unsigned int value)
+{
+    unsigned int maxValue = SERIALPORT_ATOMIC_LOAD(pValue);
+
+    while(value>maxValue)
+    {
+        if (SERIALPORT_ATOMIC_CAS(pValue, maxValue, value))
+        {
+            break;
+        }
+        maxValue = SERIALPORT_ATOMIC_LOAD(pValue);
+    }
+}
+
+SERIALPORT_TIMESTAMP SerialPortStatistics_GetPercentile(const unsigned int* pHistogram, double percentile)
+{
+    unsigned long long totalCount = 0, count = 0;
+    int                i;
+
+    for(i = 0; i<SERIALPORT_HISTOGRAM_BUCKETS; i++)
+    {
+        totalCount += pHistogram[i];
+    }
+    if (totalCount==0)
+    {
+        return 0;
+    }
+    //upper bound of the bucket the percentile falls into
+    for(i = 0; i<SERIALPORT_HISTOGRAM_BUCKETS-1; i++)
+    {
+        count += pHistogram[i];
+        if (count>=totalCount*percentile/100.0)
+        {
+            break;
+        }
+    }
+    return ((SERIALPORT_TIMESTAMP)1<<i) - 1;
+}
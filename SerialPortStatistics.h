@@ -0,0 +1,82 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef SERIALPORTSTATISTICS___H
+#define SERIALPORTSTATISTICS___H
+
+#include "SerialPortIO.h"
+
+/*
+* Per-port counters of the hot path. They are updated with relaxed
+* atomic adds by whichever thread does the work (no locks), so they are
+* always on. GetStatistics copies them into a snapshot, the fields of
+* one snapshot are not taken at exactly the same moment.
+*
+*   readCalls/emptyReads  device reads (read/ReadFile), those returning nothing
+*   writeCalls            device writes (write/writev/WriteFile)
+*   wakeups               working or reactor thread woken up for the port
+*   droppedBytes          received bytes neither the ring nor a handler took
+*   callbackTime          microseconds spent in data received/sent handlers
+*   receiveHighWater     most bytes waiting in the receive ring
+*   writeQueueDepth       bytes in the write queue when the snapshot was taken
+*
+* Latency histograms have power of two buckets: bucket i counts
+* durations below 2^i microseconds (and at least 2^(i-1)), the last one
+* everything longer. readLatency is the duration of ReadBuffer, ReadLine
+* and ReadUntil calls, writeLatency of every device write. pacingLatency
+* counts how late paced writes went out after they were due.
+*/
+
+#define SERIALPORT_HISTOGRAM_BUCKETS 32
+
+typedef struct
+{
+    unsigned long long bytesReceived;
+    unsigned long long bytesSent;
+    unsigned long long readCalls;
+    unsigned long long emptyReads;
+    unsigned long long writeCalls;
+    unsigned long long wakeups;
+    unsigned long long droppedBytes;
+    unsigned long long callbackCount;
+    unsigned long long callbackTime;
+    unsigned int       callbackTimeMax;
+    unsigned int       receiveHighWater;
+    unsigned int       writeQueueDepth;
+    unsigned int       writeQueueHighWater;
+    unsigned int       readLatency[SERIALPORT_HISTOGRAM_BUCKETS];
+    unsigned int       writeLatency[SERIALPORT_HISTOGRAM_BUCKETS];
+    unsigned int       pacingLatency[SERIALPORT_HISTOGRAM_BUCKETS];
+} TSerialPortStatistics;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void    SerialPortStatistics_Reset(TSerialPortStatistics* pStatistics);
+void    SerialPortStatistics_GetSnapshot(TSerialPortStatistics* pStatistics, TSerialPortStatistics* pSnapshot);
+void    SerialPortStatistics_AddRead(TSerialPortStatistics* pStatistics, int bytesRead);
+void    SerialPortStatistics_AddWrite(TSerialPortStatistics* pStatistics, int bytesWritten, SERIALPORT_TIMESTAMP duration);
+void    SerialPortStatistics_AddCallback(TSerialPortStatistics* pStatistics, SERIALPORT_TIMESTAMP duration);
+void    SerialPortStatistics_AddLatency(unsigned int* pHistogram, SERIALPORT_TIMESTAMP duration);
+void    SerialPortStatistics_UpdateMax(unsigned int* pValue, unsigned int value);
+SERIALPORT_TIMESTAMP SerialPortStatistics_GetPercentile(const unsigned int* pHistogram, double percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
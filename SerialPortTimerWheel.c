@@ -0,0 +1,239 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+
+#include "SerialPortTimerWheel.h"
+#include <string.h>
+
+void SerialPortTimerWheel_Init(TSerialPortTimerWheel* pWheel, int tickUS)
+{
+    int level, slot;
+
+    memset(pWheel, 0, sizeof(TSerialPortTimerWheel));
+    for(level = 0; level<SERIALPORT_TIMER_LEVELS; level++)
+    {
+        for(slot = 0; slot<SERIALPORT_TIMER_SLOTS; slot++)
+        {
+            pWheel->slots[level][slot].pNext = &pWheel->slots[level][slot];
+            pWheel->slots[level][slot].pPrev = &pWheel->slots[level][slot];
+        }
+    }
+    pWheel->tickUS    = (tickUS>0) ? tickUS : 1000;
+    pWheel->startTime = SerialPortIO_GetTime();
+}
+
+static unsigned long long SerialPortTimerWheel__GetTick(TSerialPortTimerWheel* pWheel, SERIALPORT_TIMESTAMP currentTime)
+{
+    if (currentTime<=pWheel->startTime)
+    {
+        return 0;
+    }
+    return (currentTime - pWheel->startTime) / pWheel->tickUS;
+}
+
+//timers moved down from a coarser level may be due in the current tick, its slot is processed next
+static void SerialPortTimerWheel__Insert(TSerialPortTimerWheel* pWheel, TSerialPortTimer* pTimer, BOOL cascading)
+{
+    unsigned long long expires = pTimer->expires;
+    unsigned long long maxExpires;
+    TSerialPortTimer*  pSlot;
+    int                level, shift;
+
+    if ((expires<pWheel->currentTick) || ((expires==pWheel->currentTick) && !cascading))
+    {
+        expires = pWheel->currentTick+1;
+    }
+    maxExpires = pWheel->currentTick + ((unsigned long long)1 << (SERIALPORT_TIMER_SLOT_BITS*SERIALPORT_TIMER_LEVELS)) - 1;
+    if (expires>maxExpires)
+    {
+        expires = maxExpires;
+    }
+
+    //the finest level on which the deadline is less than one round away
+    for(level = 0; level<SERIALPORT_TIMER_LEVELS-1; level++)
+    {
+        shift = SERIALPORT_TIMER_SLOT_BITS*level;
+        if ((expires>>shift) - (pWheel->currentTick>>shift) < SERIALPORT_TIMER_SLOTS)
+        {
+            break;
+        }
+    }
+    shift  = SERIALPORT_TIMER_SLOT_BITS*level;
+    pSlot  = &pWheel->slots[level][(expires>>shift) & (SERIALPORT_TIMER_SLOTS-1)];
+
+    pTimer->pPrev = pSlot;
+    pTimer->pNext = pSlot->pNext;
+    pSlot->pNext->pPrev = pTimer;
+    pSlot->pNext = pTimer;
+}
+
+static void SerialPortTimerWheel__Unlink(TSerialPortTimer* pTimer)
+{
+    pTimer->pPrev->pNext = pTimer->pNext;
+    pTimer->pNext->pPrev = pTimer->pPrev;
+    pTimer->pNext = NULL;
+    pTimer->pPrev = NULL;
+}
+
+void SerialPortTimerWheel_Add(TSerialPortTimerWheel* pWheel, TSerialPortTimer* pTimer, SERIALPORT_TIMESTAMP deadline)
+{
+    if (pTimer->running)
+    {
+        SerialPortTimerWheel_Remove(pWheel, pTimer);
+    }
+    //rounded up, timers never fire early
+    pTimer->expires = 0;
+    if (deadline>pWheel->startTime)
+    {
+        pTimer->expires = (deadline - pWheel->startTime + pWheel->tickUS - 1) / pWheel->tickUS;
+    }
+    pTimer->running = TRUE;
+    SerialPortTimerWheel__Insert(pWheel, pTimer, FALSE);
+    pWheel->timerCount++;
+}
+
+void SerialPortTimerWheel_Remove(TSerialPortTimerWheel* pWheel, TSerialPortTimer* pTimer)
+{
+    if (pTimer->running)
+    {
+        SerialPortTimerWheel__Unlink(pTimer);
+        pTimer->running = FALSE;
+        pWheel->timerCount--;
+    }
+}
+
+//detaches all timers of a slot as a list linked by pNext
+static TSerialPortTimer* SerialPortTimerWheel__TakeSlot(TSerialPortTimer* pSlot)
+{
+    TSerialPortTimer* pFirst = pSlot->pNext;
+
+    if (pFirst==pSlot)
+    {
+        return NULL;
+    }
+    pSlot->pPrev->pNext = NULL;
+    pSlot->pNext = pSlot;
+    pSlot->pPrev = pSlot;
+    return pFirst;
+}
+
+static void SerialPortTimerWheel__Cascade(TSerialPortTimerWheel* pWheel, int level)
+{
+    int               slot = (int)((pWheel->currentTick >> (SERIALPORT_TIMER_SLOT_BITS*level)) & (SERIALPORT_TIMER_SLOTS-1));
+    TSerialPortTimer* pTimer = SerialPortTimerWheel__TakeSlot(&pWheel->slots[level][slot]);
+    TSerialPortTimer* pNext;
+
+    while(pTimer)
+    {
+        pNext = pTimer->pNext;
+        SerialPortTimerWheel__Insert(pWheel, pTimer, TRUE);
+        pTimer = pNext;
+    }
+}
+
+TSerialPortTimer* SerialPortTimerWheel_Advance(TSerialPortTimerWheel* pWheel, SERIALPORT_TIMESTAMP currentTime)
+{
+    unsigned long long targetTick = SerialPortTimerWheel__GetTick(pWheel, currentTime);
+    TSerialPortTimer*  pExpired = NULL;
+    TSerialPortTimer*  pTimer;
+    TSerialPortTimer*  pNext;
+    int                level, slot;
+
+    while(pWheel->currentTick<targetTick)
+    {
+        if (pWheel->timerCount==0)
+        {
+            pWheel->currentTick = targetTick;
+            break;
+        }
+        pWheel->currentTick++;
+
+        //coarser slots are moved down when the finer levels wrap, coarsest first
+        for(level = 1; level<SERIALPORT_TIMER_LEVELS; level++)
+        {
+            if (pWheel->currentTick & (((unsigned long long)1 << (SERIALPORT_TIMER_SLOT_BITS*level)) - 1))
+            {
+                break;
+            }
+        }
+        while(--level>0)
+        {
+            SerialPortTimerWheel__Cascade(pWheel, level);
+        }
+
+        slot   = (int)(pWheel->currentTick & (SERIALPORT_TIMER_SLOTS-1));
+        pTimer = SerialPortTimerWheel__TakeSlot(&pWheel->slots[0][slot]);
+        while(pTimer)
+        {
+            pNext = pTimer->pNext;
+            if (pTimer->expires>pWheel->currentTick)
+            {
+                //deadline beyond the range of the wheel
+                SerialPortTimerWheel__Insert(pWheel, pTimer, FALSE);
+            } else {
+                pTimer->running = FALSE;
+                pTimer->pPrev   = NULL;
+                pTimer->pNext   = pExpired;
+                pExpired = pTimer;
+                pWheel->timerCount--;
+            }
+            pTimer = pNext;
+        }
+    }
+    return pExpired;
+}
+
+SERIALPORT_TIMESTAMP SerialPortTimerWheel_GetNextTime(TSerialPortTimerWheel* pWheel)
+{
+    unsigned long long   tick, roundEnd;
+    TSerialPortTimer*    pSlot;
+
+    if (pWheel->timerCount==0)
+    {
+        return 0;
+    }
+    //the next occupied slot of this round, or the end of the round when coarser timers move down
+    roundEnd = (pWheel->currentTick | (SERIALPORT_TIMER_SLOTS-1)) + 1;
+    for(tick = pWheel->currentTick+1; tick<roundEnd; tick++)
+    {
+        pSlot = &pWheel->slots[0][tick & (SERIALPORT_TIMER_SLOTS-1)];
+        if (pSlot->pNext!=pSlot)
+        {
+            break;
+        }
+    }
+    return pWheel->startTime + tick * pWheel->tickUS;
+}
+
+int SerialPortTimerWheel_GetNextTimeout(TSerialPortTimerWheel* pWheel, SERIALPORT_TIMESTAMP currentTime)
+{
+    SERIALPORT_TIMESTAMP nextTime = SerialPortTimerWheel_GetNextTime(pWheel);
+
+    if (nextTime==0)
+    {
+        return SERIALPORT_INFINITE;
+    }
+    if (nextTime<=currentTime)
+    {
+        return 0;
+    }
+    return (int)((nextTime - currentTime + 999) / 1000);
+}
+
+int SerialPortTimerWheel_GetCount(TSerialPortTimerWheel* pWheel)
+{
+    return pWheel->timerCount;
+}
@@ -0,0 +1,76 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef SERIALPORTTIMERWHEEL___H
+#define SERIALPORTTIMERWHEEL___H
+
+#include "SerialPortIO.h"
+
+/*
+* Hierarchical timer wheel: 4 levels of 64 slots, level 0 has one slot
+* per tick, every further level 64 times coarser ones. Adding and
+* removing a timer is O(1) no matter how many are running, timers of
+* the coarser levels are moved down when the finer level wraps around.
+* Deadlines further than 64^4 ticks are fired at that limit.
+*
+* Slots are circular lists with the slot itself as the head, the wheel
+* must not be moved after Init. The wheel is not thread safe, the owner
+* locks it. Advance moves the wheel to the given time and returns the
+* expired timers as a list linked by pNext, so the owner can handle them
+* without holding its lock. GetNextTimeout tells how long the owner may
+* sleep (in milliseconds, SERIALPORT_INFINITE when no timer runs),
+* GetNextTime until when (0 when no timer runs) for owners with finer
+* timers.
+*/
+
+#define SERIALPORT_TIMER_LEVELS      4
+#define SERIALPORT_TIMER_SLOT_BITS   6
+#define SERIALPORT_TIMER_SLOTS       (1<<SERIALPORT_TIMER_SLOT_BITS)
+
+typedef struct TSerialPortTimer
+{
+    struct TSerialPortTimer* pNext;
+    struct TSerialPortTimer* pPrev;
+    unsigned long long       expires;       //tick
+    BOOL                     running;
+} TSerialPortTimer;
+
+typedef struct
+{
+    TSerialPortTimer     slots[SERIALPORT_TIMER_LEVELS][SERIALPORT_TIMER_SLOTS];   //list heads
+    unsigned long long   currentTick;
+    SERIALPORT_TIMESTAMP startTime;
+    int                  tickUS;
+    int                  timerCount;
+} TSerialPortTimerWheel;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void    SerialPortTimerWheel_Init(TSerialPortTimerWheel* pWheel, int tickUS);
+void    SerialPortTimerWheel_Add(TSerialPortTimerWheel* pWheel, TSerialPortTimer* pTimer, SERIALPORT_TIMESTAMP deadline);
+void    SerialPortTimerWheel_Remove(TSerialPortTimerWheel* pWheel, TSerialPortTimer* pTimer);
+TSerialPortTimer* SerialPortTimerWheel_Advance(TSerialPortTimerWheel* pWheel, SERIALPORT_TIMESTAMP currentTime);
+int     SerialPortTimerWheel_GetNextTimeout(TSerialPortTimerWheel* pWheel, SERIALPORT_TIMESTAMP currentTime);
+SERIALPORT_TIMESTAMP SerialPortTimerWheel_GetNextTime(TSerialPortTimerWheel* pWheel);
+int     SerialPortTimerWheel_GetCount(TSerialPortTimerWheel* pWheel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
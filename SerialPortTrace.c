@@ -0,0 +1,372 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#include "SerialPortTrace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SERIALPORT_TRACE__READ      0
+#define SERIALPORT_TRACE__WRITE     1
+#define SERIALPORT_TRACE__EXCHANGE  2
+#define SERIALPORT_TRACE__SPAN      3
+
+//tracks of a port in the timeline
+#define SERIALPORT_TRACE__TID_DEVICE       1
+#define SERIALPORT_TRACE__TID_EXCHANGE     2
+#define SERIALPORT_TRACE__TID_APPLICATION  3
+
+typedef struct
+{
+    SERIALPORT_TIMESTAMP startTime;
+    SERIALPORT_TIMESTAMP endTime;
+    SERIALPORT_TIMESTAMP firstByteUS;      //exchange only
+    const char*          name;             //span only
+    int                  type;
+    int                  portId;
+    int                  bytes;            //request bytes of an exchange
+    int                  responseBytes;
+} TSerialPortTraceEvent;
+
+typedef struct
+{
+    char                 name[64];
+    BOOL                 open;             //a request was written
+    SERIALPORT_TIMESTAMP writeStartTime;
+    SERIALPORT_TIMESTAMP writeEndTime;
+    SERIALPORT_TIMESTAMP firstReadTime;
+    SERIALPORT_TIMESTAMP lastReadTime;
+    int                  writeBytes;
+    int                  readBytes;
+} TSerialPortTracePort;
+
+struct TSerialPortTrace
+{
+    SERIALPORT_LOCK        lock;
+    SERIALPORT_TIMESTAMP   startTime;
+    TSerialPortTraceEvent* pEvents;
+    int                    maxEvents;
+    int                    nextEvent;
+    int                    eventCount;
+    unsigned long long     droppedCount;
+    TSerialPortTracePort   ports[SERIALPORT_TRACE_MAX_PORTS];
+    int                    portCount;
+};
+
+//called locked
+static TSerialPortTraceEvent* SerialPortTrace__AddEvent(TSerialPortTrace* pTrace, int type, int portId)
+{
+    TSerialPortTraceEvent* pEvent = &pTrace->pEvents[pTrace->nextEvent];
+
+    pTrace->nextEvent = (pTrace->nextEvent + 1) % pTrace->maxEvents;
+    if (pTrace->eventCount<pTrace->maxEvents)
+    {
+        pTrace->eventCount++;
+    } else {
+        pTrace->droppedCount++;
+    }
+    memset(pEvent, 0, sizeof(TSerialPortTraceEvent));
+    pEvent->type   = type;
+    pEvent->portId = portId;
+    return pEvent;
+}
+
+static void SerialPortTrace__GetExchange(const TSerialPortTracePort* pPort, int portId, TSerialPortTraceEvent* pEvent)
+{
+    memset(pEvent, 0, sizeof(TSerialPortTraceEvent));
+    pEvent->type          = SERIALPORT_TRACE__EXCHANGE;
+    pEvent->portId        = portId;
+    pEvent->startTime     = pPort->writeStartTime;
+    pEvent->endTime       = (pPort->readBytes>0) ? pPort->lastReadTime : pPort->writeEndTime;
+    pEvent->firstByteUS   = ((pPort->readBytes>0) && (pPort->firstReadTime>pPort->writeEndTime)) ? pPort->firstReadTime - pPort->writeEndTime : 0;
+    pEvent->bytes         = pPort->writeBytes;
+    pEvent->responseBytes = pPort->readBytes;
+}
+
+static void SerialPortTrace__WriteString(FILE* pFile, const char* text)
+{
+    fputc('"', pFile);
+    for(; *text; text++)
+    {
+        if ((*text=='"') || (*text=='\\'))
+        {
+            fputc('\\', pFile);
+            fputc(*text, pFile);
+        } else if ((unsigned char)*text<0x20) {
+            fprintf(pFile, "\\u%04x", (unsigned char)*text);
+        } else {
+            fputc(*text, pFile);
+        }
+    }
+    fputc('"', pFile);
+}
+
+static void SerialPortTrace__WriteEvent(TSerialPortTrace* pTrace, FILE* pFile, const TSerialPortTraceEvent* pEvent)
+{
+    long long startUS = (long long)(pEvent->startTime - pTrace->startTime);
+    long long duration = (long long)(pEvent->endTime - pEvent->startTime);
+    int       pid = pEvent->portId + 1;
+
+    switch(pEvent->type)
+    {
+        case SERIALPORT_TRACE__READ:
+            fprintf(pFile, ",\n{\"name\":\"read\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld,\"pid\":%i,\"tid\":%i,\"args\":{\"bytes\":%i}}",
+                    startUS, pid, SERIALPORT_TRACE__TID_DEVICE, pEvent->bytes);
+            break;
+        case SERIALPORT_TRACE__WRITE:
+            fprintf(pFile, ",\n{\"name\":\"write\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%i,\"tid\":%i,\"args\":{\"bytes\":%i}}",
+                    startUS, duration, pid, SERIALPORT_TRACE__TID_DEVICE, pEvent->bytes);
+            break;
+        case SERIALPORT_TRACE__EXCHANGE:
+            fprintf(pFile, ",\n{\"name\":\"exchange\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%i,\"tid\":%i,"
+                    "\"args\":{\"request_bytes\":%i,\"response_bytes\":%i",
+                    startUS, duration, pid, SERIALPORT_TRACE__TID_EXCHANGE, pEvent->bytes, pEvent->responseBytes);
+            if (pEvent->responseBytes>0)
+            {
+                fprintf(pFile, ",\"first_byte_us\":%lld", (long long)pEvent->firstByteUS);
+            }
+            fprintf(pFile, "}}");
+            break;
+        default:
+            fprintf(pFile, ",\n{\"name\":");
+            SerialPortTrace__WriteString(pFile, pEvent->name);
+            fprintf(pFile, ",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%i,\"tid\":%i}",
+                    startUS, duration, pid, SERIALPORT_TRACE__TID_APPLICATION);
+            break;
+    }
+}
+
+TSerialPortTrace* SerialPortTrace_Create(int maxEvents)
+{
+    TSerialPortTrace* pTrace;
+
+    if (maxEvents<=0)
+    {
+        return NULL;
+    }
+    pTrace = (TSerialPortTrace*)calloc(1, sizeof(TSerialPortTrace));
+    if (pTrace==NULL)
+    {
+        return NULL;
+    }
+    pTrace->pEvents = (TSerialPortTraceEvent*)malloc(sizeof(TSerialPortTraceEvent)*maxEvents);
+    if (pTrace->pEvents==NULL)
+    {
+        free(pTrace);
+        return NULL;
+    }
+    pTrace->maxEvents = maxEvents;
+    pTrace->startTime = SerialPortIO_GetTime();
+    SerialPortIO_InitLock(&pTrace->lock);
+    return pTrace;
+}
+
+void SerialPortTrace_Delete(TSerialPortTrace* pTrace)
+{
+    if (pTrace==NULL)
+    {
+        return;
+    }
+    SerialPortIO_DeleteLock(&pTrace->lock);
+    free(pTrace->pEvents);
+    free(pTrace);
+}
+
+int SerialPortTrace_AddPort(TSerialPortTrace* pTrace, const char* name)
+{
+    TSerialPortTracePort* pPort;
+    int                   portId = -1;
+
+    SerialPortIO_Lock(&pTrace->lock);
+    if (pTrace->portCount<SERIALPORT_TRACE_MAX_PORTS)
+    {
+        portId = pTrace->portCount++;
+        pPort = &pTrace->ports[portId];
+        memset(pPort, 0, sizeof(TSerialPortTracePort));
+        if (name)
+        {
+            strncpy(pPort->name, name, sizeof(pPort->name)-1);
+        } else {
+            sprintf(pPort->name, "port %i", portId + 1);
+        }
+    }
+    SerialPortIO_Unlock(&pTrace->lock);
+    return portId;
+}
+
+void SerialPortTrace_OnRead(TSerialPortTrace* pTrace, int portId, SERIALPORT_TIMESTAMP readTime, int bytesRead)
+{
+    TSerialPortTracePort*  pPort;
+    TSerialPortTraceEvent* pEvent;
+
+    if ((portId<0) || (portId>=SERIALPORT_TRACE_MAX_PORTS) || (bytesRead<=0))
+    {
+        return;
+    }
+    SerialPortIO_Lock(&pTrace->lock);
+    pEvent = SerialPortTrace__AddEvent(pTrace, SERIALPORT_TRACE__READ, portId);
+    pEvent->startTime = readTime;
+    pEvent->endTime   = readTime;
+    pEvent->bytes     = bytesRead;
+
+    pPort = &pTrace->ports[portId];
+    if (pPort->open)
+    {
+        if (pPort->readBytes==0)
+        {
+            pPort->firstReadTime = readTime;
+        }
+        pPort->lastReadTime = readTime;
+        pPort->readBytes   += bytesRead;
+    }
+    SerialPortIO_Unlock(&pTrace->lock);
+}
+
+void SerialPortTrace_OnWrite(TSerialPortTrace* pTrace, int portId, SERIALPORT_TIMESTAMP startTime, SERIALPORT_TIMESTAMP endTime, int bytesWritten)
+{
+    TSerialPortTracePort*  pPort;
+    TSerialPortTraceEvent* pEvent;
+
+    if ((portId<0) || (portId>=SERIALPORT_TRACE_MAX_PORTS) || (bytesWritten<=0))
+    {
+        return;
+    }
+    SerialPortIO_Lock(&pTrace->lock);
+    pEvent = SerialPortTrace__AddEvent(pTrace, SERIALPORT_TRACE__WRITE, portId);
+    pEvent->startTime = startTime;
+    pEvent->endTime   = endTime;
+    pEvent->bytes     = bytesWritten;
+
+    //writes without a response in between belong to one request
+    pPort = &pTrace->ports[portId];
+    if (pPort->open && (pPort->readBytes==0))
+    {
+        pPort->writeEndTime = endTime;
+        pPort->writeBytes  += bytesWritten;
+    } else {
+        if (pPort->open)
+        {
+            pEvent = SerialPortTrace__AddEvent(pTrace, SERIALPORT_TRACE__EXCHANGE, portId);
+            SerialPortTrace__GetExchange(pPort, portId, pEvent);
+        }
+        pPort->open           = TRUE;
+        pPort->writeStartTime = startTime;
+        pPort->writeEndTime   = endTime;
+        pPort->writeBytes     = bytesWritten;
+        pPort->readBytes      = 0;
+    }
+    SerialPortIO_Unlock(&pTrace->lock);
+}
+
+void SerialPortTrace_AddSpan(TSerialPortTrace* pTrace, int portId, const char* name, SERIALPORT_TIMESTAMP startTime, SERIALPORT_TIMESTAMP endTime)
+{
+    TSerialPortTraceEvent* pEvent;
+
+    if ((portId<0) || (portId>=SERIALPORT_TRACE_MAX_PORTS) || (name==NULL))
+    {
+        return;
+    }
+    SerialPortIO_Lock(&pTrace->lock);
+    pEvent = SerialPortTrace__AddEvent(pTrace, SERIALPORT_TRACE__SPAN, portId);
+    pEvent->name      = name;
+    pEvent->startTime = startTime;
+    pEvent->endTime   = (endTime>startTime) ? endTime : startTime;
+    SerialPortIO_Unlock(&pTrace->lock);
+}
+
+int SerialPortTrace_GetEventCount(TSerialPortTrace* pTrace)
+{
+    int count;
+
+    SerialPortIO_Lock(&pTrace->lock);
+    count = pTrace->eventCount;
+    SerialPortIO_Unlock(&pTrace->lock);
+    return count;
+}
+
+unsigned long long SerialPortTrace_GetDroppedCount(TSerialPortTrace* pTrace)
+{
+    unsigned long long count;
+
+    SerialPortIO_Lock(&pTrace->lock);
+    count = pTrace->droppedCount;
+    SerialPortIO_Unlock(&pTrace->lock);
+    return count;
+}
+
+void SerialPortTrace_Clear(TSerialPortTrace* pTrace)
+{
+    int i;
+
+    SerialPortIO_Lock(&pTrace->lock);
+    pTrace->nextEvent    = 0;
+    pTrace->eventCount   = 0;
+    pTrace->droppedCount = 0;
+    for(i = 0; i<pTrace->portCount; i++)
+    {
+        pTrace->ports[i].open = FALSE;
+    }
+    SerialPortIO_Unlock(&pTrace->lock);
+}
+
+BOOL SerialPortTrace_Export(TSerialPortTrace* pTrace, const char* fileName)
+{
+    TSerialPortTraceEvent exchange;
+    FILE*                 pFile;
+    BOOL                  result;
+    int                   i;
+
+    pFile = fopen(fileName, "w");
+    if (pFile==NULL)
+    {
+        return FALSE;
+    }
+    SerialPortIO_Lock(&pTrace->lock);
+    fprintf(pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(pFile, "{\"name\":\"trace\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"dropped_events\":%llu}}", pTrace->droppedCount);
+    for(i = 0; i<pTrace->portCount; i++)
+    {
+        fprintf(pFile, ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%i,\"tid\":0,\"args\":{\"name\":", i + 1);
+        SerialPortTrace__WriteString(pFile, pTrace->ports[i].name);
+        fprintf(pFile, "}}");
+        fprintf(pFile, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%i,\"tid\":%i,\"args\":{\"name\":\"device\"}}", i + 1, SERIALPORT_TRACE__TID_DEVICE);
+        fprintf(pFile, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%i,\"tid\":%i,\"args\":{\"name\":\"exchanges\"}}", i + 1, SERIALPORT_TRACE__TID_EXCHANGE);
+        fprintf(pFile, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%i,\"tid\":%i,\"args\":{\"name\":\"application\"}}", i + 1, SERIALPORT_TRACE__TID_APPLICATION);
+    }
+
+    //oldest first, then the exchanges still waiting for the next write
+    for(i = 0; i<pTrace->eventCount; i++)
+    {
+        SerialPortTrace__WriteEvent(pTrace, pFile, &pTrace->pEvents[(pTrace->nextEvent - pTrace->eventCount + i + pTrace->maxEvents) % pTrace->maxEvents]);
+    }
+    for(i = 0; i<pTrace->portCount; i++)
+    {
+        if (pTrace->ports[i].open)
+        {
+            SerialPortTrace__GetExchange(&pTrace->ports[i], i, &exchange);
+            SerialPortTrace__WriteEvent(pTrace, pFile, &exchange);
+        }
+    }
+    fprintf(pFile, "\n]}\n");
+    SerialPortIO_Unlock(&pTrace->lock);
+
+    result = !ferror(pFile);
+    if (fclose(pFile)!=0)
+    {
+        result = FALSE;
+    }
+    return result;
+}
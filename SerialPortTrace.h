@@ -0,0 +1,69 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef SERIALPORTTRACE___H
+#define SERIALPORTTRACE___H
+
+#include "SerialPortIO.h"
+
+/*
+* Timeline of the device I/O of one or more ports, exported in the
+* Chrome trace format (chrome://tracing, Perfetto). A port with a trace
+* (SetTrace) records every read and write right where the transport
+* returns, with the monotonic time of the syscall:
+*
+*   write     span of the write syscall, bytes written
+*   read      instant the chunk was read, bytes read
+*   exchange  writes up to the first response are one request, all
+*             chunks read until the next write its response; the span
+*             lasts from the first write to the last chunk, first_byte_us
+*             is from the end of the request to its first chunk
+*
+* AddSpan adds spans of the application (e.g. from a request being
+* queued to its response being handled) on their own track, so the
+* time spent in the library, the driver and the device can be told
+* apart. Span names must stay valid until Export.
+*
+* Events are kept in a ring of maxEvents, the oldest are overwritten
+* (GetDroppedCount). Recording takes a short lock, the trace can be
+* shared by any number of ports and must outlive them. Every port is
+* one process of the timeline, named by AddPort.
+*/
+
+#define SERIALPORT_TRACE_MAX_PORTS  64
+
+typedef struct TSerialPortTrace TSerialPortTrace;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+TSerialPortTrace* SerialPortTrace_Create(int maxEvents);
+void    SerialPortTrace_Delete(TSerialPortTrace* pTrace);
+int     SerialPortTrace_AddPort(TSerialPortTrace* pTrace, const char* name);
+void    SerialPortTrace_OnRead(TSerialPortTrace* pTrace, int portId, SERIALPORT_TIMESTAMP readTime, int bytesRead);
+void    SerialPortTrace_OnWrite(TSerialPortTrace* pTrace, int portId, SERIALPORT_TIMESTAMP startTime, SERIALPORT_TIMESTAMP endTime, int bytesWritten);
+void    SerialPortTrace_AddSpan(TSerialPortTrace* pTrace, int portId, const char* name, SERIALPORT_TIMESTAMP startTime, SERIALPORT_TIMESTAMP endTime);
+int     SerialPortTrace_GetEventCount(TSerialPortTrace* pTrace);
+unsigned long long SerialPortTrace_GetDroppedCount(TSerialPortTrace* pTrace);
+void    SerialPortTrace_Clear(TSerialPortTrace* pTrace);
+BOOL    SerialPortTrace_Export(TSerialPortTrace* pTrace, const char* fileName);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,536 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+
+#include "SerialPortTransaction.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct TSerialPortTransactions
+{
+    int                             maxInFlight;
+    SERIALPORT_SEND_HANDLER         sendHandler;
+    void*                           pSendContext;
+    SERIALPORT_FRAME_LENGTH_HANDLER frameLength;
+    SERIALPORT_TAG_HANDLER          getTag;
+    void*                           pFramingContext;
+
+    TSerialPortTransaction*         pPendingFirst;      //sent, oldest first
+    TSerialPortTransaction*         pPendingLast;
+    int                             pendingCount;
+    TSerialPortTransaction*         pQueuedFirst;       //waiting for a free slot
+    TSerialPortTransaction*         pQueuedLast;
+    int                             queuedCount;
+    volatile unsigned int           unmatchedCount;
+
+    TSerialPortTimerWheel           wheel;
+    SERIALPORT_TIMESTAMP            nextWakeTime;       //0 when the timer thread sleeps without a timeout
+    SERIALPORT_EVENT                wakeEvent;
+    SERIALPORT_THREAD               timerThread;
+    volatile int                    stopping;
+    SERIALPORT_LOCK                 lock;
+
+    SERIALPORT_LOCK                 receiveLock;
+    unsigned char*                  pFrame;             //incomplete frame from previous chunks
+    int                             frameDataLength;
+    int                             maxFrameLength;
+};
+
+static void SerialPortTransactions__Append(TSerialPortTransaction** ppFirst, TSerialPortTransaction** ppLast, TSerialPortTransaction* pTransaction)
+{
+    pTransaction->pNext = NULL;
+    pTransaction->pPrev = *ppLast;
+    if (*ppLast)
+    {
+        (*ppLast)->pNext = pTransaction;
+    } else {
+        *ppFirst = pTransaction;
+    }
+    *ppLast = pTransaction;
+}
+
+static void SerialPortTransactions__Unlink(TSerialPortTransaction** ppFirst, TSerialPortTransaction** ppLast, TSerialPortTransaction* pTransaction)
+{
+    if (pTransaction->pPrev)
+    {
+        pTransaction->pPrev->pNext = pTransaction->pNext;
+    } else {
+        *ppFirst = pTransaction->pNext;
+    }
+    if (pTransaction->pNext)
+    {
+        pTransaction->pNext->pPrev = pTransaction->pPrev;
+    } else {
+        *ppLast = pTransaction->pPrev;
+    }
+    pTransaction->pNext = NULL;
+    pTransaction->pPrev = NULL;
+}
+
+//takes a queued or pending transaction out of the engine and adds it to the list of completed ones, called locked
+static void SerialPortTransactions__Finish(TSerialPortTransactions* pTransactions, TSerialPortTransaction* pTransaction, int status, TSerialPortTransaction** ppCompleted)
+{
+    if (pTransaction->status==SERIALPORT_TRANSACTION_PENDING)
+    {
+        SerialPortTransactions__Unlink(&pTransactions->pPendingFirst, &pTransactions->pPendingLast, pTransaction);
+        pTransactions->pendingCount--;
+    } else {
+        SerialPortTransactions__Unlink(&pTransactions->pQueuedFirst, &pTransactions->pQueuedLast, pTransaction);
+        pTransactions->queuedCount--;
+    }
+    SerialPortTimerWheel_Remove(&pTransactions->wheel, &pTransaction->timer);
+    pTransaction->completeTime = SerialPortIO_GetTime();
+    SERIALPORT_ATOMIC_STORE(&pTransaction->status, status);
+    pTransaction->pNext = *ppCompleted;
+    *ppCompleted = pTransaction;
+}
+
+//sends queued transactions while there are free slots, called locked
+static void SerialPortTransactions__Send(TSerialPortTransactions* pTransactions, TSerialPortTransaction** ppCompleted)
+{
+    TSerialPortTransaction* pTransaction;
+    int                     bytesSent;
+
+    while((pTransactions->pQueuedFirst!=NULL) &&
+          ((pTransactions->maxInFlight<=0) || (pTransactions->pendingCount<pTransactions->maxInFlight)))
+    {
+        pTransaction = pTransactions->pQueuedFirst;
+        SerialPortTransactions__Unlink(&pTransactions->pQueuedFirst, &pTransactions->pQueuedLast, pTransaction);
+        pTransactions->queuedCount--;
+
+        //pending before sending, the response may arrive before the send handler returns
+        pTransaction->sendTime = SerialPortIO_GetTime();
+        SERIALPORT_ATOMIC_STORE(&pTransaction->status, SERIALPORT_TRANSACTION_PENDING);
+        SerialPortTransactions__Append(&pTransactions->pPendingFirst, &pTransactions->pPendingLast, pTransaction);
+        pTransactions->pendingCount++;
+
+        bytesSent = 0;
+        if (pTransactions->sendHandler)
+        {
+            bytesSent = pTransactions->sendHandler(pTransactions->pSendContext, pTransaction->pRequest, pTransaction->requestLength);
+        }
+        if ((bytesSent<pTransaction->requestLength) && (pTransaction->status==SERIALPORT_TRANSACTION_PENDING))
+        {
+            SerialPortTransactions__Finish(pTransactions, pTransaction, SERIALPORT_TRANSACTION_FAILED, ppCompleted);
+        }
+    }
+}
+
+static void SerialPortTransactions__Complete(TSerialPortTransaction* pCompleted)
+{
+    TSerialPortTransaction* pNext;
+
+    //handlers may submit the transaction again, pNext is taken first
+    while(pCompleted)
+    {
+        pNext = pCompleted->pNext;
+        pCompleted->pNext = NULL;
+        if (pCompleted->onCompleted)
+        {
+            pCompleted->onCompleted(pCompleted);
+        }
+        if (pCompleted->pCompletedEvent)
+        {
+            SerialPortIO_SetEvent(pCompleted->pCompletedEvent);
+        }
+        pCompleted = pNext;
+    }
+}
+
+static void SerialPortTransactions__TimerThread(void* lpParam)
+{
+    TSerialPortTransactions* pTransactions = (TSerialPortTransactions*)lpParam;
+    TSerialPortTransaction*  pCompleted;
+    TSerialPortTransaction*  pTransaction;
+    TSerialPortTimer*        pTimer;
+    TSerialPortTimer*        pNext;
+    SERIALPORT_TIMESTAMP     currentTime;
+    int                      timeOutMS;
+
+    while(!SERIALPORT_ATOMIC_LOAD(&pTransactions->stopping))
+    {
+        pCompleted = NULL;
+        SerialPortIO_Lock(&pTransactions->lock);
+        currentTime = SerialPortIO_GetTime();
+        pTimer = SerialPortTimerWheel_Advance(&pTransactions->wheel, currentTime);
+        while(pTimer)
+        {
+            pNext = pTimer->pNext;
+            pTransaction = (TSerialPortTransaction*)((char*)pTimer - offsetof(TSerialPortTransaction, timer));
+            SerialPortTransactions__Finish(pTransactions, pTransaction, SERIALPORT_TRANSACTION_TIMEOUT, &pCompleted);
+            pTimer = pNext;
+        }
+        SerialPortTransactions__Send(pTransactions, &pCompleted);
+
+        timeOutMS = SerialPortTimerWheel_GetNextTimeout(&pTransactions->wheel, currentTime);
+        pTransactions->nextWakeTime = (timeOutMS<0) ? 0 : currentTime + (SERIALPORT_TIMESTAMP)timeOutMS*1000;
+        SerialPortIO_Unlock(&pTransactions->lock);
+
+        SerialPortTransactions__Complete(pCompleted);
+        SerialPortIO_WaitEvent(&pTransactions->wakeEvent, timeOutMS);
+    }
+}
+
+void SerialPortTransaction_Init(TSerialPortTransaction* pTransaction, const unsigned char* pRequest, int requestLength,
+                                unsigned char* pResponse, int responseSize, int timeOutMS)
+{
+    memset(pTransaction, 0, sizeof(TSerialPortTransaction));
+    pTransaction->pRequest      = pRequest;
+    pTransaction->requestLength = requestLength;
+    pTransaction->pResponse     = pResponse;
+    pTransaction->responseSize  = responseSize;
+    pTransaction->matchType     = SERIALPORT_MATCH_ORDER;
+    pTransaction->timeOutMS     = timeOutMS;
+}
+
+int SerialPortTransaction_Wait(TSerialPortTransaction* pTransaction, int timeOutMS)
+{
+    SERIALPORT_TIMESTAMP startTime = SerialPortIO_GetTime();
+    SERIALPORT_TIMESTAMP elapsed;
+    int                  status, waitTime;
+
+    while(1)
+    {
+        status = SERIALPORT_ATOMIC_LOAD(&pTransaction->status);
+        if ((status>=SERIALPORT_TRANSACTION_COMPLETED) || (status==SERIALPORT_TRANSACTION_IDLE) || (timeOutMS==0))
+        {
+            return status;
+        }
+        waitTime = timeOutMS;
+        if (timeOutMS>0)
+        {
+            elapsed = (SerialPortIO_GetTime() - startTime) / 1000;
+            if (elapsed>=(SERIALPORT_TIMESTAMP)timeOutMS)
+            {
+                return status;
+            }
+            waitTime = timeOutMS - (int)elapsed;
+        }
+        //the event may be shared by several transactions, the status tells whose completion woke us up
+        if (pTransaction->pCompletedEvent)
+        {
+            SerialPortIO_WaitEvent(pTransaction->pCompletedEvent, waitTime);
+        } else {
+            SerialPortIO_Sleep(SERIALPORT_INTERNAL_TIMEOUT);
+        }
+    }
+}
+
+TSerialPortTransactions* SerialPortTransactions_Create(int maxInFlight, int maxFrameLength)
+{
+    TSerialPortTransactions* pTransactions;
+
+    if (maxFrameLength<=0)
+    {
+        return NULL;
+    }
+    pTransactions = (TSerialPortTransactions*)calloc(1, sizeof(TSerialPortTransactions));
+    if (pTransactions==NULL)
+    {
+        return NULL;
+    }
+    pTransactions->pFrame = (unsigned char*)malloc(maxFrameLength);
+    if ((pTransactions->pFrame==NULL) || (!SerialPortIO_CreateEvent(&pTransactions->wakeEvent)))
+    {
+        free(pTransactions->pFrame);
+        free(pTransactions);
+        return NULL;
+    }
+    pTransactions->maxInFlight    = maxInFlight;
+    pTransactions->maxFrameLength = maxFrameLength;
+    pTransactions->frameLength    = SerialPortTransactions_GetLineLength;
+    SerialPortTimerWheel_Init(&pTransactions->wheel, 1000);
+    SerialPortIO_InitLock(&pTransactions->lock);
+    SerialPortIO_InitLock(&pTransactions->receiveLock);
+
+    if (!SerialPortIO_StartThread(&pTransactions->timerThread, SerialPortTransactions__TimerThread, pTransactions))
+    {
+        SerialPortIO_DeleteLock(&pTransactions->lock);
+        SerialPortIO_DeleteLock(&pTransactions->receiveLock);
+        SerialPortIO_DeleteEvent(&pTransactions->wakeEvent);
+        free(pTransactions->pFrame);
+        free(pTransactions);
+        return NULL;
+    }
+    return pTransactions;
+}
+
+void SerialPortTransactions_Delete(TSerialPortTransactions* pTransactions)
+{
+    if (pTransactions==NULL)
+    {
+        return;
+    }
+    SERIALPORT_ATOMIC_STORE(&pTransactions->stopping, 1);
+    SerialPortIO_SetEvent(&pTransactions->wakeEvent);
+    SerialPortIO_JoinThread(&pTransactions->timerThread);
+
+    SerialPortTransactions_CancelAll(pTransactions);
+    SerialPortIO_DeleteLock(&pTransactions->lock);
+    SerialPortIO_DeleteLock(&pTransactions->receiveLock);
+    SerialPortIO_DeleteEvent(&pTransactions->wakeEvent);
+    free(pTransactions->pFrame);
+    free(pTransactions);
+}
+
+void SerialPortTransactions_SetSendHandler(TSerialPortTransactions* pTransactions, SERIALPORT_SEND_HANDLER sendHandler, void* pContext)
+{
+    SerialPortIO_Lock(&pTransactions->lock);
+    pTransactions->sendHandler  = sendHandler;
+    pTransactions->pSendContext = pContext;
+    SerialPortIO_Unlock(&pTransactions->lock);
+}
+
+void SerialPortTransactions_SetFraming(TSerialPortTransactions* pTransactions, SERIALPORT_FRAME_LENGTH_HANDLER frameLength,
+                                       SERIALPORT_TAG_HANDLER getTag, void* pContext)
+{
+    SerialPortIO_Lock(&pTransactions->receiveLock);
+    pTransactions->frameLength     = frameLength ? frameLength : SerialPortTransactions_GetLineLength;
+    pTransactions->getTag          = getTag;
+    pTransactions->pFramingContext = pContext;
+    pTransactions->frameDataLength = 0;
+    SerialPortIO_Unlock(&pTransactions->receiveLock);
+}
+
+BOOL SerialPortTransactions_Submit(TSerialPortTransactions* pTransactions, TSerialPortTransaction* pTransaction)
+{
+    TSerialPortTransaction*  pCompleted = NULL;
+    TSerialPortTransaction** ppCompleted;
+    SERIALPORT_TIMESTAMP     deadline = 0;
+    BOOL                     result;
+
+    if ((pTransaction->status==SERIALPORT_TRANSACTION_QUEUED) || (pTransaction->status==SERIALPORT_TRANSACTION_PENDING))
+    {
+        return FALSE;
+    }
+    pTransaction->responseLength = 0;
+    pTransaction->sendTime       = 0;
+    pTransaction->completeTime   = 0;
+    pTransaction->timer.running  = FALSE;
+
+    SerialPortIO_Lock(&pTransactions->lock);
+    SERIALPORT_ATOMIC_STORE(&pTransaction->status, SERIALPORT_TRANSACTION_QUEUED);
+    SerialPortTransactions__Append(&pTransactions->pQueuedFirst, &pTransactions->pQueuedLast, pTransaction);
+    pTransactions->queuedCount++;
+    if (pTransaction->timeOutMS>=0)
+    {
+        deadline = SerialPortIO_GetTime() + (SERIALPORT_TIMESTAMP)pTransaction->timeOutMS*1000;
+        SerialPortTimerWheel_Add(&pTransactions->wheel, &pTransaction->timer, deadline);
+        if ((pTransactions->nextWakeTime==0) || (deadline<pTransactions->nextWakeTime))
+        {
+            pTransactions->nextWakeTime = deadline;
+            SerialPortIO_SetEvent(&pTransactions->wakeEvent);
+        }
+    }
+    SerialPortTransactions__Send(pTransactions, &pCompleted);
+
+    //a request which could not be sent right away is reported by the result only
+    result = (pTransaction->status!=SERIALPORT_TRANSACTION_FAILED);
+    for(ppCompleted = &pCompleted; !result && (*ppCompleted!=NULL); ppCompleted = &(*ppCompleted)->pNext)
+    {
+        if (*ppCompleted==pTransaction)
+        {
+            *ppCompleted = pTransaction->pNext;
+            pTransaction->pNext = NULL;
+            break;
+        }
+    }
+    SerialPortIO_Unlock(&pTransactions->lock);
+
+    SerialPortTransactions__Complete(pCompleted);
+    return result;
+}
+
+BOOL SerialPortTransactions_Cancel(TSerialPortTransactions* pTransactions, TSerialPortTransaction* pTransaction)
+{
+    TSerialPortTransaction* pCompleted = NULL;
+
+    SerialPortIO_Lock(&pTransactions->lock);
+    if ((pTransaction->status==SERIALPORT_TRANSACTION_QUEUED) || (pTransaction->status==SERIALPORT_TRANSACTION_PENDING))
+    {
+        SerialPortTransactions__Finish(pTransactions, pTransaction, SERIALPORT_TRANSACTION_CANCELLED, &pCompleted);
+        SerialPortTransactions__Send(pTransactions, &pCompleted);
+    }
+    SerialPortIO_Unlock(&pTransactions->lock);
+
+    SerialPortTransactions__Complete(pCompleted);
+    return (pCompleted!=NULL);
+}
+
+void SerialPortTransactions_CancelAll(TSerialPortTransactions* pTransactions)
+{
+    TSerialPortTransaction* pCompleted = NULL;
+
+    SerialPortIO_Lock(&pTransactions->lock);
+    while(pTransactions->pQueuedFirst)
+    {
+        SerialPortTransactions__Finish(pTransactions, pTransactions->pQueuedFirst, SERIALPORT_TRANSACTION_CANCELLED, &pCompleted);
+    }
+    while(pTransactions->pPendingFirst)
+    {
+        SerialPortTransactions__Finish(pTransactions, pTransactions->pPendingFirst, SERIALPORT_TRANSACTION_CANCELLED, &pCompleted);
+    }
+    SerialPortIO_Unlock(&pTransactions->lock);
+
+    SerialPortTransactions__Complete(pCompleted);
+}
+
+void SerialPortTransactions_OnFrameReceived(TSerialPortTransactions* pTransactions, const unsigned char* pFrame, int frameLength)
+{
+    TSerialPortTransaction* pCompleted = NULL;
+    TSerialPortTransaction* pTransaction;
+    unsigned int            tag = 0;
+    int                     tagState = 0;      //0 not read yet, 1 read, -1 frame has no tag
+    BOOL                    matched;
+
+    SerialPortIO_Lock(&pTransactions->lock);
+    for(pTransaction = pTransactions->pPendingFirst; pTransaction!=NULL; pTransaction = pTransaction->pNext)
+    {
+        switch(pTransaction->matchType)
+        {
+        case SERIALPORT_MATCH_TAG:
+            if (tagState==0)
+            {
+                tagState = ((pTransactions->getTag!=NULL) && pTransactions->getTag(pTransactions->pFramingContext, pFrame, frameLength, &tag)) ? 1 : -1;
+            }
+            matched = (tagState==1) && (tag==pTransaction->tag);
+            break;
+        case SERIALPORT_MATCH_CUSTOM:
+            matched = (pTransaction->match!=NULL) && pTransaction->match(pTransaction, pFrame, frameLength);
+            break;
+        default:
+            matched = TRUE;
+            break;
+        }
+        if (matched)
+        {
+            break;
+        }
+    }
+    if (pTransaction)
+    {
+        pTransaction->responseLength = (frameLength<pTransaction->responseSize) ? frameLength : pTransaction->responseSize;
+        if (pTransaction->responseLength>0)
+        {
+            memcpy(pTransaction->pResponse, pFrame, pTransaction->responseLength);
+        }
+        SerialPortTransactions__Finish(pTransactions, pTransaction, SERIALPORT_TRANSACTION_COMPLETED, &pCompleted);
+        SerialPortTransactions__Send(pTransactions, &pCompleted);
+    } else {
+        SERIALPORT_ATOMIC_INCREMENT(&pTransactions->unmatchedCount);
+    }
+    SerialPortIO_Unlock(&pTransactions->lock);
+
+    SerialPortTransactions__Complete(pCompleted);
+}
+
+//cuts frames from the start of pData, returns the bytes used, the rest is an incomplete frame
+static int SerialPortTransactions__CutFrames(TSerialPortTransactions* pTransactions, const unsigned char* pData, int dataLength)
+{
+    int offset = 0;
+    int frameLength;
+
+    while(offset<dataLength)
+    {
+        frameLength = pTransactions->frameLength(pTransactions->pFramingContext, pData+offset, dataLength-offset);
+        if (frameLength<0)
+        {
+            offset += (-frameLength<dataLength-offset) ? -frameLength : dataLength-offset;
+            continue;
+        }
+        if ((frameLength==0) || (frameLength>dataLength-offset))
+        {
+            break;
+        }
+        SerialPortTransactions_OnFrameReceived(pTransactions, pData+offset, frameLength);
+        offset += frameLength;
+    }
+    return offset;
+}
+
+void SerialPortTransactions_OnDataReceived(TSerialPortTransactions* pTransactions, const unsigned char* pData, int dataLength)
+{
+    int chunkLength, used;
+
+    SerialPortIO_Lock(&pTransactions->receiveLock);
+    while(dataLength>0)
+    {
+        if (pTransactions->frameDataLength==0)
+        {
+            //frames are cut straight from the received data, only the tail is copied
+            used = SerialPortTransactions__CutFrames(pTransactions, pData, dataLength);
+            pData      += used;
+            dataLength -= used;
+            if ((dataLength==0) || (dataLength>=pTransactions->maxFrameLength))
+            {
+                if (dataLength)
+                {
+                    //longer than any frame may be, nobody can use it
+                    SERIALPORT_ATOMIC_INCREMENT(&pTransactions->unmatchedCount);
+                }
+                break;
+            }
+            memcpy(pTransactions->pFrame, pData, dataLength);
+            pTransactions->frameDataLength = dataLength;
+            break;
+        }
+
+        chunkLength = pTransactions->maxFrameLength - pTransactions->frameDataLength;
+        if (chunkLength>dataLength)
+        {
+            chunkLength = dataLength;
+        }
+        memcpy(pTransactions->pFrame + pTransactions->frameDataLength, pData, chunkLength);
+        pTransactions->frameDataLength += chunkLength;
+        pData      += chunkLength;
+        dataLength -= chunkLength;
+
+        used = SerialPortTransactions__CutFrames(pTransactions, pTransactions->pFrame, pTransactions->frameDataLength);
+        if ((used==0) && (pTransactions->frameDataLength==pTransactions->maxFrameLength))
+        {
+            SERIALPORT_ATOMIC_INCREMENT(&pTransactions->unmatchedCount);
+            used = pTransactions->frameDataLength;
+        }
+        pTransactions->frameDataLength -= used;
+        memmove(pTransactions->pFrame, pTransactions->pFrame + used, pTransactions->frameDataLength);
+
+        //the rest of the data is cut directly again once the buffered frame is done
+    }
+    SerialPortIO_Unlock(&pTransactions->receiveLock);
+}
+
+int SerialPortTransactions_GetPendingCount(TSerialPortTransactions* pTransactions)
+{
+    int count;
+
+    SerialPortIO_Lock(&pTransactions->lock);
+    count = pTransactions->pendingCount + pTransactions->queuedCount;
+    SerialPortIO_Unlock(&pTransactions->lock);
+    return count;
+}
+
+unsigned int SerialPortTransactions_GetUnmatchedCount(TSerialPortTransactions* pTransactions)
+{
+    return SERIALPORT_ATOMIC_LOAD(&pTransactions->unmatchedCount);
+}
+
+int SerialPortTransactions_GetLineLength(void* pContext, const unsigned char* pData, int dataLength)
+{
+    const unsigned char* pLineEnd = (const unsigned char*)memchr(pData, '\n', dataLength);
+    (void)pContext;
+    return pLineEnd ? (int)(pLineEnd - pData) + 1 : 0;
+}
@@ -0,0 +1,127 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+
+#ifndef SERIALPORTTRANSACTION___H
+#define SERIALPORTTRANSACTION___H
+
+#include "SerialPortIO.h"
+#include "SerialPortTimerWheel.h"
+
+/*
+* Pipelined request/response transactions. Submit sends the request
+* right away (up to maxInFlight transactions wait for their responses at
+* the same time, the rest waits in submission order) and returns, the
+* transaction completes when a matching response arrives, the deadline
+* passes or it is cancelled. Deadlines are kept in a timer wheel served
+* by a thread of the engine.
+*
+* Received data are cut into frames by frameLength (default: lines
+* ending with LF): it returns the length of the frame at the start of
+* the data, 0 when more data are needed, -n to skip n bytes of garbage.
+* Frames cut elsewhere (e.g. by TSerialPortFramer) are passed to
+* OnFrameReceived. Every frame goes to the oldest waiting transaction
+* it matches:
+*
+*   SERIALPORT_MATCH_ORDER  any frame, responses come in request order
+*   SERIALPORT_MATCH_TAG    frames whose tag (read by getTag) equals tag
+*   SERIALPORT_MATCH_CUSTOM frames accepted by the match function
+*
+* Frames matching nothing are counted by GetUnmatchedCount.
+*
+* On completion onCompleted (optional) is called and pCompletedEvent
+* (optional, owned by the caller) is set, on the receiving thread, the
+* engine thread or the thread cancelling. Wait blocks on that event.
+* The response is copied into pResponse (truncated to responseSize).
+* The transaction must stay untouched until it completes.
+*
+* The send handler is called with the engine locked so requests are
+* written in submission order, it must not call the engine.
+*/
+
+#define SERIALPORT_MATCH_ORDER   0
+#define SERIALPORT_MATCH_TAG     1
+#define SERIALPORT_MATCH_CUSTOM  2
+
+#define SERIALPORT_TRANSACTION_IDLE       0
+#define SERIALPORT_TRANSACTION_QUEUED     1     //waiting for a free slot
+#define SERIALPORT_TRANSACTION_PENDING    2     //sent, waiting for the response
+#define SERIALPORT_TRANSACTION_COMPLETED  3
+#define SERIALPORT_TRANSACTION_TIMEOUT    4
+#define SERIALPORT_TRANSACTION_CANCELLED  5
+#define SERIALPORT_TRANSACTION_FAILED     6     //request could not be sent
+
+typedef struct TSerialPortTransaction  TSerialPortTransaction;
+typedef struct TSerialPortTransactions TSerialPortTransactions;
+
+typedef int  (*SERIALPORT_SEND_HANDLER)(void* pContext, const unsigned char* pData, int dataLength);
+typedef int  (*SERIALPORT_FRAME_LENGTH_HANDLER)(void* pContext, const unsigned char* pData, int dataLength);
+typedef BOOL (*SERIALPORT_TAG_HANDLER)(void* pContext, const unsigned char* pFrame, int frameLength, unsigned int* pTag);
+typedef BOOL (*SERIALPORT_MATCH_HANDLER)(TSerialPortTransaction* pTransaction, const unsigned char* pFrame, int frameLength);
+typedef void (*SERIALPORT_TRANSACTION_HANDLER)(TSerialPortTransaction* pTransaction);
+
+struct TSerialPortTransaction
+{
+    const unsigned char*           pRequest;
+    int                            requestLength;
+    unsigned char*                 pResponse;
+    int                            responseSize;
+    int                            responseLength;
+    int                            matchType;
+    unsigned int                   tag;
+    SERIALPORT_MATCH_HANDLER       match;
+    int                            timeOutMS;
+    SERIALPORT_TRANSACTION_HANDLER onCompleted;
+    SERIALPORT_EVENT*              pCompletedEvent;
+    void*                          pContext;
+
+    volatile int                   status;
+    SERIALPORT_TIMESTAMP           sendTime;
+    SERIALPORT_TIMESTAMP           completeTime;
+
+    TSerialPortTimer               timer;
+    TSerialPortTransaction*        pNext;
+    TSerialPortTransaction*        pPrev;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void    SerialPortTransaction_Init(TSerialPortTransaction* pTransaction, const unsigned char* pRequest, int requestLength,
+                                   unsigned char* pResponse, int responseSize, int timeOutMS);
+int     SerialPortTransaction_Wait(TSerialPortTransaction* pTransaction, int timeOutMS);
+
+TSerialPortTransactions* SerialPortTransactions_Create(int maxInFlight, int maxFrameLength);
+void    SerialPortTransactions_Delete(TSerialPortTransactions* pTransactions);
+void    SerialPortTransactions_SetSendHandler(TSerialPortTransactions* pTransactions, SERIALPORT_SEND_HANDLER sendHandler, void* pContext);
+void    SerialPortTransactions_SetFraming(TSerialPortTransactions* pTransactions, SERIALPORT_FRAME_LENGTH_HANDLER frameLength,
+                                          SERIALPORT_TAG_HANDLER getTag, void* pContext);
+BOOL    SerialPortTransactions_Submit(TSerialPortTransactions* pTransactions, TSerialPortTransaction* pTransaction);
+BOOL    SerialPortTransactions_Cancel(TSerialPortTransactions* pTransactions, TSerialPortTransaction* pTransaction);
+void    SerialPortTransactions_CancelAll(TSerialPortTransactions* pTransactions);
+void    SerialPortTransactions_OnDataReceived(TSerialPortTransactions* pTransactions, const unsigned char* pData, int dataLength);
+void    SerialPortTransactions_OnFrameReceived(TSerialPortTransactions* pTransactions, const unsigned char* pFrame, int frameLength);
+int     SerialPortTransactions_GetPendingCount(TSerialPortTransactions* pTransactions);
+unsigned int SerialPortTransactions_GetUnmatchedCount(TSerialPortTransactions* pTransactions);
+
+int     SerialPortTransactions_GetLineLength(void* pContext, const unsigned char* pData, int dataLength);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,813 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#include "SerialPortVirtual.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SERIALPORT_VIRTUAL_MAX_NAME   64
+#define SERIALPORT_VIRTUAL_MAX_LINE   (1<<22)
+
+//one direction, bytes written by end i travel in channels[i]
+typedef struct
+{
+    unsigned char*      pLine;          //bytes on the line
+    unsigned long long* pArrival;       //their arrival times in nanoseconds
+    unsigned int        lineMask;
+    unsigned int        lineHead;
+    unsigned int        lineTail;
+    unsigned long long  lineFree;       //when the transmitter sends out the last byte
+    unsigned long long  byteTime;
+    TSerialPortSettings settings;       //of the writing end
+    unsigned char*      pFifo;          //receiver FIFO of the other end
+    unsigned int        fifoSize;
+    unsigned int        fifoHead;
+    unsigned int        fifoTail;
+    unsigned int        random;
+} TSerialPortVirtualChannel;
+
+typedef struct TSerialPortVirtualWire
+{
+    struct TSerialPortVirtualWire* pNext;
+    char                           name[SERIALPORT_VIRTUAL_MAX_NAME];
+    TSerialPortVirtualParameters   parameters;
+    TSerialPortVirtualCounters     counters;
+    BOOL                           configured;
+    int                            openCount;
+    TSerialPortDevice*             pEnds[2];
+    SERIALPORT_EVENT               readyEvents[2];
+    TSerialPortVirtualChannel      channels[2];
+    unsigned int                   modemLines[2];   //RTS and DTR each end drives
+    BOOL                           writeWaiting[2]; //a non-blocking write found the transmit FIFO full
+    SERIALPORT_LOCK                lock;
+    SERIALPORT_EVENT               deliveryEvent;
+    SERIALPORT_THREAD              deliveryThread;
+    volatile int                   stopping;
+} TSerialPortVirtualWire;
+
+typedef struct
+{
+    TSerialPortVirtualWire* pWire;
+    int                     end;
+} TSerialPortVirtualEnd;
+
+static TSerialPortVirtualWire* m_pWires = NULL;
+static volatile int            m_wiresLock = 0;
+
+//open and close are rare, a spin lock avoids initializing a lock object at startup
+static void SerialPortVirtual__LockWires(void)
+{
+    while(SERIALPORT_ATOMIC_EXCHANGE(&m_wiresLock, 1))
+    {
+        SerialPortIO_Sleep(0);
+    }
+}
+
+static void SerialPortVirtual__UnlockWires(void)
+{
+    SERIALPORT_ATOMIC_STORE(&m_wiresLock, 0);
+}
+
+static TSerialPortVirtualWire* SerialPortVirtual__FindWire(const char* wireName)
+{
+    TSerialPortVirtualWire* pWire;
+
+    for(pWire = m_pWires; pWire!=NULL; pWire = pWire->pNext)
+    {
+        if (strcmp(pWire->name, wireName)==0)
+        {
+            break;
+        }
+    }
+    return pWire;
+}
+
+static unsigned long long SerialPortVirtual__GetTime(void)
+{
+    return SerialPortIO_GetTime() * 1000;
+}
+
+//xorshift32, never returns 0 for a non-zero state
+static unsigned int SerialPortVirtual__Random(unsigned int* pState)
+{
+    unsigned int x = *pState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *pState = x;
+    return x;
+}
+
+static void SerialPortVirtual__ResetRandom(TSerialPortVirtualWire* pWire, int end)
+{
+    pWire->channels[end].random = (pWire->parameters.seed * 2654435761u) ^ (end ? 0x5BD1E995u : 0x1B873593u);
+    if (pWire->channels[end].random==0)
+    {
+        pWire->channels[end].random = 1;
+    }
+}
+
+static TSerialPortVirtualWire* SerialPortVirtual__CreateWire(const char* wireName)
+{
+    TSerialPortVirtualWire* pWire;
+
+    if (strlen(wireName)>=SERIALPORT_VIRTUAL_MAX_NAME)
+    {
+        return NULL;
+    }
+    pWire = (TSerialPortVirtualWire*)calloc(1, sizeof(TSerialPortVirtualWire));
+    if (pWire==NULL)
+    {
+        return NULL;
+    }
+    if (!SerialPortIO_CreateEvent(&pWire->readyEvents[0]))
+    {
+        free(pWire);
+        return NULL;
+    }
+    if (!SerialPortIO_CreateEvent(&pWire->readyEvents[1]))
+    {
+        SerialPortIO_DeleteEvent(&pWire->readyEvents[0]);
+        free(pWire);
+        return NULL;
+    }
+    if (!SerialPortIO_CreateEvent(&pWire->deliveryEvent))
+    {
+        SerialPortIO_DeleteEvent(&pWire->readyEvents[0]);
+        SerialPortIO_DeleteEvent(&pWire->readyEvents[1]);
+        free(pWire);
+        return NULL;
+    }
+    strcpy(pWire->name, wireName);
+    SerialPortVirtual_GetDefaultParameters(&pWire->parameters);
+    SerialPortIO_InitLock(&pWire->lock);
+    pWire->pNext = m_pWires;
+    m_pWires = pWire;
+    return pWire;
+}
+
+static void SerialPortVirtual__DeleteWire(TSerialPortVirtualWire* pWire)
+{
+    TSerialPortVirtualWire** ppWire;
+    int                      i;
+
+    for(ppWire = &m_pWires; *ppWire!=NULL; ppWire = &(*ppWire)->pNext)
+    {
+        if (*ppWire==pWire)
+        {
+            *ppWire = pWire->pNext;
+            break;
+        }
+    }
+    for(i = 0; i<2; i++)
+    {
+        free(pWire->channels[i].pLine);
+        free(pWire->channels[i].pArrival);
+        free(pWire->channels[i].pFifo);
+        SerialPortIO_DeleteEvent(&pWire->readyEvents[i]);
+    }
+    SerialPortIO_DeleteEvent(&pWire->deliveryEvent);
+    SerialPortIO_DeleteLock(&pWire->lock);
+    free(pWire);
+}
+
+//bytes the transmit FIFO of end takes now, called with the wire locked
+static int SerialPortVirtual__GetRoom(TSerialPortVirtualWire* pWire, int end, unsigned long long currentTime)
+{
+    TSerialPortVirtualChannel* pChannel = &pWire->channels[end];
+    unsigned int               pendingBytes = 0;
+    int                        room;
+
+    if (pChannel->lineFree>currentTime)
+    {
+        pendingBytes = (unsigned int)((pChannel->lineFree - currentTime + pChannel->byteTime - 1) / pChannel->byteTime);
+    }
+    room = pWire->parameters.txFifoSize - (int)pendingBytes;
+    if (room>(int)(pChannel->lineMask+1 - (pChannel->lineHead-pChannel->lineTail)))
+    {
+        room = (int)(pChannel->lineMask+1 - (pChannel->lineHead-pChannel->lineTail));
+    }
+    return room;
+}
+
+//moves bytes which have arrived by now into the receiver FIFO, called with the wire locked
+static void SerialPortVirtual__Deliver(TSerialPortVirtualWire* pWire, int end, unsigned long long currentTime)
+{
+    TSerialPortVirtualChannel* pChannel = &pWire->channels[end];
+    BOOL                       received = FALSE;
+    unsigned int               lineIndex;
+
+    if (pChannel->pLine==NULL)
+    {
+        return;
+    }
+    while(pChannel->lineTail!=pChannel->lineHead)
+    {
+        lineIndex = pChannel->lineTail & pChannel->lineMask;
+        if (pChannel->pArrival[lineIndex]>currentTime)
+        {
+            break;
+        }
+        pChannel->lineTail++;
+
+        //nobody listens at the other end
+        if ((pWire->pEnds[1-end]==NULL) || (pChannel->pFifo==NULL))
+        {
+            continue;
+        }
+        if (pChannel->fifoHead-pChannel->fifoTail>=pChannel->fifoSize)
+        {
+            pWire->counters.bytesOverrun++;
+            continue;
+        }
+        pChannel->pFifo[pChannel->fifoHead % pChannel->fifoSize] = pChannel->pLine[lineIndex];
+        pChannel->fifoHead++;
+        received = TRUE;
+    }
+    if (received)
+    {
+        SerialPortIO_SetEvent(&pWire->readyEvents[1-end]);
+    }
+}
+
+static void SerialPortVirtual__DeliveryThread(void* lpParam)
+{
+    TSerialPortVirtualWire* pWire = (TSerialPortVirtualWire*)lpParam;
+    TSerialPortVirtualChannel* pChannel;
+    unsigned long long      currentTime, nextArrival, arrival, roomTime;
+    int                     timeOutMS, i;
+
+    while(!SERIALPORT_ATOMIC_LOAD(&pWire->stopping))
+    {
+        SerialPortIO_Lock(&pWire->lock);
+        currentTime = SerialPortVirtual__GetTime();
+        nextArrival = 0;
+        for(i = 0; i<2; i++)
+        {
+            SerialPortVirtual__Deliver(pWire, i, currentTime);
+            pChannel = &pWire->channels[i];
+            if ((pChannel->pLine!=NULL) && (pChannel->lineTail!=pChannel->lineHead))
+            {
+                arrival = pChannel->pArrival[pChannel->lineTail & pChannel->lineMask];
+                if ((nextArrival==0) || (arrival<nextArrival))
+                {
+                    nextArrival = arrival;
+                }
+            }
+
+            //the readiness event tells a waiting writer about room, the reactor retries it then
+            if (pWire->writeWaiting[i])
+            {
+                if (SerialPortVirtual__GetRoom(pWire, i, currentTime)>0)
+                {
+                    pWire->writeWaiting[i] = FALSE;
+                    SerialPortIO_SetEvent(&pWire->readyEvents[i]);
+                } else {
+                    //a full line frees room with the next arrival
+                    roomTime = pChannel->lineFree - (unsigned long long)(pWire->parameters.txFifoSize-1) * pChannel->byteTime;
+                    if ((roomTime>currentTime) && ((nextArrival==0) || (roomTime<nextArrival)))
+                    {
+                        nextArrival = roomTime;
+                    }
+                }
+            }
+        }
+        SerialPortIO_Unlock(&pWire->lock);
+
+        timeOutMS = SERIALPORT_INFINITE;
+        if (nextArrival)
+        {
+            timeOutMS = (int)((nextArrival - currentTime + 999999) / 1000000);
+        }
+        SerialPortIO_WaitEvent(&pWire->deliveryEvent, timeOutMS);
+    }
+}
+
+static void SerialPortVirtual__SetByteTime(TSerialPortVirtualWire* pWire, int end)
+{
+    TSerialPortVirtualChannel* pChannel = &pWire->channels[end];
+
+    //bitsPerByte overrides the character the settings give
+    if (pChannel->settings.baudRate<=0)
+    {
+        return;
+    }
+    if (pWire->parameters.bitsPerByte>0)
+    {
+        pChannel->byteTime = (unsigned long long)pWire->parameters.bitsPerByte * 1000000000ULL / (unsigned int)pChannel->settings.baudRate;
+    } else {
+        pChannel->byteTime = SerialPortIO_GetCharTime(&pChannel->settings);
+    }
+    if (pChannel->byteTime==0)
+    {
+        pChannel->byteTime = 1;
+    }
+}
+
+static BOOL SerialPortVirtual__AllocateBuffers(TSerialPortVirtualWire* pWire, int end, const TSerialPortSettings* pSettings)
+{
+    TSerialPortVirtualChannel* pTxChannel = &pWire->channels[end];
+    TSerialPortVirtualChannel* pRxChannel = &pWire->channels[1-end];
+    unsigned long long         lineBytes;
+    unsigned int               lineSize = 16;
+    unsigned char*             pLine;
+    unsigned long long*        pArrival;
+    unsigned char*             pFifo;
+
+    //room for the transmit FIFO and for everything the latency keeps on the line
+    pTxChannel->settings = *pSettings;
+    SerialPortVirtual__SetByteTime(pWire, end);
+    lineBytes = (unsigned long long)pWire->parameters.txFifoSize + 1 +
+                (unsigned long long)pWire->parameters.latencyUS * 1000 / pTxChannel->byteTime;
+    while((lineSize<lineBytes) && (lineSize<SERIALPORT_VIRTUAL_MAX_LINE))
+    {
+        lineSize <<= 1;
+    }
+
+    pLine    = (unsigned char*)malloc(lineSize);
+    pArrival = (unsigned long long*)malloc(lineSize * sizeof(unsigned long long));
+    pFifo    = (unsigned char*)malloc(pWire->parameters.rxFifoSize);
+    if ((pLine==NULL) || (pArrival==NULL) || (pFifo==NULL))
+    {
+        free(pLine);
+        free(pArrival);
+        free(pFifo);
+        return FALSE;
+    }
+
+    //whatever the previous holder of this end left on the line is lost
+    free(pTxChannel->pLine);
+    free(pTxChannel->pArrival);
+    pTxChannel->pLine    = pLine;
+    pTxChannel->pArrival = pArrival;
+    pTxChannel->lineMask = lineSize-1;
+    pTxChannel->lineHead = 0;
+    pTxChannel->lineTail = 0;
+    pTxChannel->lineFree = 0;
+    pWire->writeWaiting[end] = FALSE;
+    SerialPortVirtual__ResetRandom(pWire, end);
+
+    free(pRxChannel->pFifo);
+    pRxChannel->pFifo    = pFifo;
+    pRxChannel->fifoSize = pWire->parameters.rxFifoSize;
+    pRxChannel->fifoHead = 0;
+    pRxChannel->fifoTail = 0;
+    SerialPortIO_ResetEvent(&pWire->readyEvents[end]);
+    return TRUE;
+}
+
+static BOOL SerialPortVirtual__Open(TSerialPortDevice* pDevice, const char* deviceName, const TSerialPortSettings* pSettings)
+{
+    TSerialPortVirtualWire* pWire;
+    TSerialPortVirtualEnd*  pEnd;
+    int                     end;
+
+    if (pSettings->baudRate<=0)
+    {
+        return FALSE;
+    }
+    pEnd = (TSerialPortVirtualEnd*)malloc(sizeof(TSerialPortVirtualEnd));
+    if (pEnd==NULL)
+    {
+        return FALSE;
+    }
+
+    SerialPortVirtual__LockWires();
+    pWire = SerialPortVirtual__FindWire(deviceName);
+    if (pWire==NULL)
+    {
+        pWire = SerialPortVirtual__CreateWire(deviceName);
+    }
+    if ((pWire==NULL) || ((pWire->pEnds[0]!=NULL) && (pWire->pEnds[1]!=NULL)))
+    {
+        SerialPortVirtual__UnlockWires();
+        free(pEnd);
+        return FALSE;
+    }
+    end = (pWire->pEnds[0]==NULL) ? 0 : 1;
+
+    SerialPortIO_Lock(&pWire->lock);
+    if (!SerialPortVirtual__AllocateBuffers(pWire, end, pSettings))
+    {
+        SerialPortIO_Unlock(&pWire->lock);
+        if ((pWire->openCount==0) && !pWire->configured)
+        {
+            SerialPortVirtual__DeleteWire(pWire);
+        }
+        SerialPortVirtual__UnlockWires();
+        free(pEnd);
+        return FALSE;
+    }
+    pWire->pEnds[end] = pDevice;
+    pWire->modemLines[end] = SERIALPORT_MODEM_RTS | SERIALPORT_MODEM_DTR;
+    SerialPortIO_Unlock(&pWire->lock);
+
+    if (pWire->openCount==0)
+    {
+        pWire->stopping = 0;
+        if (!SerialPortIO_StartThread(&pWire->deliveryThread, SerialPortVirtual__DeliveryThread, pWire))
+        {
+            pWire->pEnds[end] = NULL;
+            if (!pWire->configured)
+            {
+                SerialPortVirtual__DeleteWire(pWire);
+            }
+            SerialPortVirtual__UnlockWires();
+            free(pEnd);
+            return FALSE;
+        }
+    }
+    pWire->openCount++;
+    SerialPortVirtual__UnlockWires();
+
+    pEnd->pWire = pWire;
+    pEnd->end   = end;
+    pDevice->pContext = pEnd;
+#ifdef _WIN32
+    pDevice->nativeHandle = pWire->readyEvents[end];
+#else
+    pDevice->nativeHandle = pWire->readyEvents[end].readHandle;
+#endif
+    return TRUE;
+}
+
+static void SerialPortVirtual__Close(TSerialPortDevice* pDevice)
+{
+    TSerialPortVirtualEnd*  pEnd  = (TSerialPortVirtualEnd*)pDevice->pContext;
+    TSerialPortVirtualWire* pWire = pEnd->pWire;
+
+    SerialPortVirtual__LockWires();
+    SerialPortIO_Lock(&pWire->lock);
+    pWire->pEnds[pEnd->end] = NULL;
+    SerialPortIO_Unlock(&pWire->lock);
+
+    pWire->openCount--;
+    if (pWire->openCount==0)
+    {
+        SERIALPORT_ATOMIC_STORE(&pWire->stopping, 1);
+        SerialPortIO_SetEvent(&pWire->deliveryEvent);
+        SerialPortIO_JoinThread(&pWire->deliveryThread);
+        if (!pWire->configured)
+        {
+            SerialPortVirtual__DeleteWire(pWire);
+        }
+    }
+    SerialPortVirtual__UnlockWires();
+    free(pEnd);
+}
+
+static int SerialPortVirtual__ReadFifo(TSerialPortVirtualWire* pWire, int end, unsigned char* pData, int dataLength)
+{
+    TSerialPortVirtualChannel* pChannel = &pWire->channels[1-end];
+    int                        bytesRead = 0;
+
+    SerialPortIO_Lock(&pWire->lock);
+    SerialPortVirtual__Deliver(pWire, 1-end, SerialPortVirtual__GetTime());
+    if (pData==NULL)
+    {
+        bytesRead = (int)(pChannel->fifoHead-pChannel->fifoTail);
+    } else {
+        while((bytesRead<dataLength) && (pChannel->fifoTail!=pChannel->fifoHead))
+        {
+            pData[bytesRead++] = pChannel->pFifo[pChannel->fifoTail % pChannel->fifoSize];
+            pChannel->fifoTail++;
+        }
+        //the event is the level of the FIFO, the reactor polls it
+        if (pChannel->fifoTail==pChannel->fifoHead)
+        {
+            SerialPortIO_ResetEvent(&pWire->readyEvents[end]);
+        }
+    }
+    SerialPortIO_Unlock(&pWire->lock);
+    return bytesRead;
+}
+
+static int SerialPortVirtual__Read(TSerialPortDevice* pDevice, unsigned char* pData, int dataLength, int timeOutMS, SERIALPORT_EVENT* pWakeEvent)
+{
+    TSerialPortVirtualEnd* pEnd = (TSerialPortVirtualEnd*)pDevice->pContext;
+    SERIALPORT_TIMESTAMP   startTime = SerialPortIO_GetTime();
+    int                    bytesRead, waitTime, waitResult;
+
+    while(1)
+    {
+        //pData==NULL only checks whether something can be read
+        bytesRead = SerialPortVirtual__ReadFifo(pEnd->pWire, pEnd->end, pData, dataLength);
+        if ((bytesRead>0) || (timeOutMS==0))
+        {
+            return bytesRead;
+        }
+        waitTime = timeOutMS;
+        if (timeOutMS>0)
+        {
+            waitTime = timeOutMS - (int)((SerialPortIO_GetTime() - startTime) / 1000);
+            if (waitTime<=0)
+            {
+                return 0;
+            }
+        }
+        waitResult = SerialPortIO_WaitEvents(&pEnd->pWire->readyEvents[pEnd->end], pWakeEvent, waitTime);
+        if (waitResult<=0)
+        {
+            return waitResult;
+        }
+    }
+}
+
+static int SerialPortVirtual__WaitForData(TSerialPortDevice* pDevice, int timeOutMS, SERIALPORT_EVENT* pWakeEvent)
+{
+    int result = SerialPortVirtual__Read(pDevice, NULL, 0, timeOutMS, pWakeEvent);
+    return (result>0) ? 1 : result;
+}
+
+//puts as many bytes on the line as the transmit FIFO takes, returns their count
+static int SerialPortVirtual__Transmit(TSerialPortVirtualWire* pWire, int end, const unsigned char* pData, int dataLength)
+{
+    TSerialPortVirtualChannel*    pChannel = &pWire->channels[end];
+    TSerialPortVirtualParameters* pParameters = &pWire->parameters;
+    unsigned long long            currentTime, latency;
+    unsigned int                  lineIndex, random;
+    int                           room, bytesWritten;
+    unsigned char                 value;
+
+    SerialPortIO_Lock(&pWire->lock);
+    currentTime = SerialPortVirtual__GetTime();
+    SerialPortVirtual__Deliver(pWire, end, currentTime);
+    room = SerialPortVirtual__GetRoom(pWire, end, currentTime);
+    if (room>dataLength)
+    {
+        room = dataLength;
+    }
+
+    latency = (unsigned long long)pParameters->latencyUS * 1000;
+    if (pChannel->lineFree<currentTime)
+    {
+        pChannel->lineFree = currentTime;
+    }
+    for(bytesWritten = 0; bytesWritten<room; bytesWritten++)
+    {
+        value = pData[bytesWritten];
+        pChannel->lineFree += pChannel->byteTime;
+        pWire->counters.bytesSent++;
+
+        //lost bytes still take their time on the line
+        if (pParameters->dropRate)
+        {
+            random = SerialPortVirtual__Random(&pChannel->random);
+            if (random % 1000000 < pParameters->dropRate)
+            {
+                pWire->counters.bytesDropped++;
+                continue;
+            }
+        }
+        if (pParameters->bitErrorRate)
+        {
+            random = SerialPortVirtual__Random(&pChannel->random);
+            if (random % 1000000 < pParameters->bitErrorRate)
+            {
+                value ^= (unsigned char)(1 << ((random >> 20) & 7));
+                pWire->counters.bytesCorrupted++;
+            }
+        }
+        lineIndex = pChannel->lineHead & pChannel->lineMask;
+        pChannel->pLine[lineIndex]    = value;
+        pChannel->pArrival[lineIndex] = pChannel->lineFree + latency;
+        pChannel->lineHead++;
+    }
+    SerialPortIO_Unlock(&pWire->lock);
+
+    if (bytesWritten>0)
+    {
+        SerialPortIO_SetEvent(&pWire->deliveryEvent);
+    }
+    return bytesWritten;
+}
+
+static int SerialPortVirtual__WriteVector(TSerialPortDevice* pDevice, const SERIALPORT_BUFFER* pBuffers, int bufferCount, BOOL blocking)
+{
+    TSerialPortVirtualEnd* pEnd = (TSerialPortVirtualEnd*)pDevice->pContext;
+    int                    bytesWrittenTotal = 0;
+    int                    i, offset, bytesWritten;
+
+    for(i = 0; i<bufferCount; i++)
+    {
+        offset = 0;
+        while(offset<pBuffers[i].dataLength)
+        {
+            bytesWritten = SerialPortVirtual__Transmit(pEnd->pWire, pEnd->end, pBuffers[i].pData+offset, pBuffers[i].dataLength-offset);
+            offset += bytesWritten;
+            bytesWrittenTotal += bytesWritten;
+            if (bytesWritten==0)
+            {
+                if (!blocking)
+                {
+                    SerialPortIO_Lock(&pEnd->pWire->lock);
+                    pEnd->pWire->writeWaiting[pEnd->end] = TRUE;
+                    SerialPortIO_Unlock(&pEnd->pWire->lock);
+                    SerialPortIO_SetEvent(&pEnd->pWire->deliveryEvent);
+                    return bytesWrittenTotal;
+                }
+                SerialPortIO_Sleep(SERIALPORT_INTERNAL_TIMEOUT);
+            }
+        }
+    }
+    return bytesWrittenTotal;
+}
+
+static int SerialPortVirtual__Write(TSerialPortDevice* pDevice, const unsigned char* pData, int dataLength)
+{
+    SERIALPORT_BUFFER buffer;
+
+    buffer.pData      = pData;
+    buffer.dataLength = dataLength;
+    return SerialPortVirtual__WriteVector(pDevice, &buffer, 1, TRUE);
+}
+
+static BOOL SerialPortVirtual__Drain(TSerialPortDevice* pDevice)
+{
+    TSerialPortVirtualEnd*  pEnd  = (TSerialPortVirtualEnd*)pDevice->pContext;
+    TSerialPortVirtualWire* pWire = pEnd->pWire;
+    unsigned long long      lineFree;
+
+    while(1)
+    {
+        SerialPortIO_Lock(&pWire->lock);
+        lineFree = pWire->channels[pEnd->end].lineFree;
+        SerialPortIO_Unlock(&pWire->lock);
+        if (lineFree<=SerialPortVirtual__GetTime())
+        {
+            return TRUE;
+        }
+        SerialPortIO_Sleep(SERIALPORT_INTERNAL_TIMEOUT);
+    }
+}
+
+static BOOL SerialPortVirtual__GetPeerName(TSerialPortDevice* pDevice, char* deviceName, int maxLength)
+{
+    TSerialPortVirtualEnd* pEnd = (TSerialPortVirtualEnd*)pDevice->pContext;
+
+    if ((int)strlen(pEnd->pWire->name)+8>=maxLength)
+    {
+        return FALSE;
+    }
+    sprintf(deviceName, "virtual:%s", pEnd->pWire->name);
+    return TRUE;
+}
+
+static BOOL SerialPortVirtual__Configure(TSerialPortDevice* pDevice, const TSerialPortSettings* pSettings)
+{
+    TSerialPortVirtualEnd* pEnd = (TSerialPortVirtualEnd*)pDevice->pContext;
+
+    //only the rate of what this end sends changes, bytes already on the line keep their arrival times
+    if (pSettings->baudRate<=0)
+    {
+        return FALSE;
+    }
+    SerialPortIO_Lock(&pEnd->pWire->lock);
+    pEnd->pWire->channels[pEnd->end].settings = *pSettings;
+    SerialPortVirtual__SetByteTime(pEnd->pWire, pEnd->end);
+    SerialPortIO_Unlock(&pEnd->pWire->lock);
+    return TRUE;
+}
+
+//a null modem: RTS of one end is CTS of the other, DTR is DSR and DCD
+static BOOL SerialPortVirtual__GetModemStatus(TSerialPortDevice* pDevice, unsigned int* pModemStatus)
+{
+    TSerialPortVirtualEnd*  pEnd  = (TSerialPortVirtualEnd*)pDevice->pContext;
+    TSerialPortVirtualWire* pWire = pEnd->pWire;
+    unsigned int            modemStatus, peerLines = 0;
+
+    SerialPortIO_Lock(&pWire->lock);
+    modemStatus = pWire->modemLines[pEnd->end];
+    if (pWire->pEnds[1-pEnd->end]!=NULL)
+    {
+        peerLines = pWire->modemLines[1-pEnd->end];
+    }
+    SerialPortIO_Unlock(&pWire->lock);
+
+    if (peerLines & SERIALPORT_MODEM_RTS) modemStatus |= SERIALPORT_MODEM_CTS;
+    if (peerLines & SERIALPORT_MODEM_DTR) modemStatus |= SERIALPORT_MODEM_DSR | SERIALPORT_MODEM_DCD;
+    *pModemStatus = modemStatus;
+    return TRUE;
+}
+
+static BOOL SerialPortVirtual__SetModemLines(TSerialPortDevice* pDevice, unsigned int lines, unsigned int mask)
+{
+    TSerialPortVirtualEnd*  pEnd  = (TSerialPortVirtualEnd*)pDevice->pContext;
+    TSerialPortVirtualWire* pWire = pEnd->pWire;
+
+    SerialPortIO_Lock(&pWire->lock);
+    pWire->modemLines[pEnd->end] = (pWire->modemLines[pEnd->end] & ~mask) | (lines & mask);
+    SerialPortIO_Unlock(&pWire->lock);
+    return TRUE;
+}
+
+const TSerialPortTransport SerialPortVirtual_Transport =
+{
+    "virtual:",
+    SerialPortVirtual__Open,
+    SerialPortVirtual__Close,
+    SerialPortVirtual__Read,
+    SerialPortVirtual__WaitForData,
+    SerialPortVirtual__Write,
+    SerialPortVirtual__WriteVector,
+    SerialPortVirtual__Drain,
+    SerialPortVirtual__GetPeerName,
+    SerialPortVirtual__Configure,
+    SerialPortVirtual__GetModemStatus,
+    SerialPortVirtual__SetModemLines,
+    NULL,
+    NULL
+};
+
+void SerialPortVirtual_GetDefaultParameters(TSerialPortVirtualParameters* pParameters)
+{
+    pParameters->bitsPerByte  = 0;
+    pParameters->latencyUS    = 0;
+    pParameters->txFifoSize   = 4096;
+    pParameters->rxFifoSize   = 4096;
+    pParameters->bitErrorRate = 0;
+    pParameters->dropRate     = 0;
+    pParameters->seed         = 1;
+}
+
+BOOL SerialPortVirtual_SetParameters(const char* wireName, const TSerialPortVirtualParameters* pParameters)
+{
+    TSerialPortVirtualWire* pWire;
+
+    if ((pParameters->bitsPerByte<0) || (pParameters->latencyUS<0) ||
+        (pParameters->txFifoSize<=0) || (pParameters->rxFifoSize<=0))
+    {
+        return FALSE;
+    }
+
+    SerialPortVirtual__LockWires();
+    pWire = SerialPortVirtual__FindWire(wireName);
+    if (pWire==NULL)
+    {
+        pWire = SerialPortVirtual__CreateWire(wireName);
+    }
+    if (pWire!=NULL)
+    {
+        SerialPortIO_Lock(&pWire->lock);
+        //the settings of the opened ends stay
+        pWire->parameters = *pParameters;
+        SerialPortVirtual__SetByteTime(pWire, 0);
+        SerialPortVirtual__SetByteTime(pWire, 1);
+        pWire->configured = TRUE;
+        SerialPortVirtual__ResetRandom(pWire, 0);
+        SerialPortVirtual__ResetRandom(pWire, 1);
+        SerialPortIO_Unlock(&pWire->lock);
+    }
+    SerialPortVirtual__UnlockWires();
+    return (pWire!=NULL);
+}
+
+BOOL SerialPortVirtual_GetCounters(const char* wireName, TSerialPortVirtualCounters* pCounters)
+{
+    TSerialPortVirtualWire* pWire;
+
+    SerialPortVirtual__LockWires();
+    pWire = SerialPortVirtual__FindWire(wireName);
+    if (pWire!=NULL)
+    {
+        SerialPortIO_Lock(&pWire->lock);
+        *pCounters = pWire->counters;
+        SerialPortIO_Unlock(&pWire->lock);
+    }
+    SerialPortVirtual__UnlockWires();
+    return (pWire!=NULL);
+}
+
+BOOL SerialPortVirtual_Remove(const char* wireName)
+{
+    TSerialPortVirtualWire* pWire;
+    BOOL                    result = FALSE;
+
+    SerialPortVirtual__LockWires();
+    pWire = SerialPortVirtual__FindWire(wireName);
+    if (pWire!=NULL)
+    {
+        pWire->configured = FALSE;
+        if (pWire->openCount==0)
+        {
+            SerialPortVirtual__DeleteWire(pWire);
+        }
+        result = TRUE;
+    }
+    SerialPortVirtual__UnlockWires();
+    return result;
+}
@@ -0,0 +1,83 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef SERIALPORTVIRTUAL___H
+#define SERIALPORTVIRTUAL___H
+
+#include "SerialPortIO.h"
+
+/*
+* In-memory serial wire, so protocols can be tested without hardware.
+* The first port opening "virtual:NAME" gets one end of the wire NAME,
+* the second one the other end, a third open fails. The wire exists
+* while any of its ends is open, or until Remove when its parameters
+* were set.
+*
+* Every byte takes one character time of the writing end's settings on
+* the line (start, data, parity and stop bits), or bitsPerByte/baudRate
+* seconds when bitsPerByte is set, plus latencyUS. A write blocks while
+* txFifoSize bytes are waiting for the line, a non-blocking one returns
+* what fit and the readiness event of the end is set once there is room
+* again. Bytes the receiver leaves unread beyond rxFifoSize are lost
+* like in an overrun UART. Errors are injected per byte from a generator
+* seeded by seed, each direction has its own one, so the same traffic
+* gets the same errors on every run.
+*
+* Arrived bytes are handed to waiting readers by a thread of the wire,
+* with the resolution of the platform's timed waits (1 ms), readers
+* polling the port see them exactly on time. Changed parameters apply to
+* bytes written afterwards, FIFO sizes when an end is opened.
+*
+* The readiness event of an end is its native handle, so virtual ports
+* work with the reactor on POSIX. The Windows reactor waits for comm
+* events and cannot serve them.
+*/
+
+typedef struct
+{
+    int          bitsPerByte;       //overrides the character of the settings, 0 uses them
+    int          latencyUS;         //added to every byte (USB frames, converters)
+    int          txFifoSize;        //bytes waiting for the line before a write blocks
+    int          rxFifoSize;        //bytes a receiver may leave unread
+    unsigned int bitErrorRate;      //bytes with one flipped bit, per million
+    unsigned int dropRate;          //bytes lost on the line, per million
+    unsigned int seed;
+} TSerialPortVirtualParameters;
+
+typedef struct
+{
+    unsigned long long bytesSent;
+    unsigned long long bytesCorrupted;
+    unsigned long long bytesDropped;
+    unsigned long long bytesOverrun;
+} TSerialPortVirtualCounters;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void    SerialPortVirtual_GetDefaultParameters(TSerialPortVirtualParameters* pParameters);
+BOOL    SerialPortVirtual_SetParameters(const char* wireName, const TSerialPortVirtualParameters* pParameters);
+BOOL    SerialPortVirtual_GetCounters(const char* wireName, TSerialPortVirtualCounters* pCounters);
+BOOL    SerialPortVirtual_Remove(const char* wireName);
+
+extern const TSerialPortTransport SerialPortVirtual_Transport;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,331 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#include "SerialPortWriteQueue.h"
+#include <stdlib.h>
+#include <string.h>
+
+void SerialPortWriteQueue_Init(TSerialPortWriteQueue* pQueue)
+{
+    memset(pQueue, 0, sizeof(TSerialPortWriteQueue));
+}
+
+static void SerialPortWriteQueue__FreeList(TSerialPortWriteNode* pNode)
+{
+    TSerialPortWriteNode* pNext;
+    while(pNode)
+    {
+        pNext = pNode->pNext;
+        free(pNode);
+        pNode = pNext;
+    }
+}
+
+void SerialPortWriteQueue_Clear(TSerialPortWriteQueue* pQueue)
+{
+    SerialPortWriteQueue__FreeList((TSerialPortWriteNode*)SERIALPORT_ATOMIC_EXCHANGE_POINTER(&pQueue->pPushed, NULL));
+    SerialPortWriteQueue__FreeList(pQueue->pPending);
+    pQueue->pPending = NULL;
+    pQueue->pPendingTail = NULL;
+    pQueue->pendingOffset = 0;
+    pQueue->batchLength = 0;
+    pQueue->batchWaitForTransmit = FALSE;
+    pQueue->releaseTime = 0;
+    SERIALPORT_ATOMIC_STORE(&pQueue->queuedBytes, 0);
+}
+
+BOOL SerialPortWriteQueue_Push(TSerialPortWriteQueue* pQueue, const SERIALPORT_BUFFER* pBuffers, int bufferCount, BOOL waitForTransmit, BOOL* pWasEmpty)
+{
+    TSerialPortWriteNode* pNode;
+    TSerialPortWriteNode* pHead;
+    int                   dataLength = 0;
+    int                   i;
+
+    for(i = 0; i<bufferCount; i++)
+    {
+        dataLength += pBuffers[i].dataLength;
+    }
+    pNode = (TSerialPortWriteNode*)malloc(sizeof(TSerialPortWriteNode) + dataLength);
+    if (pNode==NULL)
+    {
+        return FALSE;
+    }
+    pNode->dataLength = 0;
+    pNode->waitForTransmit = waitForTransmit;
+    for(i = 0; i<bufferCount; i++)
+    {
+        memcpy(pNode->data + pNode->dataLength, pBuffers[i].pData, pBuffers[i].dataLength);
+        pNode->dataLength += pBuffers[i].dataLength;
+    }
+
+    SERIALPORT_ATOMIC_ADD(&pQueue->queuedBytes, (unsigned int)dataLength);
+    if (pQueue->pStatistics)
+    {
+        SerialPortStatistics_UpdateMax(&pQueue->pStatistics->writeQueueHighWater, SERIALPORT_ATOMIC_LOAD(&pQueue->queuedBytes));
+    }
+    do
+    {
+        pHead = pQueue->pPushed;
+        pNode->pNext = pHead;
+    } while(!SERIALPORT_ATOMIC_CAS_POINTER(&pQueue->pPushed, pHead, pNode));
+
+    if (pWasEmpty)
+    {
+        *pWasEmpty = (pHead==NULL);
+    }
+    return TRUE;
+}
+
+static void SerialPortWriteQueue__TakePushed(TSerialPortWriteQueue* pQueue)
+{
+    TSerialPortWriteNode* pNode;
+    TSerialPortWriteNode* pNext;
+    TSerialPortWriteNode* pFirst = NULL;
+    TSerialPortWriteNode* pLast;
+
+    pNode = (TSerialPortWriteNode*)SERIALPORT_ATOMIC_EXCHANGE_POINTER(&pQueue->pPushed, NULL);
+    if (pNode==NULL)
+    {
+        return;
+    }
+    //pushed list is newest first
+    pLast = pNode;
+    while(pNode)
+    {
+        pNext = pNode->pNext;
+        pNode->pNext = pFirst;
+        pFirst = pNode;
+        pNode = pNext;
+    }
+    if (pQueue->pPendingTail)
+    {
+        pQueue->pPendingTail->pNext = pFirst;
+    } else {
+        pQueue->pPending = pFirst;
+    }
+    pQueue->pPendingTail = pLast;
+}
+
+static unsigned long long SerialPortWriteQueue__GetInterval(TSerialPortWriteQueue* pQueue)
+{
+    return 1000000000ULL / (unsigned int)pQueue->pacing.bytesPerSecond;
+}
+
+static int SerialPortWriteQueue__GetDueLength(TSerialPortWriteQueue* pQueue, unsigned long long currentTime)
+{
+    TSerialPortPacing* pPacing = &pQueue->pacing;
+    unsigned long long dueTime = currentTime;
+    unsigned long long gap, interval = 0, tolerance = 0, rateTime;
+    int                dueLength = 0x7FFFFFFF;
+
+    gap = (unsigned long long)pPacing->byteGapUS * 1000;
+    if ((pQueue->pendingOffset==0) && (pPacing->frameGapUS>pPacing->byteGapUS))
+    {
+        gap = (unsigned long long)pPacing->frameGapUS * 1000;
+    }
+    if ((gap>0) && (pQueue->lineFree+gap>dueTime))
+    {
+        dueTime = pQueue->lineFree + gap;
+    }
+    if (pPacing->bytesPerSecond>0)
+    {
+        //GCRA: a byte is due one interval after the previous one, a burst may run ahead
+        interval  = SerialPortWriteQueue__GetInterval(pQueue);
+        tolerance = (unsigned long long)(pPacing->burstBytes-1) * interval;
+        if (pQueue->rateTime>dueTime+tolerance)
+        {
+            dueTime = pQueue->rateTime - tolerance;
+        }
+    }
+    if (dueTime>currentTime)
+    {
+        pQueue->releaseTime = (SERIALPORT_TIMESTAMP)((dueTime + 999) / 1000);
+        return 0;
+    }
+
+    if (pPacing->bytesPerSecond>0)
+    {
+        rateTime  = (pQueue->rateTime>currentTime) ? pQueue->rateTime : currentTime;
+        dueLength = (int)((currentTime + tolerance - rateTime) / interval) + 1;
+    }
+    if (pPacing->byteGapUS>0)
+    {
+        dueLength = 1;
+    } else if ((pPacing->frameGapUS>0) && (dueLength>pQueue->pPending->dataLength-pQueue->pendingOffset))
+    {
+        //frames are not coalesced, the gap comes after this one
+        dueLength = pQueue->pPending->dataLength - pQueue->pendingOffset;
+    }
+    return dueLength;
+}
+
+static void SerialPortWriteQueue__AddPaced(TSerialPortWriteQueue* pQueue, unsigned long long currentTime, int bytesWritten)
+{
+    //the driver sends right away unless earlier bytes are still on the line
+    if (pQueue->lineFree<currentTime)
+    {
+        pQueue->lineFree = currentTime;
+    }
+    pQueue->lineFree += (unsigned long long)bytesWritten * pQueue->byteTime;
+    if (pQueue->pacing.bytesPerSecond>0)
+    {
+        if (pQueue->rateTime<currentTime)
+        {
+            pQueue->rateTime = currentTime;
+        }
+        pQueue->rateTime += (unsigned long long)bytesWritten * SerialPortWriteQueue__GetInterval(pQueue);
+    }
+}
+
+int SerialPortWriteQueue_Send(TSerialPortWriteQueue* pQueue, SERIALPORT_HANDLE portHandle, BOOL blocking)
+{
+    SERIALPORT_BUFFER     buffers[SERIALPORT_MAX_WRITE_BUFFERS];
+    TSerialPortWriteNode* pNode;
+    SERIALPORT_TIMESTAMP  startTime = 0;
+    int                   bufferCount, requestedLength, bytesWritten, consumedLength;
+    int                   dueLength = 0x7FFFFFFF;
+
+    for(;;)
+    {
+        SerialPortWriteQueue__TakePushed(pQueue);
+        if (pQueue->pPending==NULL)
+        {
+            pQueue->releaseTime = 0;
+            break;
+        }
+        if (pQueue->pStatistics || pQueue->paced)
+        {
+            startTime = SerialPortIO_GetTime();
+        }
+        if (pQueue->paced)
+        {
+            dueLength = SerialPortWriteQueue__GetDueLength(pQueue, startTime*1000);
+            if (dueLength==0)
+            {
+                return 0;
+            }
+            if (pQueue->releaseTime && pQueue->pStatistics)
+            {
+                //how late the write comes after it was due
+                SerialPortStatistics_AddLatency(pQueue->pStatistics->pacingLatency, (startTime>pQueue->releaseTime) ? startTime-pQueue->releaseTime : 0);
+            }
+            pQueue->releaseTime = 0;
+        }
+
+        //small frames are coalesced into one gathered write
+        bufferCount = 0;
+        requestedLength = 0;
+        for(pNode = pQueue->pPending; pNode && (bufferCount<SERIALPORT_MAX_WRITE_BUFFERS) && (requestedLength<dueLength); pNode = pNode->pNext)
+        {
+            buffers[bufferCount].pData      = pNode->data + ((bufferCount==0) ? pQueue->pendingOffset : 0);
+            buffers[bufferCount].dataLength = pNode->dataLength - ((bufferCount==0) ? pQueue->pendingOffset : 0);
+            if (buffers[bufferCount].dataLength>dueLength-requestedLength)
+            {
+                buffers[bufferCount].dataLength = dueLength - requestedLength;
+            }
+            requestedLength += buffers[bufferCount].dataLength;
+            bufferCount++;
+        }
+
+        bytesWritten = SerialPortIO_WriteVector(portHandle, buffers, bufferCount, blocking);
+        if (pQueue->pStatistics)
+        {
+            SerialPortStatistics_AddWrite(pQueue->pStatistics, bytesWritten, SerialPortIO_GetTime()-startTime);
+        }
+        if (bytesWritten<0)
+        {
+            if (!pQueue->keepOnError)
+            {
+                SerialPortWriteQueue_Clear(pQueue);
+            }
+            return -1;
+        }
+        if (pQueue->paced)
+        {
+            SerialPortWriteQueue__AddPaced(pQueue, startTime*1000, bytesWritten);
+        }
+        SERIALPORT_ATOMIC_ADD(&pQueue->queuedBytes, (unsigned int)(-bytesWritten));
+        pQueue->batchLength += bytesWritten;
+
+        //completed frames are released, a partially written one stays first
+        consumedLength = bytesWritten + pQueue->pendingOffset;
+        while(pQueue->pPending && (consumedLength>=pQueue->pPending->dataLength))
+        {
+            pNode = pQueue->pPending;
+            consumedLength -= pNode->dataLength;
+            if (pNode->waitForTransmit)
+            {
+                pQueue->batchWaitForTransmit = TRUE;
+            }
+            pQueue->pPending = pNode->pNext;
+            free(pNode);
+        }
+        if (pQueue->pPending==NULL)
+        {
+            pQueue->pPendingTail = NULL;
+        }
+        pQueue->pendingOffset = consumedLength;
+
+        if (bytesWritten<requestedLength)
+        {
+            //device did not take everything, the rest waits until it is writable
+            return 0;
+        }
+    }
+
+    if (pQueue->batchLength==0)
+    {
+        return 0;
+    }
+    if (pQueue->batchWaitForTransmit)
+    {
+        SerialPortIO_Drain(portHandle);
+    }
+    pQueue->batchLength = 0;
+    pQueue->batchWaitForTransmit = FALSE;
+    return 1;
+}
+
+int SerialPortWriteQueue_GetCount(TSerialPortWriteQueue* pQueue)
+{
+    return (int)SERIALPORT_ATOMIC_LOAD(&pQueue->queuedBytes);
+}
+
+void SerialPortWriteQueue_SetPacing(TSerialPortWriteQueue* pQueue, const TSerialPortPacing* pPacing, const TSerialPortSettings* pSettings)
+{
+    if ((pPacing==NULL) || ((pPacing->bytesPerSecond<=0) && (pPacing->frameGapUS<=0) && (pPacing->byteGapUS<=0)))
+    {
+        memset(&pQueue->pacing, 0, sizeof(TSerialPortPacing));
+        pQueue->paced = FALSE;
+        pQueue->releaseTime = 0;
+        return;
+    }
+    pQueue->pacing = *pPacing;
+    if (pQueue->pacing.bytesPerSecond<0) pQueue->pacing.bytesPerSecond = 0;
+    if (pQueue->pacing.burstBytes<1)     pQueue->pacing.burstBytes = 1;
+    if (pQueue->pacing.frameGapUS<0)     pQueue->pacing.frameGapUS = 0;
+    if (pQueue->pacing.byteGapUS<0)      pQueue->pacing.byteGapUS = 0;
+    pQueue->byteTime = SerialPortIO_GetCharTime(pSettings);
+    pQueue->paced = TRUE;
+}
+
+void SerialPortWriteQueue_NoteWrite(TSerialPortWriteQueue* pQueue, int bytesWritten)
+{
+    if (pQueue->paced && (bytesWritten>0))
+    {
+        SerialPortWriteQueue__AddPaced(pQueue, SerialPortIO_GetTime()*1000, bytesWritten);
+    }
+}
@@ -0,0 +1,101 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef SERIALPORTWRITEQUEUE___H
+#define SERIALPORTWRITEQUEUE___H
+
+#include "SerialPortIO.h"
+#include "SerialPortStatistics.h"
+
+/*
+* Lock-free multi-producer/single-consumer write queue. Any thread can
+* Push without waiting for the device, the single consumer (working
+* thread, reactor thread or the caller of a synchronously opened port)
+* Send()s everything queued so far with gathered writes.
+*
+* Push reports through pWasEmpty whether the consumer has to be woken
+* up. Send returns 1 when a batch has been completed (the queue is
+* empty, transmitted completely if any frame asked for it), 0 when
+* nothing was sent or the device did not accept everything without
+* blocking, -1 on a device error (queued data are discarded unless
+* keepOnError is set, then they wait for the next Send, possibly to
+* another handle after the device was reopened).
+*
+* pStatistics (optional, set by the owner after Init) gets the device
+* writes and the high-water mark of queued bytes.
+*
+* SetPacing makes Send keep frames (Push calls) apart on the line. It
+* models when the written bytes leave the wire from the character time
+* of the line settings, gaps are measured from there instead of from a
+* drain of the driver. A byte rate below the line rate lets out at most
+* burstBytes at once (which also lets a late write catch up). When the
+* next bytes are not due yet, Send returns 0 and releaseTime tells when
+* they are (0 when nothing waits), the owner calls Send again at that
+* time. NoteWrite accounts for bytes the owner writes around the queue.
+*/
+
+typedef struct
+{
+    int bytesPerSecond;     //0 = as fast as the line goes
+    int burstBytes;         //bytes the byte rate lets out at once, at least 1
+    int frameGapUS;         //idle line between two frames
+    int byteGapUS;          //idle line after every byte of a frame
+} TSerialPortPacing;
+
+typedef struct TSerialPortWriteNode
+{
+    struct TSerialPortWriteNode* pNext;
+    int                          dataLength;
+    BOOL                         waitForTransmit;
+    unsigned char                data[1];
+} TSerialPortWriteNode;
+
+typedef struct
+{
+    TSerialPortWriteNode* volatile pPushed;     //producers push here, newest first
+    TSerialPortWriteNode* pPending;             //consumer only, oldest first
+    TSerialPortWriteNode* pPendingTail;
+    int                   pendingOffset;        //bytes of pPending already written
+    int                   batchLength;
+    BOOL                  batchWaitForTransmit;
+    volatile unsigned int queuedBytes;
+    BOOL                  keepOnError;
+    TSerialPortStatistics* pStatistics;
+    BOOL                  paced;
+    TSerialPortPacing     pacing;
+    unsigned long long    byteTime;             //nanoseconds one character takes on the line
+    unsigned long long    lineFree;             //nanoseconds, the line goes idle after the written bytes
+    unsigned long long    rateTime;             //nanoseconds, byte rate schedule
+    SERIALPORT_TIMESTAMP  releaseTime;
+} TSerialPortWriteQueue;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void    SerialPortWriteQueue_Init(TSerialPortWriteQueue* pQueue);
+void    SerialPortWriteQueue_Clear(TSerialPortWriteQueue* pQueue);
+BOOL    SerialPortWriteQueue_Push(TSerialPortWriteQueue* pQueue, const SERIALPORT_BUFFER* pBuffers, int bufferCount, BOOL waitForTransmit, BOOL* pWasEmpty);
+int     SerialPortWriteQueue_Send(TSerialPortWriteQueue* pQueue, SERIALPORT_HANDLE portHandle, BOOL blocking);
+int     SerialPortWriteQueue_GetCount(TSerialPortWriteQueue* pQueue);
+void    SerialPortWriteQueue_SetPacing(TSerialPortWriteQueue* pQueue, const TSerialPortPacing* pPacing, const TSerialPortSettings* pSettings);
+void    SerialPortWriteQueue_NoteWrite(TSerialPortWriteQueue* pQueue, int bytesWritten);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
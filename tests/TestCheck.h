@@ -0,0 +1,42 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#ifndef SERIALPORTTESTCHECK___H
+#define SERIALPORTTESTCHECK___H
+
+#include <stdio.h>
+
+/*
+* Every test program counts failed checks and exits with 1 when there
+* was any, so ctest reports it. Failed checks are printed with their
+* location and keep the test running.
+*/
+
+static int m_failedChecks = 0;
+
+#define TEST_CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            m_failedChecks++; \
+        } \
+    } while(0)
+
+#define TEST_RESULT() ((m_failedChecks==0) ? 0 : 1)
+
+#endif
@@ -0,0 +1,100 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#include "SerialPortCrc.h"
+#include "TestCheck.h"
+
+static const unsigned char m_checkString[] = "123456789";
+
+//check values of the CRC catalogue
+static void TestKnownAnswers(void)
+{
+    TEST_CHECK(SerialPortCrc_Compute(SERIALPORT_CRC16_MODBUS, m_checkString, 9)==0x4B37);
+    TEST_CHECK(SerialPortCrc_Compute(SERIALPORT_CRC16_CCITT, m_checkString, 9)==0x29B1);
+    TEST_CHECK(SerialPortCrc_Compute(SERIALPORT_CRC32, m_checkString, 9)==0xCBF43926);
+
+    TEST_CHECK(SerialPortCrc_GetSize(SERIALPORT_CRC16_MODBUS)==2);
+    TEST_CHECK(SerialPortCrc_GetSize(SERIALPORT_CRC16_CCITT)==2);
+    TEST_CHECK(SerialPortCrc_GetSize(SERIALPORT_CRC32)==4);
+}
+
+//wire byte order and frame checks
+static void TestAppend(void)
+{
+    unsigned char frame[16];
+    int           i;
+
+    for(i = 0; i<9; i++)
+    {
+        frame[i] = m_checkString[i];
+    }
+    TEST_CHECK(SerialPortCrc_Append(SERIALPORT_CRC16_MODBUS, 0x4B37, frame+9)==2);
+    TEST_CHECK((frame[9]==0x37) && (frame[10]==0x4B));
+    TEST_CHECK(SerialPortCrc_Check(SERIALPORT_CRC16_MODBUS, frame, 11));
+
+    TEST_CHECK(SerialPortCrc_Append(SERIALPORT_CRC16_CCITT, 0x29B1, frame+9)==2);
+    TEST_CHECK((frame[9]==0x29) && (frame[10]==0xB1));
+    TEST_CHECK(SerialPortCrc_Check(SERIALPORT_CRC16_CCITT, frame, 11));
+
+    TEST_CHECK(SerialPortCrc_Append(SERIALPORT_CRC32, 0xCBF43926, frame+9)==4);
+    TEST_CHECK((frame[9]==0x26) && (frame[10]==0x39) && (frame[11]==0xF4) && (frame[12]==0xCB));
+    TEST_CHECK(SerialPortCrc_Check(SERIALPORT_CRC32, frame, 13));
+
+    frame[4] ^= 0x10;
+    TEST_CHECK(!SerialPortCrc_Check(SERIALPORT_CRC32, frame, 13));
+}
+
+//chunked updates give the value of one pass, long blocks take the PCLMUL path
+static void TestIncremental(void)
+{
+    static const int crcTypes[3] = { SERIALPORT_CRC16_MODBUS, SERIALPORT_CRC16_CCITT, SERIALPORT_CRC32 };
+    static unsigned char data[5000];
+    TSerialPortCrc       crc;
+    unsigned int         seed = 12345;
+    int                  i, type, offset, chunkLength;
+
+    for(i = 0; i<(int)sizeof(data); i++)
+    {
+        seed = seed*1103515245 + 12345;
+        data[i] = (unsigned char)(seed >> 16);
+    }
+    for(type = 0; type<3; type++)
+    {
+        SerialPortCrc_Init(&crc, crcTypes[type]);
+        for(offset = 0, chunkLength = 1; offset<(int)sizeof(data); offset += chunkLength, chunkLength = chunkLength*3 % 701 + 1)
+        {
+            if (chunkLength>(int)sizeof(data)-offset)
+            {
+                chunkLength = (int)sizeof(data)-offset;
+            }
+            SerialPortCrc_Update(&crc, data+offset, chunkLength);
+        }
+        TEST_CHECK(SerialPortCrc_GetValue(&crc)==SerialPortCrc_Compute(crcTypes[type], data, sizeof(data)));
+    }
+
+    SerialPortCrc_Init(&crc, SERIALPORT_CRC32);
+    SerialPortCrc_Update(&crc, m_checkString, 4);
+    SerialPortCrc_Update(&crc, m_checkString+4, 5);
+    TEST_CHECK(SerialPortCrc_GetValue(&crc)==0xCBF43926);
+}
+
+int main(void)
+{
+    TestKnownAnswers();
+    TestAppend();
+    TestIncremental();
+    return TEST_RESULT();
+}
@@ -0,0 +1,121 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#include "SerialPortFramer.hpp"
+#include "TestCheck.h"
+#include <string>
+#include <vector>
+
+//collects the delivered frames as strings
+class TFrameCollector
+{
+public:
+    std::vector<std::string> frames;
+    
+    void OnFramesReceived(const TSerialPortFrame* pFrames, int frameCount)
+    {
+        for(int i = 0; i<frameCount; i++)
+        {
+            frames.push_back(std::string((const char*)pFrames[i].pData, pFrames[i].dataLength));
+        }
+    }
+};
+
+//the same stream fed at once and byte by byte gives the same frames
+template <class TFraming>
+static void CheckFrames(const unsigned char* pData, int dataLength, const std::vector<std::string>& expected, unsigned int expectedErrors)
+{
+    for(int chunkLength = dataLength; chunkLength>0; chunkLength = (chunkLength>1) ? 1 : 0)
+    {
+        TFrameCollector collector;
+        TSerialPortFramer<TFraming, TFrameCollector> framer(&collector);
+        
+        for(int offset = 0; offset<dataLength; offset += chunkLength)
+        {
+            framer.OnDataReceived(pData+offset, (chunkLength<dataLength-offset) ? chunkLength : dataLength-offset);
+        }
+        TEST_CHECK(collector.frames==expected);
+        TEST_CHECK(framer.GetFrameCount()==expected.size());
+        TEST_CHECK(framer.GetErrorCount()==expectedErrors);
+    }
+}
+
+static std::vector<std::string> Frames(const char* pFrame1, const char* pFrame2=NULL)
+{
+    std::vector<std::string> frames;
+    frames.push_back(pFrame1);
+    if (pFrame2) frames.push_back(pFrame2);
+    return frames;
+}
+
+static void TestFixed()
+{
+    //a stray byte in front of the second frame is skipped
+    static const unsigned char stream[] = { 0x38, 'a', 'b', 'c', 0x11, 0x38, 'd', 'e', 'f' };
+    CheckFrames<TSerialPortFixedFraming<0x38, 4> >(stream, sizeof(stream), Frames("abc", "def"), 1);
+}
+
+static void TestLength()
+{
+    static const unsigned char stream[] = { 3, 'a', 'b', 'c', 1, 'z' };
+    CheckFrames<TSerialPortLengthFraming<1> >(stream, sizeof(stream), Frames("abc", "z"), 0);
+    
+    static const unsigned char stream2[] = { 0, 3, 'a', 'b', 'c' };
+    CheckFrames<TSerialPortLengthFraming<2> >(stream2, sizeof(stream2), Frames("abc"), 0);
+}
+
+static void TestDelimiter()
+{
+    static const unsigned char stream[] = "hello\nworld\n";
+    CheckFrames<TSerialPortDelimiterFraming<> >(stream, sizeof(stream)-1, Frames("hello", "world"), 0);
+}
+
+//RFC 1055: END and ESC inside the payload are escaped
+static void TestSlip()
+{
+    static const unsigned char stream[] = { 0xC0, 'a', 0xDB, 0xDC, 'b', 0xDB, 0xDD, 0xC0, 'x', 'y', 0xC0 };
+    CheckFrames<TSerialPortSlipFraming<> >(stream, sizeof(stream), Frames("a\xC0" "b\xDB", "xy"), 0);
+}
+
+//the example of the COBS paper: 11 22 00 33
+static void TestCobs()
+{
+    static const unsigned char stream[] = { 0x03, 0x11, 0x22, 0x02, 0x33, 0x00 };
+    std::vector<std::string> expected(1, std::string("\x11\x22\x00\x33", 4));
+    CheckFrames<TSerialPortCobsFraming<> >(stream, sizeof(stream), expected, 0);
+}
+
+//"123456789" with its CRC-16/MODBUS, then the same frame corrupted
+static void TestCrc()
+{
+    static const unsigned char stream[] =
+    {
+        11, '1', '2', '3', '4', '5', '6', '7', '8', '9', 0x37, 0x4B,
+        11, '1', '2', '3', '4', '5', '6', '7', '8', '0', 0x37, 0x4B
+    };
+    CheckFrames<TSerialPortCrcFraming<TSerialPortLengthFraming<1>, SERIALPORT_CRC16_MODBUS> >(stream, sizeof(stream), Frames("123456789"), 1);
+}
+
+int main()
+{
+    TestFixed();
+    TestLength();
+    TestDelimiter();
+    TestSlip();
+    TestCobs();
+    TestCrc();
+    return TEST_RESULT();
+}
@@ -0,0 +1,289 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#include "SerialPort.hpp"
+#include "SerialPort.h"
+#include "TestCheck.h"
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+#define TEST_DATA_LENGTH 3000
+
+static unsigned char m_testData[TEST_DATA_LENGTH];
+
+static void InitTestData()
+{
+    for(int i = 0; i<TEST_DATA_LENGTH; i++)
+    {
+        m_testData[i] = (unsigned char)(i*7 + i/256);
+    }
+}
+
+//ReadBuffer returns what has arrived, collects dataLength bytes or gives up after the timeout
+static int ReadAll(TSerialPort* pPort, unsigned char* pData, int dataLength, int timeOutMS)
+{
+    int bytesRead, totalRead = 0;
+
+    while(totalRead<dataLength)
+    {
+        bytesRead = pPort->ReadBuffer(pData+totalRead, dataLength-totalRead, timeOutMS);
+        if (bytesRead<=0)
+        {
+            break;
+        }
+        totalRead += bytesRead;
+    }
+    return totalRead;
+}
+
+#ifndef _WIN32
+//the master end stays with the test, the port under test opens the slave
+static int OpenPty(char* slaveName, int maxLength)
+{
+    int masterHandle = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if ((masterHandle<0) || (grantpt(masterHandle)!=0) || (unlockpt(masterHandle)!=0) || (ptsname(masterHandle)==NULL))
+    {
+        return -1;
+    }
+    strncpy(slaveName, ptsname(masterHandle), maxLength-1);
+    slaveName[maxLength-1] = 0;
+    return masterHandle;
+}
+
+static int ReadMaster(int masterHandle, unsigned char* pData, int dataLength, int timeOutMS)
+{
+    struct pollfd pollHandle;
+    int           bytesRead, totalRead = 0;
+
+    pollHandle.fd = masterHandle;
+    pollHandle.events = POLLIN;
+    while((totalRead<dataLength) && (poll(&pollHandle, 1, timeOutMS)>0))
+    {
+        bytesRead = (int)read(masterHandle, pData+totalRead, dataLength-totalRead);
+        if (bytesRead<=0)
+        {
+            break;
+        }
+        totalRead += bytesRead;
+    }
+    return totalRead;
+}
+
+static void TestPty()
+{
+    TSerialPort   port;
+    char          slaveName[SERIALPORT_MAX_DEVICE_NAME];
+    unsigned char received[TEST_DATA_LENGTH];
+    int           masterHandle = OpenPty(slaveName, sizeof(slaveName));
+
+    TEST_CHECK(masterHandle>=0);
+    TEST_CHECK(port.Open(slaveName, 115200, 100));
+
+    TEST_CHECK(write(masterHandle, m_testData, TEST_DATA_LENGTH)==TEST_DATA_LENGTH);
+    TEST_CHECK(ReadAll(&port, received, TEST_DATA_LENGTH, 1000)==TEST_DATA_LENGTH);
+    TEST_CHECK(memcmp(received, m_testData, TEST_DATA_LENGTH)==0);
+
+    TEST_CHECK(port.WriteBuffer(m_testData, TEST_DATA_LENGTH)==TEST_DATA_LENGTH);
+    memset(received, 0, sizeof(received));
+    TEST_CHECK(ReadMaster(masterHandle, received, TEST_DATA_LENGTH, 1000)==TEST_DATA_LENGTH);
+    TEST_CHECK(memcmp(received, m_testData, TEST_DATA_LENGTH)==0);
+    
+    //CR, LF and CR LF all end a line
+    char line[16];
+    TEST_CHECK(write(masterHandle, "first\r\nsecond\n", 14)==14);
+    TEST_CHECK(port.ReadLine(line, sizeof(line), 1000)==5);
+    TEST_CHECK(strcmp(line, "first")==0);
+    TEST_CHECK(port.ReadLine(line, sizeof(line), 1000)==6);
+    TEST_CHECK(strcmp(line, "second")==0);
+
+    port.Close();
+    close(masterHandle);
+}
+
+//the same through the C API
+static void TestPtyC()
+{
+    char          slaveName[SERIALPORT_MAX_DEVICE_NAME];
+    unsigned char received[100];
+    int           masterHandle = OpenPty(slaveName, sizeof(slaveName));
+
+    TEST_CHECK(masterHandle>=0);
+    SerialPort_Initialize();
+    TEST_CHECK(SerialPort_OpenDevice(slaveName, 115200, 100));
+    TEST_CHECK(SerialPort_WriteBuffer(m_testData, sizeof(received))==(int)sizeof(received));
+    TEST_CHECK(ReadMaster(masterHandle, received, sizeof(received), 1000)==(int)sizeof(received));
+    TEST_CHECK(memcmp(received, m_testData, sizeof(received))==0);
+    SerialPort_Close();
+    SerialPort_Uninitialize();
+    close(masterHandle);
+}
+#endif
+
+//what one port writes the other one reads, both ways
+static void CheckPair(TSerialPort* pFirst, TSerialPort* pSecond)
+{
+    static unsigned char received[TEST_DATA_LENGTH];
+
+    TEST_CHECK(pFirst->WriteBuffer(m_testData, TEST_DATA_LENGTH)==TEST_DATA_LENGTH);
+    memset(received, 0, sizeof(received));
+    TEST_CHECK(ReadAll(pSecond, received, TEST_DATA_LENGTH, 1000)==TEST_DATA_LENGTH);
+    TEST_CHECK(memcmp(received, m_testData, TEST_DATA_LENGTH)==0);
+
+    TEST_CHECK(pSecond->WriteBuffer(m_testData, 100)==100);
+    TEST_CHECK(ReadAll(pFirst, received, 100, 1000)==100);
+    TEST_CHECK(memcmp(received, m_testData, 100)==0);
+}
+
+static void TestVirtual()
+{
+    TSerialPort first, second;
+    char        peerName[SERIALPORT_MAX_DEVICE_NAME];
+
+    TEST_CHECK(first.Open("virtual:loopback", 1000000, 100));
+    TEST_CHECK(second.Open("virtual:loopback", 1000000, 100));
+    TEST_CHECK(first.GetPeerName(peerName, sizeof(peerName)) && (strcmp(peerName, "virtual:loopback")==0));
+    CheckPair(&first, &second);
+    first.Close();
+    second.Close();
+}
+
+//the C API over the same kind of wire
+static void TestVirtualC()
+{
+    TSerialPortInstance* pFirst  = SerialPortInstance_Create();
+    TSerialPortInstance* pSecond = SerialPortInstance_Create();
+    unsigned char        received[100];
+    int                  bytesRead, totalRead = 0;
+
+    TEST_CHECK(SerialPortInstance_OpenDevice(pFirst, "virtual:c", 1000000, 100));
+    TEST_CHECK(SerialPortInstance_OpenDevice(pSecond, "virtual:c", 1000000, 100));
+    TEST_CHECK(SerialPortInstance_WriteBuffer(pFirst, m_testData, sizeof(received))==(int)sizeof(received));
+    while(totalRead<(int)sizeof(received))
+    {
+        bytesRead = SerialPortInstance_ReadBuffer(pSecond, received+totalRead, sizeof(received)-totalRead, 1000);
+        if (bytesRead<=0)
+        {
+            break;
+        }
+        totalRead += bytesRead;
+    }
+    TEST_CHECK(totalRead==(int)sizeof(received));
+    TEST_CHECK(memcmp(received, m_testData, sizeof(received))==0);
+    SerialPortInstance_Close(pFirst);
+    SerialPortInstance_Close(pSecond);
+    SerialPortInstance_Delete(pFirst);
+    SerialPortInstance_Delete(pSecond);
+}
+
+//"pty:" opens the master, the peer opens the slave
+static void TestPtyTransport()
+{
+#ifndef _WIN32
+    TSerialPort master, slave;
+    char        slaveName[SERIALPORT_MAX_DEVICE_NAME];
+
+    TEST_CHECK(master.Open("pty:", 115200, 100));
+    TEST_CHECK(master.GetPeerName(slaveName, sizeof(slaveName)));
+    TEST_CHECK(slave.Open(slaveName, 115200, 100));
+    CheckPair(&master, &slave);
+    slave.Close();
+    master.Close();
+#endif
+}
+
+static volatile int m_asyncReceived;
+
+static void OnAsyncReceived(const unsigned char* pData, int dataLength)
+{
+    static int offset = 0;
+
+    if (memcmp(pData, m_testData+offset, dataLength)==0)
+    {
+        offset += dataLength;
+        SERIALPORT_ATOMIC_STORE(&m_asyncReceived, offset);
+    }
+}
+
+//queued writes through a reactor finish although the transmit FIFO is smaller than the data
+static void TestVirtualReactor()
+{
+    TSerialPortVirtualParameters parameters;
+    TSerialPortReactor*          pReactor = SerialPortReactor_Create(1);
+    TSerialPort                  sender, receiver;
+
+    SerialPortVirtual_GetDefaultParameters(&parameters);
+    parameters.txFifoSize = 16;
+    SerialPortVirtual_SetParameters("reactor", &parameters);
+    sender.SetReactor(pReactor);
+    receiver.SetReactor(pReactor);
+    TEST_CHECK(receiver.OpenAsync("virtual:reactor", 1000000, OnAsyncReceived, NULL));
+    TEST_CHECK(sender.OpenAsync("virtual:reactor", 1000000, NULL, NULL));
+    TEST_CHECK(sender.QueueWrite(m_testData, TEST_DATA_LENGTH)==TEST_DATA_LENGTH);
+    for(int i = 0; (i<200) && (SERIALPORT_ATOMIC_LOAD(&m_asyncReceived)<TEST_DATA_LENGTH); i++)
+    {
+        SerialPortIO_Sleep(10);
+    }
+    TEST_CHECK(m_asyncReceived==TEST_DATA_LENGTH);
+    sender.Close();
+    receiver.Close();
+    SerialPortVirtual_Remove("reactor");
+    SerialPortReactor_Delete(pReactor);
+}
+
+//96 bytes at 9600 baud 8E2 take 120 ms on the line
+static void TestVirtualTiming()
+{
+    TSerialPort         first, second;
+    TSerialPortSettings settings;
+    unsigned char       received[96];
+
+    SerialPortIO_InitSettings(&settings, 9600);
+    settings.parity   = SERIALPORT_PARITY_EVEN;
+    settings.stopBits = SERIALPORT_STOPBITS_TWO;
+    first.SetSettings(&settings);
+    second.SetSettings(&settings);
+    TEST_CHECK(first.Open("virtual:timing", 9600, 100));
+    TEST_CHECK(second.Open("virtual:timing", 9600, 100));
+
+    SERIALPORT_TIMESTAMP startTime = SerialPortIO_GetTime();
+    first.WriteBuffer(m_testData, sizeof(received));
+    TEST_CHECK(ReadAll(&second, received, sizeof(received), 1000)==(int)sizeof(received));
+    SERIALPORT_TIMESTAMP lineTime = SerialPortIO_GetTime() - startTime;
+    TEST_CHECK((lineTime>=119000) && (lineTime<400000));
+    first.Close();
+    second.Close();
+}
+
+int main()
+{
+    InitTestData();
+#ifndef _WIN32
+    TestPty();
+    TestPtyC();
+#endif
+    TestVirtual();
+    TestVirtualC();
+    TestPtyTransport();
+    TestVirtualReactor();
+    TestVirtualTiming();
+    return TEST_RESULT();
+}
@@ -0,0 +1,150 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#include "SerialPortModbus.h"
+#include "SerialPortCrc.h"
+#include "TestCheck.h"
+#include <string.h>
+
+//the bus sends into a buffer instead of a port, the test plays the slave
+static unsigned char    m_sentFrame[SERIALPORT_MODBUS_MAX_FRAME];
+static volatile int     m_sentLength;
+static SERIALPORT_EVENT m_sentEvent;
+
+static int OnSend(void* pContext, const unsigned char* pData, int dataLength)
+{
+    (void)pContext;
+    memcpy(m_sentFrame, pData, dataLength);
+    SERIALPORT_ATOMIC_STORE(&m_sentLength, dataLength);
+    SerialPortIO_SetEvent(&m_sentEvent);
+    return dataLength;
+}
+
+static BOOL WaitSent(void)
+{
+    while(SERIALPORT_ATOMIC_LOAD(&m_sentLength)==0)
+    {
+        if (!SerialPortIO_WaitEvent(&m_sentEvent, 1000))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+//the response arrives after the request has left the line
+static void Respond(TSerialPortModbusBus* pBus, const unsigned char* pFrame, int frameLength, BOOL appendCrc)
+{
+    unsigned char response[SERIALPORT_MODBUS_MAX_FRAME];
+
+    memcpy(response, pFrame, frameLength);
+    if (appendCrc)
+    {
+        frameLength += SerialPortCrc_Append(SERIALPORT_CRC16_MODBUS, SerialPortCrc_Compute(SERIALPORT_CRC16_MODBUS, response, frameLength), response+frameLength);
+    }
+    SerialPortIO_Sleep(5);
+    SERIALPORT_ATOMIC_STORE(&m_sentLength, 0);
+    SerialPortModbus_OnDataReceived(pBus, response, frameLength, SerialPortIO_GetTime());
+}
+
+static void TestCharTime(void)
+{
+    TSerialPortSettings settings;
+
+    SerialPortIO_InitSettings(&settings, 9600);
+    TEST_CHECK(SerialPortIO_GetCharTime(&settings)==1041666);
+    settings.parity   = SERIALPORT_PARITY_EVEN;
+    settings.stopBits = SERIALPORT_STOPBITS_TWO;
+    TEST_CHECK(SerialPortIO_GetCharTime(&settings)==1250000);
+    settings.dataBits = 7;
+    settings.parity   = SERIALPORT_PARITY_NONE;
+    settings.stopBits = SERIALPORT_STOPBITS_ONE5;
+    TEST_CHECK(SerialPortIO_GetCharTime(&settings)==989583);
+    settings.baudRate = 0;
+    TEST_CHECK(SerialPortIO_GetCharTime(&settings)==0);
+}
+
+//frames of the examples in the Modbus over serial line specification
+static void TestRequests(TSerialPortModbusBus* pBus)
+{
+    static const unsigned char readRequest[]  = { 0x11, 0x03, 0x00, 0x6B, 0x00, 0x03, 0x76, 0x87 };
+    static const unsigned char readResponse[] = { 0x11, 0x03, 0x06, 0xAE, 0x41, 0x56, 0x52, 0x43, 0x40 };
+    static const unsigned char writeRequest[] = { 0x11, 0x06, 0x00, 0x01, 0x00, 0x03, 0x9A, 0x9B };
+    static const unsigned char exception[]    = { 0x11, 0x83, 0x02 };
+    TSerialPortModbusRequest   request;
+    unsigned short             values[4];
+
+    SerialPortModbus_InitRead(&request, 0x11, SERIALPORT_MODBUS_READ_HOLDING, 0x6B, 3, 500);
+    TEST_CHECK((request.requestLength==8) && (memcmp(request.request, readRequest, 8)==0));
+    TEST_CHECK(SerialPortModbus_Submit(pBus, &request));
+    TEST_CHECK(WaitSent() && (m_sentLength==8) && (memcmp(m_sentFrame, readRequest, 8)==0));
+    Respond(pBus, readResponse, sizeof(readResponse), TRUE);
+    TEST_CHECK(SerialPortModbus_Wait(&request, 1000)==SERIALPORT_TRANSACTION_COMPLETED);
+    TEST_CHECK(SerialPortModbus_GetRegisters(&request, values, 4)==3);
+    TEST_CHECK((values[0]==0xAE41) && (values[1]==0x5652) && (values[2]==0x4340));
+
+    SerialPortModbus_InitWriteRegister(&request, 0x11, 1, 3, 500);
+    TEST_CHECK((request.requestLength==8) && (memcmp(request.request, writeRequest, 8)==0));
+
+    //an exception response completes the request as well
+    SerialPortModbus_InitRead(&request, 0x11, SERIALPORT_MODBUS_READ_HOLDING, 0x6B, 3, 500);
+    SerialPortModbus_Submit(pBus, &request);
+    TEST_CHECK(WaitSent());
+    Respond(pBus, exception, sizeof(exception), TRUE);
+    TEST_CHECK(SerialPortModbus_Wait(&request, 1000)==SERIALPORT_TRANSACTION_COMPLETED);
+    TEST_CHECK(SerialPortModbus_GetException(&request)==2);
+    TEST_CHECK(SerialPortModbus_GetRegisters(&request, values, 4)==-1);
+}
+
+//a response with a wrong CRC ends the exchange, without retries the request fails
+static void TestBadCrc(TSerialPortModbusBus* pBus)
+{
+    static const unsigned char badResponse[] = { 0x11, 0x03, 0x02, 0x00, 0x01, 0x00, 0x00 };
+    TSerialPortModbusRequest    request;
+    TSerialPortModbusStatistics statistics;
+
+    SerialPortModbus_InitRead(&request, 0x11, SERIALPORT_MODBUS_READ_HOLDING, 0, 1, 50);
+    request.retries = 0;
+    SerialPortModbus_Submit(pBus, &request);
+    TEST_CHECK(WaitSent());
+    Respond(pBus, badResponse, sizeof(badResponse), FALSE);
+    TEST_CHECK(SerialPortModbus_Wait(&request, 1000)==SERIALPORT_TRANSACTION_FAILED);
+    SerialPortModbus_GetStatistics(pBus, &statistics);
+    TEST_CHECK(statistics.crcErrors==1);
+    TEST_CHECK(statistics.timeouts==0);
+}
+
+int main(void)
+{
+    TSerialPortSettings   settings;
+    TSerialPortModbus*    pModbus;
+    TSerialPortModbusBus* pBus;
+
+    TestCharTime();
+
+    SerialPortIO_CreateEvent(&m_sentEvent);
+    SerialPortIO_InitSettings(&settings, 115200);
+    pModbus = SerialPortModbus_Create();
+    pBus = SerialPortModbus_AddBus(pModbus, &settings);
+    TEST_CHECK(pBus!=NULL);
+    SerialPortModbus_SetSendHandler(pBus, OnSend, NULL);
+    TestRequests(pBus);
+    TestBadCrc(pBus);
+    SerialPortModbus_RemoveBus(pBus);
+    SerialPortModbus_Delete(pModbus);
+    SerialPortIO_DeleteEvent(&m_sentEvent);
+    return TEST_RESULT();
+}
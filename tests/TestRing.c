@@ -0,0 +1,125 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#include "SerialPortRing.h"
+#include "TestCheck.h"
+#include <string.h>
+
+static void TestCapacity(void)
+{
+    TSerialPortRing ring;
+
+    TEST_CHECK(!SerialPortRing_Create(&ring, 0));
+    TEST_CHECK(SerialPortRing_Create(&ring, 100));
+    TEST_CHECK(ring.capacity==128);
+    TEST_CHECK(SerialPortRing_GetCount(&ring)==0);
+    TEST_CHECK(SerialPortRing_GetFree(&ring)==128);
+    SerialPortRing_Delete(&ring);
+}
+
+//head and tail run past the end many times, the data come out in order
+static void TestWrapAround(void)
+{
+    TSerialPortRing ring;
+    unsigned char   data[100], readData[100];
+    unsigned char   written = 0, expected = 0;
+    int             round, i, length;
+    BOOL            inOrder = TRUE;
+
+    SerialPortRing_Create(&ring, 64);
+    for(round = 0; round<1000; round++)
+    {
+        length = round % 50 + 1;
+        for(i = 0; i<length; i++)
+        {
+            data[i] = written++;
+        }
+        TEST_CHECK(SerialPortRing_Write(&ring, data, length)==length);
+        TEST_CHECK(SerialPortRing_Read(&ring, readData, length)==length);
+        for(i = 0; i<length; i++)
+        {
+            inOrder = inOrder && (readData[i]==expected++);
+        }
+    }
+    TEST_CHECK(inOrder);
+
+    //a full ring takes no more
+    memset(data, 0x55, sizeof(data));
+    TEST_CHECK(SerialPortRing_Write(&ring, data, 100)==64);
+    TEST_CHECK(SerialPortRing_GetFree(&ring)==0);
+    TEST_CHECK(SerialPortRing_Write(&ring, data, 1)==0);
+    SerialPortRing_Clear(&ring);
+    TEST_CHECK(SerialPortRing_GetCount(&ring)==0);
+    SerialPortRing_Delete(&ring);
+}
+
+//direct access returns the contiguous part up to the end of the buffer
+static void TestDirectAccess(void)
+{
+    TSerialPortRing      ring;
+    unsigned char*       pWrite;
+    const unsigned char* pRead;
+    unsigned char        data[64];
+
+    SerialPortRing_Create(&ring, 64);
+    memset(data, 1, sizeof(data));
+    SerialPortRing_Write(&ring, data, 40);
+    SerialPortRing_Read(&ring, data, 40);
+
+    TEST_CHECK(SerialPortRing_GetWriteBuffer(&ring, &pWrite)==24);
+    memset(pWrite, 'a', 24);
+    SerialPortRing_CommitWrite(&ring, 24);
+    TEST_CHECK(SerialPortRing_GetWriteBuffer(&ring, &pWrite)==40);
+    memset(pWrite, 'b', 10);
+    SerialPortRing_CommitWrite(&ring, 10);
+
+    TEST_CHECK(SerialPortRing_GetCount(&ring)==34);
+    TEST_CHECK(SerialPortRing_GetReadBuffer(&ring, &pRead)==24);
+    TEST_CHECK((pRead[0]=='a') && (pRead[23]=='a'));
+    SerialPortRing_CommitRead(&ring, 24);
+    TEST_CHECK(SerialPortRing_GetReadBuffer(&ring, &pRead)==10);
+    TEST_CHECK(pRead[0]=='b');
+    SerialPortRing_Delete(&ring);
+}
+
+//delimiters are found across the end of the buffer
+static void TestFind(void)
+{
+    TSerialPortRing ring;
+    unsigned char   data[64];
+
+    SerialPortRing_Create(&ring, 64);
+    memset(data, 'x', sizeof(data));
+    SerialPortRing_Write(&ring, data, 60);
+    SerialPortRing_Read(&ring, data, 60);
+    SerialPortRing_Write(&ring, (const unsigned char*)"abc\r\ndef\n", 9);
+
+    TEST_CHECK(SerialPortRing_Find(&ring, 0, 9, (const unsigned char*)"\r\n", 2)==3);
+    TEST_CHECK(SerialPortRing_Find(&ring, 5, 9, (const unsigned char*)"\n", 1)==8);
+    TEST_CHECK(SerialPortRing_Find(&ring, 0, 8, (const unsigned char*)"\n", 1)==4);
+    TEST_CHECK(SerialPortRing_Find(&ring, 0, 9, (const unsigned char*)"z", 1)==-1);
+    TEST_CHECK(SerialPortRing_Find(&ring, 9, 9, (const unsigned char*)"\n", 1)==-1);
+    SerialPortRing_Delete(&ring);
+}
+
+int main(void)
+{
+    TestCapacity();
+    TestWrapAround();
+    TestDirectAccess();
+    TestFind();
+    return TEST_RESULT();
+}
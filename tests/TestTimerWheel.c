@@ -0,0 +1,91 @@
+/*
+* Windows Serial Port for Windows API
+*
+* Copyright (c) 2016 Ondrej Sterba <osterba@inbox.com>
+*
+* https://github.com/embedded-tools/WindowsSerialPort
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for any purpose is hereby granted without fee
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation.
+* It is provided "as is" without express or implied warranty.
+*
+*/
+
+#include "SerialPortTimerWheel.h"
+#include "TestCheck.h"
+
+#define TEST_TIMER_COUNT 7
+
+//deadlines on every level of the wheel, in microseconds from its start
+static const unsigned long long m_deadlines[TEST_TIMER_COUNT] =
+{
+    500, 1000, 63000, 70000, 5000000, 300000000, 1200
+};
+
+static void TestDeadlines(void)
+{
+    TSerialPortTimerWheel wheel;
+    TSerialPortTimer      timers[TEST_TIMER_COUNT] = { { 0 } };
+    SERIALPORT_TIMESTAMP  firedTimes[TEST_TIMER_COUNT] = { 0 };
+    SERIALPORT_TIMESTAMP  startTime, currentTime;
+    TSerialPortTimer*     pTimer;
+    int                   i;
+
+    SerialPortTimerWheel_Init(&wheel, 1000);
+    startTime = wheel.startTime;
+    TEST_CHECK(SerialPortTimerWheel_GetNextTime(&wheel)==0);
+    TEST_CHECK(SerialPortTimerWheel_GetNextTimeout(&wheel, startTime)==SERIALPORT_INFINITE);
+
+    for(i = 0; i<TEST_TIMER_COUNT; i++)
+    {
+        SerialPortTimerWheel_Add(&wheel, &timers[i], startTime + m_deadlines[i]);
+    }
+    TEST_CHECK(SerialPortTimerWheel_GetCount(&wheel)==TEST_TIMER_COUNT);
+    SerialPortTimerWheel_Remove(&wheel, &timers[TEST_TIMER_COUNT-1]);
+    TEST_CHECK(SerialPortTimerWheel_GetCount(&wheel)==TEST_TIMER_COUNT-1);
+    TEST_CHECK(SerialPortTimerWheel_GetNextTime(&wheel)==startTime+1000);
+
+    //advanced in uneven steps, as an owner waking up late would
+    for(currentTime = startTime; currentTime<startTime+400000000ULL; currentTime += 700 + (currentTime/1000 % 5) * 300)
+    {
+        for(pTimer = SerialPortTimerWheel_Advance(&wheel, currentTime); pTimer; pTimer = pTimer->pNext)
+        {
+            firedTimes[pTimer-timers] = currentTime;
+        }
+    }
+
+    TEST_CHECK(SerialPortTimerWheel_GetCount(&wheel)==0);
+    for(i = 0; i<TEST_TIMER_COUNT-1; i++)
+    {
+        //never early, late by less than one tick and one step
+        TEST_CHECK(firedTimes[i]>=startTime+m_deadlines[i]);
+        TEST_CHECK(firedTimes[i]<startTime+m_deadlines[i]+1000+2000);
+        TEST_CHECK(!timers[i].running);
+    }
+    TEST_CHECK(firedTimes[TEST_TIMER_COUNT-1]==0);
+}
+
+//a timer added again moves to its new deadline
+static void TestReAdd(void)
+{
+    TSerialPortTimerWheel wheel;
+    TSerialPortTimer      timer = { 0 };
+
+    SerialPortTimerWheel_Init(&wheel, 1000);
+    SerialPortTimerWheel_Add(&wheel, &timer, wheel.startTime + 5000);
+    SerialPortTimerWheel_Add(&wheel, &timer, wheel.startTime + 9000);
+    TEST_CHECK(SerialPortTimerWheel_GetCount(&wheel)==1);
+    TEST_CHECK(SerialPortTimerWheel_Advance(&wheel, wheel.startTime + 8000)==NULL);
+    TEST_CHECK(SerialPortTimerWheel_GetNextTimeout(&wheel, wheel.startTime + 8000)==1);
+    TEST_CHECK(SerialPortTimerWheel_Advance(&wheel, wheel.startTime + 9000)==&timer);
+}
+
+int main(void)
+{
+    TestDeadlines();
+    TestReAdd();
+    return TEST_RESULT();
+}